@@ -12,14 +12,26 @@
 // OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
 // PERFORMANCE OF THIS SOFTWARE.
 
+#include <config.h>
+
 #include <dispatcher.h>
+#include <cpu_affinity.h>
+#include <response_validator.h>
+#include <interval_reporter.h>
+#include <latency_histogram.h>
+#include <load_profile.h>
+#include <result_writer.h>
+#include <server_pool.h>
 
 #include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/foreach.hpp>
 #include <boost/lexical_cast.hpp>
 #include <boost/shared_ptr.hpp>
 
+#include <algorithm>
 #include <cassert>
 #include <cstring>
+#include <fstream>
 #include <sstream>
 #include <iostream>
 #include <vector>
@@ -29,6 +41,7 @@
 
 #include <stdlib.h>
 #include <unistd.h>
+#include <getopt.h>
 #include <pthread.h>
 #include <stdint.h>
 
@@ -39,44 +52,382 @@ using boost::shared_ptr;
 
 namespace {
 struct QueryStatistics {
-    QueryStatistics() : queries_sent(0), queries_completed(0)
+    QueryStatistics() : queries_sent(0), queries_completed(0),
+                        queries_skipped(0), queries_timedout(0),
+                        tcp_failures(0)
     {}
 
     size_t queries_sent;
     size_t queries_completed;
+    size_t queries_skipped;
+    size_t queries_timedout;
+    size_t tcp_failures;
+    LatencyHistogram rtt_histogram; // merged RTTs of all threads
+    ResponseStats responses;    // merged response statistics of all threads
+    LatencyHistogram late_rtt_histogram; // of responses after timeouts
     std::vector<double> qps_results; // a list of QPS per worker thread
 };
 
+// Queries per second; 0 if the duration is 0 (e.g., a thread that never
+// ran), so that results don't have nan or inf, which JSON doesn't allow.
+double
+getRate(size_t queries, double seconds) {
+    return (seconds > 0 ? queries / seconds : 0);
+}
+
 double
 accumulateResult(const Dispatcher& disp, QueryStatistics& result) {
     result.queries_sent += disp.getQueriesSent();
     result.queries_completed += disp.getQueriesCompleted();
+    result.queries_skipped += disp.getQueriesSkipped();
+    result.queries_timedout += disp.getQueriesTimedOut();
+    result.tcp_failures += disp.getTCPFailureCount();
+    result.rtt_histogram.merge(disp.getLatencyHistogram());
+    result.responses.merge(disp.getResponseStats());
+    result.late_rtt_histogram.merge(disp.getLateLatencyHistogram());
 
     const time_duration duration = disp.getEndTime() - disp.getStartTime();
-    return (disp.getQueriesCompleted() / (
-                static_cast<double>(duration.total_microseconds()) / 1000000));
+    return (getRate(disp.getQueriesCompleted(),
+                    static_cast<double>(duration.total_microseconds()) /
+                    1000000));
+}
+
+typedef shared_ptr<Dispatcher> DispatcherPtr;
+typedef shared_ptr<std::stringstream> SStreamPtr;
+
+double
+getSeconds(const time_duration& duration) {
+    return (static_cast<double>(duration.total_microseconds()) / 1000000);
+}
+
+// Sum up the results of each load profile step over the threads.
+std::vector<LoadStepResult>
+mergeStepResults(const std::vector<DispatcherPtr>& dispatchers) {
+    std::vector<LoadStepResult> steps = dispatchers[0]->getStepResults();
+    for (size_t i = 1; i < dispatchers.size(); ++i) {
+        const std::vector<LoadStepResult>& thread_steps =
+            dispatchers[i]->getStepResults();
+        for (size_t j = 0; j < steps.size() && j < thread_steps.size(); ++j) {
+            steps[j].merge(thread_steps[j]);
+        }
+    }
+    return (steps);
+}
+
+// Sum up the results of each server over the threads.
+std::vector<ServerResult>
+mergeServerResults(const std::vector<DispatcherPtr>& dispatchers) {
+    std::vector<ServerResult> servers = dispatchers[0]->getServerResults();
+    for (size_t i = 1; i < dispatchers.size(); ++i) {
+        const std::vector<ServerResult>& thread_servers =
+            dispatchers[i]->getServerResults();
+        for (size_t j = 0; j < servers.size() && j < thread_servers.size();
+             ++j) {
+            servers[j].merge(thread_servers[j]);
+        }
+    }
+    return (servers);
+}
+
+// Return the distinct CPUs that received responses for the dispatcher (see
+// Dispatcher::getIncomingCPU()).  It's empty if unknown, e.g., the thread
+// died before creating the sockets.
+std::vector<int>
+getIncomingCPUs(const Dispatcher& disp) {
+    std::vector<int> cpus;
+    const size_t n_sockets = (disp.getUDPSocketCount() +
+                              disp.getTCPConnectionCount()) *
+        disp.getServerCount();
+    try {
+        for (size_t i = 0; i < n_sockets; ++i) {
+            const int cpu = disp.getIncomingCPU(i);
+            if (cpu >= 0 &&
+                std::find(cpus.begin(), cpus.end(), cpu) == cpus.end()) {
+                cpus.push_back(cpu);
+            }
+        }
+    } catch (const DispatcherError&) {}
+    return (cpus);
+}
+
+std::string
+getNodeText(int node) {
+    return (node >= 0 ? lexical_cast<std::string>(node) : "unknown");
+}
+
+// Print the CPU the dispatcher's thread was bound to and those that
+// received the responses, with their NUMA nodes.  Receiving responses on
+// another node means packets cross the nodes on every response, so it's
+// warned.
+void
+printPlacement(const Dispatcher& disp) {
+    const unsigned int cpu = disp.getCPUAffinity().at(0);
+    const int node = getCPUNode(cpu);
+    std::cout << "    CPU " << cpu << " (NUMA node " << getNodeText(node)
+              << "), responses received on ";
+    const std::vector<int> rx_cpus = getIncomingCPUs(disp);
+    bool remote = false;
+    for (size_t i = 0; i < rx_cpus.size(); ++i) {
+        const int rx_node = getCPUNode(rx_cpus[i]);
+        std::cout << (i > 0 ? ", " : "") << "CPU " << rx_cpus[i]
+                  << " (NUMA node " << getNodeText(rx_node) << ")";
+        remote = remote || (node >= 0 && rx_node >= 0 && rx_node != node);
+    }
+    std::cout << (rx_cpus.empty() ? "unknown CPU\n" : "\n");
+    if (remote) {
+        std::cout << "    [WARN] responses are received on a different "
+                  << "NUMA node; consider binding\n           the thread to "
+                  << "a CPU of that node, or moving the NIC queue IRQs\n";
+    }
+}
+
+void
+addLatency(ResultRecord& record, const LatencyHistogram& rtt,
+           const std::string& prefix = "latency")
+{
+    record.addInteger(prefix + "_count", rtt.getCount());
+    record.addNumber(prefix + "_mean_usec", rtt.getMean());
+    record.addInteger(prefix + "_min_usec", rtt.getMin());
+    record.addInteger(prefix + "_max_usec", rtt.getMax());
+    record.addInteger(prefix + "_p50_usec", rtt.getPercentile(50));
+    record.addInteger(prefix + "_p90_usec", rtt.getPercentile(90));
+    record.addInteger(prefix + "_p99_usec", rtt.getPercentile(99));
+    record.addInteger(prefix + "_p999_usec", rtt.getPercentile(99.9));
+}
+
+// RCODEs that are always shown; others are shown only if seen.
+bool
+isCommonRcode(unsigned int rcode) {
+    return (rcode == 0 || rcode == 2 || rcode == 3 || rcode == 5);
+}
+
+// Print the breakdown of responses by RCODE and header flags.
+void
+printResponses(const ResponseStats& stats, const LatencyHistogram& late_rtt) {
+    std::cout << "  Responses:            " << stats.responses
+              << " responses\n";
+    for (size_t i = 0; i < ResponseStats::RCODE_COUNT; ++i) {
+        if (isCommonRcode(i) || stats.rcodes[i] > 0) {
+            std::cout << "    " << std::setw(10) << std::left
+                      << ResponseStats::getRcodeText(i) << std::right
+                      << std::setw(8) << stats.rcodes[i] << "\n";
+        }
+    }
+    std::cout << "    Flags:    ";
+    for (size_t i = 0; i < ResponseStats::FLAG_COUNT; ++i) {
+        std::cout << " " << ResponseStats::getFlagText(
+            static_cast<ResponseStats::Flag>(i)) << " " << stats.flags[i];
+    }
+    std::cout << "\n";
+    std::cout << "    NOERROR without answers:  " << stats.nodata << "\n";
+    std::cout << "    Invalid (ignored):        " << stats.invalid << "\n";
+    std::cout << "    Retried over TCP:         " << stats.tcp_retries << "\n";
+
+    // Responses not matching an outstanding query; late ones would
+    // otherwise be indistinguishable from lost ones.
+    std::cout << "  Unmatched responses:\n";
+    std::cout << "    Late (after timeout):     " << stats.late;
+    if (late_rtt.getCount() > 0) {
+        std::cout << std::setprecision(6) << " (latency 50th "
+                  << late_rtt.getPercentile(50) / 1000000.0 << " s, max "
+                  << late_rtt.getMax() / 1000000.0 << " s)";
+    }
+    std::cout << "\n";
+    std::cout << "    Duplicate:                " << stats.duplicates << "\n";
+    std::cout << "    Unknown ID:               " << stats.unknown << "\n";
+}
+
+void
+addResponses(ResultRecord& record, const ResponseStats& stats,
+             const LatencyHistogram& late_rtt)
+{
+    record.addInteger("responses", stats.responses);
+    for (size_t i = 0; i < ResponseStats::RCODE_COUNT; ++i) {
+        if (isCommonRcode(i) || stats.rcodes[i] > 0) {
+            record.addInteger(std::string("rcode_") +
+                              ResponseStats::getRcodeText(i),
+                              stats.rcodes[i]);
+        }
+    }
+    for (size_t i = 0; i < ResponseStats::FLAG_COUNT; ++i) {
+        record.addInteger(std::string("flag_") +
+                          ResponseStats::getFlagText(
+                              static_cast<ResponseStats::Flag>(i)),
+                          stats.flags[i]);
+    }
+    record.addInteger("responses_nodata", stats.nodata);
+    record.addInteger("responses_invalid", stats.invalid);
+    record.addInteger("tcp_retries", stats.tcp_retries);
+    record.addInteger("responses_late", stats.late);
+    record.addInteger("responses_duplicate", stats.duplicates);
+    record.addInteger("responses_unknown", stats.unknown);
+    addLatency(record, late_rtt, "late_latency");
+}
+
+// Add the results of the test to the machine-readable form ("config" is
+// expected to be there already).
+void
+addResults(ResultSet& results, const std::vector<DispatcherPtr>& dispatchers,
+           const QueryStatistics& total, const ptime& start_time,
+           const ptime& end_time, const LoadProfile* profile,
+           const IntervalReporter* reporter)
+{
+    for (size_t i = 0; i < dispatchers.size(); ++i) {
+        const Dispatcher& disp = *dispatchers[i];
+        const double seconds = getSeconds(disp.getEndTime() -
+                                          disp.getStartTime());
+        ResultRecord& thread = results.addRecord("threads");
+        thread.addInteger("thread", i);
+        thread.addInteger("queries_sent", disp.getQueriesSent());
+        thread.addInteger("queries_completed", disp.getQueriesCompleted());
+        thread.addInteger("queries_timedout", disp.getQueriesTimedOut());
+        thread.addInteger("queries_skipped", disp.getQueriesSkipped());
+        thread.addInteger("tcp_failures", disp.getTCPFailureCount());
+        thread.addNumber("qps", getRate(disp.getQueriesCompleted(), seconds));
+        thread.addInteger("tls_handshakes", disp.getTLSHandshakeCount());
+        thread.addInteger("tls_resumed", disp.getTLSResumedCount());
+        if (!disp.getCPUAffinity().empty()) {
+            thread.addInteger("cpu", disp.getCPUAffinity()[0]);
+            std::string rx_cpus;
+            BOOST_FOREACH(int cpu, getIncomingCPUs(disp)) {
+                rx_cpus += (rx_cpus.empty() ? "" : ",") +
+                    lexical_cast<std::string>(cpu);
+            }
+            thread.addString("rx_cpus", rx_cpus);
+        }
+        addLatency(thread, disp.getLatencyHistogram());
+        const size_t n_connections = disp.getTCPConnectionCount() *
+            disp.getServerCount();
+        for (size_t j = 0; j < n_connections; ++j) {
+            ResultRecord& conn = results.addRecord("connections");
+            conn.addInteger("thread", i);
+            conn.addInteger("connection", j);
+            conn.addInteger("queries_sent", disp.getConnectionQueriesSent(j));
+            conn.addInteger("queries_completed",
+                            disp.getConnectionQueriesCompleted(j));
+            conn.addNumber("qps",
+                           getRate(disp.getConnectionQueriesCompleted(j),
+                                   seconds));
+        }
+    }
+
+    const double seconds = getSeconds(end_time - start_time);
+    ResultRecord& summary = results.getRecord("total");
+    summary.addString("started_at", to_iso_extended_string(start_time));
+    summary.addString("finished_at", to_iso_extended_string(end_time));
+    summary.addNumber("run_seconds", seconds);
+    summary.addInteger("queries_sent", total.queries_sent);
+    summary.addInteger("queries_completed", total.queries_completed);
+    summary.addInteger("queries_timedout", total.queries_timedout);
+    summary.addInteger("queries_skipped", total.queries_skipped);
+    summary.addInteger("tcp_failures", total.tcp_failures);
+    summary.addNumber("qps", getRate(total.queries_completed, seconds));
+    addLatency(summary, total.rtt_histogram);
+    addResponses(summary, total.responses, total.late_rtt_histogram);
+    if (profile != NULL && profile->isSearch()) {
+        summary.addInteger("found_rate", dispatchers[0]->getFoundRate());
+    }
+
+    if (dispatchers[0]->getServerCount() > 1) {
+        BOOST_FOREACH(const ServerResult& server,
+                      mergeServerResults(dispatchers)) {
+            ResultRecord& record = results.addRecord("servers");
+            record.addString("server", server.server.address);
+            record.addInteger("port", server.server.port);
+            record.addInteger("weight", server.server.weight);
+            record.addInteger("queries_sent", server.queries_sent);
+            record.addInteger("queries_completed", server.queries_completed);
+            record.addInteger("queries_timedout", server.queries_timedout);
+            record.addNumber("loss_percent", server.getLossRate());
+            record.addNumber("qps", getRate(server.queries_completed,
+                                            seconds));
+            addLatency(record, server.rtt_histogram);
+        }
+    }
+
+    if (reporter != NULL) {
+        BOOST_FOREACH(const IntervalResult& interval, reporter->getResults()) {
+            ResultRecord& record = results.addRecord("intervals");
+            record.addNumber("start", interval.start / 1000000.0);
+            record.addNumber("end", interval.end / 1000000.0);
+            record.addInteger("queries_sent", interval.queries_sent);
+            record.addInteger("queries_completed",
+                              interval.queries_completed);
+            record.addInteger("queries_timedout", interval.queries_timedout);
+            record.addInteger("queries_skipped", interval.queries_skipped);
+            record.addInteger("latency_p50_usec", interval.rtt_p50);
+            record.addInteger("latency_p90_usec", interval.rtt_p90);
+            record.addInteger("latency_p99_usec", interval.rtt_p99);
+        }
+    }
+
+    if (profile != NULL) {
+        const std::vector<LoadStepResult> steps =
+            mergeStepResults(dispatchers);
+        BOOST_FOREACH(const LoadStepResult& step, steps) {
+            ResultRecord& record = results.addRecord("steps");
+            record.addInteger("start_rate", step.step.start_rate);
+            record.addInteger("end_rate", step.step.end_rate);
+            record.addInteger("duration", step.step.duration);
+            record.addInteger("queries_sent", step.queries_sent);
+            record.addInteger("queries_completed", step.queries_completed);
+            record.addInteger("queries_skipped", step.queries_skipped);
+            record.addNumber("loss_percent", step.getLossRate());
+            addLatency(record, step.rtt_histogram);
+            if (profile->isSearch()) {
+                record.addBoolean("acceptable", profile->isAcceptable(step));
+            }
+        }
+    }
 }
 
 // Default Parameters
 uint16_t getDefaultPort() { return (Dispatcher::DEFAULT_PORT); }
 long getDefaultDuration() { return (Dispatcher::DEFAULT_DURATION); }
+size_t getDefaultWindow() { return (Dispatcher::DEFAULT_WINDOW); }
+size_t getDefaultUDPSockets() { return (Dispatcher::DEFAULT_UDP_SOCKETS); }
+size_t getDefaultTCPConnections() {
+    return (Dispatcher::DEFAULT_TCP_CONNECTIONS);
+}
 const size_t DEFAULT_THREAD_COUNT = 1;
 const char* const DEFAULT_CLASS = "IN";
 const bool DEFAULT_DNSSEC = true; // set EDNS DO bit by default
 const bool DEFAULT_EDNS = true; // set EDNS0 OPT RR by default
 const char* const DEFAULT_DATA_FILE = "-"; // stdin
 const char* const DEFAULT_PROTOCOL = "udp";
+const char* const DEFAULT_MANAGER = "asio";
+const uint16_t DEFAULT_TLS_PORT = 853; // RFC 7858
+const size_t DEFAULT_TLS_CONNECTIONS = 1;
+const char* const DEFAULT_REPORT_INTERVAL = "1000"; // msec, if only -I
+const char* const DEFAULT_OUTPUT_FORMAT = "json";
 
 void
 usage() {
     const std::string usage_head = "Usage: queryperf++ ";
     const std::string indent(usage_head.size(), ' ');
     std::cerr << usage_head
-         << "[-C qclass] [-d datafile] [-D on|off] [-e on|off] [-l limit]\n";
+         << "[-a cpu_list] [-C qclass] [-d datafile] [-D on|off] "
+         << "[-e on|off]\n";
+    std::cerr << indent
+         << "[-F json|csv] [-i msec] [-I report_file] [-k #queries] "
+         << "[-l limit] [-L]\n";
     std::cerr << indent
-         << "[-L] [-n #threads] [-p port] [-P udp|tcp] [-Q query_sequence]\n";
+         << "[-m asio|epoll|uring] [-n #threads] [-o output_file] "
+         << "[-p port]\n";
     std::cerr << indent
-         << "[-s server_addr]\n";
+         << "[-P udp|tcp|tls] [-q #queries] [-Q query_sequence] [-r qps]\n";
+    std::cerr << indent
+         << "[-R on|off] [-s server_addr] [-S load_profile] "
+         << "[-t #connections]\n";
+    std::cerr << indent << "[-T on|off] [-u #sockets] [-V on|off] "
+              << "[-W #messages]\n";
+    std::cerr << indent
+              << "[-z sequential|uniform|zipf[:exponent]|weighted]\n";
+    std::cerr << usage_head
+              << "[-C qclass] [-D on|off] [-e on|off] [-P udp|tcp|tls]\n";
+    std::cerr << indent << "--compile datafile compiled_file\n";
+    std::cerr << "  -a binds the threads to the given CPUs, e.g., 0-3,8, "
+              << "one per thread in\n     order (default: unspecified)\n";
     std::cerr << "  -C sets default query class (default: "
          << DEFAULT_CLASS << ")\n";
     std::cerr << "  -d sets the input data file (default: stdin)\n";
@@ -84,23 +435,70 @@ usage() {
          << (DEFAULT_EDNS ? "on" : "off") << ")\n";
     std::cerr << "  -e sets whether to include EDNS (default: "
          << (DEFAULT_DNSSEC ? "on" : "off") << ")\n";
+    std::cerr << "  -F sets the format of the output file (default: "
+              << DEFAULT_OUTPUT_FORMAT << ")\n";
+    std::cerr << "  -i reports statistics of every interval of the given "
+              << "milliseconds\n     during the test (default: disabled)\n";
+    std::cerr << "  -I writes the interval reports to the given file "
+              << "(default: stdout)\n";
+    std::cerr << "  -k sets the number of queries per TCP connection before "
+              << "reconnecting\n     (default: unlimited)\n";
     std::cerr << "  -l sets how long to run tests in seconds (default: "
          << getDefaultDuration() << ")\n";
     std::cerr << "  -L enables query preloading (default: disabled)\n";
+    std::cerr << "  -m sets the I/O backend (default: "
+              << DEFAULT_MANAGER << ")\n";
     std::cerr << "  -n sets the number of querying threads (default: "
          << DEFAULT_THREAD_COUNT << ")\n";
+    std::cerr << "  -o writes the configuration and results to the given "
+              << "file in the\n     format specified by -F "
+              << "(default: unspecified)\n";
     std::cerr << "  -p sets the port on which to query the server (default: "
-         << getDefaultPort() << ")\n";
+         << getDefaultPort() << ", " << DEFAULT_TLS_PORT << " for tls)\n";
     std::cerr << "  -P sets transport protocol for queries (default: "
          << DEFAULT_PROTOCOL << ")\n";
+    std::cerr << "  -q sets the maximum number of outstanding queries "
+              << "(default: " << getDefaultWindow() << ")\n";
     std::cerr
         << "  -Q sets newline-separated query data (default: unspecified)\n";
-    std::cerr << "  -s sets the server to query (default: "
-              << Dispatcher::DEFAULT_SERVER << ")";
+    std::cerr << "  -r sets the target query rate per second for the open-loop "
+              << "mode\n     (default: unspecified, closed-loop mode)\n";
+    std::cerr << "  -R sets whether to resume TLS sessions on reconnecting "
+              << "(default: on)\n";
+    std::cerr << "  -s sets the server(s) to query, as "
+              << "ADDRESS[#PORT][/WEIGHT][,...]\n     (default: "
+              << Dispatcher::DEFAULT_SERVER << ")\n";
+    std::cerr << "  -S sets the load profile for the open-loop mode, one of:\n"
+              << "       step:QPS[,QPS...]:SECONDS\n"
+              << "       ramp:FROM_QPS-TO_QPS:SECONDS[:STEPS]\n"
+              << "       search:LOSS%:P99_MSEC:SECONDS[:START_QPS[:MAX_QPS"
+              << "[:RESOLUTION]]]\n"
+              << "     (default: unspecified; overrides -l)\n";
+    std::cerr << "  -t sets the number of persistent TCP connections per thread"
+              << "\n     (default: " << getDefaultTCPConnections()
+              << ", a new connection for each query;\n     "
+              << DEFAULT_TLS_CONNECTIONS << " for tls)\n";
+    std::cerr << "  -T sets whether to retry truncated UDP responses over TCP "
+              << "(default: off)\n";
+    std::cerr << "  -u sets the number of UDP sockets per thread (default: "
+              << getDefaultUDPSockets() << ")\n";
+    std::cerr << "  -V sets whether to ignore responses that don't match the "
+              << "question\n     of the query (default: off)\n";
+    std::cerr << "  -W shows up to the given number of messages per second "
+              << "per thread\n     on individual timeouts and TCP failures "
+              << "(default: 0, none)\n";
+    std::cerr << "  -z sets how to choose each query from the input data; "
+              << "other than\n     sequential implies -L "
+              << "(default: sequential)\n";
+    std::cerr << "  --compile saves the queries of datafile in the compiled "
+              << "format,\n     which can be used as the datafile with fast "
+              << "loading";
     std::cerr << std::endl;
     exit(1);
 }
 
+// Run the dispatcher given as the argument.  It returns the dispatcher, or
+// NULL if it failed.
 void*
 runQueryperf(void* arg) {
     Dispatcher* disp = static_cast<Dispatcher*>(arg);
@@ -109,12 +507,28 @@ runQueryperf(void* arg) {
     } catch (const std::exception& ex) {
         std::cerr << "Worker thread died unexpectedly: " << ex.what()
                   << std::endl;
+        return (NULL);
     }
-    return (NULL);
+    return (disp);
 }
 
-typedef shared_ptr<Dispatcher> DispatcherPtr;
-typedef shared_ptr<std::stringstream> SStreamPtr;
+// Parse the text queries and save them as a compiled query file.
+int
+compileQueries(const char* data_file, const char* compiled_file,
+               const char* qclass_txt, bool dnssec_flag, bool edns_flag,
+               int proto)
+{
+    Dispatcher disp(data_file);
+    disp.setDefaultQueryClass(qclass_txt);
+    disp.setDNSSEC(dnssec_flag);
+    disp.setEDNS(edns_flag);
+    disp.setProtocol(proto);
+    disp.loadQueries();
+    disp.saveQueries(compiled_file);
+    std::cout << "[Status] Compiled " << disp.getQueryCount()
+              << " queries into " << compiled_file << std::endl;
+    return (0);
+}
 
 bool
 parseOnOffFlag(const char* optname, const char* const optarg,
@@ -143,17 +557,46 @@ main(int argc, char* argv[]) {
     const char* edns_flag_txt = NULL;
     const char* server_address = Dispatcher::DEFAULT_SERVER;
     const char* proto_txt = DEFAULT_PROTOCOL;
-    std::string server_port_str = lexical_cast<std::string>(getDefaultPort());
+    const char* manager_txt = DEFAULT_MANAGER;
+    const char* server_port_txt = NULL;
     std::string time_limit_str =
         lexical_cast<std::string>(getDefaultDuration());
     const char* num_threads_txt = NULL;
     const char* query_txt = NULL;
+    const char* window_txt = NULL;
+    const char* rate_txt = NULL;
+    const char* profile_txt = NULL;
+    const char* interval_txt = NULL;
+    const char* interval_file = NULL;
+    const char* output_file = NULL;
+    const char* output_format = DEFAULT_OUTPUT_FORMAT;
+    const char* udp_sockets_txt = NULL;
+    const char* tcp_connections_txt = NULL;
+    const char* queries_per_connection_txt = NULL;
+    const char* tls_resumption_txt = NULL;
+    const char* cpus_txt = NULL;
+    const char* tcp_retry_txt = NULL;
+    const char* validation_txt = NULL;
+    const char* log_rate_txt = NULL;
+    const char* selection_txt = "sequential";
     size_t num_threads = DEFAULT_THREAD_COUNT;
     bool preload = false;
+    bool compile = false;
 
+    const struct option long_options[] = {
+        { "compile", no_argument, NULL, 'c' },
+        { NULL, 0, NULL, 0 }
+    };
     int ch;
-    while ((ch = getopt(argc, argv, "C:d:D:e:hl:Ln:p:P:Q:s:")) != -1) {
+    while ((ch = getopt_long(argc, argv, "a:C:d:D:e:F:hi:I:k:l:Lm:n:o:p:P:q:Q:r:R:s:S:t:T:u:V:W:z:",
+                             long_options, NULL)) != -1) {
         switch (ch) {
+        case 'a':
+            cpus_txt = optarg;
+            break;
+        case 'c':
+            compile = true;
+            break;
         case 'C':
             qclass_txt = optarg;
             break;
@@ -166,6 +609,18 @@ main(int argc, char* argv[]) {
         case 'e':
             edns_flag_txt = optarg;
             break;
+        case 'F':
+            output_format = optarg;
+            break;
+        case 'i':
+            interval_txt = optarg;
+            break;
+        case 'o':
+            output_file = optarg;
+            break;
+        case 'I':
+            interval_file = optarg;
+            break;
         case 'n':
             num_threads_txt = optarg;
             break;
@@ -173,20 +628,56 @@ main(int argc, char* argv[]) {
             server_address = optarg;
             break;
         case 'p':
-            server_port_str = std::string(optarg);
+            server_port_txt = optarg;
             break;
         case 'P':
             proto_txt = optarg;
             break;
+        case 'q':
+            window_txt = optarg;
+            break;
         case 'Q':
             query_txt = optarg;
             break;
+        case 'r':
+            rate_txt = optarg;
+            break;
+        case 'R':
+            tls_resumption_txt = optarg;
+            break;
+        case 'S':
+            profile_txt = optarg;
+            break;
+        case 't':
+            tcp_connections_txt = optarg;
+            break;
+        case 'T':
+            tcp_retry_txt = optarg;
+            break;
+        case 'u':
+            udp_sockets_txt = optarg;
+            break;
+        case 'V':
+            validation_txt = optarg;
+            break;
+        case 'W':
+            log_rate_txt = optarg;
+            break;
+        case 'z':
+            selection_txt = optarg;
+            break;
+        case 'k':
+            queries_per_connection_txt = optarg;
+            break;
         case 'l':
             time_limit_str = std::string(optarg);
             break;
         case 'L':
             preload = true;
             break;
+        case 'm':
+            manager_txt = optarg;
+            break;
         case 'h':
         case '?':
         default :
@@ -195,6 +686,10 @@ main(int argc, char* argv[]) {
     }
 
     // Validation on options
+    if (compile && (argc - optind != 2 || data_file != NULL ||
+                    query_txt != NULL)) {
+        usage();
+    }
     if (data_file == NULL && query_txt == NULL) {
         data_file = DEFAULT_DATA_FILE;
     }
@@ -210,12 +705,62 @@ main(int argc, char* argv[]) {
         std::cerr << "[WARN] EDNS is disabled but DNSSEC is enabled; "
                   << "EDNS will still be included." << std::endl;
     }
+    const std::string format_str(output_format);
+    if (format_str != "json" && format_str != "csv") {
+        std::cerr << "Invalid output format: " << format_str << std::endl;
+        return (1);
+    }
     const std::string proto_str(proto_txt);
-    if (proto_str != "udp" && proto_str != "tcp") {
+    if (proto_str != "udp" && proto_str != "tcp" && proto_str != "tls") {
         std::cerr << "Invalid protocol: " << proto_str << std::endl;
         return (1);
     }
+    // DNS over TLS is DNS over TCP on a TLS session; queries are the same.
     const int proto = proto_str == "udp" ? IPPROTO_UDP : IPPROTO_TCP;
+    const bool tls = proto_str == "tls";
+    const bool tls_resumption = parseOnOffFlag("-R", tls_resumption_txt,
+                                               true);
+    const bool tcp_retry = parseOnOffFlag("-T", tcp_retry_txt, false);
+    const bool validation = parseOnOffFlag("-V", validation_txt, false);
+    const std::string server_port_str = server_port_txt != NULL ?
+        std::string(server_port_txt) :
+        lexical_cast<std::string>(tls ? DEFAULT_TLS_PORT : getDefaultPort());
+    std::vector<ServerSpec> servers;
+    try {
+        servers = parseServerList(server_address,
+                                  lexical_cast<uint16_t>(server_port_str));
+    } catch (const std::exception& ex) {
+        std::cerr << ex.what() << std::endl;
+        return (1);
+    }
+
+    if (compile) {
+        try {
+            return (compileQueries(argv[optind], argv[optind + 1], qclass_txt,
+                                   dnssec_flag, edns_flag, proto));
+        } catch (const std::exception& ex) {
+            std::cerr << "Failed to compile queries: " << ex.what()
+                      << std::endl;
+            return (1);
+        }
+    }
+    // Compiled query files are always preloaded, and so are queries chosen
+    // at random.  Input that can't be rewound (e.g., a pipe) must be
+    // preloaded, too, since queries are sent again from the beginning
+    // once they have all been sent.
+    if (data_file != NULL && !Dispatcher::isSeekableQueryFile(data_file)) {
+        if (!preload) {
+            std::cout << "[Status] The input data can't be rewound; "
+                      << "preloading queries" << std::endl;
+        }
+        preload = true;
+    } else if (data_file != NULL &&
+               Dispatcher::isCompiledQueryFile(data_file)) {
+        preload = true;
+    }
+    if (std::string(selection_txt) != "sequential") {
+        preload = true;
+    }
 
     try {
         std::vector<DispatcherPtr> dispatchers;
@@ -223,13 +768,39 @@ main(int argc, char* argv[]) {
         if (num_threads_txt != NULL) {
             num_threads = lexical_cast<size_t>(num_threads_txt);
         }
-        if (num_threads > 1 && data_file != NULL &&
-            std::string(data_file) == "-") {
-            std::cerr << "stdin can be used as input only with 1 thread"
-                      << std::endl;
-            return (1);
+        // The target rate is for the whole process; it's evenly distributed
+        // to the threads.
+        size_t query_rate = 0;
+        if (rate_txt != NULL) {
+            query_rate = lexical_cast<size_t>(rate_txt);
+            if (query_rate < num_threads) {
+                std::cerr << "query rate must be at least the number of "
+                          << "threads" << std::endl;
+                return (1);
+            }
+        }
+        // Likewise, the rates of a load profile are distributed, except for
+        // a search, whose steps depend on the result of the whole.
+        shared_ptr<LoadProfile> profile;
+        if (profile_txt != NULL) {
+            if (rate_txt != NULL) {
+                std::cerr << "-r and -S cannot be specified at the same time"
+                          << std::endl;
+                return (1);
+            }
+            profile.reset(new LoadProfile(LoadProfile::parse(profile_txt)));
+            if (profile->isSearch() && num_threads > 1) {
+                std::cerr << "a search load profile can be used only with "
+                          << "1 thread" << std::endl;
+                return (1);
+            }
+        }
+        // Each thread is bound to a CPU of the list in order, wrapping
+        // around if there are more threads.
+        std::vector<unsigned int> cpus;
+        if (cpus_txt != NULL) {
+            cpus = parseCPUList(cpus_txt);
         }
-
         // Prepare
         std::cout << "[Status] Processing input data" << std::endl;
         for (size_t i = 0; i < num_threads; ++i) {
@@ -242,25 +813,176 @@ main(int argc, char* argv[]) {
                 disp.reset(new Dispatcher(*ss));
                 input_streams.push_back(ss);
             }
-            disp->setServerAddress(server_address);
-            disp->setServerPort(lexical_cast<uint16_t>(server_port_str));
+            disp->setMessageManagerType(manager_txt);
+            if (!cpus.empty()) {
+                disp->setCPUAffinity(std::vector<unsigned int>(
+                                         1, cpus[i % cpus.size()]));
+            }
+            // A single server is the default one of the dispatcher, and
+            // multiple ones share the queries by their weights.
+            if (servers.size() == 1) {
+                disp->setServerAddress(servers[0].address);
+                disp->setServerPort(servers[0].port);
+            } else {
+                BOOST_FOREACH(const ServerSpec& server, servers) {
+                    disp->addServer(server.address, server.port,
+                                    server.weight);
+                }
+            }
             disp->setTestDuration(lexical_cast<size_t>(time_limit_str));
+            // The number of sockets limits the window size, so it's set
+            // first.
+            if (udp_sockets_txt != NULL) {
+                disp->setUDPSocketCount(lexical_cast<size_t>(udp_sockets_txt));
+            }
+            if (tcp_connections_txt != NULL) {
+                disp->setTCPConnectionCount(
+                    lexical_cast<size_t>(tcp_connections_txt));
+            } else if (tls) {
+                disp->setTCPConnectionCount(DEFAULT_TLS_CONNECTIONS);
+            }
+            if (window_txt != NULL) {
+                disp->setWindow(lexical_cast<size_t>(window_txt));
+            }
+            if (query_rate > 0) {
+                // Distribute the remainder so the sum is the target rate.
+                disp->setQueryRate(query_rate / num_threads +
+                                   (i < query_rate % num_threads ? 1 : 0));
+            }
+            if (profile) {
+                disp->setLoadProfile(profile->isSearch() ? *profile :
+                                     profile->getShare(i, num_threads));
+            }
             disp->setDefaultQueryClass(qclass_txt);
             disp->setDNSSEC(dnssec_flag);
             disp->setEDNS(edns_flag);
             disp->setProtocol(proto);
-            // Preload must be the final step of configuration before running.
-            if (preload) {
+            disp->setTLS(tls);
+            disp->setTLSSessionResumption(tls_resumption);
+            disp->setTCPRetry(tcp_retry);
+            disp->setResponseValidation(validation);
+            if (log_rate_txt != NULL) {
+                disp->setLogRate(lexical_cast<size_t>(log_rate_txt));
+            }
+            if (queries_per_connection_txt != NULL) {
+                disp->setQueriesPerConnection(
+                    lexical_cast<size_t>(queries_per_connection_txt));
+            }
+            disp->setQuerySelection(selection_txt);
+            // Threads interleave the values of sequence templates.
+            disp->setQuerySequence(i, num_threads);
+            // Preload (or stream) must be the final step of configuration
+            // before running.  The input is parsed only once in the first
+            // dispatcher, and the others share the result; each thread
+            // starts from a different position of the preloaded queries,
+            // while streamed queries are distributed among the threads.
+            if (preload && i == 0) {
                 disp->loadQueries();
+            } else if (preload) {
+                disp->loadQueries(*dispatchers[0],
+                                  i * dispatchers[0]->getQueryCount() /
+                                  num_threads);
+            } else if (i == 0) {
+                disp->streamQueries();
+            } else {
+                disp->streamQueries(*dispatchers[0]);
             }
             dispatchers.push_back(disp);
         }
 
+        // Periodic reports, sampling the counters of all threads.
+        std::ofstream interval_stream;
+        shared_ptr<IntervalReporter> reporter;
+        if (interval_txt != NULL || interval_file != NULL) {
+            std::ostream* os = &std::cout;
+            if (interval_file != NULL) {
+                interval_stream.open(interval_file);
+                if (!interval_stream) {
+                    std::cerr << "failed to open report file: "
+                              << interval_file << std::endl;
+                    return (1);
+                }
+                os = &interval_stream;
+            }
+            reporter.reset(new IntervalReporter(
+                               *os, lexical_cast<unsigned int>(
+                                   interval_txt != NULL ? interval_txt :
+                                   DEFAULT_REPORT_INTERVAL)));
+            for (size_t i = 0; i < num_threads; ++i) {
+                reporter->addCounters(dispatchers[i]->getStatsCounters());
+            }
+        }
+
+        // The machine-readable output; the file is opened now so that an
+        // error is detected before running the test.
+        std::ofstream output_stream;
+        ResultSet results;
+        if (output_file != NULL) {
+            output_stream.open(output_file);
+            if (!output_stream) {
+                std::cerr << "failed to open output file: " << output_file
+                          << std::endl;
+                return (1);
+            }
+            const Dispatcher& disp = *dispatchers[0];
+            ResultRecord& config = results.getRecord("config");
+            config.addString("version", PACKAGE_VERSION);
+            config.addString("server", server_address);
+            config.addInteger("port",
+                              lexical_cast<uint16_t>(server_port_str));
+            config.addString("protocol", proto_str);
+            config.addString("manager", manager_txt);
+            if (data_file != NULL) {
+                config.addString("data_file", data_file);
+            } else {
+                config.addString("queries", query_txt);
+            }
+            config.addBoolean("preload", preload);
+            config.addString("qclass", qclass_txt);
+            config.addBoolean("dnssec", dnssec_flag);
+            config.addBoolean("edns", edns_flag);
+            config.addInteger("threads", num_threads);
+            config.addInteger("duration", disp.getTestDuration());
+            config.addInteger("window", disp.getWindow());
+            config.addInteger("udp_sockets", disp.getUDPSocketCount());
+            config.addInteger("tcp_connections",
+                              disp.getTCPConnectionCount());
+            config.addInteger("queries_per_connection",
+                              disp.getQueriesPerConnection());
+            config.addBoolean("tls_resumption", tls_resumption);
+            config.addBoolean("tc_retry", tcp_retry);
+            config.addBoolean("validation", validation);
+            config.addInteger("log_rate", disp.getLogRate());
+            config.addString("query_selection", selection_txt);
+            config.addInteger("query_rate", query_rate);
+            config.addString("load_profile",
+                             profile_txt != NULL ? profile_txt : "");
+            config.addString("cpu_affinity",
+                             cpus_txt != NULL ? cpus_txt : "");
+            config.addInteger("report_interval",
+                              reporter ? lexical_cast<unsigned int>(
+                                  interval_txt != NULL ? interval_txt :
+                                  DEFAULT_REPORT_INTERVAL) : 0);
+        }
+
         // Run
-        std::cout << "[Status] Sending queries to " << server_address
-             << " over " << proto_str << ", port " << server_port_str << std::endl;
+        if (servers.size() > 1) {
+            std::cout << "[Status] Sending queries to " << servers.size()
+                      << " servers over " << proto_str << std::endl;
+        } else {
+            std::cout << "[Status] Sending queries to " << servers[0].address
+                      << " over " << proto_str << ", port " << servers[0].port
+                      << std::endl;
+        }
+        if (profile) {
+            std::cout << "[Status] Load profile: " << profile->toText()
+                      << std::endl;
+        }
         std::vector<pthread_t> threads;
         const ptime start_time = microsec_clock::local_time();
+        if (reporter) {
+            reporter->start();
+        }
         for (size_t i = 0; i < num_threads; ++i) {
             pthread_t th;
             const int error = pthread_create(&th, NULL, runQueryperf,
@@ -273,15 +995,27 @@ main(int argc, char* argv[]) {
             threads.push_back(th);
         }
 
+        bool worker_failed = false;
         for (size_t i = 0; i < num_threads; ++i) {
-            const int error = pthread_join(threads[i], NULL);
+            void* result = NULL;
+            const int error = pthread_join(threads[i], &result);
             if (error != 0) {
                 // if join failed, we warn about it and just continue anyway
                 std::cerr
                     << "pthread_join failed: " << strerror(error) << std::endl;
+            } else if (result == NULL) {
+                worker_failed = true;
             }
         }
         const ptime end_time = microsec_clock::local_time();
+        if (reporter) {
+            reporter->stop();
+        }
+        // The statistics of a thread that died would be incomplete.
+        if (worker_failed) {
+            std::cerr << "Testing failed: a worker thread died" << std::endl;
+            return (1);
+        }
         std::cout << "[Status] Testing complete" << std::endl;
 
         // Accumulate per-thread statistics.  Print the summary QPS for each,
@@ -296,6 +1030,25 @@ main(int argc, char* argv[]) {
             total_qps += qps;
             std::cout << "  Queries per second #" << i <<
                 ":  " << std::fixed << qps << " qps\n";
+
+            // Throughput of each persistent TCP connection, if any.
+            const Dispatcher& disp = *dispatchers[i];
+            const double seconds = static_cast<double>(
+                (disp.getEndTime() -
+                 disp.getStartTime()).total_microseconds()) / 1000000;
+            const size_t n_connections = disp.getTCPConnectionCount() *
+                disp.getServerCount();
+            for (size_t j = 0; j < n_connections; ++j) {
+                const size_t completed = disp.getConnectionQueriesCompleted(j);
+                std::cout << "    TCP connection #" << j << ":  "
+                          << completed << "/"
+                          << disp.getConnectionQueriesSent(j)
+                          << " queries completed, " << std::fixed
+                          << getRate(completed, seconds) << " qps\n";
+            }
+            if (!disp.getCPUAffinity().empty()) {
+                printPlacement(disp);
+            }
         }
         if (num_threads > 1) {
             std::cout << "         Summarized QPS:  " << std::fixed << total_qps
@@ -308,6 +1061,20 @@ main(int argc, char* argv[]) {
              << " queries\n";
         std::cout << "  Queries completed:    " << result.queries_completed
              << " queries\n";
+        std::cout << "  Queries timed out:    " << result.queries_timedout
+                  << " queries\n";
+        std::cout << "  TCP failures:         " << result.tcp_failures
+                  << " connections\n";
+        if (tls) {
+            size_t handshakes = 0;
+            size_t resumed = 0;
+            for (size_t i = 0; i < num_threads; ++i) {
+                handshakes += dispatchers[i]->getTLSHandshakeCount();
+                resumed += dispatchers[i]->getTLSResumedCount();
+            }
+            std::cout << "  TLS handshakes:       " << handshakes << " ("
+                      << resumed << " resumed)\n";
+        }
         std::cout << "\n";
 
         std::cout << "  Percentage completed: " << std::setprecision(2);
@@ -329,6 +1096,58 @@ main(int argc, char* argv[]) {
         }
         std::cout << "\n";
 
+        // Results of each server, summed over the threads.
+        if (servers.size() > 1) {
+            const double seconds = getSeconds(end_time - start_time);
+            std::cout << "  Servers:\n";
+            BOOST_FOREACH(const ServerResult& server,
+                          mergeServerResults(dispatchers)) {
+                std::cout << "    " << server.server.address << "#"
+                          << server.server.port << " (weight "
+                          << server.server.weight << "):  "
+                          << server.queries_completed << "/"
+                          << server.queries_sent << " queries completed, "
+                          << std::setprecision(2) << server.getLossRate()
+                          << "% lost, " << std::setprecision(6)
+                          << getRate(server.queries_completed, seconds)
+                          << " qps";
+                if (server.rtt_histogram.getCount() > 0) {
+                    std::cout << ", latency 50th "
+                              << server.rtt_histogram.getPercentile(50) /
+                        1000000.0
+                              << " s, 99th "
+                              << server.rtt_histogram.getPercentile(99) /
+                        1000000.0 << " s";
+                }
+                std::cout << "\n";
+            }
+            std::cout << "\n";
+        }
+
+        printResponses(result.responses, result.late_rtt_histogram);
+        std::cout << "\n";
+
+        // Latency statistics; the histogram is in microseconds.
+        const LatencyHistogram& rtt = result.rtt_histogram;
+        if (rtt.getCount() > 0) {
+            std::cout << std::setprecision(6);
+            std::cout << "  Average Latency (s):  " << rtt.getMean() / 1000000
+                      << " (min " << rtt.getMin() / 1000000.0
+                      << ", max " << rtt.getMax() / 1000000.0 << ")\n";
+            const double percentiles[] = { 50, 90, 99, 99.9 };
+            const char* const labels[] = { "50th", "90th", "99th", "99.9th" };
+            for (size_t i = 0; i < sizeof(percentiles) / sizeof(percentiles[0]);
+                 ++i) {
+                std::cout << "  Latency " << std::setw(6) << std::left
+                          << labels[i] << std::right << " (s):   "
+                          << rtt.getPercentile(percentiles[i]) / 1000000.0
+                          << "\n";
+            }
+            std::cout << "  Latency max    (s):   "
+                      << rtt.getMax() / 1000000.0 << "\n";
+            std::cout << "\n";
+        }
+
         std::cout << "  Started at:           " << start_time << std::endl;
         std::cout << "  Finished at:          " << end_time << std::endl;
         const time_duration duration = end_time - start_time;
@@ -338,12 +1157,88 @@ main(int argc, char* argv[]) {
             << " seconds\n";
         std::cout << "\n";
 
-        const double qps = result.queries_completed / (
+        const double qps = getRate(
+            result.queries_completed,
             static_cast<double>(duration.total_microseconds()) / 1000000);
         std::cout.precision(6);
         std::cout << "  Queries per second:   " << std::fixed << qps
                   << " qps\n";
+
+        // In the open-loop mode, show how close we were to the target rate.
+        // The actual rate is measured over the sending period, i.e., the
+        // test duration.
+        if (query_rate > 0) {
+            const double send_rate = static_cast<double>(result.queries_sent) /
+                lexical_cast<size_t>(time_limit_str);
+            std::cout << "\n";
+            std::cout << "  Target send rate:     " << std::fixed
+                      << static_cast<double>(query_rate) << " qps\n";
+            std::cout << "  Actual send rate:     " << std::fixed
+                      << send_rate << " qps\n";
+            std::cout << "  Queries skipped:      " << result.queries_skipped
+                      << " queries (window full)\n";
+            if (send_rate < query_rate) {
+                std::cout << "  Shortfall:            "
+                          << (1 - send_rate / query_rate) * 100 << "%\n";
+            }
+        }
+
+        // Results of each step of the load profile, summed over the threads.
+        if (profile) {
+            const std::vector<LoadStepResult> steps =
+                mergeStepResults(dispatchers);
+            std::cout << "\n  Load steps:\n";
+            for (size_t i = 0; i < steps.size(); ++i) {
+                const LoadStepResult& step = steps[i];
+                std::cout << "    #" << i << ":  " << step.step.start_rate;
+                if (step.step.end_rate != step.step.start_rate) {
+                    std::cout << "-" << step.step.end_rate;
+                }
+                std::cout << " qps for " << step.step.duration << " s, "
+                          << step.queries_sent << " sent, "
+                          << step.queries_completed << " completed, "
+                          << std::setprecision(2) << step.getLossRate()
+                          << "% lost";
+                if (step.rtt_histogram.getCount() > 0) {
+                    std::cout << std::setprecision(6) << ", latency 50th "
+                              << step.rtt_histogram.getPercentile(50) /
+                        1000000.0
+                              << " s, 99th "
+                              << step.rtt_histogram.getPercentile(99) /
+                        1000000.0 << " s";
+                }
+                if (profile->isSearch()) {
+                    std::cout << (profile->isAcceptable(step) ? " (ok)" :
+                                  " (failed)");
+                }
+                std::cout << "\n";
+            }
+            if (profile->isSearch()) {
+                std::cout << "  Highest rate found:   ";
+                if (dispatchers[0]->getFoundRate() > 0) {
+                    std::cout << dispatchers[0]->getFoundRate() << " qps\n";
+                } else {
+                    std::cout << "none\n";
+                }
+            }
+        }
         std::cout << std::endl;
+
+        if (output_file != NULL) {
+            addResults(results, dispatchers, result, start_time, end_time,
+                       profile.get(), reporter.get());
+            if (format_str == "json") {
+                results.writeJSON(output_stream);
+            } else {
+                results.writeCSV(output_stream);
+            }
+            output_stream.close();
+            if (!output_stream) {
+                std::cerr << "failed to write output file: " << output_file
+                          << std::endl;
+                return (1);
+            }
+        }
     } catch (const std::exception& ex) {
         std::cerr << "Unexpected failure: " << ex.what() << std::endl;
         return (1);
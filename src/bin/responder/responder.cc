@@ -0,0 +1,604 @@
+// Copyright (C) 2012  JINMEI Tatuya
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+// OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+// A minimal DNS responder for benchmarking queryperf++ itself.  It answers
+// each query with the query itself with the QR bit set, optionally after a
+// fixed delay or not at all (at a given rate), without parsing or looking
+// up anything, so that it's much faster than the generator and the
+// throughput measured against it is that of the generator.
+
+#include <config.h>
+
+#include <message_manager.h>
+#include <monotonic_time.h>
+#include <query_sampler.h>
+#include <sockaddr_util.h>
+
+#include <boost/lexical_cast.hpp>
+
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <unistd.h>
+
+using namespace std;
+using namespace Queryperf;
+using boost::lexical_cast;
+
+namespace {
+const char* const DEFAULT_ADDRESS = "::1";
+const uint16_t DEFAULT_PORT = 5300;
+const size_t DEFAULT_THREAD_COUNT = 1;
+const char* const DEFAULT_PROTOCOL = "both";
+
+const size_t HEADER_LEN = 12;   // of DNS messages
+const size_t BATCH_SIZE = 64;   // UDP messages received or sent at once
+const size_t UDP_BUF_LEN = 4096;
+const size_t TCP_READ_LEN = 65536;
+
+#if defined(HAVE_RECVMMSG) || defined(HAVE_SENDMMSG)
+typedef struct mmsghdr MessageHeader;
+#else
+struct MessageHeader {
+    struct msghdr msg_hdr;
+    unsigned int msg_len;
+};
+#endif
+
+// Parameters shared by all threads (never modified once they start).
+struct ResponderConfig {
+    ResponderConfig() : delay_msec(0), drop_threshold(0) {}
+
+    uint64_t delay_msec;        // delay of every response
+    uint64_t drop_threshold;    // a query is dropped if a random number
+                                // is smaller than this
+};
+
+ResponderConfig config;
+
+// Per-thread state of the artificial delay and drop.
+class ResponsePolicy {
+public:
+    explicit ResponsePolicy(uint64_t seed) : rng_(seed) {}
+
+    bool drop() {
+        return (config.drop_threshold != 0 &&
+                rng_.next() < config.drop_threshold);
+    }
+
+    // When a response to a query received now should be sent.
+    uint64_t getDueTime() const {
+        return (getMonotonicTime() + config.delay_msec * 1000);
+    }
+
+    // The poll() timeout until the given time, rounded up so the response
+    // is never sent early (-1, i.e., infinite, if nothing is pending).
+    static int getTimeout(bool pending, uint64_t due) {
+        if (!pending) {
+            return (-1);
+        }
+        const uint64_t now = getMonotonicTime();
+        return (due <= now ? 0 : static_cast<int>((due - now + 999) / 1000));
+    }
+
+private:
+    RandomGenerator rng_;
+};
+
+// Turn a query into the response in place, or return false if it's not a
+// DNS query at all.
+inline bool
+makeResponse(uint8_t* data, size_t len) {
+    if (len < HEADER_LEN || (data[2] & 0x80) != 0) {
+        return (false);
+    }
+    data[2] |= 0x80;            // QR
+    return (true);
+}
+
+string
+getErrorText(const string& what) {
+    return (what + ": " + strerror(errno));
+}
+
+int
+openSocket(const string& address, uint16_t port, int type) {
+    struct sockaddr_storage ss;
+    const socklen_t sslen = convertAddress(address, port, ss);
+    const int fd = socket(ss.ss_family, type, 0);
+    if (fd < 0) {
+        throw runtime_error(getErrorText("socket"));
+    }
+    // Each UDP thread has its own socket for the same port, among which
+    // the kernel distributes the queries.
+    const int on = 1;
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) != 0 ||
+#ifdef SO_REUSEPORT
+        (type == SOCK_DGRAM &&
+         setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) != 0) ||
+#endif
+        false) {
+        close(fd);
+        throw runtime_error(getErrorText("setsockopt"));
+    }
+    if (bind(fd, convertSockAddr(&ss), sslen) != 0) {
+        close(fd);
+        throw runtime_error(getErrorText("bind"));
+    }
+    if (type == SOCK_STREAM && listen(fd, SOMAXCONN) != 0) {
+        close(fd);
+        throw runtime_error(getErrorText("listen"));
+    }
+    return (fd);
+}
+
+// A response to be sent after the delay.  All responses have the same
+// delay, so they are due in the order of the queries.
+struct PendingResponse {
+    uint64_t due;
+    struct sockaddr_storage from; // UDP only
+    socklen_t fromlen;
+    vector<uint8_t> data;
+};
+
+class UDPResponder {
+public:
+    UDPResponder(int fd, uint64_t seed) : fd_(fd), policy_(seed),
+                                          bufs_(BATCH_SIZE * UDP_BUF_LEN)
+    {
+        memset(msgs_, 0, sizeof(msgs_));
+        memset(send_msgs_, 0, sizeof(send_msgs_));
+    }
+
+    void run();
+
+private:
+    // Receive up to BATCH_SIZE queries without blocking.
+    size_t receive();
+
+    // Send the first n messages of send_msgs_.
+    void send(size_t n);
+
+    void sendDue();
+
+    const int fd_;
+    ResponsePolicy policy_;
+    vector<uint8_t> bufs_;
+    struct iovec iovs_[BATCH_SIZE];
+    struct sockaddr_storage addrs_[BATCH_SIZE];
+    MessageHeader msgs_[BATCH_SIZE];
+    struct iovec send_iovs_[BATCH_SIZE];
+    MessageHeader send_msgs_[BATCH_SIZE];
+    deque<PendingResponse> pending_;
+};
+
+size_t
+UDPResponder::receive() {
+    for (size_t i = 0; i < BATCH_SIZE; ++i) {
+        iovs_[i].iov_base = &bufs_[i * UDP_BUF_LEN];
+        iovs_[i].iov_len = UDP_BUF_LEN;
+        msgs_[i].msg_hdr.msg_iov = &iovs_[i];
+        msgs_[i].msg_hdr.msg_iovlen = 1;
+        msgs_[i].msg_hdr.msg_name = &addrs_[i];
+        msgs_[i].msg_hdr.msg_namelen = sizeof(addrs_[i]);
+    }
+#ifdef HAVE_RECVMMSG
+    const int n = recvmmsg(fd_, msgs_, BATCH_SIZE, MSG_DONTWAIT, NULL);
+    return (n > 0 ? n : 0);
+#else
+    size_t n = 0;
+    for (; n < BATCH_SIZE; ++n) {
+        const ssize_t len = recvmsg(fd_, &msgs_[n].msg_hdr, MSG_DONTWAIT);
+        if (len < 0) {
+            break;
+        }
+        msgs_[n].msg_len = len;
+    }
+    return (n);
+#endif
+}
+
+void
+UDPResponder::send(size_t n) {
+    // Responses that can't be sent (e.g., the socket buffer is full) are
+    // simply lost, as they would be on the network.
+#ifdef HAVE_SENDMMSG
+    size_t sent = 0;
+    while (sent < n) {
+        const int ret = sendmmsg(fd_, &send_msgs_[sent], n - sent, 0);
+        if (ret <= 0) {
+            break;
+        }
+        sent += ret;
+    }
+#else
+    for (size_t i = 0; i < n; ++i) {
+        sendmsg(fd_, &send_msgs_[i].msg_hdr, 0);
+    }
+#endif
+}
+
+void
+UDPResponder::sendDue() {
+    const uint64_t now = getMonotonicTime();
+    while (!pending_.empty() && pending_.front().due <= now) {
+        size_t n = 0;
+        for (; n < BATCH_SIZE && n < pending_.size() &&
+                 pending_[n].due <= now; ++n) {
+            PendingResponse& response = pending_[n];
+            send_iovs_[n].iov_base = &response.data[0];
+            send_iovs_[n].iov_len = response.data.size();
+            send_msgs_[n].msg_hdr.msg_iov = &send_iovs_[n];
+            send_msgs_[n].msg_hdr.msg_iovlen = 1;
+            send_msgs_[n].msg_hdr.msg_name = &response.from;
+            send_msgs_[n].msg_hdr.msg_namelen = response.fromlen;
+        }
+        send(n);
+        pending_.erase(pending_.begin(), pending_.begin() + n);
+    }
+}
+
+void
+UDPResponder::run() {
+    struct pollfd pfd;
+    pfd.fd = fd_;
+    pfd.events = POLLIN;
+    while (true) {
+        const int timeout = ResponsePolicy::getTimeout(
+            !pending_.empty(), pending_.empty() ? 0 : pending_.front().due);
+        if (poll(&pfd, 1, timeout) < 0 && errno != EINTR) {
+            throw runtime_error(getErrorText("poll"));
+        }
+        const size_t n = receive();
+        size_t n_responses = 0;
+        for (size_t i = 0; i < n; ++i) {
+            uint8_t* data = static_cast<uint8_t*>(iovs_[i].iov_base);
+            if (!makeResponse(data, msgs_[i].msg_len) || policy_.drop()) {
+                continue;
+            }
+            if (config.delay_msec > 0) {
+                pending_.push_back(PendingResponse());
+                PendingResponse& response = pending_.back();
+                response.due = policy_.getDueTime();
+                response.from = addrs_[i];
+                response.fromlen = msgs_[i].msg_hdr.msg_namelen;
+                response.data.assign(data, data + msgs_[i].msg_len);
+                continue;
+            }
+            // Send it back from the receive buffer.
+            send_iovs_[n_responses].iov_base = data;
+            send_iovs_[n_responses].iov_len = msgs_[i].msg_len;
+            send_msgs_[n_responses].msg_hdr.msg_iov =
+                &send_iovs_[n_responses];
+            send_msgs_[n_responses].msg_hdr.msg_iovlen = 1;
+            send_msgs_[n_responses].msg_hdr.msg_name = &addrs_[i];
+            send_msgs_[n_responses].msg_hdr.msg_namelen =
+                msgs_[i].msg_hdr.msg_namelen;
+            ++n_responses;
+        }
+        send(n_responses);
+        sendDue();
+    }
+}
+
+// Handle a single TCP connection in its own thread: queries are read as
+// they come (possibly pipelined), and responses are written in the same
+// order.
+class TCPResponder {
+public:
+    TCPResponder(int fd, uint64_t seed) : fd_(fd), policy_(seed) {}
+    ~TCPResponder() { close(fd_); }
+
+    void run();
+
+private:
+    // Write all data, returning false if the connection is broken.
+    bool write(const vector<uint8_t>& data);
+
+    const int fd_;
+    ResponsePolicy policy_;
+    deque<PendingResponse> pending_;
+};
+
+bool
+TCPResponder::write(const vector<uint8_t>& data) {
+    size_t written = 0;
+    while (written < data.size()) {
+        const ssize_t ret = ::send(fd_, &data[written], data.size() - written,
+                                   0);
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ret <= 0) {
+            return (false);
+        }
+        written += ret;
+    }
+    return (true);
+}
+
+void
+TCPResponder::run() {
+    vector<uint8_t> inbuf;
+    vector<uint8_t> outbuf;
+    vector<uint8_t> readbuf(TCP_READ_LEN);
+    struct pollfd pfd;
+    pfd.fd = fd_;
+    pfd.events = POLLIN;
+    while (true) {
+        const int timeout = ResponsePolicy::getTimeout(
+            !pending_.empty(), pending_.empty() ? 0 : pending_.front().due);
+        const int ready = poll(&pfd, 1, timeout);
+        if (ready < 0 && errno != EINTR) {
+            return;
+        }
+        if (ready > 0) {
+            const ssize_t len = recv(fd_, &readbuf[0], readbuf.size(), 0);
+            if (len < 0) {
+                return;
+            }
+            if (len == 0) {
+                // The client may shut down its side right after sending
+                // queries; the delayed responses are still to be sent
+                // (poll() ignores the negative descriptor from now on).
+                pfd.fd = -1;
+            }
+            inbuf.insert(inbuf.end(), readbuf.begin(), readbuf.begin() + len);
+        }
+
+        // Respond to all complete queries (each has a 2-byte length).
+        size_t pos = 0;
+        while (inbuf.size() - pos >= 2) {
+            const size_t msglen = (inbuf[pos] << 8) | inbuf[pos + 1];
+            if (inbuf.size() - pos - 2 < msglen) {
+                break;
+            }
+            uint8_t* data = &inbuf[pos];
+            pos += 2 + msglen;
+            if (!makeResponse(data + 2, msglen) || policy_.drop()) {
+                continue;
+            }
+            if (config.delay_msec > 0) {
+                pending_.push_back(PendingResponse());
+                pending_.back().due = policy_.getDueTime();
+                pending_.back().data.assign(data, data + 2 + msglen);
+            } else {
+                outbuf.insert(outbuf.end(), data, data + 2 + msglen);
+            }
+        }
+        inbuf.erase(inbuf.begin(), inbuf.begin() + pos);
+
+        const uint64_t now = getMonotonicTime();
+        while (!pending_.empty() && pending_.front().due <= now) {
+            outbuf.insert(outbuf.end(), pending_.front().data.begin(),
+                          pending_.front().data.end());
+            pending_.pop_front();
+        }
+        if (!outbuf.empty()) {
+            if (!write(outbuf)) {
+                return;
+            }
+            outbuf.clear();
+        }
+        if (pfd.fd < 0 && pending_.empty()) {
+            return;
+        }
+    }
+}
+
+// Thread entry points.  Each thread seeds its random numbers differently.
+struct ThreadParam {
+    ThreadParam(int fd_param, uint64_t seed_param) :
+        fd(fd_param), seed(seed_param)
+    {}
+    int fd;
+    uint64_t seed;
+};
+
+void*
+runUDP(void* arg) {
+    const ThreadParam* param = static_cast<ThreadParam*>(arg);
+    try {
+        UDPResponder(param->fd, param->seed).run();
+    } catch (const std::exception& ex) {
+        cerr << "UDP responder failed: " << ex.what() << endl;
+    }
+    return (NULL);
+}
+
+void*
+runTCPConnection(void* arg) {
+    ThreadParam* param = static_cast<ThreadParam*>(arg);
+    TCPResponder(param->fd, param->seed).run();
+    delete param;
+    return (NULL);
+}
+
+void*
+runTCPListener(void* arg) {
+    const ThreadParam* param = static_cast<ThreadParam*>(arg);
+    for (uint64_t n = 0; ; ++n) {
+        const int fd = accept(param->fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED || errno == EMFILE ||
+                errno == ENFILE) {
+                continue;
+            }
+            cerr << getErrorText("accept") << endl;
+            return (NULL);
+        }
+        ThreadParam* conn_param = new ThreadParam(fd, param->seed + n);
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        pthread_t thread;
+        if (pthread_create(&thread, &attr, runTCPConnection,
+                           conn_param) != 0) {
+            close(fd);
+            delete conn_param;
+        }
+        pthread_attr_destroy(&attr);
+    }
+}
+
+void
+usage() {
+    cerr << "Usage: responder [-a address] [-d msec] [-D percentage] "
+         << "[-n #threads]\n"
+         << "                 [-p port] [-P udp|tcp|both]\n";
+    cerr << "  -a sets the address to listen on (default: "
+         << DEFAULT_ADDRESS << ")\n";
+    cerr << "  -d sets the delay of every response in milliseconds "
+         << "(default: 0)\n";
+    cerr << "  -D sets the percentage of queries dropped without "
+         << "responses (default: 0)\n";
+    cerr << "  -n sets the number of UDP threads (default: "
+         << DEFAULT_THREAD_COUNT << ")\n";
+    cerr << "  -p sets the port to listen on (default: " << DEFAULT_PORT
+         << ")\n";
+    cerr << "  -P sets the transport protocols to serve (default: "
+         << DEFAULT_PROTOCOL << ")\n";
+    cerr << "Each TCP connection is handled in its own thread." << endl;
+    exit(1);
+}
+}
+
+int
+main(int argc, char* argv[]) {
+    const char* address = DEFAULT_ADDRESS;
+    const char* port_txt = NULL;
+    const char* threads_txt = NULL;
+    const char* delay_txt = NULL;
+    const char* drop_txt = NULL;
+    string proto_str = DEFAULT_PROTOCOL;
+
+    int ch;
+    while ((ch = getopt(argc, argv, "a:d:D:hn:p:P:")) != -1) {
+        switch (ch) {
+        case 'a':
+            address = optarg;
+            break;
+        case 'd':
+            delay_txt = optarg;
+            break;
+        case 'D':
+            drop_txt = optarg;
+            break;
+        case 'n':
+            threads_txt = optarg;
+            break;
+        case 'p':
+            port_txt = optarg;
+            break;
+        case 'P':
+            proto_str = optarg;
+            if (proto_str != "udp" && proto_str != "tcp" &&
+                proto_str != "both") {
+                cerr << "Invalid protocol: " << proto_str << endl;
+                return (1);
+            }
+            break;
+        case 'h':
+        case '?':
+        default:
+            usage();
+        }
+    }
+    if (optind < argc) {
+        usage();
+    }
+
+    try {
+        const uint16_t port = port_txt != NULL ?
+            lexical_cast<uint16_t>(port_txt) : DEFAULT_PORT;
+        const size_t n_threads = threads_txt != NULL ?
+            lexical_cast<size_t>(threads_txt) : DEFAULT_THREAD_COUNT;
+        if (n_threads == 0) {
+            cerr << "The number of threads must be positive" << endl;
+            return (1);
+        }
+        if (delay_txt != NULL) {
+            config.delay_msec = lexical_cast<unsigned int>(delay_txt);
+        }
+        if (drop_txt != NULL) {
+            const double drop_rate = lexical_cast<double>(drop_txt);
+            if (drop_rate < 0 || drop_rate > 100) {
+                cerr << "Invalid drop percentage: " << drop_txt << endl;
+                return (1);
+            }
+            const double threshold = drop_rate / 100 * 18446744073709551616.0;
+            config.drop_threshold = threshold >= 18446744073709551615.0 ?
+                ~static_cast<uint64_t>(0) :
+                static_cast<uint64_t>(threshold);
+        }
+
+        // A client closing a TCP connection shouldn't kill the responder.
+        signal(SIGPIPE, SIG_IGN);
+
+        // Open all sockets first, so errors are reported before starting.
+        vector<ThreadParam> params;
+        if (proto_str != "tcp") {
+            for (size_t i = 0; i < n_threads; ++i) {
+                params.push_back(ThreadParam(openSocket(address, port,
+                                                        SOCK_DGRAM), i));
+            }
+        }
+        const bool tcp = proto_str != "udp";
+        if (tcp) {
+            params.push_back(ThreadParam(openSocket(address, port,
+                                                    SOCK_STREAM),
+                                         n_threads));
+        }
+
+        cout << "[Status] Responding on " << address << " port " << port
+             << " over " << proto_str << " (" << n_threads
+             << " UDP threads, delay " << config.delay_msec << " ms)"
+             << endl;
+        vector<pthread_t> threads(params.size());
+        for (size_t i = 0; i < params.size(); ++i) {
+            const bool listener = tcp && i == params.size() - 1;
+            const int error = pthread_create(&threads[i], NULL,
+                                             listener ? runTCPListener :
+                                             runUDP, &params[i]);
+            if (error != 0) {
+                cerr << "Failed to start a thread: " << strerror(error)
+                     << endl;
+                return (1);
+            }
+        }
+        // The threads run until the process is killed (or they fail).
+        for (size_t i = 0; i < threads.size(); ++i) {
+            pthread_join(threads[i], NULL);
+        }
+    } catch (const boost::bad_lexical_cast&) {
+        usage();
+    } catch (const std::exception& ex) {
+        cerr << "Failed to start the responder: " << ex.what() << endl;
+        return (1);
+    }
+    return (1);
+}
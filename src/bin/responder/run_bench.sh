@@ -0,0 +1,105 @@
+#!/bin/sh
+#
+# Measure the maximum throughput of queryperf++ itself: run it against the
+# loopback responder, which is much faster than queryperf++, over a matrix
+# of query windows, threads and transports, and report the best QPS for
+# each transport.  Normally run by "make bench"; the following variables
+# control the runs.
+
+QUERYPERF=${QUERYPERF:-../queryperfpp/queryperf++}
+RESPONDER=${RESPONDER:-./responder}
+BENCH_PORT=${BENCH_PORT:-5399}
+BENCH_DURATION=${BENCH_DURATION:-3}            # seconds per run
+BENCH_THREADS=${BENCH_THREADS:-"1 2 4"}        # queryperf++ threads
+BENCH_WINDOWS=${BENCH_WINDOWS:-"20 200 2000"}  # outstanding queries
+BENCH_TRANSPORTS=${BENCH_TRANSPORTS:-"udp tcp"}
+BENCH_TCP_CONNECTIONS=${BENCH_TCP_CONNECTIONS:-4}
+BENCH_RESPONDER_THREADS=${BENCH_RESPONDER_THREADS:-4}
+BENCH_LOG=${BENCH_LOG:-bench.log}
+
+tmpdir=$(mktemp -d "${TMPDIR:-/tmp}/qpbench.XXXXXX") || exit 1
+responder_pid=
+cleanup() {
+    if [ -n "$responder_pid" ]; then
+        kill "$responder_pid" 2>/dev/null
+        wait "$responder_pid" 2>/dev/null
+    fi
+    rm -rf "$tmpdir"
+}
+trap cleanup EXIT
+trap 'exit 1' HUP INT TERM
+
+queries=$tmpdir/queries
+for i in 0 1 2 3 4 5 6 7 8 9; do
+    echo "www$i.example.com A"
+    echo "www$i.example.com AAAA"
+    echo "mail$i.example.org MX"
+done > "$queries"
+
+"$RESPONDER" -a 127.0.0.1 -p "$BENCH_PORT" -n "$BENCH_RESPONDER_THREADS" \
+    > "$tmpdir/responder.out" 2>&1 &
+responder_pid=$!
+sleep 1
+if ! kill -0 "$responder_pid" 2>/dev/null; then
+    echo "responder failed to start:" >&2
+    cat "$tmpdir/responder.out" >&2
+    responder_pid=
+    exit 1
+fi
+
+: > "$BENCH_LOG"
+results=$tmpdir/results
+: > "$results"
+json=$tmpdir/result.json
+failed=
+for proto in $BENCH_TRANSPORTS; do
+    extra=
+    if [ "$proto" = tcp ]; then
+        extra="-t $BENCH_TCP_CONNECTIONS"
+    fi
+    for threads in $BENCH_THREADS; do
+        for window in $BENCH_WINDOWS; do
+            echo "=== $proto threads=$threads window=$window" >> "$BENCH_LOG"
+            rm -f "$json"
+            "$QUERYPERF" -s 127.0.0.1 -p "$BENCH_PORT" \
+                -l "$BENCH_DURATION" -n "$threads" -q "$window" \
+                -P "$proto" $extra -L -d "$queries" -F json -o "$json" \
+                >> "$BENCH_LOG" 2>&1
+            status=$?
+            # The "qps" of the "total" record in the JSON results.
+            qps=
+            if [ -f "$json" ]; then
+                cat "$json" >> "$BENCH_LOG"
+                qps=$(awk '/^  "total": \{/ { total = 1; next }
+                           total && /^  [^ ]/ { total = 0 }
+                           total && /^    "qps": / {
+                               sub(/^    "qps": /, ""); sub(/,$/, "");
+                               print
+                           }' "$json")
+            fi
+            case "$qps" in
+            "" | *[!0-9.e+-]*)
+                qps=
+                ;;
+            esac
+            if [ "$status" -ne 0 ] || [ -z "$qps" ]; then
+                echo "$proto threads=$threads window=$window: failed" \
+                     "(see $BENCH_LOG)" >&2
+                failed=1
+                continue
+            fi
+            printf '%-4s threads=%-3s window=%-6s %12s qps\n' \
+                   "$proto" "$threads" "$window" "$qps"
+            echo "$proto $threads $window $qps" >> "$results"
+        done
+    done
+done
+
+echo
+awk '$4 > max[$1] { max[$1] = $4; conf[$1] = "threads=" $2 " window=" $3 }
+     END { for (p in max) printf "Maximum %s throughput: %.0f qps (%s)\n",
+                                 p, max[p], conf[p] }' "$results"
+if [ -n "$failed" ]; then
+    echo "some runs failed (see $BENCH_LOG)" >&2
+    exit 1
+fi
@@ -16,6 +16,9 @@
 
 #include <message_manager.h>
 #include <asio_message_manager.h>
+#include <timer_wheel.h>
+#include <tcp_stream.h>
+#include <cpu_affinity.h>
 
 #ifdef HAVE_NONBOOST_ASIO
 #include <asio.hpp>
@@ -23,15 +26,17 @@
 #include <boost/asio.hpp>
 #endif
 
+#include <boost/scoped_ptr.hpp>
 #include <boost/shared_array.hpp>
 #include <boost/bind.hpp>
 #include <boost/date_time/posix_time/posix_time_types.hpp>
 #include <boost/lexical_cast.hpp>
 
+#include <cerrno>
 #include <memory>
 #include <limits>
 #include <string>
-#include <iostream>
+#include <vector>
 
 #include <stdint.h>
 
@@ -41,6 +46,7 @@ using namespace asio;
 using namespace boost::asio;
 using boost::system::error_code;
 using boost::system::system_error;
+using boost::system::system_category;
 #endif
 using boost::lexical_cast;
 
@@ -132,8 +138,8 @@ UDPMessageSocket::handleRead(const error_code& ec, size_t length) {
 
 class TCPMessageSocket : public ASIOMessageSocket::ASIOMessageSocketImpl {
 public:
-    TCPMessageSocket(io_service& io_service, const std::string& address,
-                     uint16_t port, void* recvbuf,
+    TCPMessageSocket(io_service& io_service, DiagnosticLog& log,
+                     const std::string& address, uint16_t port, void* recvbuf,
                      MessageSocket::Callback callback);
     ~TCPMessageSocket() { delete aux_recvbuf_; }
     virtual void send(const void* data, size_t datalen);
@@ -164,6 +170,7 @@ private:
 private:
     //ASIOMessageManager* manager_;
     ip::tcp::socket asio_sock_;
+    DiagnosticLog& log_;
     error_code asio_error_; // placeholder for getting ASIO error
     ip::tcp::endpoint dest_;
     MessageSocket::Callback callback_;
@@ -176,11 +183,11 @@ private:
     bool completed_;
 };
 
-TCPMessageSocket::TCPMessageSocket(io_service& io_service,
+TCPMessageSocket::TCPMessageSocket(io_service& io_service, DiagnosticLog& log,
                                    const std::string& address, uint16_t port,
                                    void* recvbuf,
                                    MessageSocket::Callback callback) :
-    asio_sock_(io_service),
+    asio_sock_(io_service), log_(log),
     dest_(ip::address::from_string(address), port),
     callback_(callback), recvbuf_(recvbuf), recvdata_len_(0),
     aux_recvbuf_(NULL), cancelled_(false), completed_(false)
@@ -220,7 +227,9 @@ TCPMessageSocket::handleConnect(const error_code& ec) {
         return;
     }
     if (ec) {
-        std::cerr << "[Warn] TCP connect failed: " << ec.message() << std::endl;
+        if (log_.admit()) {
+            log_.write("[Warn] TCP connect failed: " + ec.message());
+        }
         sendCallback(NULL, 0);
         return;
     }
@@ -234,7 +243,9 @@ TCPMessageSocket::handleWrite(const error_code& ec, size_t) {
         return;
     }
     if (ec) {
-        std::cerr << "[Warn] TCP send failed: " << ec.message() << std::endl;
+        if (log_.admit()) {
+            log_.write("[Warn] TCP send failed: " + ec.message());
+        }
         sendCallback(NULL, 0);
         return;
     }
@@ -242,8 +253,10 @@ TCPMessageSocket::handleWrite(const error_code& ec, size_t) {
     // of the socket, so the server won't wait for subsequent queries.
     asio_sock_.shutdown(ip::tcp::socket::shutdown_send, asio_error_);
     if (asio_error_) {
-        std::cerr << "[Warn] failed to shut down TCP socket: "
-                  << asio_error_.message() << std::endl;
+        if (log_.admit()) {
+            log_.write("[Warn] failed to shut down TCP socket: " +
+                       asio_error_.message());
+        }
         sendCallback(NULL, 0);
         return;
     }
@@ -268,8 +281,10 @@ TCPMessageSocket::handleReadLength(const error_code& ec, size_t length) {
         return;
     }
     if (ec) {
-        std::cerr << "[Warn] failed to read TCP message length: "
-                  << ec.message() << std::endl;
+        if (log_.admit()) {
+            log_.write("[Warn] failed to read TCP message length: " +
+                       ec.message());
+        }
         sendCallback(NULL, 0);
         return;
     }
@@ -306,8 +321,9 @@ TCPMessageSocket::handleReadData(const error_code& ec, size_t length) {
         return;
     }
     if (ec) {
-        std::cerr << "[Warn] failed to read TCP message: " << ec.message()
-                  << std::endl;
+        if (log_.admit()) {
+            log_.write("[Warn] failed to read TCP message: " + ec.message());
+        }
         sendCallback(NULL, recvdata_len_);
         return;
     }
@@ -325,6 +341,258 @@ TCPMessageSocket::handleReadData(const error_code& ec, size_t length) {
                              boost::bind(&TCPMessageSocket::handleReadLength,
                                          this, _1, _2));
 }
+
+// A persistent TCP connection with pipelined messages.  Each handler is
+// bound with the generation of the connection it was started for, so
+// handlers for a failed connection are ignored even if a new connection
+// has been opened by then.
+class PersistentTCPMessageSocket :
+        public ASIOMessageSocket::ASIOMessageSocketImpl
+{
+public:
+    PersistentTCPMessageSocket(io_service& io_service, DiagnosticLog& log,
+                               const std::string& address, uint16_t port,
+                               const StreamSocketParams& params,
+                               MessageSocket::Callback callback);
+    virtual void send(const void* data, size_t datalen);
+    virtual void cancel();
+    virtual int native() { return (asio_sock_.native()); }
+
+private:
+    void startConnect();
+    void startWrite();
+    void startRead();
+    void handleConnect(unsigned int generation, const error_code& ec);
+    void handleWrite(unsigned int generation, const error_code& ec, size_t);
+    void handleRead(unsigned int generation, const error_code& ec,
+                    size_t length);
+
+    // Common check on completion of an operation.  It returns true if the
+    // handler shouldn't do anything, i.e., the socket has been released
+    // (in which case it may be deleted here) or the operation is for an
+    // old connection.
+    bool completionCheck(unsigned int generation) {
+        --pending_;
+        if (cancelled_) {
+            if (pending_ == 0) {
+                delete this;
+            }
+            return (true);
+        }
+        return (generation != generation_);
+    }
+
+    // Close the connection and tell the owner.
+    void fail(const char* what, const error_code& ec);
+
+    // Close the connection that has exchanged all messages allowed, and
+    // open a new one if more messages are queued.
+    void reconnect();
+
+    // Common cleanup on closing the connection.
+    void closeSocket();
+
+private:
+    enum State {
+        CLOSED,
+        CONNECTING,
+        CONNECTED
+    };
+
+    ip::tcp::socket asio_sock_;
+    DiagnosticLog& log_;
+    ip::tcp::endpoint dest_;
+    MessageSocket::Callback callback_;
+    TCPStream stream_;
+    std::vector<uint8_t> writebuf_; // data being written
+    State state_;
+    bool writing_;
+    unsigned int generation_;   // incremented every time a connection fails
+    size_t pending_;            // # of outstanding operations
+    bool cancelled_;
+};
+
+PersistentTCPMessageSocket::PersistentTCPMessageSocket(
+    io_service& io_service, DiagnosticLog& log, const std::string& address,
+    uint16_t port, const StreamSocketParams& params,
+    MessageSocket::Callback callback) :
+    asio_sock_(io_service), log_(log), callback_(callback), stream_(params),
+    state_(CLOSED), writing_(false), generation_(0), pending_(0),
+    cancelled_(false)
+{
+    try {
+        dest_ = ip::tcp::endpoint(ip::address::from_string(address), port);
+    } catch (const system_error& e) {
+        throw MessageSocketError(std::string("Failed to create a socket: ") +
+                                 e.what());
+    }
+}
+
+void
+PersistentTCPMessageSocket::send(const void* data, size_t datalen) {
+    stream_.queueMessage(data, datalen);
+    if (state_ == CLOSED) {
+        startConnect();
+    } else if (state_ == CONNECTED && !writing_ && stream_.hasQueued()) {
+        startWrite();
+    }
+}
+
+void
+PersistentTCPMessageSocket::cancel() {
+    cancelled_ = true;
+    if (pending_ == 0) {
+        delete this;
+    } else {
+        // Outstanding handlers will be called with an error, and the last
+        // one will delete us.
+        error_code ec;
+        asio_sock_.close(ec);
+    }
+}
+
+void
+PersistentTCPMessageSocket::startConnect() {
+    state_ = CONNECTING;
+    ++pending_;
+    asio_sock_.async_connect(dest_,
+                             boost::bind(
+                                 &PersistentTCPMessageSocket::handleConnect,
+                                 this, generation_, _1));
+}
+
+void
+PersistentTCPMessageSocket::startWrite() {
+    // Send all queued messages at once.
+    if (!stream_.takeQueued(writebuf_)) {
+        fail(stream_.getError().c_str(),
+             error_code(EPROTO, system_category()));
+        return;
+    }
+    writing_ = true;
+    ++pending_;
+    async_write(asio_sock_, buffer(writebuf_),
+                boost::bind(&PersistentTCPMessageSocket::handleWrite, this,
+                            generation_, _1, _2));
+}
+
+void
+PersistentTCPMessageSocket::startRead() {
+    size_t len;
+    uint8_t* space = stream_.getReceiveSpace(len);
+    ++pending_;
+    asio_sock_.async_read_some(buffer(space, len),
+                               boost::bind(
+                                   &PersistentTCPMessageSocket::handleRead,
+                                   this, generation_, _1, _2));
+}
+
+void
+PersistentTCPMessageSocket::handleConnect(unsigned int generation,
+                                          const error_code& ec)
+{
+    if (completionCheck(generation)) {
+        return;
+    }
+    if (ec) {
+        fail("TCP connect failed", ec);
+        return;
+    }
+    // Queries are often smaller than a segment; don't let them wait for
+    // acknowledgment of the previous ones.
+    error_code ignored;
+    asio_sock_.set_option(ip::tcp::no_delay(true), ignored);
+    state_ = CONNECTED;
+    stream_.startConnection();
+    startRead();
+    if (stream_.hasQueued()) {
+        startWrite();
+    }
+}
+
+void
+PersistentTCPMessageSocket::handleWrite(unsigned int generation,
+                                        const error_code& ec, size_t)
+{
+    if (completionCheck(generation)) {
+        return;
+    }
+    writing_ = false;
+    if (ec) {
+        fail("TCP send failed", ec);
+        return;
+    }
+    if (stream_.hasQueued()) {
+        startWrite();
+    }
+}
+
+void
+PersistentTCPMessageSocket::handleRead(unsigned int generation,
+                                       const error_code& ec, size_t length)
+{
+    if (completionCheck(generation)) {
+        return;
+    }
+    if (ec) {
+        fail("failed to read TCP message", ec);
+        return;
+    }
+    if (!stream_.commitReceived(length)) {
+        fail(stream_.getError().c_str(),
+             error_code(EPROTO, system_category()));
+        return;
+    }
+    const void* data;
+    size_t datalen;
+    while (stream_.getNextMessage(data, datalen)) {
+        callback_(MessageSocket::Event(data, datalen));
+    }
+    if (state_ != CONNECTED) {
+        return;                 // failed in the callback
+    }
+    if (stream_.isFinished()) {
+        reconnect();
+        return;
+    }
+    startRead();
+    // The TLS handshake may need to send more data.
+    if (!writing_ && stream_.hasQueued()) {
+        startWrite();
+    }
+}
+
+void
+PersistentTCPMessageSocket::fail(const char* what, const error_code& ec) {
+    // Closing the connection by the server isn't an error by itself; the
+    // owner will know if it has affected any query.
+    if (ec != error::eof) {
+        if (log_.admit()) {
+            log_.write(std::string("[Warn] ") + what + ": " + ec.message());
+        }
+    }
+    closeSocket();
+    stream_.clear();
+    callback_(MessageSocket::Event(NULL, 0));
+}
+
+void
+PersistentTCPMessageSocket::reconnect() {
+    closeSocket();
+    stream_.closeConnection();
+    if (stream_.hasPending()) {
+        startConnect();
+    }
+}
+
+void
+PersistentTCPMessageSocket::closeSocket() {
+    error_code ignored;
+    asio_sock_.close(ignored);
+    ++generation_;
+    state_ = CLOSED;
+    writing_ = false;
+}
 } // end of unnamed namespace
 
 ASIOMessageSocket::~ASIOMessageSocket() {
@@ -339,6 +607,11 @@ ASIOMessageSocket::send(const void* data, size_t datalen) {
     impl_->send(data, datalen);
 }
 
+int
+ASIOMessageSocket::getIncomingCPU() const {
+    return (getSocketIncomingCPU(impl_->native()));
+}
+
 int
 ASIOMessageSocket::native() {
     return (impl_->native());
@@ -346,6 +619,7 @@ ASIOMessageSocket::native() {
 
 struct ASIOMessageManager::ASIOMessageManagerImpl {
     io_service io_service_;
+    boost::scoped_ptr<TimerWheel> timer_wheel_; // for coarse timers
 };
 
 ASIOMessageManager::ASIOMessageManager() :
@@ -353,6 +627,8 @@ ASIOMessageManager::ASIOMessageManager() :
 {}
 
 ASIOMessageManager::~ASIOMessageManager() {
+    // Timers of the wheel depend on the manager.
+    impl_->timer_wheel_.reset();
     delete impl_;
 }
 
@@ -379,8 +655,8 @@ ASIOMessageManager::createMessageSocket(int proto, const std::string& address,
             throw MessageSocketError("Insufficient TCP receive buffer");
         }
         std::auto_ptr<TCPMessageSocket> impl_p(
-            new TCPMessageSocket(impl_->io_service_, address, port, recvbuf,
-                                 callback));
+            new TCPMessageSocket(impl_->io_service_, getDiagnosticLog(),
+                                 address, port, recvbuf, callback));
         ret = new ASIOMessageSocket(impl_p.get());
         impl_p.release();
         return (ret);
@@ -389,6 +665,22 @@ ASIOMessageManager::createMessageSocket(int proto, const std::string& address,
                              lexical_cast<std::string>(proto));
 }
 
+MessageSocket*
+ASIOMessageManager::createPersistentMessageSocket(
+    const std::string& address, uint16_t port,
+    const StreamSocketParams& params, MessageSocket::Callback callback)
+{
+    if (!callback) {
+        throw MessageSocketError("null socket callback specified");
+    }
+    std::auto_ptr<PersistentTCPMessageSocket> impl_p(
+        new PersistentTCPMessageSocket(impl_->io_service_, getDiagnosticLog(),
+                                       address, port, params, callback));
+    MessageSocket* ret = new ASIOMessageSocket(impl_p.get());
+    impl_p.release();
+    return (ret);
+}
+
 class ASIOMessageTimer : public MessageTimer {
 public:
     ASIOMessageTimer(io_service& io_service, Callback callback) :
@@ -433,6 +725,14 @@ ASIOMessageManager::createMessageTimer(MessageTimer::Callback callback) {
     return (new ASIOMessageTimer(impl_->io_service_, callback));
 }
 
+MessageTimer*
+ASIOMessageManager::createCoarseMessageTimer(MessageTimer::Callback callback) {
+    if (!impl_->timer_wheel_) {
+        impl_->timer_wheel_.reset(new TimerWheel(*this));
+    }
+    return (impl_->timer_wheel_->createTimer(callback));
+}
+
 void
 ASIOMessageManager::run() {
     impl_->io_service_.run();
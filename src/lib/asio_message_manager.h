@@ -37,6 +37,7 @@ public:
     ASIOMessageSocket(ASIOMessageSocketImpl* impl) : impl_(impl) {}
     virtual ~ASIOMessageSocket();
     virtual void send(const void* data, size_t datalen);
+    virtual int getIncomingCPU() const;
 
     /// \brief Return the native socket descriptor.
     ///
@@ -55,8 +56,18 @@ public:
         void* recvbuf, size_t recvbuf_len,
         MessageSocket::Callback callback);
 
+    virtual MessageSocket* createPersistentMessageSocket(
+        const std::string& address, uint16_t port,
+        const StreamSocketParams& params,
+        MessageSocket::Callback callback);
+
     virtual MessageTimer* createMessageTimer(MessageTimer::Callback callback);
 
+    /// \brief Create a timer managed in a \c TimerWheel of the manager
+    /// (with the default tick interval).
+    virtual MessageTimer* createCoarseMessageTimer(
+        MessageTimer::Callback callback);
+
     virtual void run();
 
     virtual void stop();
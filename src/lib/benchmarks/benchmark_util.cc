@@ -0,0 +1,228 @@
+// Copyright (C) 2012  JINMEI Tatuya
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+// OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#include <benchmark_util.h>
+
+#include <boost/lexical_cast.hpp>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+
+#include <netinet/in.h>
+#include <unistd.h>
+
+using namespace std;
+using boost::lexical_cast;
+
+namespace Queryperf {
+namespace benchmark {
+
+namespace {
+void
+usage(const char* program) {
+    cerr << "Usage: " << program
+         << " [-d query_file] [-l seconds] [-q window]\n";
+    cerr << "  -d sets the query file (default: generated queries)\n";
+    cerr << "  -l sets the duration of each benchmark in seconds "
+         << "(default: 1)\n";
+    cerr << "  -q sets the query window of the dispatcher benchmarks "
+         << "(default: several)" << endl;
+    exit(1);
+}
+}
+
+BenchmarkOptions
+parseOptions(int argc, char* argv[], const char* program) {
+    BenchmarkOptions options;
+    int ch;
+    try {
+        while ((ch = getopt(argc, argv, "d:hl:q:")) != -1) {
+            switch (ch) {
+            case 'd':
+                options.query_file = optarg;
+                break;
+            case 'l':
+                options.duration = lexical_cast<unsigned int>(optarg);
+                break;
+            case 'q':
+                options.window = lexical_cast<size_t>(optarg);
+                break;
+            case 'h':
+            case '?':
+            default:
+                usage(program);
+            }
+        }
+    } catch (const boost::bad_lexical_cast&) {
+        usage(program);
+    }
+    if (optind < argc || options.duration == 0) {
+        usage(program);
+    }
+    return (options);
+}
+
+string
+generateQueries(size_t count, bool templates) {
+    static const char* const types[] = { "A", "AAAA", "MX", "NS", "TXT" };
+    ostringstream os;
+    for (size_t i = 0; i < count; ++i) {
+        os << (templates ? "{rand:8}." : "") << "host" << i
+           << ".example.com. "
+           << types[i % (sizeof(types) / sizeof(types[0]))] << "\n";
+    }
+    return (os.str());
+}
+
+BenchmarkRepository::BenchmarkRepository(const BenchmarkOptions& options,
+                                         bool templates)
+{
+    if (options.query_file.empty() || templates) {
+        input_.str(generateQueries(GENERATED_QUERIES, templates));
+        repository_.reset(new QueryRepository(input_));
+    } else {
+        repository_.reset(new QueryRepository(options.query_file));
+    }
+}
+
+void
+addConfig(ResultSet& results, const char* program,
+          const BenchmarkOptions& options)
+{
+    ResultRecord& config = results.getRecord("config");
+    config.addString("program", program);
+    config.addString("queries", options.query_file.empty() ?
+                     "generated" : options.query_file);
+    config.addInteger("duration", options.duration);
+}
+
+void
+addResult(ResultSet& results, const string& name,
+          const BenchmarkResult& result)
+{
+    ResultRecord& record = results.addRecord("benchmarks");
+    record.addString("name", name);
+    record.addInteger("operations", result.operations);
+    record.addNumber("seconds", result.seconds);
+    record.addNumber("qps", result.getRate());
+}
+
+void
+writeResults(const ResultSet& results) {
+    results.writeJSON(cout);
+    cout.flush();
+}
+
+void
+InMemoryMessageSocket::send(const void* data, size_t datalen) {
+    manager_.queue(this, data, datalen);
+}
+
+InMemoryMessageTimer::InMemoryMessageTimer(InMemoryMessageManager& manager,
+                                           Callback callback) :
+    manager_(manager), callback_(callback), active_(false), expiration_(0)
+{
+    manager_.timers_.push_back(this);
+}
+
+InMemoryMessageTimer::~InMemoryMessageTimer() {
+    vector<InMemoryMessageTimer*>& timers = manager_.timers_;
+    timers.erase(find(timers.begin(), timers.end(), this));
+}
+
+void
+InMemoryMessageTimer::start(const boost::posix_time::time_duration& duration)
+{
+    active_ = true;
+    expiration_ = getMonotonicTime() + duration.total_microseconds();
+}
+
+MessageSocket*
+InMemoryMessageManager::createMessageSocket(int proto, const string&,
+                                            uint16_t, void* recvbuf,
+                                            size_t recvbuf_len,
+                                            MessageSocket::Callback callback)
+{
+    if (proto != IPPROTO_UDP) {
+        throw MessageSocketError("in-memory sockets only support UDP");
+    }
+    return (new InMemoryMessageSocket(*this, recvbuf, recvbuf_len,
+                                      callback));
+}
+
+MessageTimer*
+InMemoryMessageManager::createMessageTimer(MessageTimer::Callback callback) {
+    return (new InMemoryMessageTimer(*this, callback));
+}
+
+void
+InMemoryMessageManager::queue(InMemoryMessageSocket* socket,
+                              const void* data, size_t len)
+{
+    const size_t offset = queued_data_.size();
+    const uint8_t* const bytes = static_cast<const uint8_t*>(data);
+    queued_data_.insert(queued_data_.end(), bytes, bytes + len);
+    queued_.push_back(QueuedMessage(socket, offset, len));
+}
+
+bool
+InMemoryMessageManager::checkTimers() {
+    const uint64_t now = getMonotonicTime();
+    bool active = false;
+    // A callback may start other timers, but timers are not created or
+    // destroyed while the loop is running.
+    for (size_t i = 0; i < timers_.size(); ++i) {
+        InMemoryMessageTimer& timer = *timers_[i];
+        if (timer.active_ && timer.expiration_ <= now) {
+            timer.active_ = false;
+            timer.callback_();
+        }
+        active = active || timer.active_;
+    }
+    return (active);
+}
+
+void
+InMemoryMessageManager::run() {
+    running_ = true;
+    while (running_) {
+        // Without anything to deliver, the loop would only wait for timers
+        // in vain if none is active.
+        if (!checkTimers() && queued_.empty()) {
+            break;
+        }
+        delivering_.swap(queued_);
+        delivering_data_.swap(queued_data_);
+        queued_.clear();
+        queued_data_.clear();
+        for (size_t i = 0; i < delivering_.size() && running_; ++i) {
+            const QueuedMessage& message = delivering_[i];
+            InMemoryMessageSocket& socket = *message.socket;
+            const size_t len = std::min(message.len, socket.recvbuf_len_);
+            uint8_t* const response = static_cast<uint8_t*>(socket.recvbuf_);
+            memcpy(response, &delivering_data_[message.offset], len);
+            if (len > 2) {
+                response[2] |= 0x80; // QR
+            }
+            socket.callback_(MessageSocket::Event(response, len));
+        }
+    }
+    running_ = false;
+}
+
+} // end of benchmark
+} // end of QueryPerf
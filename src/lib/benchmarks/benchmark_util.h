@@ -0,0 +1,205 @@
+// Copyright (C) 2012  JINMEI Tatuya
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+// OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#ifndef __QUERYPERF_BENCHMARK_UTIL_H
+#define __QUERYPERF_BENCHMARK_UTIL_H 1
+
+#include <message_manager.h>
+#include <monotonic_time.h>
+#include <query_repository.h>
+#include <result_writer.h>
+
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_ptr.hpp>
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+namespace Queryperf {
+namespace benchmark {
+
+// Common parameters of the benchmark programs, given on the command line.
+struct BenchmarkOptions {
+    BenchmarkOptions() : duration(1), window(0) {}
+
+    unsigned int duration;      // of each benchmark, in seconds
+    std::string query_file;     // empty if the generated queries are used
+    size_t window;              // 0 unless explicitly specified
+};
+
+// Parse the common options ("-d query_file -l seconds -q window"); the
+// program exits with the usage on errors.
+BenchmarkOptions parseOptions(int argc, char* argv[], const char* program);
+
+// The number of distinct queries generated unless a query file is given.
+const size_t GENERATED_QUERIES = 10000;
+
+// Return the text of a query file of the given number of distinct queries.
+// If templates is true, each query name has a random label.
+std::string generateQueries(size_t count, bool templates);
+
+// A query repository of the query file given in the options, or of the
+// generated queries.  Queries with qname templates are always generated.
+class BenchmarkRepository : private boost::noncopyable {
+public:
+    BenchmarkRepository(const BenchmarkOptions& options, bool templates);
+
+    QueryRepository& get() { return (*repository_); }
+
+private:
+    std::istringstream input_;  // must be valid while the repository is
+    boost::scoped_ptr<QueryRepository> repository_;
+};
+
+// Measure how many times per second an operation can be performed, by
+// calling op() repeatedly for about the given duration.  The clock is read
+// once every batch of calls so it doesn't dominate cheap operations.
+struct BenchmarkResult {
+    BenchmarkResult() : operations(0), seconds(0) {}
+
+    uint64_t operations;
+    double seconds;
+    double getRate() const {
+        return (seconds > 0 ? operations / seconds : 0);
+    }
+};
+
+template <typename Operation>
+BenchmarkResult
+measureRate(Operation& op, unsigned int duration) {
+    const size_t BATCH = 256;
+    const uint64_t start = getMonotonicTime();
+    const uint64_t end = start + static_cast<uint64_t>(duration) * 1000000;
+    BenchmarkResult result;
+    uint64_t now;
+    do {
+        for (size_t i = 0; i < BATCH; ++i) {
+            op();
+        }
+        result.operations += BATCH;
+        now = getMonotonicTime();
+    } while (now < end);
+    result.seconds = static_cast<double>(now - start) / 1000000;
+    return (result);
+}
+
+// Add the configuration common to the programs to the results.
+void addConfig(ResultSet& results, const char* program,
+               const BenchmarkOptions& options);
+
+// Add a record of a benchmark to the "benchmarks" section of the results.
+void addResult(ResultSet& results, const std::string& name,
+               const BenchmarkResult& result);
+
+// Write the results in JSON to the standard output.
+void writeResults(const ResultSet& results);
+
+class InMemoryMessageManager;
+
+// A UDP socket of InMemoryMessageManager.  Each query sent is returned as
+// its response (with the QR bit set) from the event loop of the manager.
+class InMemoryMessageSocket : public MessageSocket {
+public:
+    InMemoryMessageSocket(InMemoryMessageManager& manager, void* recvbuf,
+                          size_t recvbuf_len, Callback callback) :
+        manager_(manager), recvbuf_(recvbuf), recvbuf_len_(recvbuf_len),
+        callback_(callback)
+    {}
+    virtual void send(const void* data, size_t datalen);
+
+private:
+    friend class InMemoryMessageManager;
+    InMemoryMessageManager& manager_;
+    void* const recvbuf_;
+    const size_t recvbuf_len_;
+    const Callback callback_;
+};
+
+class InMemoryMessageTimer : public MessageTimer {
+public:
+    InMemoryMessageTimer(InMemoryMessageManager& manager,
+                         Callback callback);
+    virtual ~InMemoryMessageTimer();
+    virtual void start(const boost::posix_time::time_duration& duration);
+    virtual void cancel() { active_ = false; }
+
+private:
+    friend class InMemoryMessageManager;
+    InMemoryMessageManager& manager_;
+    const Callback callback_;
+    bool active_;
+    uint64_t expiration_;       // in monotonic time
+};
+
+// A message manager without any network I/O or latency: responses are
+// delivered as soon as the event loop gets the control back, so the
+// measured throughput is the cost of the owner (i.e., the dispatcher)
+// alone.  Responses are delivered in batches, each of which consists of
+// the queries sent while the previous batch was delivered; timers are
+// checked between the batches.  Only UDP is supported.
+class InMemoryMessageManager : public MessageManager {
+public:
+    InMemoryMessageManager() : running_(false) {}
+
+    virtual MessageSocket* createMessageSocket(
+        int proto, const std::string& address, uint16_t port,
+        void* recvbuf, size_t recvbuf_len,
+        MessageSocket::Callback callback);
+
+    virtual MessageTimer* createMessageTimer(MessageTimer::Callback callback);
+
+    virtual void run();
+
+    virtual void stop() { running_ = false; }
+
+private:
+    friend class InMemoryMessageSocket;
+    friend class InMemoryMessageTimer;
+
+    struct QueuedMessage {
+        QueuedMessage(InMemoryMessageSocket* socket_param,
+                      size_t offset_param, size_t len_param) :
+            socket(socket_param), offset(offset_param), len(len_param)
+        {}
+        InMemoryMessageSocket* socket;
+        size_t offset;          // in the data buffer of the batch
+        size_t len;
+    };
+
+    void queue(InMemoryMessageSocket* socket, const void* data, size_t len);
+
+    // Call the callbacks of expired timers, and return whether any timer
+    // is still active.
+    bool checkTimers();
+
+    bool running_;
+    std::vector<QueuedMessage> queued_; // sent in the current batch
+    std::vector<uint8_t> queued_data_;
+    std::vector<QueuedMessage> delivering_; // sent in the previous batch
+    std::vector<uint8_t> delivering_data_;
+    std::vector<InMemoryMessageTimer*> timers_;
+};
+
+} // end of benchmark
+} // end of QueryPerf
+
+#endif // __QUERYPERF_BENCHMARK_UTIL_H
+
+// Local Variables:
+// mode: c++
+// End:
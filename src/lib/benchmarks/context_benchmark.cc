@@ -0,0 +1,80 @@
+// Copyright (C) 2012  JINMEI Tatuya
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+// OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+// Throughput of QueryContext::start(), i.e., the cost of making a query
+// ready to be sent: a copy of preloaded or streamed wire data, rendering
+// of a message parsed on demand, or expansion of qname templates.
+
+#include <benchmark_util.h>
+#include <query_context.h>
+#include <query_repository.h>
+
+#include <dns/message.h>
+
+#include <iostream>
+#include <stdexcept>
+
+using namespace std;
+using namespace Queryperf;
+using namespace Queryperf::benchmark;
+
+namespace {
+struct StartQuery {
+    StartQuery(QueryRepository& repository) :
+        context_(repository), qid_(0)
+    {}
+    void operator()() {
+        context_.start(++qid_);
+    }
+    QueryContext context_;
+    bundy::dns::qid_t qid_;
+};
+
+enum Mode { PRELOADED, STREAMED, RENDERED, TEMPLATES };
+const char* const mode_names[] = {
+    "preloaded", "streamed", "rendered", "templates"
+};
+
+void
+measureStart(const BenchmarkOptions& options, ResultSet& results, Mode mode) {
+    BenchmarkRepository repository(options, mode == TEMPLATES);
+    if (mode == PRELOADED || mode == TEMPLATES) {
+        repository.get().load();
+    } else if (mode == STREAMED) {
+        repository.get().stream();
+    }
+    StartQuery op(repository.get());
+    addResult(results, string("start/") + mode_names[mode],
+              measureRate(op, options.duration));
+}
+}
+
+int
+main(int argc, char* argv[]) {
+    const BenchmarkOptions options =
+        parseOptions(argc, argv, "context_benchmark");
+    try {
+        ResultSet results;
+        addConfig(results, "context_benchmark", options);
+        measureStart(options, results, PRELOADED);
+        measureStart(options, results, STREAMED);
+        measureStart(options, results, RENDERED);
+        measureStart(options, results, TEMPLATES);
+        writeResults(results);
+    } catch (const std::exception& ex) {
+        cerr << "Benchmark failed: " << ex.what() << endl;
+        return (1);
+    }
+    return (0);
+}
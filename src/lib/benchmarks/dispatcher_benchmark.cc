@@ -0,0 +1,88 @@
+// Copyright (C) 2012  JINMEI Tatuya
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+// OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+// Throughput of the Dispatcher with responses returned immediately by an
+// in-memory message manager, i.e., the cost of the loop of handling a
+// response and starting the next query, for several query windows.
+
+#include <benchmark_util.h>
+#include <dispatcher.h>
+#include <query_context.h>
+#include <query_repository.h>
+
+#include <boost/lexical_cast.hpp>
+
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+
+using namespace std;
+using namespace Queryperf;
+using namespace Queryperf::benchmark;
+using boost::lexical_cast;
+
+namespace {
+void
+measureRestart(const BenchmarkOptions& options, ResultSet& results,
+               size_t window)
+{
+    BenchmarkRepository repository(options, false);
+    repository.get().load();
+    QueryContextCreator creator(repository.get());
+    InMemoryMessageManager manager;
+    Dispatcher dispatcher(manager, creator);
+    dispatcher.setTestDuration(options.duration);
+    dispatcher.setWindow(window);
+    dispatcher.run();
+
+    if (dispatcher.getQueriesCompleted() != dispatcher.getQueriesSent()) {
+        throw runtime_error("some queries were not responded");
+    }
+    BenchmarkResult result;
+    result.operations = dispatcher.getQueriesCompleted();
+    result.seconds = static_cast<double>(
+        (dispatcher.getEndTime() -
+         dispatcher.getStartTime()).total_microseconds()) / 1000000;
+    addResult(results, "restart/window=" + lexical_cast<string>(window),
+              result);
+}
+}
+
+int
+main(int argc, char* argv[]) {
+    const BenchmarkOptions options =
+        parseOptions(argc, argv, "dispatcher_benchmark");
+    const size_t default_windows[] = {
+        1, Dispatcher::DEFAULT_WINDOW, 200, 2000
+    };
+    vector<size_t> windows;
+    if (options.window > 0) {
+        windows.push_back(options.window);
+    } else {
+        windows.assign(default_windows, default_windows +
+                       sizeof(default_windows) / sizeof(default_windows[0]));
+    }
+    try {
+        ResultSet results;
+        addConfig(results, "dispatcher_benchmark", options);
+        for (size_t i = 0; i < windows.size(); ++i) {
+            measureRestart(options, results, windows[i]);
+        }
+        writeResults(results);
+    } catch (const std::exception& ex) {
+        cerr << "Benchmark failed: " << ex.what() << endl;
+        return (1);
+    }
+    return (0);
+}
@@ -0,0 +1,112 @@
+// Copyright (C) 2012  JINMEI Tatuya
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+// OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+// Throughput of QueryRepository in getting the next query, in each way
+// the queries can be held: preloaded, streamed by the parse-ahead thread,
+// or parsed on demand (getNextQuery() only).
+
+#include <benchmark_util.h>
+#include <query_repository.h>
+
+#include <dns/message.h>
+
+#include <iostream>
+#include <stdexcept>
+
+using namespace std;
+using namespace Queryperf;
+using namespace Queryperf::benchmark;
+using namespace bundy::dns;
+
+namespace {
+struct GetNextQuery {
+    GetNextQuery(QueryRepository& repository) :
+        repository_(repository), message_(Message::RENDER), protocol_(0)
+    {}
+    void operator()() {
+        repository_.getNextQuery(message_, protocol_);
+    }
+    QueryRepository& repository_;
+    Message message_;
+    int protocol_;
+};
+
+struct GetNextQueryData {
+    GetNextQueryData(QueryRepository& repository) :
+        repository_(repository), protocol_(0), len_(0)
+    {}
+    void operator()() {
+        if (repository_.getNextQueryData(len_, protocol_) == NULL) {
+            throw runtime_error("no query data");
+        }
+    }
+    QueryRepository& repository_;
+    int protocol_;
+    size_t len_;
+};
+
+enum Mode { PRELOADED, STREAMED, ON_DEMAND };
+const char* const mode_names[] = { "preloaded", "streamed", "on-demand" };
+
+void
+prepare(QueryRepository& repository, Mode mode) {
+    if (mode == PRELOADED) {
+        repository.load();
+    } else if (mode == STREAMED) {
+        repository.stream();
+    }
+}
+
+void
+measureNextQuery(const BenchmarkOptions& options, ResultSet& results,
+                 Mode mode)
+{
+    BenchmarkRepository repository(options, false);
+    prepare(repository.get(), mode);
+    GetNextQuery op(repository.get());
+    addResult(results, string("getNextQuery/") + mode_names[mode],
+              measureRate(op, options.duration));
+}
+
+void
+measureNextQueryData(const BenchmarkOptions& options, ResultSet& results,
+                     Mode mode)
+{
+    BenchmarkRepository repository(options, false);
+    prepare(repository.get(), mode);
+    GetNextQueryData op(repository.get());
+    addResult(results, string("getNextQueryData/") + mode_names[mode],
+              measureRate(op, options.duration));
+}
+}
+
+int
+main(int argc, char* argv[]) {
+    const BenchmarkOptions options =
+        parseOptions(argc, argv, "repository_benchmark");
+    try {
+        ResultSet results;
+        addConfig(results, "repository_benchmark", options);
+        measureNextQuery(options, results, PRELOADED);
+        measureNextQuery(options, results, STREAMED);
+        measureNextQuery(options, results, ON_DEMAND);
+        measureNextQueryData(options, results, PRELOADED);
+        measureNextQueryData(options, results, STREAMED);
+        writeResults(results);
+    } catch (const std::exception& ex) {
+        cerr << "Benchmark failed: " << ex.what() << endl;
+        return (1);
+    }
+    return (0);
+}
@@ -0,0 +1,155 @@
+// Copyright (C) 2012  JINMEI Tatuya
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+// OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#include <config.h>
+
+#include <cpu_affinity.h>
+
+#include <boost/foreach.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+
+using namespace std;
+using boost::lexical_cast;
+
+namespace Queryperf {
+
+namespace {
+// Convert a CPU number in the list, rejecting anything but digits (which
+// lexical_cast would accept, e.g., a sign).
+unsigned int
+parseCPU(const string& text, const string& list) {
+    if (text.empty() || text.size() > 9 ||
+        text.find_first_not_of("0123456789") != string::npos) {
+        throw CPUAffinityError("invalid CPU list: " + list);
+    }
+    const unsigned int cpu = lexical_cast<unsigned int>(text);
+    if (cpu >= MAX_CPUS) {
+        throw CPUAffinityError("CPU number out of range: " + text);
+    }
+    return (cpu);
+}
+}
+
+vector<unsigned int>
+parseCPUList(const string& text) {
+    vector<unsigned int> cpus;
+    string::size_type pos = 0;
+    while (true) {
+        const string::size_type end = text.find(',', pos);
+        const string item = text.substr(pos, end == string::npos ?
+                                        string::npos : end - pos);
+        const string::size_type dash = item.find('-');
+        if (dash == string::npos) {
+            cpus.push_back(parseCPU(item, text));
+        } else {
+            const unsigned int first = parseCPU(item.substr(0, dash), text);
+            const unsigned int last = parseCPU(item.substr(dash + 1), text);
+            if (first > last) {
+                throw CPUAffinityError("invalid CPU range: " + item);
+            }
+            for (unsigned int cpu = first; cpu <= last; ++cpu) {
+                cpus.push_back(cpu);
+            }
+        }
+        if (end == string::npos) {
+            break;
+        }
+        pos = end + 1;
+    }
+    return (cpus);
+}
+
+void
+setThreadAffinity(const vector<unsigned int>& cpus) {
+    if (cpus.empty()) {
+        throw CPUAffinityError("no CPU to bind the thread to");
+    }
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+    cpu_set_t* cpuset = CPU_ALLOC(MAX_CPUS);
+    if (cpuset == NULL) {
+        throw CPUAffinityError("failed to allocate a CPU set");
+    }
+    const size_t setsize = CPU_ALLOC_SIZE(MAX_CPUS);
+    CPU_ZERO_S(setsize, cpuset);
+    BOOST_FOREACH(unsigned int cpu, cpus) {
+        if (cpu >= MAX_CPUS) {
+            CPU_FREE(cpuset);
+            throw CPUAffinityError("CPU number out of range: " +
+                                   lexical_cast<string>(cpu));
+        }
+        CPU_SET_S(cpu, setsize, cpuset);
+    }
+    const int error = pthread_setaffinity_np(pthread_self(), setsize, cpuset);
+    CPU_FREE(cpuset);
+    if (error != 0) {
+        throw CPUAffinityError(string("failed to set CPU affinity: ") +
+                               strerror(error));
+    }
+#else
+    throw CPUAffinityError("CPU affinity is not supported on this system");
+#endif
+}
+
+int
+getCPUNode(unsigned int cpu) {
+    // Linux shows the node of a CPU as a "nodeN" link in its sysfs
+    // directory.
+    const string path = "/sys/devices/system/cpu/cpu" +
+        lexical_cast<string>(cpu);
+    DIR* dir = opendir(path.c_str());
+    if (dir == NULL) {
+        return (-1);
+    }
+    int node = -1;
+    const struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        const char* name = entry->d_name;
+        if (strncmp(name, "node", 4) == 0 && name[4] >= '0' &&
+            name[4] <= '9') {
+            node = atoi(name + 4);
+            break;
+        }
+    }
+    closedir(dir);
+    return (node);
+}
+
+int
+getSocketIncomingCPU(int fd) {
+#ifdef SO_INCOMING_CPU
+    if (fd >= 0) {
+        int cpu = -1;
+        socklen_t len = sizeof(cpu);
+        if (getsockopt(fd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, &len) == 0) {
+            return (cpu);
+        }
+    }
+#else
+    (void)fd;
+#endif
+    return (-1);
+}
+
+} // end of QueryPerf
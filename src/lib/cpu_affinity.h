@@ -0,0 +1,79 @@
+// Copyright (C) 2012  JINMEI Tatuya
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+// OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#ifndef __QUERYPERF_CPU_AFFINITY_H
+#define __QUERYPERF_CPU_AFFINITY_H 1
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace Queryperf {
+
+/// \brief Exception class thrown on failure of CPU affinity operations.
+class CPUAffinityError : public std::runtime_error {
+public:
+    explicit CPUAffinityError(const std::string& what_arg) :
+        std::runtime_error(what_arg)
+    {}
+};
+
+/// \brief Maximum number of CPUs (CPU numbers must be smaller than this).
+const unsigned int MAX_CPUS = 1024;
+
+/// \brief Parse a textual list of CPUs.
+///
+/// The list is a comma-separated list of CPU numbers or ranges of them,
+/// e.g., "0-3,8" (the same form as the Linux cpuset lists).  The order is
+/// preserved, so the result can be used to assign CPUs to threads in
+/// order.
+///
+/// \throw CPUAffinityError The text is empty or malformed, or a CPU number
+/// isn't smaller than \c MAX_CPUS.
+std::vector<unsigned int> parseCPUList(const std::string& text);
+
+/// \brief Bind the calling thread to the given CPUs.
+///
+/// On Linux, memory is allocated on the NUMA node of the CPU that first
+/// touches it by default, so a thread should be bound before it allocates
+/// its buffers to make them local to the node.
+///
+/// \throw CPUAffinityError \c cpus is empty, none of them is available,
+/// or the system doesn't support CPU affinity.
+void setThreadAffinity(const std::vector<unsigned int>& cpus);
+
+/// \brief Return the NUMA node of the given CPU.
+///
+/// It returns -1 if it's unknown (e.g., the CPU doesn't exist, or the
+/// system isn't Linux).
+int getCPUNode(unsigned int cpu);
+
+/// \brief Return the CPU that processed the last packet received on a
+/// socket.
+///
+/// With multi-queue NICs, this is usually the CPU handling the interrupt
+/// of the receive queue that the socket's flow is steered to.  It returns
+/// -1 if it's unknown (e.g., nothing has been received, or the system
+/// doesn't support it).
+///
+/// \param fd The socket descriptor (-1 is allowed, and -1 is returned).
+int getSocketIncomingCPU(int fd);
+
+} // end of QueryPerf
+
+#endif // __QUERYPERF_CPU_AFFINITY_H
+
+// Local Variables:
+// mode: c++
+// End:
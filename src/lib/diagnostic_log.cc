@@ -0,0 +1,57 @@
+// Copyright (C) 2012  JINMEI Tatuya
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+// OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#include <diagnostic_log.h>
+#include <monotonic_time.h>
+
+using namespace std;
+
+namespace Queryperf {
+
+namespace {
+const uint64_t WINDOW_USEC = 1000000;
+}
+
+DiagnosticLog::DiagnosticLog(ostream& os) :
+    os_(os), rate_(0), window_start_(0), window_count_(0), suppressed_(0),
+    suppressed_reported_(0)
+{}
+
+bool
+DiagnosticLog::admitSlow() {
+    const uint64_t now = getMonotonicTime();
+    if (now - window_start_ >= WINDOW_USEC) {
+        window_start_ = now;
+        window_count_ = 0;
+    }
+    if (window_count_ < rate_) {
+        ++window_count_;
+        return (true);
+    }
+    ++suppressed_;
+    return (false);
+}
+
+void
+DiagnosticLog::write(const string& message) {
+    os_ << message;
+    if (suppressed_ > suppressed_reported_) {
+        os_ << " (" << suppressed_ - suppressed_reported_
+            << " messages suppressed)";
+        suppressed_reported_ = suppressed_;
+    }
+    os_ << endl;
+}
+
+} // end of QueryPerf
@@ -0,0 +1,87 @@
+// Copyright (C) 2012  JINMEI Tatuya
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+// OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#ifndef __QUERYPERF_DIAGNOSTIC_LOG_H
+#define __QUERYPERF_DIAGNOSTIC_LOG_H 1
+
+#include <boost/noncopyable.hpp>
+
+#include <cstddef>
+#include <iostream>
+#include <string>
+
+#include <stdint.h>
+
+namespace Queryperf {
+
+/// \brief A rate-limited log of diagnostic messages on individual events,
+/// such as query timeouts and TCP failures.
+///
+/// Such events can happen tens of thousands of times per second when the
+/// server is overloaded, and writing each of them to a shared stream
+/// would serialize the threads and make the overload worse.  So the
+/// events are expected to be counted separately, and this log only shows
+/// a sample of them: at most the given number of messages per second,
+/// the rest being suppressed (their number is shown with the next message
+/// written).  It's disabled by default, in which case \c admit() is just a
+/// comparison.
+///
+/// Each thread is expected to have its own log; it's not thread safe.
+class DiagnosticLog : private boost::noncopyable {
+public:
+    /// \brief Constructor.
+    ///
+    /// \param os The stream to write messages to.  It must be valid while
+    /// the log is used.
+    explicit DiagnosticLog(std::ostream& os = std::cerr);
+
+    /// \brief Set the maximum number of messages written per second; 0
+    /// disables the log.
+    void setRate(size_t messages_per_second) { rate_ = messages_per_second; }
+    size_t getRate() const { return (rate_); }
+
+    /// \brief Check whether a message for an event should be written.
+    ///
+    /// It should be called for every event, and the message should be
+    /// built and written by \c write() only if it returns true, so that
+    /// suppressed events cost nothing but this call.
+    bool admit() {
+        return (rate_ != 0 && admitSlow());
+    }
+
+    /// \brief Write a message (admitted by \c admit()).
+    void write(const std::string& message);
+
+    /// \brief Return the number of messages suppressed so far (not
+    /// counting those while the log is disabled).
+    uint64_t getSuppressedCount() const { return (suppressed_); }
+
+private:
+    bool admitSlow();
+
+    std::ostream& os_;
+    size_t rate_;
+    uint64_t window_start_;     // when the current 1-second window started
+    size_t window_count_;       // # of messages admitted in the window
+    uint64_t suppressed_;
+    uint64_t suppressed_reported_; // suppressed_ at the last write()
+};
+
+} // end of QueryPerf
+
+#endif // __QUERYPERF_DIAGNOSTIC_LOG_H
+
+// Local Variables:
+// mode: c++
+// End:
@@ -12,13 +12,28 @@
 // OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
 // PERFORMANCE OF THIS SOFTWARE.
 
+#include <config.h>
+
 #include <query_context.h>
 #include <query_repository.h>
 #include <dispatcher.h>
 #include <message_manager.h>
 #include <asio_message_manager.h>
-
-#include <util/buffer.h>
+#ifdef HAVE_EPOLL
+#include <epoll_message_manager.h>
+#endif
+#ifdef HAVE_IO_URING
+#include <uring_message_manager.h>
+#endif
+#include <latency_histogram.h>
+#include <stats_counters.h>
+#include <monotonic_time.h>
+#include <tls_context.h>
+#include <load_profile.h>
+#include <cpu_affinity.h>
+#include <response_validator.h>
+#include <server_pool.h>
+#include <qid_allocator.h>
 
 #include <exceptions/exceptions.h>
 #include <dns/message.h>
@@ -30,32 +45,124 @@
 #include <boost/scoped_ptr.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/foreach.hpp>
+#include <boost/lexical_cast.hpp>
 
 #include <algorithm>
 #include <istream>
 #include <cassert>
-#include <list>
+#include <limits>
+#include <memory>
+#include <vector>
 
 #include <netinet/in.h>
 
+#include <sys/stat.h>
+#include <unistd.h>
+
 using namespace std;
-using namespace bundy::util;
 using namespace bundy::dns;
 using namespace Queryperf;
 using boost::scoped_ptr;
+using boost::lexical_cast;
 using namespace boost::posix_time;
 using boost::posix_time::seconds;
 
 namespace {
+const qid_t MAX_QID = numeric_limits<qid_t>::max();
+const size_t QID_SPACE = static_cast<size_t>(MAX_QID) + 1;
+
+// The number of QIDs of all sockets, unless the window needs more.  The
+// tables for matching responses take about 27 bytes per QID.
+const size_t QID_BUDGET = 4 * QID_SPACE;
+
+// Return the number of QIDs used on each of socket_count sockets, of which
+// group_count ones (those of a server) must be able to have the whole
+// window outstanding: twice the share of the window, or more if the
+// budget allows, up to all QIDs.
+size_t
+getQIDSpace(size_t window, size_t group_count, size_t socket_count) {
+    const size_t share = (window + group_count - 1) / group_count;
+    return (std::min(QID_SPACE,
+                     std::max(share * 2, QID_BUDGET / socket_count)));
+}
+
+// Size of the receive buffer of each UDP socket.
+const size_t UDP_RECVBUF_LEN = 4096;
+
+// Interval of the pacing timer in the open-loop mode.  Queries that became
+// due since the previous tick are sent at once in each tick.
+const long PACING_INTERVAL_USEC = 1000;
+
+// Create a builtin message manager of the given type.
+MessageManager*
+createMessageManager(const string& type) {
+    if (type == "asio") {
+        return (new ASIOMessageManager);
+    }
+#ifdef HAVE_EPOLL
+    if (type == "epoll") {
+        return (new EpollMessageManager);
+    }
+#endif
+#ifdef HAVE_IO_URING
+    if (type == "uring") {
+        return (new UringMessageManager);
+    }
+#endif
+    throw DispatcherError("unknown or unsupported message manager type: " +
+                          type);
+}
+
+// The last query retired from each slot (socket and QID) of the
+// outstanding table is remembered in 64 bits: how it ended in the top 2
+// bits, and the monotonic time when it was sent in the rest.  Responses
+// carry nothing but the QID to identify the query, so this is how a
+// response for a free slot is told from garbage: a late one for the
+// previous generation of the slot, a duplicate, or an unknown ID.
+enum SlotState {
+    SLOT_UNUSED = 0,            // no query has been retired from the slot
+    SLOT_COMPLETED,             // responded
+    SLOT_TIMEDOUT,              // timed out, the response may come later
+    SLOT_LATE                   // timed out, and the response has come
+};
+const int SLOT_STATE_SHIFT = 62;
+const uint64_t SLOT_TIME_MASK = (static_cast<uint64_t>(1) << SLOT_STATE_SHIFT) -
+    1;
+
+inline uint64_t
+makeRetiredSlot(SlotState state, uint64_t start_time) {
+    return ((static_cast<uint64_t>(state) << SLOT_STATE_SHIFT) |
+            (start_time & SLOT_TIME_MASK));
+}
+
+inline SlotState
+getSlotState(uint64_t slot) {
+    return (static_cast<SlotState>(slot >> SLOT_STATE_SHIFT));
+}
+
+// A response delivered to the dispatcher, with its header parsed in place.
+struct Response {
+    Response(const void* data_param, size_t len_param) :
+        data(data_param), len(len_param)
+    {}
+    const void* const data;
+    const size_t len;
+    MessageHeader header;
+};
+
 class QueryEvent {
-    typedef boost::function<void(qid_t, const Message*)> RestartCallback;
+    typedef boost::function<void(size_t, qid_t, const Response*)>
+    RestartCallback;
 public:
     QueryEvent(MessageManager& mgr, qid_t qid, QueryContext* ctx,
                RestartCallback restart_callback) :
-        ctx_(ctx), qid_(qid), restart_callback_(restart_callback),
-        timer_(mgr.createMessageTimer(
+        ctx_(ctx), qid_(qid), socket_index_(0),
+        restart_callback_(restart_callback),
+        timer_(mgr.createCoarseMessageTimer(
                    boost::bind(&QueryEvent::queryTimerCallback, this))),
-        tcp_sock_(NULL), tcp_rcvbuf_(NULL)
+        log_(mgr.getDiagnosticLog()),
+        tcp_sock_(NULL), tcp_rcvbuf_(NULL), start_time_(0), step_index_(0),
+        query_data_(NULL), query_len_(0), query_proto_(IPPROTO_UDP)
     {}
 
     ~QueryEvent() {
@@ -64,13 +171,30 @@ public:
         delete[] tcp_rcvbuf_;
     }
 
-    QueryContext::QuerySpec start(qid_t qid, const time_duration& timeout) {
+    QueryContext::QuerySpec start(qid_t qid, size_t socket_index,
+                                  const time_duration& timeout)
+    {
         assert(ctx_ != NULL);
         qid_ = qid;
+        socket_index_ = socket_index;
         timer_->start(timeout);
-        return (ctx_->start(qid_));
+        const QueryContext::QuerySpec spec = ctx_->start(qid_);
+        start_time_ = getMonotonicTime();
+        query_data_ = spec.data;
+        query_len_ = spec.len;
+        query_proto_ = spec.proto;
+        return (spec);
     }
 
+    // The current query in wire format (with the QID it was started with),
+    // which is valid until the next start(), and its transport protocol.
+    // The protocol is changed if the query is retried over TCP.
+    QueryContext::QuerySpec getQuery() const {
+        return (QueryContext::QuerySpec(query_proto_, query_data_,
+                                        query_len_));
+    }
+    void setProtocol(int proto) { query_proto_ = proto; }
+
     void* getTCPBuf() {
         if (tcp_rcvbuf_ == NULL) {
             tcp_rcvbuf_ = new uint8_t[TCP_RCVBUF_LEN];
@@ -83,7 +207,30 @@ public:
 
     qid_t getQid() const { return (qid_); }
 
-    bool matchResponse(qid_t qid) const { return (qid_ == qid); }
+    // Index of the socket that the current query is associated with: one
+    // of the UDP sockets, or (if it's larger than the number of them) one
+    // of the persistent TCP connections.
+    size_t getSocketIndex() const { return (socket_index_); }
+
+    // Move the current query to another socket with a new QID.  The caller
+    // is responsible for updating the QID of the query data.
+    void relocate(qid_t qid, size_t socket_index) {
+        qid_ = qid;
+        socket_index_ = socket_index;
+    }
+
+    // Monotonic time (in microseconds) when the current query was started.
+    uint64_t getStartTime() const { return (start_time_); }
+
+    // Index of the load profile step in which the current query was sent.
+    size_t getStepIndex() const { return (step_index_); }
+    void setStepIndex(size_t index) { step_index_ = index; }
+
+    // Stop waiting for the response; called when the query is completed
+    // and won't be restarted.
+    void cancel() {
+        timer_->cancel();
+    }
 
     void setTCPSocket(MessageSocket* tcp_sock) {
         assert(tcp_sock_ == NULL);
@@ -98,31 +245,39 @@ public:
 
 private:
     void queryTimerCallback() {
-        cout << "[Timeout] Query timed out: msg id: " << qid_ << endl;
+        // Timeouts are counted by the dispatcher; this is only a sample.
+        if (log_.admit()) {
+            log_.write("[Timeout] Query timed out: msg id: " +
+                       lexical_cast<string>(qid_));
+        }
         if (tcp_sock_ != NULL) {
             clearTCPSocket();
         }
-        restart_callback_(qid_, NULL);
+        restart_callback_(socket_index_, qid_, NULL);
     }
 
     QueryContext* ctx_;
     qid_t qid_;
+    size_t socket_index_;
     RestartCallback restart_callback_;
     boost::shared_ptr<MessageTimer> timer_;
+    DiagnosticLog& log_;
     MessageSocket* tcp_sock_;
     static const size_t TCP_RCVBUF_LEN = 65535;
     uint8_t* tcp_rcvbuf_;      // lazily allocated
+    uint64_t start_time_;
+    size_t step_index_;
+    const void* query_data_;
+    size_t query_len_;
+    int query_proto_;
 };
-
-typedef boost::shared_ptr<QueryEvent> QueryEventPtr;
 } // unnamed namespace
 
 namespace Queryperf {
 struct Dispatcher::DispatcherImpl {
     DispatcherImpl(MessageManager& msg_mgr,
                    QueryContextCreator& ctx_creator) :
-        msg_mgr_(&msg_mgr), qryctx_creator_(&ctx_creator),
-        response_(Message::PARSE)
+        msg_mgr_(&msg_mgr), qryctx_creator_(&ctx_creator)
     {
         initParams();
     }
@@ -132,8 +287,7 @@ struct Dispatcher::DispatcherImpl {
         msg_mgr_local_(new ASIOMessageManager),
         qryctx_creator_local_(new QueryContextCreator(*qry_repo_local_)),
         msg_mgr_(msg_mgr_local_.get()),
-        qryctx_creator_(qryctx_creator_local_.get()),
-        response_(Message::PARSE)
+        qryctx_creator_(qryctx_creator_local_.get())
     {
         initParams();
     }
@@ -143,18 +297,38 @@ struct Dispatcher::DispatcherImpl {
         msg_mgr_local_(new ASIOMessageManager),
         qryctx_creator_local_(new QueryContextCreator(*qry_repo_local_)),
         msg_mgr_(msg_mgr_local_.get()),
-        qryctx_creator_(qryctx_creator_local_.get()),
-        response_(Message::PARSE)
+        qryctx_creator_(qryctx_creator_local_.get())
     {
         initParams();
     }
 
+    ~DispatcherImpl() {
+        // Query events hold timers (and possibly sockets) of the message
+        // manager, so they must be released before the manager.
+        BOOST_FOREACH(QueryEvent* qev, qevents_) {
+            delete qev;
+        }
+    }
+
     void initParams() {
         keep_sending_ = true;
         window_ = DEFAULT_WINDOW;
-        qid_ = 0;
-        queries_sent_ = 0;
-        queries_completed_ = 0;
+        udp_socket_count_ = DEFAULT_UDP_SOCKETS;
+        udp_socket_total_ = 0;
+        tcp_connection_count_ = DEFAULT_TCP_CONNECTIONS;
+        tls_ = false;
+        tls_resumption_ = true;
+        queries_per_connection_ = 0;
+        validate_responses_ = false;
+        tcp_retry_ = false;
+        log_rate_ = 0;
+        tcp_failures_ = 0;
+        outstanding_count_ = 0;
+        query_rate_ = 0;
+        draining_ = false;
+        qid_space_ = 0;
+        pacing_start_ = 0;
+        queries_paced_ = 0;
         server_address_ = DEFAULT_SERVER;
         server_port_ = DEFAULT_PORT;
         test_duration_ = DEFAULT_DURATION;
@@ -164,104 +338,414 @@ struct Dispatcher::DispatcherImpl {
     void run();
 
     // Callback from the message manager called when a response to a query is
-    // delivered.
-    void responseCallback(const MessageSocket::Event& sockev);
+    // delivered on the socket_index-th UDP socket.
+    void responseCallback(const MessageSocket::Event& sockev,
+                          size_t socket_index);
 
     void responseTCPCallback(const MessageSocket::Event& sockev,
                              QueryEvent* qev);
 
-    // Generate next query either due to completion or timeout.
-    void restartQuery(qid_t qid, const Message* response);
+    // Callback from the message manager for a response or a failure of the
+    // connection_index-th persistent TCP connection.
+    void responseStreamCallback(const MessageSocket::Event& sockev,
+                                size_t connection_index);
+
+    // Generate next query either due to completion or timeout (if
+    // response is NULL).
+    void restartQuery(size_t socket_index, qid_t qid,
+                      const Response* response);
+
+    // Send the query of a truncated UDP response over TCP.
+    void retryOverTCP(QueryEvent& qev);
+
+    // Return the entry of the outstanding table for the given socket and
+    // QID.
+    QueryEvent*& getOutstanding(size_t socket_index, qid_t qid) {
+        return (outstanding_[socket_index * qid_space_ + qid]);
+    }
+
+    // Select the socket for a new query from count sockets beginning at
+    // first, in a round-robin manner (next is the next candidate relative
+    // to first), skipping sockets whose QIDs are all in use.  There's
+    // always a free one as the window can't be larger than the total QID
+    // space.
+    size_t selectSocket(size_t first, size_t count, size_t& next) const {
+        size_t i = next;
+        while (socket_outstanding_[first + i] == qid_space_) {
+            i = (i + 1) % count;
+        }
+        next = (i + 1) % count;
+        return (first + i);
+    }
+
+    // Return the last query retired from the given slot (see SlotState).
+    uint64_t& getRetired(size_t socket_index, qid_t qid) {
+        return (retired_[socket_index * qid_space_ + qid]);
+    }
+
+    // Record how the query of the given event ended, freeing its slot.
+    // Unless free_qid is false, its QID can then be used by a new query
+    // (after quarantine if it timed out).
+    void retireQuery(QueryEvent*& entry, const QueryEvent& qev,
+                     SlotState state, bool free_qid = true)
+    {
+        entry = NULL;
+        --socket_outstanding_[qev.getSocketIndex()];
+        getRetired(qev.getSocketIndex(), qev.getQid()) =
+            makeRetiredSlot(state, qev.getStartTime());
+        if (!free_qid) {
+            return;
+        }
+        QidAllocator& qids = qid_allocators_[qev.getSocketIndex()];
+        if (state == SLOT_TIMEDOUT) {
+            qids.quarantine(qev.getQid());
+        } else {
+            qids.release(qev.getQid());
+        }
+    }
+
+    // Account for a response whose QID isn't outstanding on the socket.
+    void recordUnmatched(size_t socket_index, qid_t qid);
+
+    // Return a QID not in use on the given socket, so that a response
+    // always identifies a single outstanding query.  QIDs whose query
+    // timed out are used only if there's no other, and the one that timed
+    // out first is used first, so that a late response to it is unlikely
+    // to be taken for the response to a new query (see QidAllocator).
+    qid_t selectQid(size_t socket_index) {
+        return (qid_allocators_[socket_index].allocate());
+    }
+
+    // Start a new query for the given event, registering it in the
+    // outstanding table.  Queries are distributed to the servers by the
+    // schedule, and to the UDP sockets of the server, each of which has its
+    // own QID space.  TCP queries are sent over the
+    // persistent connections if they are used; since the protocol is only
+    // known once the query is built, such a query is then moved to one of
+    // the connections (which have their own QID spaces, too), possibly
+    // with a new QID.
+    void startQuery(QueryEvent& qev) {
+        const size_t server = server_schedule_.next();
+        const size_t socket_index = selectSocket(server * udp_socket_count_,
+                                                 udp_socket_count_,
+                                                 next_sockets_[server]);
+        const qid_t qid = selectQid(socket_index);
+        dispatchQuery(qev, qev.start(qid, socket_index, query_timeout_));
+        counters_.addSent();
+        ++server_results_[server].queries_sent;
+    }
+
+    // Register and send the query of the given event, whose QID and UDP
+    // socket have been selected (see startQuery()).  A TCP query is sent to
+    // the server of the UDP socket.
+    void dispatchQuery(QueryEvent& qev,
+                       const QueryContext::QuerySpec& qry_spec)
+    {
+        if (qry_spec.proto == IPPROTO_TCP && tcp_connection_count_ > 0) {
+            const qid_t qid = qev.getQid();
+            const size_t server = socket_servers_[qev.getSocketIndex()];
+            const size_t conn_index =
+                selectSocket(udp_socket_total_ +
+                             server * tcp_connection_count_,
+                             tcp_connection_count_,
+                             next_connections_[server]);
+            // The QID of the UDP socket isn't used any more (or hasn't been
+            // used at all).
+            qid_allocators_[qev.getSocketIndex()].release(qid);
+            if (qid_allocators_[conn_index].reserve(qid)) {
+                qev.relocate(qid, conn_index);
+                registerQuery(qev);
+                sendQuery(qev, qry_spec);
+            } else {
+                const qid_t conn_qid = selectQid(conn_index);
+                const uint8_t* const data =
+                    static_cast<const uint8_t*>(qry_spec.data);
+                tcp_query_data_.assign(data, data + qry_spec.len);
+                tcp_query_data_[0] = conn_qid >> 8;
+                tcp_query_data_[1] = conn_qid & 0xff;
+                qev.relocate(conn_qid, conn_index);
+                registerQuery(qev);
+                sendQuery(qev, QueryContext::QuerySpec(qry_spec.proto,
+                                                       &tcp_query_data_[0],
+                                                       qry_spec.len));
+            }
+            return;
+        }
+        registerQuery(qev);
+        sendQuery(qev, qry_spec);
+    }
+
+    void registerQuery(QueryEvent& qev) {
+        getOutstanding(qev.getSocketIndex(), qev.getQid()) = &qev;
+        ++socket_outstanding_[qev.getSocketIndex()];
+    }
 
     // A subroutine commonly used to send a single query.
     void sendQuery(QueryEvent& qev, const QueryContext::QuerySpec& qry_spec) {
-        if (qry_spec.proto == IPPROTO_UDP) {
-            udp_socket_->send(qry_spec.data, qry_spec.len);
+        if (qev.getSocketIndex() >= udp_socket_total_) {
+            const size_t connection_index =
+                qev.getSocketIndex() - udp_socket_total_;
+            tcp_sockets_[connection_index]->send(qry_spec.data, qry_spec.len);
+            ++connection_queries_sent_[connection_index];
+        } else if (qry_spec.proto == IPPROTO_UDP) {
+            udp_sockets_[qev.getSocketIndex()]->send(qry_spec.data,
+                                                     qry_spec.len);
         } else {
+            const ServerSpec& server =
+                servers_[socket_servers_[qev.getSocketIndex()]];
             MessageSocket* tcp_sock =
                 msg_mgr_->createMessageSocket(
-                    IPPROTO_TCP, server_address_, server_port_,
+                    IPPROTO_TCP, server.address, server.port,
                     qev.getTCPBuf(), qev.getTCPBufLen(),
                     boost::bind(&DispatcherImpl::responseTCPCallback, this,
                                 _1, &qev));
                 qev.setTCPSocket(tcp_sock);
                 tcp_sock->send(qry_spec.data, qry_spec.len);
         }
-
-        ++queries_sent_;
-        ++qid_;
     }
 
     // Callback from the message manager on expiration of the session timer.
-    // Stop sending more queries; only wait for outstanding ones.
+    // Stop sending more queries; only wait for outstanding ones.  With a
+    // load profile it expires at the end of each step instead.
     void sessionTimerCallback() {
+        if (load_profile_) {
+            endStep();
+            return;
+        }
         keep_sending_ = false;
+        if (pacing_timer_) {
+            pacing_timer_->cancel();
+            if (outstanding_count_ == 0) {
+                msg_mgr_->stop();
+            }
+        }
     }
 
+    // Callback from the message manager on expiration of the pacing timer
+    // (open-loop mode only).
+    void pacingTimerCallback();
+
+    // Load profile steps: start a step, handle the end of it, and move to
+    // the next one (if any) once the result of the current one is ready.
+    void startStep(const LoadStep& step);
+    void endStep();
+    void nextStep();
+
     // These are placeholders for the support class objects when they are
     // built within the context.
     scoped_ptr<QueryRepository> qry_repo_local_;
-    scoped_ptr<ASIOMessageManager> msg_mgr_local_;
+    scoped_ptr<MessageManager> msg_mgr_local_;
     scoped_ptr<QueryContextCreator> qryctx_creator_local_;
 
     // These are pointers to the objects actually used in the object
     MessageManager* msg_mgr_;
     QueryContextCreator* qryctx_creator_;
 
+    // TLS context shared by the persistent TCP connections (if TLS is
+    // used).  It must be released after the sockets.
+    scoped_ptr<TLSContext> tls_context_;
+
     // Note that these should be placed after msg_mgr_local_; in the destructor
     // these should be released first.
-    scoped_ptr<MessageSocket> udp_socket_;
+    vector<boost::shared_ptr<MessageSocket> > udp_sockets_;
+    vector<boost::shared_ptr<MessageSocket> > tcp_sockets_; // persistent
     scoped_ptr<MessageTimer> session_timer_;
-    uint8_t udp_recvbuf_[4096];
+    scoped_ptr<MessageTimer> pacing_timer_; // used only in open-loop mode
+    vector<uint8_t> udp_recvbuf_; // UDP_RECVBUF_LEN bytes for each socket
 
     // Configurable parameters
     string server_address_;
     uint16_t server_port_;
+    vector<ServerSpec> servers_; // the above one is added if it's empty
     size_t test_duration_;
     time_duration query_timeout_;
 
     bool keep_sending_; // whether to send next query on getting a response
     size_t window_;
-    qid_t qid_;
-    Message response_;          // placeholder for response messages
-    list<boost::shared_ptr<QueryEvent> > outstanding_;
+    size_t udp_socket_count_;
+    size_t tcp_connection_count_; // 0 means a new connection per query
+    bool tls_;                  // whether the connections use TLS
+    bool tls_resumption_;
+    size_t queries_per_connection_; // 0 means unlimited
+    vector<unsigned int> cpus_; // CPUs to bind the thread to (if non empty)
+    bool validate_responses_;   // whether to ignore invalid responses
+    bool tcp_retry_;            // whether to retry truncated UDP over TCP
+    size_t log_rate_;           // max diagnostic messages per second
+    ServerSchedule server_schedule_; // server for each query
+    size_t udp_socket_total_;   // # of UDP sockets of all servers
+    vector<size_t> socket_servers_; // server of each socket
+    vector<size_t> next_sockets_; // next UDP socket for each server
+    vector<size_t> next_connections_; // same for the persistent connections
+    vector<QidAllocator> qid_allocators_; // QIDs of each socket
+    vector<uint8_t> tcp_query_data_; // TCP query with an updated QID
+    vector<QueryEvent*> qevents_; // pool of all query events (owned)
+
+    // Outstanding query events indexed by the socket and QID (NULL if the
+    // QID is unused), so responses are matched in constant time.  The
+    // sockets are the UDP sockets followed by the persistent TCP
+    // connections.
+    size_t qid_space_;          // number of QIDs used on each socket
+    vector<QueryEvent*> outstanding_;
+    vector<size_t> socket_outstanding_; // # of used QIDs for each socket
+    vector<uint64_t> retired_;  // the previous query of each slot
+    size_t outstanding_count_;
+
+    // Open-loop mode parameters and state.  query_rate_ of 0 means the
+    // closed-loop mode, where a new query is sent only on completion or
+    // timeout of another one, unless a load profile is given.
+    size_t query_rate_;
+    scoped_ptr<LoadProfile> load_profile_; // target rates in steps
+    bool draining_;             // waiting for the result of a search step
+    vector<QueryEvent*> idle_events_; // query events ready for a new query
+    uint64_t pacing_start_;     // in monotonic time, unaffected by clock steps
+    uint64_t queries_paced_;    // # of queries that have become due so far
 
     // statistics
-    size_t queries_sent_;
-    size_t queries_completed_;
+    StatsCounters counters_;    // can be sampled while running
+    ResponseStats response_stats_;
+    vector<ServerResult> server_results_;
+    size_t tcp_failures_;       // TCP connections failed or closed early
+    LatencyHistogram late_rtt_histogram_; // of responses after timeouts
+    vector<size_t> connection_queries_sent_; // per persistent connection
+    vector<size_t> connection_queries_completed_;
+    vector<LoadStepResult> step_results_; // for each load profile step
     ptime start_time_;
     ptime end_time_;
 };
 
 void
 Dispatcher::DispatcherImpl::run() {
+    // Bind the thread first, so that everything allocated below and the
+    // copy of the preloaded queries are local to its NUMA node.
+    if (!cpus_.empty()) {
+        try {
+            setThreadAffinity(cpus_);
+        } catch (const CPUAffinityError& ex) {
+            throw DispatcherError(ex.what());
+        }
+        if (qry_repo_local_ && qry_repo_local_->getQueryCount() > 0) {
+            qry_repo_local_->localize();
+        }
+    }
+
+    msg_mgr_->getDiagnosticLog().setRate(log_rate_);
+
+    // Set up the servers, each of which has udp_socket_count_ sockets
+    // and tcp_connection_count_ connections.  The UDP sockets of all
+    // servers come first in the socket indices.
+    if (servers_.empty()) {
+        servers_.push_back(ServerSpec(server_address_, server_port_, 1));
+    }
+    vector<unsigned int> weights;
+    BOOST_FOREACH(const ServerSpec& server, servers_) {
+        weights.push_back(server.weight);
+        server_results_.push_back(ServerResult(server));
+    }
+    server_schedule_.reset(weights);
+    udp_socket_total_ = servers_.size() * udp_socket_count_;
+    for (size_t i = 0; i < udp_socket_total_; ++i) {
+        socket_servers_.push_back(i / udp_socket_count_);
+    }
+    for (size_t i = 0; i < servers_.size() * tcp_connection_count_; ++i) {
+        socket_servers_.push_back(i / tcp_connection_count_);
+    }
+    next_sockets_.assign(servers_.size(), 0);
+    next_connections_.assign(servers_.size(), 0);
+
     // Allocate resources used throughout the test session:
-    // common UDP socket and the whole session timer.
-    udp_socket_.reset(msg_mgr_->createMessageSocket(
-                          IPPROTO_UDP, server_address_, server_port_,
-                          udp_recvbuf_, sizeof(udp_recvbuf_),
-                          boost::bind(&DispatcherImpl::responseCallback,
-                                      this, _1)));
+    // common UDP sockets and the whole session timer.
+    udp_recvbuf_.resize(udp_socket_total_ * UDP_RECVBUF_LEN);
+    for (size_t i = 0; i < udp_socket_total_; ++i) {
+        const ServerSpec& server = servers_[socket_servers_[i]];
+        udp_sockets_.push_back(boost::shared_ptr<MessageSocket>(
+                                   msg_mgr_->createMessageSocket(
+                                       IPPROTO_UDP, server.address,
+                                       server.port,
+                                       &udp_recvbuf_[i * UDP_RECVBUF_LEN],
+                                       UDP_RECVBUF_LEN,
+                                       boost::bind(
+                                           &DispatcherImpl::responseCallback,
+                                           this, _1, i))));
+    }
+    StreamSocketParams stream_params;
+    if (tls_) {
+        try {
+            tls_context_.reset(new TLSContext(tls_resumption_));
+        } catch (const TLSError& ex) {
+            throw DispatcherError(ex.what());
+        }
+        stream_params.tls_context = tls_context_.get();
+    }
+    stream_params.max_messages = queries_per_connection_;
+    const size_t connection_total = servers_.size() * tcp_connection_count_;
+    for (size_t i = 0; i < connection_total; ++i) {
+        const ServerSpec& server =
+            servers_[socket_servers_[udp_socket_total_ + i]];
+        tcp_sockets_.push_back(boost::shared_ptr<MessageSocket>(
+                                   msg_mgr_->createPersistentMessageSocket(
+                                       server.address, server.port,
+                                       stream_params,
+                                       boost::bind(
+                                           &DispatcherImpl::
+                                           responseStreamCallback,
+                                           this, _1, i))));
+    }
+    connection_queries_sent_.assign(connection_total, 0);
+    connection_queries_completed_.assign(connection_total, 0);
     session_timer_.reset(msg_mgr_->createMessageTimer(
                              boost::bind(&DispatcherImpl::sessionTimerCallback,
                                          this)));
 
-    // Start the session timer.
-    session_timer_->start(seconds(test_duration_));
+    if (query_rate_ > 0 || load_profile_) {
+        pacing_timer_.reset(msg_mgr_->createMessageTimer(
+                                boost::bind(
+                                    &DispatcherImpl::pacingTimerCallback,
+                                    this)));
+    }
+
+    // Start the session timer, unless the profile decides the duration.
+    if (!load_profile_) {
+        session_timer_->start(seconds(test_duration_));
+    }
 
     // Create a pool of query contexts.  Setting QID to 0 for now.
+    qevents_.reserve(window_);
     for (size_t i = 0; i < window_; ++i) {
-        QueryEventPtr qev(new QueryEvent(
-                              *msg_mgr_, 0, qryctx_creator_->create(),
-                              boost::bind(&DispatcherImpl::restartQuery,
-                                          this, _1, _2)));
-        outstanding_.push_back(qev);
+        std::auto_ptr<QueryEvent> qev(new QueryEvent(
+                                          *msg_mgr_, 0,
+                                          qryctx_creator_->create(),
+                                          boost::bind(
+                                              &DispatcherImpl::restartQuery,
+                                              this, _1, _2, _3)));
+        qevents_.push_back(qev.get());
+        qev.release();
     }
-
-    // Record the start time and dispatch initial queries at once.
+    const size_t socket_count = udp_socket_total_ + connection_total;
+    qid_space_ = getQIDSpace(window_, tcp_connection_count_ > 0 ?
+                             std::min(udp_socket_count_,
+                                      tcp_connection_count_) :
+                             udp_socket_count_, socket_count);
+    outstanding_.assign(socket_count * qid_space_, NULL);
+    socket_outstanding_.assign(socket_count, 0);
+    retired_.assign(socket_count * qid_space_, 0);
+    qid_allocators_.assign(socket_count, QidAllocator(qid_space_));
+
+    // Record the start time.  In the closed-loop mode dispatch initial
+    // queries at once; in the open-loop mode they are sent by the pacing
+    // timer.
     start_time_ = microsec_clock::local_time();
-    BOOST_FOREACH(boost::shared_ptr<QueryEvent>& qev, outstanding_) {
-        sendQuery(*qev, qev->start(qid_, query_timeout_));
+    if (load_profile_) {
+        idle_events_ = qevents_;
+        startStep(load_profile_->start());
+    } else if (pacing_timer_) {
+        idle_events_ = qevents_;
+        pacing_start_ = getMonotonicTime();
+        pacing_timer_->start(microseconds(PACING_INTERVAL_USEC));
+    } else {
+        BOOST_FOREACH(QueryEvent* qev, qevents_) {
+            startQuery(*qev);
+            ++outstanding_count_;
+        }
     }
 
     // Enter the event loop.
@@ -270,15 +754,16 @@ Dispatcher::DispatcherImpl::run() {
 
 void
 Dispatcher::DispatcherImpl::responseCallback(
-    const MessageSocket::Event& sockev)
+    const MessageSocket::Event& sockev, size_t socket_index)
 {
-    // Parse the header of the response
-    InputBuffer buffer(sockev.data, sockev.datalen);
-    response_.clear(Message::PARSE);
-    response_.parseHeader(buffer);
-    // TODO: catch exception due to bogus response
+    // Parse the header of the response; the QID identifies the query.
+    Response response(sockev.data, sockev.datalen);
+    if (!response.header.parse(sockev.data, sockev.datalen)) {
+        ++response_stats_.invalid;
+        return;
+    }
 
-    restartQuery(response_.getQid(), &response_);
+    restartQuery(socket_index, response.header.qid, &response);
 }
 
 void
@@ -288,43 +773,257 @@ Dispatcher::DispatcherImpl::responseTCPCallback(
     qev->clearTCPSocket();
 
     if (sockev.datalen > 0) {
-        // Parse the header of the response
-        InputBuffer buffer(sockev.data, sockev.datalen);
-        response_.clear(Message::PARSE);
-        response_.parseHeader(buffer);
-    } else {
-        cout << "[Fail] TCP connection terminated unexpectedly" << endl;
+        // The connection is used only for this query, so a bogus response
+        // can't be followed by the right one; the query will time out.
+        Response response(sockev.data, sockev.datalen);
+        if (!response.header.parse(sockev.data, sockev.datalen)) {
+            ++response_stats_.invalid;
+            return;
+        }
+        restartQuery(qev->getSocketIndex(), qev->getQid(), &response);
+        return;
     }
 
-    restartQuery(qev->getQid(), sockev.datalen > 0 ? &response_ : NULL);
+    ++tcp_failures_;
+    DiagnosticLog& log = msg_mgr_->getDiagnosticLog();
+    if (log.admit()) {
+        log.write("[Fail] TCP connection terminated unexpectedly");
+    }
+    restartQuery(qev->getSocketIndex(), qev->getQid(), NULL);
 }
 
 void
-Dispatcher::DispatcherImpl::restartQuery(qid_t qid, const Message* response) {
-    // Identify the matching query from the outstanding queue.
-    const list<boost::shared_ptr<QueryEvent> >::iterator qev_it =
-        find_if(outstanding_.begin(), outstanding_.end(),
-                boost::bind(&QueryEvent::matchResponse, _1, qid));
-    if (qev_it != outstanding_.end()) {
-        if (response != NULL) {
-            // TODO: let the context check the response further
-            ++queries_completed_;
+Dispatcher::DispatcherImpl::responseStreamCallback(
+    const MessageSocket::Event& sockev, size_t connection_index)
+{
+    const size_t socket_index = udp_socket_total_ + connection_index;
+    if (sockev.data != NULL) {
+        Response response(sockev.data, sockev.datalen);
+        if (!response.header.parse(sockev.data, sockev.datalen)) {
+            ++response_stats_.invalid;
+            return;
+        }
+        restartQuery(socket_index, response.header.qid, &response);
+        return;
+    }
+
+    // The connection is closed.  Queries sent over it won't be responded,
+    // so consider them failed right now, rather than waiting for timeouts.
+    // New queries sent on restart will use a new connection.
+    if (socket_outstanding_[socket_index] == 0) {
+        return;
+    }
+    vector<qid_t> qids;
+    for (size_t qid = 0; qid < qid_space_; ++qid) {
+        if (getOutstanding(socket_index, qid) != NULL) {
+            qids.push_back(qid);
         }
+    }
+    ++tcp_failures_;
+    DiagnosticLog& log = msg_mgr_->getDiagnosticLog();
+    if (log.admit()) {
+        log.write("[Fail] TCP connection #" +
+                  lexical_cast<string>(connection_index) +
+                  " terminated unexpectedly with " +
+                  lexical_cast<string>(qids.size()) +
+                  " queries outstanding");
+    }
+    BOOST_FOREACH(qid_t qid, qids) {
+        restartQuery(socket_index, qid, NULL);
+    }
+}
 
-        // If necessary, create a new query and dispatch it.
-        if (keep_sending_) {
-            sendQuery(**qev_it, (*qev_it)->start(qid_, query_timeout_));
+void
+Dispatcher::DispatcherImpl::restartQuery(size_t socket_index, qid_t qid,
+                                         const Response* response)
+{
+    // Identify the matching query from the outstanding table.  A QID we
+    // never use can't match anything.
+    if (qid >= qid_space_) {
+        assert(response != NULL);
+        ++response_stats_.unknown;
+        return;
+    }
+    QueryEvent*& entry = getOutstanding(socket_index, qid);
+    QueryEvent* qev = entry;
+    if (qev == NULL) {
+        assert(response != NULL); // timeouts always have the entry
+        recordUnmatched(socket_index, qid);
+        return;
+    }
 
-            // Move this context to the end of the queue.
-            outstanding_.splice(qev_it, outstanding_, outstanding_.end());
-        } else {
-            outstanding_.erase(qev_it);
-            if (outstanding_.empty()) {
-                msg_mgr_->stop();
+    if (response != NULL) {
+        // An invalid response (e.g., a spoofed one) is ignored; the query
+        // keeps waiting for the right one until it times out.
+        if (validate_responses_) {
+            const QueryContext::QuerySpec query = qev->getQuery();
+            if (!validateResponse(response->header, response->data,
+                                  response->len, query.data, query.len)) {
+                ++response_stats_.invalid;
+                return;
             }
         }
+        response_stats_.record(response->header);
+    }
+
+    // A truncated response is retried over TCP, possibly with the same QID
+    // on the same socket, so the QID is kept until the retry is sent.
+    if (response != NULL && tcp_retry_ &&
+        qev->getQuery().proto == IPPROTO_UDP &&
+        response->header.hasFlag(MessageHeader::FLAG_TC)) {
+        retireQuery(entry, *qev, SLOT_COMPLETED, false);
+        retryOverTCP(*qev);
+        return;
+    }
+
+    retireQuery(entry, *qev, response != NULL ? SLOT_COMPLETED :
+                SLOT_TIMEDOUT);
+    ServerResult& server_result =
+        server_results_[socket_servers_[socket_index]];
+
+    if (response != NULL) {
+
+        const uint64_t rtt = getMonotonicTime() - qev->getStartTime();
+        counters_.addCompleted(rtt);
+        ++server_result.queries_completed;
+        server_result.rtt_histogram.record(rtt);
+        if (socket_index >= udp_socket_total_) {
+            ++connection_queries_completed_[socket_index - udp_socket_total_];
+        }
+        if (load_profile_) {
+            LoadStepResult& result = step_results_[qev->getStepIndex()];
+            ++result.queries_completed;
+            result.rtt_histogram.record(rtt);
+        }
+    } else {
+        // Timed out, or lost with its TCP connection.
+        counters_.addTimedOut();
+        ++server_result.queries_timedout;
+    }
+
+    // If necessary, create a new query and dispatch it.  In the open-loop
+    // mode the event is kept until the pacing timer needs it.
+    if (keep_sending_ && !pacing_timer_) {
+        startQuery(*qev);
     } else {
-        // TODO: record the mismatched response
+        qev->cancel();
+        idle_events_.push_back(qev);
+        if (--outstanding_count_ == 0) {
+            if (!keep_sending_) {
+                msg_mgr_->stop();
+            } else if (draining_) {
+                nextStep();
+            }
+        }
+    }
+}
+
+void
+Dispatcher::DispatcherImpl::recordUnmatched(size_t socket_index, qid_t qid) {
+    uint64_t& retired = getRetired(socket_index, qid);
+    switch (getSlotState(retired)) {
+    case SLOT_TIMEDOUT:
+        // The first response after the timeout is late; it's measured
+        // from the time the query was sent, but not counted as completed.
+        ++response_stats_.late;
+        late_rtt_histogram_.record(getMonotonicTime() -
+                                   (retired & SLOT_TIME_MASK));
+        retired = makeRetiredSlot(SLOT_LATE, retired);
+        // No more response is expected, so the QID can be used again.
+        qid_allocators_[socket_index].release(qid);
+        break;
+    case SLOT_COMPLETED:
+    case SLOT_LATE:
+        ++response_stats_.duplicates;
+        break;
+    case SLOT_UNUSED:
+        ++response_stats_.unknown;
+        break;
+    }
+}
+
+void
+Dispatcher::DispatcherImpl::retryOverTCP(QueryEvent& qev) {
+    // The query is still in progress: it keeps its start time (so the RTT
+    // includes the truncated response) and its timer.
+    ++response_stats_.tcp_retries;
+    qev.setProtocol(IPPROTO_TCP);
+    dispatchQuery(qev, qev.getQuery());
+}
+
+void
+Dispatcher::DispatcherImpl::pacingTimerCallback() {
+    if (!keep_sending_ || draining_) {
+        return;
+    }
+
+    // Send all queries that have become due since the last tick, so
+    // that a late timer doesn't lower the sending rate.  If the window is
+    // full, those that can't be sent now are skipped rather than sent in
+    // a later burst.
+    const uint64_t elapsed = getMonotonicTime() - pacing_start_;
+    const uint64_t due = load_profile_ ?
+        step_results_.back().step.getDueQueries(elapsed) :
+        elapsed * query_rate_ / 1000000;
+    LoadStepResult* const result = load_profile_ ? &step_results_.back() :
+        NULL;
+    while (queries_paced_ < due) {
+        if (idle_events_.empty()) {
+            counters_.addSkipped(due - queries_paced_);
+            if (result != NULL) {
+                result->queries_skipped += due - queries_paced_;
+            }
+            queries_paced_ = due;
+            break;
+        }
+        QueryEvent* qev = idle_events_.back();
+        idle_events_.pop_back();
+        ++outstanding_count_;
+        ++queries_paced_;
+        if (result != NULL) {
+            qev->setStepIndex(step_results_.size() - 1);
+            ++result->queries_sent;
+        }
+        startQuery(*qev);
+    }
+
+    pacing_timer_->start(microseconds(PACING_INTERVAL_USEC));
+}
+
+void
+Dispatcher::DispatcherImpl::startStep(const LoadStep& step) {
+    step_results_.push_back(LoadStepResult(step));
+    queries_paced_ = 0;
+    pacing_start_ = getMonotonicTime();
+    session_timer_->start(seconds(step.duration));
+    pacing_timer_->start(microseconds(PACING_INTERVAL_USEC));
+}
+
+void
+Dispatcher::DispatcherImpl::endStep() {
+    pacing_timer_->cancel();
+    // A search decides the next step from the result of this one, so wait
+    // until all queries of the step complete (or time out).  Otherwise
+    // the next step starts immediately, and queries of this step are
+    // still counted for it.
+    if (load_profile_->isSearch() && outstanding_count_ > 0) {
+        draining_ = true;
+        return;
+    }
+    nextStep();
+}
+
+void
+Dispatcher::DispatcherImpl::nextStep() {
+    draining_ = false;
+    LoadStep step;
+    if (load_profile_->next(step_results_.back(), step)) {
+        startStep(step);
+        return;
+    }
+    keep_sending_ = false;
+    if (outstanding_count_ == 0) {
+        msg_mgr_->stop();
     }
 }
 
@@ -368,6 +1067,70 @@ Dispatcher::loadQueries() {
     impl_->qry_repo_local_->load();
 }
 
+void
+Dispatcher::loadQueries(const Dispatcher& source, size_t start) {
+    if (!impl_->start_time_.is_special()) {
+        throw DispatcherError("query load attempt after run");
+    }
+    if (!impl_->qry_repo_local_ || !source.impl_->qry_repo_local_) {
+        throw DispatcherError("query load attempt for external repository");
+    }
+
+    impl_->qry_repo_local_->load(*source.impl_->qry_repo_local_, start);
+}
+
+void
+Dispatcher::streamQueries() {
+    if (!impl_->start_time_.is_special()) {
+        throw DispatcherError("query stream attempt after run");
+    }
+    if (!impl_->qry_repo_local_) {
+        throw DispatcherError("query stream attempt for external repository");
+    }
+
+    impl_->qry_repo_local_->stream();
+}
+
+void
+Dispatcher::streamQueries(const Dispatcher& source) {
+    if (!impl_->start_time_.is_special()) {
+        throw DispatcherError("query stream attempt after run");
+    }
+    if (!impl_->qry_repo_local_ || !source.impl_->qry_repo_local_) {
+        throw DispatcherError("query stream attempt for external repository");
+    }
+
+    impl_->qry_repo_local_->stream(*source.impl_->qry_repo_local_);
+}
+
+size_t
+Dispatcher::getQueryCount() const {
+    return (impl_->qry_repo_local_ ?
+            impl_->qry_repo_local_->getQueryCount() : 0);
+}
+
+void
+Dispatcher::saveQueries(const std::string& compiled_file) const {
+    if (!impl_->qry_repo_local_) {
+        throw DispatcherError("query save attempt for external repository");
+    }
+
+    impl_->qry_repo_local_->save(compiled_file);
+}
+
+bool
+Dispatcher::isCompiledQueryFile(const std::string& data_file) {
+    return (QueryRepository::isCompiledFile(data_file));
+}
+
+bool
+Dispatcher::isSeekableQueryFile(const std::string& data_file) {
+    struct stat st;
+    const int ret = data_file == "-" ? fstat(STDIN_FILENO, &st) :
+        stat(data_file.c_str(), &st);
+    return (ret != 0 || S_ISREG(st.st_mode));
+}
+
 void
 Dispatcher::setDefaultQueryClass(const std::string& qclass_txt) {
     // default qclass must be set before running tests.
@@ -418,9 +1181,74 @@ Dispatcher::setEDNS(bool on) {
     impl_->qry_repo_local_->setEDNS(on);
 }
 
+void
+Dispatcher::setQuerySelection(const string& selection) {
+    if (!impl_->start_time_.is_special()) {
+        throw DispatcherError("query selection is being set after run");
+    }
+    if (!impl_->qry_repo_local_) {
+        throw DispatcherError("query selection is being set "
+                              "for external repository");
+    }
+
+    const string::size_type colon = selection.find(':');
+    const string mode = selection.substr(0, colon);
+    double exponent = 1;
+    if (mode == "zipf" && colon != string::npos) {
+        try {
+            exponent = lexical_cast<double>(selection.substr(colon + 1));
+        } catch (const boost::bad_lexical_cast&) {
+            throw DispatcherError("invalid query selection: " + selection);
+        }
+    } else if (colon != string::npos) {
+        throw DispatcherError("invalid query selection: " + selection);
+    }
+    if (!(exponent >= 0)) {
+        throw DispatcherError("invalid query selection: " + selection);
+    }
+
+    QueryRepository::SelectionMode selection_mode;
+    if (mode == "sequential") {
+        selection_mode = QueryRepository::SELECT_SEQUENTIAL;
+    } else if (mode == "uniform") {
+        selection_mode = QueryRepository::SELECT_UNIFORM;
+    } else if (mode == "zipf") {
+        selection_mode = QueryRepository::SELECT_ZIPF;
+    } else if (mode == "weighted") {
+        selection_mode = QueryRepository::SELECT_WEIGHTED;
+    } else {
+        throw DispatcherError("invalid query selection: " + selection);
+    }
+    impl_->qry_repo_local_->setSelection(selection_mode, exponent);
+}
+
+void
+Dispatcher::setQuerySequence(uint64_t first, uint64_t step) {
+    if (!impl_->start_time_.is_special()) {
+        throw DispatcherError("query sequence is being set after run");
+    }
+    if (!impl_->qry_repo_local_) {
+        throw DispatcherError("query sequence is being set "
+                              "for external repository");
+    }
+    if (step == 0) {
+        throw DispatcherError("query sequence step must be positive");
+    }
+    impl_->qry_repo_local_->setSequence(first, step);
+}
+
 void
 Dispatcher::run() {
-    assert(impl_->udp_socket_ == NULL);
+    assert(impl_->udp_sockets_.empty());
+    if ((impl_->tls_ || impl_->queries_per_connection_ > 0) &&
+        impl_->tcp_connection_count_ == 0) {
+        throw DispatcherError("TLS or queries per connection requires "
+                              "persistent TCP connections");
+    }
+    if (impl_->load_profile_ && impl_->query_rate_ > 0) {
+        throw DispatcherError("query rate and load profile cannot be used "
+                              "at the same time");
+    }
     impl_->run();
     impl_->end_time_ = microsec_clock::local_time();
 }
@@ -451,6 +1279,28 @@ Dispatcher::setServerPort(uint16_t port) {
     impl_->server_port_ = port;
 }
 
+void
+Dispatcher::addServer(const string& address, uint16_t port,
+                      unsigned int weight)
+{
+    if (!impl_->start_time_.is_special()) {
+        throw DispatcherError("server cannot be added after run()");
+    }
+    if (weight == 0 || weight > ServerSpec::MAX_WEIGHT) {
+        throw DispatcherError("invalid server weight: " +
+                              lexical_cast<string>(weight));
+    }
+    if (impl_->servers_.size() == MAX_SERVERS) {
+        throw DispatcherError("too many servers");
+    }
+    impl_->servers_.push_back(ServerSpec(address, port, weight));
+}
+
+size_t
+Dispatcher::getServerCount() const {
+    return (impl_->servers_.empty() ? 1 : impl_->servers_.size());
+}
+
 void
 Dispatcher::setProtocol(int proto) {
     // This must be set before running tests.
@@ -480,14 +1330,298 @@ Dispatcher::setTestDuration(size_t duration) {
     impl_->test_duration_ = duration;
 }
 
+size_t
+Dispatcher::getWindow() const {
+    return (impl_->window_);
+}
+
+void
+Dispatcher::setWindow(size_t window) {
+    if (!impl_->start_time_.is_special()) {
+        throw DispatcherError("window size cannot be reset after run()");
+    }
+    if (window == 0 || window > MAX_WINDOW * impl_->udp_socket_count_ ||
+        (impl_->tcp_connection_count_ > 0 &&
+         window > MAX_WINDOW * impl_->tcp_connection_count_)) {
+        throw DispatcherError("window size out of range: " +
+                              lexical_cast<string>(window));
+    }
+    impl_->window_ = window;
+}
+
+size_t
+Dispatcher::getUDPSocketCount() const {
+    return (impl_->udp_socket_count_);
+}
+
+void
+Dispatcher::setUDPSocketCount(size_t count) {
+    if (!impl_->start_time_.is_special()) {
+        throw DispatcherError("number of UDP sockets cannot be reset after "
+                              "run()");
+    }
+    if (count == 0 || count > MAX_UDP_SOCKETS) {
+        throw DispatcherError("number of UDP sockets out of range: " +
+                              lexical_cast<string>(count));
+    }
+    if (impl_->window_ > MAX_WINDOW * count) {
+        throw DispatcherError("number of UDP sockets is too small for the "
+                              "window size");
+    }
+    impl_->udp_socket_count_ = count;
+}
+
+size_t
+Dispatcher::getTCPConnectionCount() const {
+    return (impl_->tcp_connection_count_);
+}
+
+void
+Dispatcher::setTCPConnectionCount(size_t count) {
+    if (!impl_->start_time_.is_special()) {
+        throw DispatcherError("number of TCP connections cannot be reset "
+                              "after run()");
+    }
+    if (count > MAX_TCP_CONNECTIONS) {
+        throw DispatcherError("number of TCP connections out of range: " +
+                              lexical_cast<string>(count));
+    }
+    if (count > 0 && impl_->window_ > MAX_WINDOW * count) {
+        throw DispatcherError("number of TCP connections is too small for "
+                              "the window size");
+    }
+    impl_->tcp_connection_count_ = count;
+}
+
+bool
+Dispatcher::getTLS() const {
+    return (impl_->tls_);
+}
+
+void
+Dispatcher::setTLS(bool on) {
+    if (!impl_->start_time_.is_special()) {
+        throw DispatcherError("TLS cannot be enabled or disabled after run()");
+    }
+    impl_->tls_ = on;
+}
+
+bool
+Dispatcher::getTLSSessionResumption() const {
+    return (impl_->tls_resumption_);
+}
+
+void
+Dispatcher::setTLSSessionResumption(bool on) {
+    if (!impl_->start_time_.is_special()) {
+        throw DispatcherError("TLS session resumption cannot be reset "
+                              "after run()");
+    }
+    impl_->tls_resumption_ = on;
+}
+
+size_t
+Dispatcher::getQueriesPerConnection() const {
+    return (impl_->queries_per_connection_);
+}
+
+void
+Dispatcher::setQueriesPerConnection(size_t count) {
+    if (!impl_->start_time_.is_special()) {
+        throw DispatcherError("queries per connection cannot be reset "
+                              "after run()");
+    }
+    impl_->queries_per_connection_ = count;
+}
+
+size_t
+Dispatcher::getQueryRate() const {
+    return (impl_->query_rate_);
+}
+
+void
+Dispatcher::setQueryRate(size_t qps) {
+    if (!impl_->start_time_.is_special()) {
+        throw DispatcherError("query rate cannot be reset after run()");
+    }
+    impl_->query_rate_ = qps;
+}
+
+void
+Dispatcher::setLoadProfile(const LoadProfile& profile) {
+    if (!impl_->start_time_.is_special()) {
+        throw DispatcherError("load profile cannot be reset after run()");
+    }
+    impl_->load_profile_.reset(new LoadProfile(profile));
+}
+
+const vector<LoadStepResult>&
+Dispatcher::getStepResults() const {
+    return (impl_->step_results_);
+}
+
+size_t
+Dispatcher::getFoundRate() const {
+    return (impl_->load_profile_ ? impl_->load_profile_->getFoundRate() : 0);
+}
+
+void
+Dispatcher::setCPUAffinity(const vector<unsigned int>& cpus) {
+    if (!impl_->start_time_.is_special()) {
+        throw DispatcherError("CPU affinity cannot be reset after run()");
+    }
+    impl_->cpus_ = cpus;
+}
+
+const vector<unsigned int>&
+Dispatcher::getCPUAffinity() const {
+    return (impl_->cpus_);
+}
+
+void
+Dispatcher::setResponseValidation(bool on) {
+    if (!impl_->start_time_.is_special()) {
+        throw DispatcherError("response validation cannot be changed "
+                              "after run()");
+    }
+    impl_->validate_responses_ = on;
+}
+
+bool
+Dispatcher::getResponseValidation() const {
+    return (impl_->validate_responses_);
+}
+
+void
+Dispatcher::setTCPRetry(bool on) {
+    if (!impl_->start_time_.is_special()) {
+        throw DispatcherError("TCP retry cannot be changed after run()");
+    }
+    impl_->tcp_retry_ = on;
+}
+
+bool
+Dispatcher::getTCPRetry() const {
+    return (impl_->tcp_retry_);
+}
+
+void
+Dispatcher::setLogRate(size_t messages_per_second) {
+    if (!impl_->start_time_.is_special()) {
+        throw DispatcherError("log rate cannot be changed after run()");
+    }
+    impl_->log_rate_ = messages_per_second;
+}
+
+size_t
+Dispatcher::getLogRate() const {
+    return (impl_->log_rate_);
+}
+
+void
+Dispatcher::setMessageManagerType(const string& type) {
+    if (!impl_->start_time_.is_special()) {
+        throw DispatcherError("message manager type cannot be changed "
+                              "after run()");
+    }
+    if (!impl_->msg_mgr_local_) {
+        throw DispatcherError("message manager type cannot be changed "
+                              "for an external manager");
+    }
+    impl_->msg_mgr_local_.reset(createMessageManager(type));
+    impl_->msg_mgr_ = impl_->msg_mgr_local_.get();
+}
+
 size_t
 Dispatcher::getQueriesSent() const {
-    return (impl_->queries_sent_);
+    return (impl_->counters_.getQueriesSent());
 }
 
 size_t
 Dispatcher::getQueriesCompleted() const {
-    return (impl_->queries_completed_);
+    return (impl_->counters_.getQueriesCompleted());
+}
+
+size_t
+Dispatcher::getQueriesSkipped() const {
+    return (impl_->counters_.getQueriesSkipped());
+}
+
+size_t
+Dispatcher::getQueriesTimedOut() const {
+    return (impl_->counters_.getQueriesTimedOut());
+}
+
+size_t
+Dispatcher::getConnectionQueriesSent(size_t connection_index) const {
+    if (connection_index >= impl_->connection_queries_sent_.size()) {
+        throw DispatcherError("TCP connection index out of range: " +
+                              lexical_cast<string>(connection_index));
+    }
+    return (impl_->connection_queries_sent_[connection_index]);
+}
+
+size_t
+Dispatcher::getConnectionQueriesCompleted(size_t connection_index) const {
+    if (connection_index >= impl_->connection_queries_completed_.size()) {
+        throw DispatcherError("TCP connection index out of range: " +
+                              lexical_cast<string>(connection_index));
+    }
+    return (impl_->connection_queries_completed_[connection_index]);
+}
+
+size_t
+Dispatcher::getTLSHandshakeCount() const {
+    return (impl_->tls_context_ ? impl_->tls_context_->getHandshakeCount() :
+            0);
+}
+
+size_t
+Dispatcher::getTLSResumedCount() const {
+    return (impl_->tls_context_ ? impl_->tls_context_->getResumedCount() :
+            0);
+}
+
+int
+Dispatcher::getIncomingCPU(size_t socket_index) const {
+    const size_t udp_count = impl_->udp_sockets_.size();
+    if (socket_index >= udp_count + impl_->tcp_sockets_.size()) {
+        throw DispatcherError("socket index out of range: " +
+                              lexical_cast<string>(socket_index));
+    }
+    return (socket_index < udp_count ?
+            impl_->udp_sockets_[socket_index]->getIncomingCPU() :
+            impl_->tcp_sockets_[socket_index - udp_count]->getIncomingCPU());
+}
+
+const LatencyHistogram&
+Dispatcher::getLatencyHistogram() const {
+    return (impl_->counters_.getLatencyHistogram());
+}
+
+const StatsCounters&
+Dispatcher::getStatsCounters() const {
+    return (impl_->counters_);
+}
+
+const vector<ServerResult>&
+Dispatcher::getServerResults() const {
+    return (impl_->server_results_);
+}
+
+const ResponseStats&
+Dispatcher::getResponseStats() const {
+    return (impl_->response_stats_);
+}
+
+const LatencyHistogram&
+Dispatcher::getLateLatencyHistogram() const {
+    return (impl_->late_rtt_histogram_);
+}
+
+size_t
+Dispatcher::getTCPFailureCount() const {
+    return (impl_->tcp_failures_);
 }
 
 const ptime&
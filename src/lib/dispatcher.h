@@ -22,6 +22,7 @@
 
 #include <stdexcept>
 #include <istream>
+#include <vector>
 
 #include <sys/types.h>
 #include <stdint.h>
@@ -45,6 +46,23 @@ public:
     /// \brief Default window size: maximum number of queries outstanding.
     static const size_t DEFAULT_WINDOW = 20;
 
+    /// \brief Maximum window size per UDP socket (the number of distinct
+    /// query IDs).
+    static const size_t MAX_WINDOW = 65536;
+
+    /// \brief Default number of UDP sockets.
+    static const size_t DEFAULT_UDP_SOCKETS = 1;
+
+    /// \brief Maximum number of UDP sockets.
+    static const size_t MAX_UDP_SOCKETS = 64;
+
+    /// \brief Default number of persistent TCP connections (none; a new
+    /// connection is opened for each TCP query).
+    static const size_t DEFAULT_TCP_CONNECTIONS = 0;
+
+    /// \brief Maximum number of persistent TCP connections.
+    static const size_t MAX_TCP_CONNECTIONS = 64;
+
     /// \brief Default test duration in seconds.
     static const long DEFAULT_DURATION = 30;
 
@@ -54,6 +72,9 @@ public:
     /// \brief Default server port
     static const uint16_t DEFAULT_PORT = 53;
 
+    /// \brief The maximum number of servers (see \c addServer()).
+    static const size_t MAX_SERVERS = 64;
+
     /// \brief Default timeout for query completion in seconds.
     static const unsigned int DEFAULT_QUERY_TIMEOUT = 5;
 
@@ -77,6 +98,73 @@ public:
     /// This can be called at most once, and must be called before run().
     void loadQueries();
 
+    /// \brief Share the queries preloaded by another dispatcher.
+    ///
+    /// This is an alternative to the other version of \c loadQueries()
+    /// for multiple dispatchers that use the same input: the input data is
+    /// parsed only once (by \c source), and the resulting queries are
+    /// shared (see \c QueryRepository::load()).  The settings related to
+    /// the queries (default query class, DNSSEC, EDNS and protocol) are
+    /// also taken from \c source.
+    ///
+    /// This can be called at most once instead of the other version, and
+    /// must be called before run().  Both dispatchers must have been
+    /// constructed with the "builtin" classes.
+    ///
+    /// \param source A dispatcher that has preloaded queries.
+    /// \param start The position of the first query to be sent (modulo the
+    /// number of queries).
+    void loadQueries(const Dispatcher& source, size_t start);
+
+    /// \brief Stream queries parsed ahead by a background thread.
+    ///
+    /// This is an alternative to \c loadQueries() that doesn't hold all
+    /// queries in memory (see \c QueryRepository::stream()).
+    ///
+    /// This can be called at most once instead of \c loadQueries(), and
+    /// must be called before run().
+    void streamQueries();
+
+    /// \brief Share the queries streamed by another dispatcher.
+    ///
+    /// Each query of the input is sent by only one of the dispatchers
+    /// sharing the stream (see \c QueryRepository::stream()), and
+    /// \c source must be valid while this dispatcher runs.  Both
+    /// dispatchers must have been constructed with the "builtin" classes.
+    ///
+    /// \param source A dispatcher that streams queries.
+    void streamQueries(const Dispatcher& source);
+
+    /// \brief Return the number of preloaded queries.
+    ///
+    /// It returns 0 if preload hasn't been done.
+    size_t getQueryCount() const;
+
+    /// \brief Save the preloaded queries as a compiled query file.
+    ///
+    /// See \c QueryRepository::save().  The dispatcher must have been
+    /// constructed with the "builtin" classes.
+    ///
+    /// \throw DispatcherError The repository is external.
+    /// \throw QueryRepositoryError Queries haven't been preloaded, or
+    /// failed to write the file.
+    void saveQueries(const std::string& compiled_file) const;
+
+    /// \brief Return whether the given file is a compiled query file.
+    ///
+    /// A compiled query file given to the constructor must be preloaded
+    /// by \c loadQueries().
+    static bool isCompiledQueryFile(const std::string& data_file);
+
+    /// \brief Return whether the given file can be read more than once.
+    ///
+    /// Only regular files can; a pipe (including the standard input, "-",
+    /// if it's a pipe) or a device can't be rewound, so its queries must
+    /// be preloaded by \c loadQueries() to be sent more than once.  It
+    /// returns true if the file can't be examined (e.g., it doesn't
+    /// exist), leaving the error to the constructor.
+    static bool isSeekableQueryFile(const std::string& data_file);
+
     /// \brief Start the dispatcher.
     void run();
 
@@ -86,9 +174,237 @@ public:
     void setServerPort(uint16_t port);
     uint16_t getServerPort() const;
 
+    /// \brief Add a server to send queries to.
+    ///
+    /// By default queries are sent to the single server given by
+    /// \c setServerAddress() and \c setServerPort().  If servers are added
+    /// by this method, queries are distributed to them instead, in
+    /// proportion to their weights, in an order decided in advance (see
+    /// \c ServerSchedule).  Each server has its own UDP sockets and
+    /// persistent TCP connections, of the numbers set by
+    /// \c setUDPSocketCount() and \c setTCPConnectionCount(), and the
+    /// statistics of each server are available from \c getServerResults().
+    ///
+    /// This method must be called before run().
+    ///
+    /// \throw DispatcherError The weight is 0 or larger than
+    /// \c ServerSpec::MAX_WEIGHT, there are already \c MAX_SERVERS servers,
+    /// or called after run().
+    void addServer(const std::string& address, uint16_t port,
+                   unsigned int weight = 1);
+
+    /// \brief Return the number of servers (1 unless \c addServer() is
+    /// used).
+    size_t getServerCount() const;
+
     void setTestDuration(size_t duration);
     size_t getTestDuration() const;
 
+    /// \brief Set the window size: maximum number of queries outstanding.
+    ///
+    /// It must be positive and not larger than \c MAX_WINDOW times the
+    /// number of UDP sockets (and that of persistent TCP connections if
+    /// they are used), since every outstanding query needs a distinct pair
+    /// of the socket and query ID.
+    ///
+    /// This method must be called before run().
+    void setWindow(size_t window);
+    size_t getWindow() const;
+
+    /// \brief Set the number of UDP sockets used to send queries (to each
+    /// server).
+    ///
+    /// Queries are distributed to the sockets in a round-robin manner, and
+    /// responses are matched by the socket they arrive on as well as the
+    /// query ID.  Since each socket has its own source port, using multiple
+    /// sockets helps the server distribute the load to multiple receive
+    /// queues (and CPU cores), and allows a window larger than
+    /// \c MAX_WINDOW.  It must be positive, not larger than
+    /// \c MAX_UDP_SOCKETS, and large enough for the window size (so it
+    /// should be set before the window size).
+    ///
+    /// Every QID of a socket takes about 27 bytes for matching responses.
+    /// All 65536 QIDs are used with up to 4 sockets (including persistent
+    /// TCP connections) in total, and fewer with more sockets, so that the
+    /// memory stays about 7MB, unless the window needs more: each socket
+    /// has at least twice its share of the window.
+    ///
+    /// This method must be called before run().
+    void setUDPSocketCount(size_t count);
+    size_t getUDPSocketCount() const;
+
+    /// \brief Set the number of persistent TCP connections (to each
+    /// server).
+    ///
+    /// If \c count is non 0, TCP queries are sent over the given number of
+    /// long-lived connections in a round-robin manner, instead of opening a
+    /// new connection for each query.  Queries are pipelined on each
+    /// connection, i.e., sent without waiting for the responses to the
+    /// previous ones, and responses are matched by the connection and the
+    /// query ID, in any order (see RFC 7766).  So the test measures the
+    /// query throughput of the server rather than the cost of connection
+    /// setup.  If a connection is closed, queries outstanding on it are
+    /// considered failed, and a new connection is opened for subsequent
+    /// queries.
+    ///
+    /// It must not be larger than \c MAX_TCP_CONNECTIONS, and, if non 0,
+    /// must be large enough for the window size (so it should be set
+    /// before the window size).  It's 0 (\c DEFAULT_TCP_CONNECTIONS) by
+    /// default.
+    ///
+    /// This method must be called before run().
+    void setTCPConnectionCount(size_t count);
+    size_t getTCPConnectionCount() const;
+
+    /// \brief Toggle whether to use TLS (DNS over TLS, RFC 7858) for the
+    /// persistent TCP connections.
+    ///
+    /// If enabled, TCP queries are sent over TLS.  Note that DNS over TLS
+    /// usually uses a different port (853) from the default.  It requires
+    /// persistent TCP connections (see \c setTCPConnectionCount()); \c run()
+    /// throws \c DispatcherError otherwise, or if TLS isn't supported in
+    /// this build.  The server certificate is not verified.  It's disabled
+    /// by default.
+    ///
+    /// This method must be called before run().
+    void setTLS(bool on);
+    bool getTLS() const;
+
+    /// \brief Toggle whether to resume the previous TLS session on
+    /// reconnecting to the server.
+    ///
+    /// It's enabled by default.  Disabling it makes every handshake a full
+    /// one.
+    ///
+    /// This method must be called before run().
+    void setTLSSessionResumption(bool on);
+    bool getTLSSessionResumption() const;
+
+    /// \brief Set the number of queries sent over each persistent TCP
+    /// connection before it's reopened.
+    ///
+    /// This controls the ratio of connection setup (and TLS handshakes) to
+    /// queries: 1 means a new connection for every query, which measures
+    /// the handshake-bound performance, while 0 (default) means a
+    /// connection is used as long as it works, which measures the steady
+    /// state.  A connection is reopened once all its queries are
+    /// responded.  It requires persistent TCP connections (see
+    /// \c setTCPConnectionCount()); \c run() throws \c DispatcherError
+    /// otherwise.
+    ///
+    /// This method must be called before run().
+    void setQueriesPerConnection(size_t count);
+    size_t getQueriesPerConnection() const;
+
+    /// \brief Set the target query rate for the open-loop mode.
+    ///
+    /// If \c qps is non 0, the dispatcher sends queries at the given rate
+    /// (queries per second) independently from responses, as long as the
+    /// number of outstanding queries is smaller than the window size.
+    /// If it's 0 (the default), the dispatcher works in the closed-loop
+    /// mode, i.e., it sends a new query only on completion or timeout of
+    /// an outstanding one.
+    ///
+    /// This method must be called before run().
+    void setQueryRate(size_t qps);
+    size_t getQueryRate() const;
+
+    /// \brief Set a load profile for the open-loop mode.
+    ///
+    /// Instead of a fixed query rate for the test duration, the dispatcher
+    /// sends queries at the rates of the steps of the profile in a single
+    /// run, keeping the queries and sockets (see \c LoadProfile).  The
+    /// test duration is the sum of the steps' durations, and the
+    /// statistics of each step are available from \c getStepResults() in
+    /// addition to the total ones.  For a search profile, each step waits
+    /// for all responses to (or timeouts of) the previous one.
+    ///
+    /// It cannot be used with \c setQueryRate(); \c run() throws
+    /// \c DispatcherError in that case.  The window size should be large
+    /// enough for the highest rate.
+    ///
+    /// This method must be called before run().
+    void setLoadProfile(const LoadProfile& profile);
+
+    /// \brief Return the statistics of each load profile step run so far.
+    ///
+    /// It's empty unless a load profile is set.
+    const std::vector<LoadStepResult>& getStepResults() const;
+
+    /// \brief Return the highest rate that met the criteria of a search
+    /// profile (0 if none, or the profile isn't a search).
+    size_t getFoundRate() const;
+
+    /// \brief Bind the dispatcher to the given CPUs.
+    ///
+    /// If \c cpus is non empty, \c run() binds the calling thread to them
+    /// before allocating anything for the test, so that, on a NUMA system,
+    /// its buffers are allocated on the node of the CPUs (the Linux
+    /// default policy places memory on the node that first touches it).
+    /// For the same reason, preloaded queries of the "builtin" repository
+    /// (which may be shared with other dispatchers) are copied in that
+    /// thread, at the cost of memory for a copy per dispatcher.  \c run()
+    /// throws \c DispatcherError if the thread can't be bound.  It's empty
+    /// (no binding) by default.
+    ///
+    /// This method must be called before run().
+    void setCPUAffinity(const std::vector<unsigned int>& cpus);
+    const std::vector<unsigned int>& getCPUAffinity() const;
+
+    /// \brief Enable or disable validation of responses.
+    ///
+    /// If enabled, a response is accepted only if it has the QR bit set and
+    /// echoes the question of the query (see \c validateResponse()).  An
+    /// invalid response is counted in \c ResponseStats::invalid and
+    /// otherwise ignored; the query keeps waiting for the right one.  A
+    /// response too short for the header is always treated that way.  It's
+    /// disabled by default, and then any response with a matching QID
+    /// completes the query.
+    ///
+    /// This method must be called before run().
+    void setResponseValidation(bool on);
+    bool getResponseValidation() const;
+
+    /// \brief Enable or disable retrying truncated responses over TCP.
+    ///
+    /// If enabled, a query sent over UDP whose response has the TC bit set
+    /// is resent over TCP (over one of the persistent connections if they
+    /// are used), like a resolver would do.  The query is completed by the
+    /// TCP response, and its RTT includes both exchanges.  It's disabled by
+    /// default, and then a truncated response completes the query.
+    ///
+    /// This method must be called before run().
+    void setTCPRetry(bool on);
+    bool getTCPRetry() const;
+
+    /// \brief Set the maximum number of diagnostic messages per second.
+    ///
+    /// Query timeouts and TCP failures are only counted by default (see
+    /// \c getQueriesTimedOut() and \c getTCPFailureCount()).  If this is
+    /// non 0, a message is also written to the standard error for some of
+    /// them, up to the given number per second, with the number of
+    /// suppressed ones (see \c DiagnosticLog).  The limit is per
+    /// dispatcher, i.e., per thread.  It's 0 by default.
+    ///
+    /// This method must be called before run().
+    void setLogRate(size_t messages_per_second);
+    size_t getLogRate() const;
+
+    /// \brief Select the type of the builtin message manager.
+    ///
+    /// \c type is "asio" (the default, based on ASIO), "epoll" (based on
+    /// Linux epoll with batched socket I/O), or "uring" (based on Linux
+    /// io_uring).  The latter two are available only if the system supports
+    /// them.
+    ///
+    /// This method is only effective for the dispatcher constructed with
+    /// the "builtin" classes, and must be called before run().
+    ///
+    /// \throw DispatcherError The type is unknown or unsupported, the
+    /// dispatcher uses an external manager, or called after run().
+    /// \throw MessageSocketError The manager isn't supported by the kernel.
+    void setMessageManagerType(const std::string& type);
+
     /// \brief Set the default transport protocol used to send queries.
     ///
     /// This method must be called before run().
@@ -115,12 +431,129 @@ public:
     /// This method must be called before run().
     void setEDNS(bool on);
 
+    /// \brief Set how to choose the next query to send.
+    ///
+    /// \c selection is one of "sequential" (the order of the input, the
+    /// default), "uniform", "zipf[:exponent]" (the exponent defaults to 1)
+    /// and "weighted" (see \c QueryRepository::setSelection()).  Modes
+    /// other than sequential require queries to be preloaded.
+    ///
+    /// This method must be called before \c loadQueries().
+    ///
+    /// \throw DispatcherError The selection is invalid, the repository is
+    /// external, or called after run().
+    void setQuerySelection(const std::string& selection);
+
+    /// \brief Set the values of the sequence templates in query names.
+    ///
+    /// Dispatchers running in different threads should start at the
+    /// thread index and step by the number of threads, so they don't
+    /// send the same names (see \c QueryRepository::setSequence()).
+    ///
+    /// This method must be called before run().
+    ///
+    /// \throw DispatcherError The step is 0, the repository is external,
+    /// or called after run().
+    void setQuerySequence(uint64_t first, uint64_t step);
+
     /// \brief Return the number of queries sent from the dispatcher.
     size_t getQueriesSent() const;
 
     /// \brief Return the number of queries correctly responded.
     size_t getQueriesCompleted() const;
 
+    /// \brief Return the number of queries that couldn't be sent in the
+    /// open-loop mode.
+    ///
+    /// These were due at the target rate, but were skipped because the
+    /// window was full.  It's always 0 in the closed-loop mode.
+    size_t getQueriesSkipped() const;
+
+    /// \brief Return the number of queries that weren't responded, i.e.,
+    /// timed out or lost with a closed TCP connection.
+    size_t getQueriesTimedOut() const;
+
+    /// \brief Return the number of queries sent over the given persistent
+    /// TCP connection.
+    ///
+    /// With multiple servers, the connections to the first server are
+    /// followed by those to the second one, and so on.
+    ///
+    /// \throw DispatcherError \c connection_index is not smaller than the
+    /// number of connections, or called before run().
+    size_t getConnectionQueriesSent(size_t connection_index) const;
+
+    /// \brief Return the number of queries responded over the given
+    /// persistent TCP connection.
+    ///
+    /// Divided by the test duration, it gives the throughput of the
+    /// connection.
+    ///
+    /// \throw DispatcherError \c connection_index is not smaller than the
+    /// number of connections, or called before run().
+    size_t getConnectionQueriesCompleted(size_t connection_index) const;
+
+    /// \brief Return the number of completed TLS handshakes.
+    ///
+    /// It's always 0 unless TLS is used.
+    size_t getTLSHandshakeCount() const;
+
+    /// \brief Return the number of completed TLS handshakes that resumed a
+    /// previous session (counted in \c getTLSHandshakeCount(), too).
+    size_t getTLSResumedCount() const;
+
+    /// \brief Return the CPU that processed the last response received on
+    /// the given socket.
+    ///
+    /// The sockets are the UDP sockets followed by the persistent TCP
+    /// connections (if any), each grouped by server in the order of
+    /// \c addServer().  If the CPU is on a different NUMA node from
+    /// the dispatcher's one, moving the dispatcher (or the interrupt of
+    /// the NIC receive queue) would reduce cross-node traffic.  It returns
+    /// -1 if it's unknown (see \c MessageSocket::getIncomingCPU()).
+    ///
+    /// \throw DispatcherError \c socket_index is not smaller than the
+    /// number of sockets, or called before run().
+    int getIncomingCPU(size_t socket_index) const;
+
+    /// \brief Return the histogram of round-trip times of completed
+    /// queries, in microseconds.
+    ///
+    /// The round-trip time is measured from the time the query is sent to
+    /// the time the response is received.  Timed out queries are not
+    /// recorded.
+    const LatencyHistogram& getLatencyHistogram() const;
+
+    /// \brief Return the statistics counters of the dispatcher.
+    ///
+    /// Unlike the other statistics methods, it can be used from another
+    /// thread while the dispatcher is running, by
+    /// \c StatsCounters::sample() (e.g., for periodic reports).
+    const StatsCounters& getStatsCounters() const;
+
+    /// \brief Return the statistics of queries sent to each server.
+    ///
+    /// They're in the order of \c addServer() (a single entry for the
+    /// default server if it isn't used), and empty before run().
+    const std::vector<ServerResult>& getServerResults() const;
+
+    /// \brief Return the statistics of responses broken down by RCODE and
+    /// header flags, and those of invalid or retried ones.
+    const ResponseStats& getResponseStats() const;
+
+    /// \brief Return the histogram of latencies of late responses, i.e.,
+    /// those received after the query timed out, in microseconds.
+    ///
+    /// Late responses are counted in \c ResponseStats::late, and are not
+    /// included in \c getLatencyHistogram().
+    const LatencyHistogram& getLateLatencyHistogram() const;
+
+    /// \brief Return the number of TCP connections that failed or were
+    /// closed by the server before all responses were received.
+    ///
+    /// Queries lost with them are counted as timed out.
+    size_t getTCPFailureCount() const;
+
     /// \brief Return the absolute time when the first query was sent.
     const boost::posix_time::ptime& getStartTime() const;
 
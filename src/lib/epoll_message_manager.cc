@@ -0,0 +1,1063 @@
+// Copyright (C) 2012  JINMEI Tatuya
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+// OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#include <config.h>
+
+#include <message_manager.h>
+#include <epoll_message_manager.h>
+#include <timer_wheel.h>
+#include <monotonic_time.h>
+#include <sockaddr_util.h>
+#include <tcp_stream.h>
+#include <cpu_affinity.h>
+
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/scoped_ptr.hpp>
+
+#include <cassert>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <unistd.h>
+#include <stdint.h>
+
+using boost::lexical_cast;
+
+namespace Queryperf {
+
+namespace {
+// Interface of objects that handle I/O readiness events of a descriptor
+// registered in the manager.
+class EpollEventHandler {
+protected:
+    EpollEventHandler() {}
+public:
+    virtual ~EpollEventHandler() {}
+    virtual void handleEvent(uint32_t events) = 0;
+
+    // Send queued data as much as possible.  Called from the manager if the
+    // handler has requested it by scheduleFlush().
+    virtual void flush() {}
+};
+
+class EpollMessageTimer;
+
+std::string
+getErrorText(const std::string& prefix, int error = errno) {
+    return (prefix + strerror(error));
+}
+} // end of unnamed namespace
+
+struct EpollMessageManager::EpollMessageManagerImpl {
+    // Timers are kept sorted by the expiration time (in the monotonic time
+    // in microseconds).
+    typedef std::multimap<uint64_t, EpollMessageTimer*> TimerMap;
+
+    explicit EpollMessageManagerImpl(DiagnosticLog& log);
+    ~EpollMessageManagerImpl() { close(epoll_fd_); }
+
+    void addHandler(int fd, uint32_t events, EpollEventHandler* handler) {
+        setHandler(EPOLL_CTL_ADD, fd, events, handler);
+    }
+    void modifyHandler(int fd, uint32_t events, EpollEventHandler* handler) {
+        setHandler(EPOLL_CTL_MOD, fd, events, handler);
+    }
+    void setHandler(int op, int fd, uint32_t events,
+                    EpollEventHandler* handler);
+    void removeHandler(int fd, EpollEventHandler* handler);
+
+    // Register a socket that has queued data, so it will be flushed
+    // before the loop waits for events.
+    void scheduleFlush(EpollEventHandler* sock) {
+        flush_list_.push_back(sock);
+    }
+    void cancelFlush(EpollEventHandler* sock);
+    void flush();
+
+    // Return the timeout for epoll_wait() based on the next timer
+    int getTimeout() const;
+    void fireTimers();
+
+    void run();
+
+    DiagnosticLog& log_;        // the log of the manager
+    int epoll_fd_;
+    bool stopped_;
+    size_t n_waiting_;   // # of sockets waiting for responses
+    TimerMap timers_;
+    std::vector<EpollEventHandler*> flush_list_;
+    struct epoll_event events_[BATCH_SIZE];
+    int n_events_;              // # of events returned from epoll_wait()
+    int cur_event_;             // index of the event being handled
+    boost::scoped_ptr<TimerWheel> timer_wheel_; // for coarse timers
+};
+
+typedef EpollMessageManager::EpollMessageManagerImpl ManagerImpl;
+
+int
+EpollMessageSocket::getIncomingCPU() const {
+    return (getSocketIncomingCPU(native()));
+}
+
+namespace {
+class UDPMessageSocket : public EpollMessageSocket, public EpollEventHandler {
+public:
+    UDPMessageSocket(ManagerImpl& mgr, const std::string& address,
+                     uint16_t port, size_t recvbuf_len,
+                     MessageSocket::Callback callback);
+    virtual ~UDPMessageSocket();
+    virtual void send(const void* data, size_t datalen);
+    virtual int native() const { return (fd_); }
+    virtual void handleEvent(uint32_t events);
+
+    virtual void flush();
+
+private:
+    ManagerImpl& mgr_;
+    int fd_;
+    MessageSocket::Callback callback_;
+    bool receiving_;            // whether we've sent anything
+    bool flush_scheduled_;
+    bool wait_writable_;        // whether the send buffer was full
+
+    // Queued data to be sent; the first sendq_head_ entries have been sent.
+    std::vector<struct iovec> sendq_;
+    size_t sendq_head_;
+    struct mmsghdr send_msgs_[EpollMessageManager::BATCH_SIZE];
+
+    std::vector<uint8_t> recv_arena_;
+    struct iovec recv_iovs_[EpollMessageManager::BATCH_SIZE];
+    struct mmsghdr recv_msgs_[EpollMessageManager::BATCH_SIZE];
+};
+
+UDPMessageSocket::UDPMessageSocket(ManagerImpl& mgr,
+                                   const std::string& address, uint16_t port,
+                                   size_t recvbuf_len,
+                                   MessageSocket::Callback callback) :
+    mgr_(mgr), fd_(-1), callback_(callback), receiving_(false),
+    flush_scheduled_(false), wait_writable_(false), sendq_head_(0)
+{
+    if (recvbuf_len == 0) {
+        throw MessageSocketError("Insufficient UDP receive buffer");
+    }
+
+    struct sockaddr_storage ss;
+    const socklen_t salen = convertAddress(address, port, ss);
+    fd_ = socket(ss.ss_family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                 IPPROTO_UDP);
+    if (fd_ < 0) {
+        throw MessageSocketError(getErrorText("Failed to create a socket: "));
+    }
+    try {
+        // make sure the receive buffer is large enough (32KB, derived from
+        // the original queryperf)
+        const int bufsize = 32768;
+        if (connect(fd_, convertSockAddr(&ss), salen) < 0 ||
+            setsockopt(fd_, SOL_SOCKET, SO_RCVBUF, &bufsize,
+                       sizeof(bufsize)) < 0) {
+            throw MessageSocketError(
+                getErrorText("Failed to create a socket: "));
+        }
+        mgr_.addHandler(fd_, EPOLLIN, this);
+    } catch (...) {
+        close(fd_);
+        throw;
+    }
+
+    // Prepare the buffers for recvmmsg().  Each message can be as large as
+    // the buffer the caller gave us.
+    recv_arena_.resize(recvbuf_len * EpollMessageManager::BATCH_SIZE);
+    memset(recv_msgs_, 0, sizeof(recv_msgs_));
+    memset(send_msgs_, 0, sizeof(send_msgs_));
+    for (size_t i = 0; i < EpollMessageManager::BATCH_SIZE; ++i) {
+        recv_iovs_[i].iov_base = &recv_arena_[i * recvbuf_len];
+        recv_iovs_[i].iov_len = recvbuf_len;
+        recv_msgs_[i].msg_hdr.msg_iov = &recv_iovs_[i];
+        recv_msgs_[i].msg_hdr.msg_iovlen = 1;
+    }
+}
+
+UDPMessageSocket::~UDPMessageSocket() {
+    mgr_.removeHandler(fd_, this);
+    if (flush_scheduled_) {
+        mgr_.cancelFlush(this);
+    }
+    if (receiving_) {
+        --mgr_.n_waiting_;
+    }
+    close(fd_);
+}
+
+void
+UDPMessageSocket::send(const void* data, size_t datalen) {
+    struct iovec iov;
+    iov.iov_base = const_cast<void*>(data);
+    iov.iov_len = datalen;
+    sendq_.push_back(iov);
+    if (!flush_scheduled_) {
+        mgr_.scheduleFlush(this);
+        flush_scheduled_ = true;
+    }
+    // If we have a full batch, no need to wait any more.
+    if (!wait_writable_ &&
+        sendq_.size() - sendq_head_ >= EpollMessageManager::BATCH_SIZE) {
+        flush();
+    }
+    if (!receiving_) {
+        ++mgr_.n_waiting_;
+        receiving_ = true;
+    }
+}
+
+void
+UDPMessageSocket::flush() {
+    flush_scheduled_ = false;
+    while (sendq_head_ < sendq_.size()) {
+        size_t n = sendq_.size() - sendq_head_;
+        if (n > EpollMessageManager::BATCH_SIZE) {
+            n = EpollMessageManager::BATCH_SIZE;
+        }
+        for (size_t i = 0; i < n; ++i) {
+            send_msgs_[i].msg_hdr.msg_iov = &sendq_[sendq_head_ + i];
+            send_msgs_[i].msg_hdr.msg_iovlen = 1;
+        }
+        const int ret = sendmmsg(fd_, send_msgs_, n, 0);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                // The socket buffer is full.  Retry once it's writable.
+                if (!wait_writable_) {
+                    mgr_.modifyHandler(fd_, EPOLLIN | EPOLLOUT, this);
+                    wait_writable_ = true;
+                }
+                return;
+            }
+            throw MessageSocketError(
+                getErrorText("Unexpected failure on socket send: "));
+        }
+        sendq_head_ += ret;
+    }
+    sendq_.clear();
+    sendq_head_ = 0;
+}
+
+void
+UDPMessageSocket::handleEvent(uint32_t events) {
+    if ((events & EPOLLOUT) != 0 && wait_writable_) {
+        mgr_.modifyHandler(fd_, EPOLLIN, this);
+        wait_writable_ = false;
+        flush();
+    }
+    if ((events & (EPOLLIN | EPOLLERR)) == 0) {
+        return;
+    }
+
+    int ret;
+    do {
+        ret = recvmmsg(fd_, recv_msgs_, EpollMessageManager::BATCH_SIZE, 0,
+                       NULL);
+    } while (ret < 0 && errno == EINTR);
+    if (ret < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return;
+        }
+        throw MessageSocketError(
+            getErrorText("unexpected failure on socket read: "));
+    }
+    for (int i = 0; i < ret; ++i) {
+        callback_(MessageSocket::Event(recv_iovs_[i].iov_base,
+                                       recv_msgs_[i].msg_len));
+    }
+}
+
+class TCPMessageSocket : public EpollMessageSocket, public EpollEventHandler {
+public:
+    TCPMessageSocket(ManagerImpl& mgr, const std::string& address,
+                     uint16_t port, void* recvbuf,
+                     MessageSocket::Callback callback);
+    virtual ~TCPMessageSocket();
+    virtual void send(const void* data, size_t datalen);
+    virtual int native() const { return (fd_); }
+    virtual void handleEvent(uint32_t events);
+
+private:
+    enum State {
+        INIT,                   // not sent yet
+        CONNECTING,
+        WRITING,
+        READING_LENGTH,
+        READING_DATA,
+        DONE                    // callback has been called
+    };
+
+    void handleConnect();
+    void handleWrite();
+    void handleRead();
+
+    // Stop watching the socket and do callback.  The caller must not touch
+    // this object after that, since the callback may delete it.
+    void complete(const void* data, size_t datalen);
+
+    ManagerImpl& mgr_;
+    int fd_;
+    struct sockaddr_storage dest_;
+    socklen_t dest_len_;
+    MessageSocket::Callback callback_;
+    State state_;
+    int connect_error_;   // error on connect(), if it fails immediately
+    uint8_t* recvbuf_;    // for the first message (must be of > 64KB)
+    size_t recvdata_len_; // actual message length of the first message
+    bool first_received_;
+    uint8_t* aux_recvbuf_; // placeholder for subsequent messages
+    uint8_t msglen_placeholder_[2];
+    size_t msglen_;        // length of the message being read
+    size_t read_len_;      // length of data read for the current item
+    struct iovec sendbufs_[2];
+};
+
+TCPMessageSocket::TCPMessageSocket(ManagerImpl& mgr,
+                                   const std::string& address, uint16_t port,
+                                   void* recvbuf,
+                                   MessageSocket::Callback callback) :
+    mgr_(mgr), fd_(-1), dest_len_(convertAddress(address, port, dest_)),
+    callback_(callback), state_(INIT), connect_error_(0),
+    recvbuf_(static_cast<uint8_t*>(recvbuf)), recvdata_len_(0),
+    first_received_(false), aux_recvbuf_(NULL), msglen_(0), read_len_(0)
+{
+    // Note: we don't even open the socket yet.
+}
+
+TCPMessageSocket::~TCPMessageSocket() {
+    if (fd_ >= 0) {
+        if (state_ != DONE) {
+            mgr_.removeHandler(fd_, this);
+            --mgr_.n_waiting_;
+        }
+        close(fd_);
+    }
+    delete[] aux_recvbuf_;
+}
+
+void
+TCPMessageSocket::send(const void* data, size_t datalen) {
+    if (state_ != INIT) {
+        throw MessageSocketError("TCP message socket can be used only once");
+    }
+    msglen_placeholder_[0] = datalen >> 8;
+    msglen_placeholder_[1] = (datalen & 0x00ff);
+    sendbufs_[0].iov_base = msglen_placeholder_;
+    sendbufs_[0].iov_len = sizeof(msglen_placeholder_);
+    sendbufs_[1].iov_base = const_cast<void*>(data);
+    sendbufs_[1].iov_len = datalen;
+
+    fd_ = socket(dest_.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                 IPPROTO_TCP);
+    if (fd_ < 0) {
+        throw MessageSocketError(getErrorText("Failed to create a socket: "));
+    }
+    // Errors are reported via the callback, just like the case where the
+    // connection attempt fails asynchronously.
+    if (connect(fd_, convertSockAddr(&dest_), dest_len_) < 0 &&
+        errno != EINPROGRESS) {
+        connect_error_ = errno;
+    }
+    mgr_.addHandler(fd_, EPOLLOUT, this);
+    ++mgr_.n_waiting_;
+    state_ = CONNECTING;
+}
+
+void
+TCPMessageSocket::handleEvent(uint32_t) {
+    switch (state_) {
+    case CONNECTING:
+        handleConnect();
+        break;
+    case WRITING:
+        handleWrite();
+        break;
+    case READING_LENGTH:
+    case READING_DATA:
+        handleRead();
+        break;
+    default:
+        assert(false);          // we shouldn't be watched in other states
+    }
+}
+
+void
+TCPMessageSocket::handleConnect() {
+    int error = connect_error_;
+    if (error == 0) {
+        socklen_t len = sizeof(error);
+        if (getsockopt(fd_, SOL_SOCKET, SO_ERROR, &error, &len) < 0) {
+            error = errno;
+        }
+    }
+    if (error != 0) {
+        if (mgr_.log_.admit()) {
+            mgr_.log_.write(getErrorText("[Warn] TCP connect failed: ",
+                                         error));
+        }
+        complete(NULL, 0);
+        return;
+    }
+    state_ = WRITING;
+    handleWrite();
+}
+
+void
+TCPMessageSocket::handleWrite() {
+    struct iovec* iov = sendbufs_[0].iov_len > 0 ? &sendbufs_[0] :
+        &sendbufs_[1];
+    while (iov->iov_len > 0) {
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = (iov == &sendbufs_[0]) ? 2 : 1;
+        const ssize_t ret = sendmsg(fd_, &msg, MSG_NOSIGNAL);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return;     // wait until it's writable again
+            }
+            if (mgr_.log_.admit()) {
+                mgr_.log_.write(getErrorText("[Warn] TCP send failed: ",
+                                             errno));
+            }
+            complete(NULL, 0);
+            return;
+        }
+        // Skip the data that have been sent.
+        size_t sent = ret;
+        while (sent > 0) {
+            const size_t n = sent < iov->iov_len ? sent : iov->iov_len;
+            iov->iov_base = static_cast<uint8_t*>(iov->iov_base) + n;
+            iov->iov_len -= n;
+            sent -= n;
+            if (iov->iov_len == 0 && iov == &sendbufs_[0]) {
+                ++iov;
+            }
+        }
+    }
+
+    // Immediately after sending the query, shutdown the outbound direction
+    // of the socket, so the server won't wait for subsequent queries.
+    if (shutdown(fd_, SHUT_WR) < 0) {
+        if (mgr_.log_.admit()) {
+            mgr_.log_.write(getErrorText(
+                                "[Warn] failed to shut down TCP socket: ",
+                                errno));
+        }
+        complete(NULL, 0);
+        return;
+    }
+
+    // Then wait for the response.
+    state_ = READING_LENGTH;
+    mgr_.modifyHandler(fd_, EPOLLIN, this);
+}
+
+void
+TCPMessageSocket::handleRead() {
+    while (true) {
+        uint8_t* buf;
+        size_t len;
+        if (state_ == READING_LENGTH) {
+            buf = msglen_placeholder_;
+            len = sizeof(msglen_placeholder_);
+        } else {
+            // We keep the first message in recvbuf_ for callback, and
+            // hold others in the aux buffer only temporarily.
+            buf = first_received_ ? aux_recvbuf_ : recvbuf_;
+            len = msglen_;
+        }
+
+        if (read_len_ < len) {
+            const ssize_t ret = recv(fd_, buf + read_len_, len - read_len_, 0);
+            if (ret < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    return;
+                }
+                if (mgr_.log_.admit()) {
+                    mgr_.log_.write(getErrorText(
+                                        "[Warn] failed to read TCP message: ",
+                                        errno));
+                }
+                complete(NULL, 0);
+                return;
+            }
+            if (ret == 0) {
+                // The server has closed the connection.  Normally we've
+                // received all messages by now; otherwise it's an unexpected
+                // termination, but do the callback with what we've had so
+                // far anyway.
+                complete(recvbuf_, recvdata_len_);
+                return;
+            }
+            read_len_ += ret;
+            if (read_len_ < len) {
+                continue;
+            }
+        }
+
+        read_len_ = 0;
+        if (state_ == READING_LENGTH) {
+            msglen_ = msglen_placeholder_[0] * 256 + msglen_placeholder_[1];
+            if (first_received_ && aux_recvbuf_ == NULL) {
+                aux_recvbuf_ = new uint8_t[65535];
+            }
+            state_ = READING_DATA;
+        } else {
+            // There may be more messages, like in the case for AXFR.  For
+            // now, we'll simply read and discard any subsequent message
+            // until the server closes the connection.
+            if (!first_received_) {
+                recvdata_len_ = msglen_;
+                first_received_ = true;
+            }
+            state_ = READING_LENGTH;
+        }
+    }
+}
+
+void
+TCPMessageSocket::complete(const void* data, size_t datalen) {
+    mgr_.removeHandler(fd_, this);
+    --mgr_.n_waiting_;
+    state_ = DONE;
+    callback_(MessageSocket::Event(data, datalen));
+}
+
+// A persistent TCP connection with pipelined messages.  Like UDP sockets,
+// messages sent in one iteration of the event loop are written at once
+// before the loop waits for events.
+class PersistentTCPMessageSocket : public EpollMessageSocket,
+                                   public EpollEventHandler
+{
+public:
+    PersistentTCPMessageSocket(ManagerImpl& mgr, const std::string& address,
+                               uint16_t port,
+                               const StreamSocketParams& params,
+                               MessageSocket::Callback callback);
+    virtual ~PersistentTCPMessageSocket();
+    virtual void send(const void* data, size_t datalen);
+    virtual int native() const { return (fd_); }
+    virtual void handleEvent(uint32_t events);
+    virtual void flush();
+
+private:
+    enum State {
+        CLOSED,
+        CONNECTING,
+        CONNECTED
+    };
+
+    void connect();
+    void handleConnect();
+    void handleRead();
+
+    // Write the queued data on the next flush, unless it's already
+    // arranged.
+    void scheduleFlush();
+
+    // Close the connection and tell the owner.  error is the errno value
+    // of the failure, or 0 if the server has closed the connection.
+    void fail(const char* what, int error);
+
+    // Close the connection that has exchanged all messages allowed, and
+    // open a new one if more messages are queued.
+    void reconnect();
+
+    // Common cleanup on closing the connection.
+    void closeSocket();
+
+    ManagerImpl& mgr_;
+    int fd_;
+    struct sockaddr_storage dest_;
+    socklen_t dest_len_;
+    MessageSocket::Callback callback_;
+    State state_;
+    int connect_error_;   // error on connect(), if it fails immediately
+    bool flush_scheduled_;
+    bool wait_writable_;        // whether the send buffer was full
+    TCPStream stream_;
+    std::vector<uint8_t> writebuf_; // data being written
+    size_t write_head_;             // data before this have been written
+};
+
+PersistentTCPMessageSocket::PersistentTCPMessageSocket(
+    ManagerImpl& mgr, const std::string& address, uint16_t port,
+    const StreamSocketParams& params, MessageSocket::Callback callback) :
+    mgr_(mgr), fd_(-1), dest_len_(convertAddress(address, port, dest_)),
+    callback_(callback), state_(CLOSED), connect_error_(0),
+    flush_scheduled_(false), wait_writable_(false), stream_(params),
+    write_head_(0)
+{}
+
+PersistentTCPMessageSocket::~PersistentTCPMessageSocket() {
+    if (fd_ >= 0) {
+        mgr_.removeHandler(fd_, this);
+        --mgr_.n_waiting_;
+        close(fd_);
+    }
+    if (flush_scheduled_) {
+        mgr_.cancelFlush(this);
+    }
+}
+
+void
+PersistentTCPMessageSocket::send(const void* data, size_t datalen) {
+    stream_.queueMessage(data, datalen);
+    if (state_ == CLOSED) {
+        connect();
+    } else if (state_ == CONNECTED) {
+        scheduleFlush();
+    }
+}
+
+void
+PersistentTCPMessageSocket::scheduleFlush() {
+    if (!flush_scheduled_ && !wait_writable_ && stream_.hasQueued()) {
+        mgr_.scheduleFlush(this);
+        flush_scheduled_ = true;
+    }
+}
+
+void
+PersistentTCPMessageSocket::connect() {
+    fd_ = socket(dest_.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                 IPPROTO_TCP);
+    if (fd_ < 0) {
+        throw MessageSocketError(getErrorText("Failed to create a socket: "));
+    }
+    // Errors are reported via the callback, just like the case where the
+    // connection attempt fails asynchronously.
+    connect_error_ = 0;
+    if (::connect(fd_, convertSockAddr(&dest_), dest_len_) < 0 &&
+        errno != EINPROGRESS) {
+        connect_error_ = errno;
+    }
+    mgr_.addHandler(fd_, EPOLLOUT, this);
+    ++mgr_.n_waiting_;
+    state_ = CONNECTING;
+}
+
+void
+PersistentTCPMessageSocket::handleEvent(uint32_t events) {
+    if (state_ == CONNECTING) {
+        handleConnect();
+        return;
+    }
+    assert(state_ == CONNECTED);
+    if ((events & EPOLLOUT) != 0 && wait_writable_) {
+        mgr_.modifyHandler(fd_, EPOLLIN, this);
+        wait_writable_ = false;
+        flush();
+        if (state_ != CONNECTED) {
+            return;             // failed, and possibly reconnecting
+        }
+    }
+    if ((events & (EPOLLIN | EPOLLERR | EPOLLHUP)) != 0) {
+        handleRead();
+    }
+}
+
+void
+PersistentTCPMessageSocket::handleConnect() {
+    int error = connect_error_;
+    if (error == 0) {
+        socklen_t len = sizeof(error);
+        if (getsockopt(fd_, SOL_SOCKET, SO_ERROR, &error, &len) < 0) {
+            error = errno;
+        }
+    }
+    if (error != 0) {
+        fail("TCP connect failed", error);
+        return;
+    }
+    // Queries are often smaller than a segment; don't let them wait for
+    // acknowledgment of the previous ones.
+    const int on = 1;
+    setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    state_ = CONNECTED;
+    mgr_.modifyHandler(fd_, EPOLLIN, this);
+    stream_.startConnection();
+    flush();
+}
+
+void
+PersistentTCPMessageSocket::flush() {
+    flush_scheduled_ = false;
+    while (true) {
+        if (write_head_ == writebuf_.size()) {
+            if (!stream_.hasQueued()) {
+                break;
+            }
+            if (!stream_.takeQueued(writebuf_)) {
+                fail(stream_.getError().c_str(), EPROTO);
+                return;
+            }
+            write_head_ = 0;
+        }
+        const ssize_t ret = ::send(fd_, &writebuf_[write_head_],
+                                   writebuf_.size() - write_head_,
+                                   MSG_NOSIGNAL);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                // The socket buffer is full.  Retry once it's writable.
+                mgr_.modifyHandler(fd_, EPOLLIN | EPOLLOUT, this);
+                wait_writable_ = true;
+                return;
+            }
+            fail("TCP send failed", errno);
+            return;
+        }
+        write_head_ += ret;
+    }
+}
+
+void
+PersistentTCPMessageSocket::handleRead() {
+    // Read as much as the buffer can hold in a single call; if more data
+    // remain, we'll be notified again.
+    size_t len;
+    uint8_t* space = stream_.getReceiveSpace(len);
+    ssize_t ret;
+    do {
+        ret = recv(fd_, space, len, 0);
+    } while (ret < 0 && errno == EINTR);
+    if (ret < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return;
+        }
+        fail("failed to read TCP message", errno);
+        return;
+    }
+    if (ret == 0) {
+        fail(NULL, 0);
+        return;
+    }
+    if (!stream_.commitReceived(ret)) {
+        fail(stream_.getError().c_str(), EPROTO);
+        return;
+    }
+    const void* data;
+    size_t datalen;
+    while (stream_.getNextMessage(data, datalen)) {
+        callback_(MessageSocket::Event(data, datalen));
+    }
+    if (stream_.isFinished()) {
+        reconnect();
+    } else {
+        // The TLS handshake may need to send more data.
+        scheduleFlush();
+    }
+}
+
+void
+PersistentTCPMessageSocket::fail(const char* what, int error) {
+    // Closing the connection by the server isn't an error by itself; the
+    // owner will know if it has affected any query.
+    if (error != 0) {
+        if (mgr_.log_.admit()) {
+            mgr_.log_.write(std::string("[Warn] ") + what + ": " +
+                            strerror(error));
+        }
+    }
+    closeSocket();
+    stream_.clear();
+    callback_(MessageSocket::Event(NULL, 0));
+}
+
+void
+PersistentTCPMessageSocket::reconnect() {
+    closeSocket();
+    stream_.closeConnection();
+    if (stream_.hasPending()) {
+        connect();
+    }
+}
+
+void
+PersistentTCPMessageSocket::closeSocket() {
+    mgr_.removeHandler(fd_, this);
+    --mgr_.n_waiting_;
+    close(fd_);
+    fd_ = -1;
+    if (flush_scheduled_) {
+        mgr_.cancelFlush(this);
+        flush_scheduled_ = false;
+    }
+    wait_writable_ = false;
+    state_ = CLOSED;
+    writebuf_.clear();
+    write_head_ = 0;
+}
+
+class EpollMessageTimer : public MessageTimer {
+public:
+    EpollMessageTimer(ManagerImpl& mgr, Callback callback) :
+        mgr_(mgr), callback_(callback), running_(false)
+    {}
+    virtual ~EpollMessageTimer() { cancel(); }
+
+    virtual void start(const boost::posix_time::time_duration& duration);
+
+    virtual void cancel() {
+        if (running_) {
+            mgr_.timers_.erase(it_);
+            running_ = false;
+        }
+    }
+
+    // Called from the manager on expiration, after removing the timer.
+    void expire() {
+        running_ = false;
+        callback_();
+    }
+
+private:
+    ManagerImpl& mgr_;
+    Callback callback_;
+    bool running_;
+    ManagerImpl::TimerMap::iterator it_; // valid only when running
+};
+
+void
+EpollMessageTimer::start(const boost::posix_time::time_duration& duration) {
+    cancel();
+    const int64_t usec = duration.total_microseconds();
+    it_ = mgr_.timers_.insert(
+        ManagerImpl::TimerMap::value_type(getMonotonicTime() +
+                                          (usec > 0 ? usec : 0), this));
+    running_ = true;
+}
+} // end of unnamed namespace
+
+EpollMessageManager::EpollMessageManagerImpl::EpollMessageManagerImpl(
+    DiagnosticLog& log) :
+    log_(log), epoll_fd_(epoll_create1(EPOLL_CLOEXEC)), stopped_(false),
+    n_waiting_(0), n_events_(0), cur_event_(0)
+{
+    if (epoll_fd_ < 0) {
+        throw MessageSocketError(getErrorText("epoll_create1 failed: "));
+    }
+}
+
+void
+EpollMessageManager::EpollMessageManagerImpl::setHandler(
+    int op, int fd, uint32_t events, EpollEventHandler* handler)
+{
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.ptr = handler;
+    if (epoll_ctl(epoll_fd_, op, fd, &ev) < 0) {
+        throw MessageSocketError(getErrorText("epoll_ctl failed: "));
+    }
+}
+
+void
+EpollMessageManager::EpollMessageManagerImpl::removeHandler(
+    int fd, EpollEventHandler* handler)
+{
+    // This is called from destructors, so we don't throw.  A failure
+    // shouldn't happen anyway, and it's harmless since the descriptor will
+    // soon be closed.
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, NULL);
+
+    // The handler may be removed while we are handling events of the same
+    // batch (e.g., a TCP socket is deleted on a UDP response).  Make sure
+    // pending events for it won't be delivered.
+    for (int i = cur_event_ + 1; i < n_events_; ++i) {
+        if (events_[i].data.ptr == handler) {
+            events_[i].data.ptr = NULL;
+        }
+    }
+}
+
+void
+EpollMessageManager::EpollMessageManagerImpl::cancelFlush(
+    EpollEventHandler* sock)
+{
+    std::vector<EpollEventHandler*>::iterator it = flush_list_.begin();
+    while (it != flush_list_.end()) {
+        if (*it == sock) {
+            it = flush_list_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void
+EpollMessageManager::EpollMessageManagerImpl::flush() {
+    for (size_t i = 0; i < flush_list_.size(); ++i) {
+        flush_list_[i]->flush();
+    }
+    flush_list_.clear();
+}
+
+int
+EpollMessageManager::EpollMessageManagerImpl::getTimeout() const {
+    if (timers_.empty()) {
+        return (-1);
+    }
+    const uint64_t now = getMonotonicTime();
+    const uint64_t expire = timers_.begin()->first;
+    if (expire <= now) {
+        return (0);
+    }
+    // Round it up so we won't wake up before the expiration.
+    const uint64_t msec = (expire - now + 999) / 1000;
+    return (msec > INT_MAX ? INT_MAX : msec);
+}
+
+void
+EpollMessageManager::EpollMessageManagerImpl::fireTimers() {
+    const uint64_t now = getMonotonicTime();
+    while (!stopped_ && !timers_.empty() && timers_.begin()->first <= now) {
+        EpollMessageTimer* timer = timers_.begin()->second;
+        timers_.erase(timers_.begin());
+        timer->expire();
+    }
+}
+
+void
+EpollMessageManager::EpollMessageManagerImpl::run() {
+    while (!stopped_) {
+        // Send all data queued by the callbacks in the previous iteration
+        // (or before run()).
+        flush();
+
+        if (n_waiting_ == 0 && timers_.empty()) {
+            break;              // nothing to wait for
+        }
+
+        n_events_ = epoll_wait(epoll_fd_, events_, BATCH_SIZE, getTimeout());
+        if (n_events_ < 0) {
+            n_events_ = 0;
+            if (errno == EINTR) {
+                continue;
+            }
+            throw MessageSocketError(getErrorText("epoll_wait failed: "));
+        }
+        for (cur_event_ = 0; cur_event_ < n_events_ && !stopped_;
+             ++cur_event_) {
+            EpollEventHandler* handler =
+                static_cast<EpollEventHandler*>(events_[cur_event_].data.ptr);
+            if (handler != NULL) {
+                handler->handleEvent(events_[cur_event_].events);
+            }
+        }
+        n_events_ = 0;
+        cur_event_ = 0;
+
+        fireTimers();
+    }
+    stopped_ = false;
+}
+
+EpollMessageManager::EpollMessageManager() :
+    impl_(new EpollMessageManagerImpl(getDiagnosticLog()))
+{}
+
+EpollMessageManager::~EpollMessageManager() {
+    // Timers of the wheel depend on the manager.
+    impl_->timer_wheel_.reset();
+    delete impl_;
+}
+
+MessageSocket*
+EpollMessageManager::createMessageSocket(int proto, const std::string& address,
+                                         uint16_t port,
+                                         void* recvbuf, size_t recvbuf_len,
+                                         MessageSocket::Callback callback)
+{
+    if (!callback) {
+        throw MessageSocketError("null socket callback specified");
+    }
+    if (proto == IPPROTO_UDP) {
+        // Received data are stored in the socket's own buffer, so recvbuf
+        // isn't used.
+        return (new UDPMessageSocket(*impl_, address, port, recvbuf_len,
+                                     callback));
+    } else if (proto == IPPROTO_TCP) {
+        if (recvbuf_len < 65535) { // must be able to hold a full TCP msg
+            throw MessageSocketError("Insufficient TCP receive buffer");
+        }
+        return (new TCPMessageSocket(*impl_, address, port, recvbuf,
+                                     callback));
+    }
+    throw MessageSocketError("unsupported or invalid protocol: " +
+                             lexical_cast<std::string>(proto));
+}
+
+MessageSocket*
+EpollMessageManager::createPersistentMessageSocket(
+    const std::string& address, uint16_t port,
+    const StreamSocketParams& params, MessageSocket::Callback callback)
+{
+    if (!callback) {
+        throw MessageSocketError("null socket callback specified");
+    }
+    return (new PersistentTCPMessageSocket(*impl_, address, port, params,
+                                           callback));
+}
+
+MessageTimer*
+EpollMessageManager::createMessageTimer(MessageTimer::Callback callback) {
+    return (new EpollMessageTimer(*impl_, callback));
+}
+
+MessageTimer*
+EpollMessageManager::createCoarseMessageTimer(MessageTimer::Callback callback) {
+    if (!impl_->timer_wheel_) {
+        impl_->timer_wheel_.reset(new TimerWheel(*this));
+    }
+    return (impl_->timer_wheel_->createTimer(callback));
+}
+
+void
+EpollMessageManager::run() {
+    impl_->run();
+}
+
+void
+EpollMessageManager::stop() {
+    impl_->stopped_ = true;
+}
+
+} // end of QueryPerf
@@ -0,0 +1,232 @@
+// Copyright (C) 2012  JINMEI Tatuya
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+// OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#include <interval_reporter.h>
+#include <stats_counters.h>
+#include <monotonic_time.h>
+
+#include <boost/foreach.hpp>
+
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+
+using namespace std;
+
+namespace Queryperf {
+
+struct IntervalReporter::IntervalReporterImpl {
+    IntervalReporterImpl(ostream& os, unsigned int interval_msec,
+                         Clock clock) :
+        os_(os), interval_usec_(static_cast<uint64_t>(interval_msec) * 1000),
+        clock_(clock.empty() ? Clock(getMonotonicTime) : clock),
+        running_(false), stopping_(false)
+    {
+        start_time_ = last_time_ = clock_();
+        pthread_mutex_init(&mutex_, NULL);
+        pthread_condattr_t attr;
+        pthread_condattr_init(&attr);
+        pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+        pthread_cond_init(&cond_, &attr);
+        pthread_condattr_destroy(&attr);
+    }
+
+    ~IntervalReporterImpl() {
+        pthread_cond_destroy(&cond_);
+        pthread_mutex_destroy(&mutex_);
+    }
+
+    static void* run(void* arg);
+
+    ostream& os_;
+    const uint64_t interval_usec_;
+    const Clock clock_;
+    vector<const StatsCounters*> counters_;
+    StatsSnapshot previous_;    // sum of the counters at the last report
+    vector<IntervalResult> results_;
+    uint64_t start_time_;
+    uint64_t last_time_;
+
+    // The reporter thread and its stop request.  The counters are never
+    // protected by the lock; it's only for the thread to sleep until the
+    // next report or stop().
+    pthread_t thread_;
+    bool running_;
+    bool stopping_;
+    pthread_mutex_t mutex_;
+    pthread_cond_t cond_;
+};
+
+void*
+IntervalReporter::IntervalReporterImpl::run(void* arg) {
+    IntervalReporter* reporter = static_cast<IntervalReporter*>(arg);
+    IntervalReporterImpl* impl = reporter->impl_;
+
+    // Reports are scheduled from the start time, rather than from the end
+    // of the previous report, so that their timing doesn't drift.
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    uint64_t deadline = static_cast<uint64_t>(now.tv_sec) * 1000000 +
+        now.tv_nsec / 1000;
+    pthread_mutex_lock(&impl->mutex_);
+    while (!impl->stopping_) {
+        deadline += impl->interval_usec_;
+        struct timespec ts;
+        ts.tv_sec = deadline / 1000000;
+        ts.tv_nsec = (deadline % 1000000) * 1000;
+        int error = 0;
+        while (!impl->stopping_ && error != ETIMEDOUT) {
+            error = pthread_cond_timedwait(&impl->cond_, &impl->mutex_, &ts);
+        }
+        if (!impl->stopping_) {
+            pthread_mutex_unlock(&impl->mutex_);
+            reporter->report();
+            pthread_mutex_lock(&impl->mutex_);
+        }
+    }
+    pthread_mutex_unlock(&impl->mutex_);
+    return (NULL);
+}
+
+IntervalReporter::IntervalReporter(ostream& os, unsigned int interval_msec,
+                                   Clock clock)
+{
+    if (interval_msec == 0) {
+        throw IntervalReporterError("report interval must be positive");
+    }
+    impl_ = new IntervalReporterImpl(os, interval_msec, clock);
+}
+
+IntervalReporter::~IntervalReporter() {
+    if (impl_->running_) {
+        pthread_mutex_lock(&impl_->mutex_);
+        impl_->stopping_ = true;
+        pthread_cond_signal(&impl_->cond_);
+        pthread_mutex_unlock(&impl_->mutex_);
+        pthread_join(impl_->thread_, NULL);
+    }
+    delete impl_;
+}
+
+void
+IntervalReporter::addCounters(const StatsCounters& counters) {
+    impl_->counters_.push_back(&counters);
+}
+
+void
+IntervalReporter::start() {
+    if (impl_->running_) {
+        throw IntervalReporterError("interval reporter already started");
+    }
+    impl_->start_time_ = impl_->last_time_ = impl_->clock_();
+    impl_->stopping_ = false;
+    const int error = pthread_create(&impl_->thread_, NULL,
+                                     IntervalReporterImpl::run, this);
+    if (error != 0) {
+        throw IntervalReporterError(
+            string("failed to create the reporter thread: ") +
+            strerror(error));
+    }
+    impl_->running_ = true;
+}
+
+void
+IntervalReporter::stop() {
+    if (!impl_->running_) {
+        return;
+    }
+    pthread_mutex_lock(&impl_->mutex_);
+    impl_->stopping_ = true;
+    pthread_cond_signal(&impl_->cond_);
+    pthread_mutex_unlock(&impl_->mutex_);
+    pthread_join(impl_->thread_, NULL);
+    impl_->running_ = false;
+
+    // Report the rest unless it's too short to be meaningful.
+    if (impl_->clock_() - impl_->last_time_ >= 1000) {
+        report();
+    }
+}
+
+void
+IntervalReporter::report() {
+    const uint64_t now = impl_->clock_();
+    StatsSnapshot current;
+    BOOST_FOREACH(const StatsCounters* counters, impl_->counters_) {
+        StatsSnapshot snapshot;
+        counters->sample(snapshot);
+        current.merge(snapshot);
+    }
+    StatsSnapshot interval = current;
+    interval.subtract(impl_->previous_);
+    const double seconds =
+        static_cast<double>(now - impl_->last_time_) / 1000000;
+
+    // Format the line separately so the state of the stream isn't
+    // changed.
+    ostringstream oss;
+    oss << fixed << setprecision(3) << "[Interval] "
+        << static_cast<double>(impl_->last_time_ - impl_->start_time_) /
+        1000000
+        << "-"
+        << static_cast<double>(now - impl_->start_time_) / 1000000 << " s: "
+        << interval.queries_sent << " sent, " << interval.queries_completed
+        << " completed (";
+    if (interval.queries_sent > 0) {
+        oss << setprecision(2)
+            << static_cast<double>(interval.queries_completed) * 100 /
+            interval.queries_sent << "%";
+    } else {
+        oss << "N/A";
+    }
+    oss << "), " << interval.queries_timedout << " timed out, "
+        << interval.queries_skipped << " skipped, " << setprecision(2)
+        << (seconds > 0 ? interval.queries_completed / seconds : 0)
+        << " qps";
+    const LatencyHistogram& rtt = interval.rtt_histogram;
+    if (rtt.getCount() > 0) {
+        oss << setprecision(6) << ", latency 50th "
+            << rtt.getPercentile(50) / 1000000.0 << " s, 90th "
+            << rtt.getPercentile(90) / 1000000.0 << " s, 99th "
+            << rtt.getPercentile(99) / 1000000.0 << " s";
+    }
+    impl_->os_ << oss.str() << endl;
+
+    IntervalResult result;
+    result.start = impl_->last_time_ - impl_->start_time_;
+    result.end = now - impl_->start_time_;
+    result.queries_sent = interval.queries_sent;
+    result.queries_completed = interval.queries_completed;
+    result.queries_timedout = interval.queries_timedout;
+    result.queries_skipped = interval.queries_skipped;
+    result.rtt_p50 = rtt.getPercentile(50);
+    result.rtt_p90 = rtt.getPercentile(90);
+    result.rtt_p99 = rtt.getPercentile(99);
+    impl_->results_.push_back(result);
+
+    impl_->previous_ = current;
+    impl_->last_time_ = now;
+}
+
+const vector<IntervalResult>&
+IntervalReporter::getResults() const {
+    return (impl_->results_);
+}
+
+} // end of QueryPerf
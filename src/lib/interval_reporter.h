@@ -0,0 +1,124 @@
+// Copyright (C) 2012  JINMEI Tatuya
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+// OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#ifndef __QUERYPERF_INTERVAL_REPORTER_H
+#define __QUERYPERF_INTERVAL_REPORTER_H 1
+
+#include <libqueryperfpp_fwd.h>
+
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+namespace Queryperf {
+
+/// \brief Exception class thrown on failure of the interval reporter.
+class IntervalReporterError : public std::runtime_error {
+public:
+    explicit IntervalReporterError(const std::string& what_arg) :
+        std::runtime_error(what_arg)
+    {}
+};
+
+/// \brief Statistics of an interval reported by \c IntervalReporter.
+struct IntervalResult {
+    uint64_t start;             // usec since the start of the reporter
+    uint64_t end;               // ditto
+    uint64_t queries_sent;
+    uint64_t queries_completed;
+    uint64_t queries_timedout;
+    uint64_t queries_skipped;
+    uint64_t rtt_p50;           // latency percentiles in usec (0 if no
+    uint64_t rtt_p90;           // query is completed)
+    uint64_t rtt_p99;
+};
+
+/// \brief Periodic reporter of statistics while a test is running.
+///
+/// The reporter runs in its own thread, and at each interval it prints a
+/// line of the statistics for the interval (the numbers of queries sent,
+/// completed and timed out, the completion ratio, QPS and latency
+/// percentiles), summed over all registered \c StatsCounters, typically
+/// one for each dispatcher thread.  Counters are sampled without locks
+/// (see \c StatsCounters), so the reporter doesn't slow down the
+/// dispatchers.
+class IntervalReporter : private boost::noncopyable {
+public:
+    /// \brief Functor type to get the current time in microseconds.
+    typedef boost::function<uint64_t()> Clock;
+
+    /// \brief Constructor.
+    ///
+    /// \throw IntervalReporterError \c interval_msec is 0.
+    ///
+    /// \param os The stream to which the reports are written.
+    /// \param interval_msec The interval of the reports in milliseconds.
+    /// \param clock Used to get the current time (mainly for tests).  If
+    /// empty, the monotonic clock is used.
+    IntervalReporter(std::ostream& os, unsigned int interval_msec,
+                     Clock clock = Clock());
+
+    /// \brief Destructor; it stops the reporter if it's running.
+    ~IntervalReporter();
+
+    /// \brief Add counters to be reported.
+    ///
+    /// They must be valid until the reporter is stopped or destroyed.
+    /// This method must be called before \c start().
+    void addCounters(const StatsCounters& counters);
+
+    /// \brief Start the reporter thread.
+    ///
+    /// The elapsed time of the reports is relative to this call.
+    ///
+    /// \throw IntervalReporterError Failed to start the thread, or already
+    /// started.
+    void start();
+
+    /// \brief Stop the reporter thread, and report the last (possibly
+    /// shorter) interval.
+    ///
+    /// It does nothing if the reporter isn't running.
+    void stop();
+
+    /// \brief Report the statistics since the previous report (or the
+    /// start).
+    ///
+    /// This is called in the reporter thread; it's public mainly for
+    /// tests, and must not be called while the thread is running.
+    void report();
+
+    /// \brief Return the statistics of all intervals reported so far.
+    ///
+    /// It must not be called while the reporter thread is running.
+    const std::vector<IntervalResult>& getResults() const;
+
+private:
+    struct IntervalReporterImpl;
+    IntervalReporterImpl* impl_;
+};
+
+} // end of QueryPerf
+
+#endif // __QUERYPERF_INTERVAL_REPORTER_H
+
+// Local Variables:
+// mode: c++
+// End:
@@ -0,0 +1,134 @@
+// Copyright (C) 2012  JINMEI Tatuya
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+// OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#include <latency_histogram.h>
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+using namespace std;
+
+namespace Queryperf {
+
+void
+LatencyHistogram::clear() {
+    memset(counts_, 0, sizeof(counts_));
+    total_count_ = 0;
+    sum_ = 0;
+    min_ = numeric_limits<uint64_t>::max();
+    max_ = 0;
+}
+
+void
+LatencyHistogram::merge(const LatencyHistogram& other) {
+    for (unsigned int i = 0; i < BUCKETS; ++i) {
+        counts_[i] += other.counts_[i];
+    }
+    total_count_ += other.total_count_;
+    sum_ += other.sum_;
+    if (other.min_ < min_) {
+        min_ = other.min_;
+    }
+    if (other.max_ > max_) {
+        max_ = other.max_;
+    }
+}
+
+void
+LatencyHistogram::load(const LatencyHistogram& source) {
+    for (unsigned int i = 0; i < BUCKETS; ++i) {
+        counts_[i] = __atomic_load_n(&source.counts_[i], __ATOMIC_RELAXED);
+    }
+    total_count_ = __atomic_load_n(&source.total_count_, __ATOMIC_RELAXED);
+    sum_ = __atomic_load_n(&source.sum_, __ATOMIC_RELAXED);
+    min_ = __atomic_load_n(&source.min_, __ATOMIC_RELAXED);
+    max_ = __atomic_load_n(&source.max_, __ATOMIC_RELAXED);
+}
+
+void
+LatencyHistogram::subtract(const LatencyHistogram& earlier) {
+    // The total count is recalculated from the buckets, so an inconsistent
+    // snapshot doesn't break getPercentile().  The largest value can't be
+    // larger than that of the whole.
+    const uint64_t max_whole = max_;
+    total_count_ = 0;
+    min_ = numeric_limits<uint64_t>::max();
+    max_ = 0;
+    for (unsigned int i = 0; i < BUCKETS; ++i) {
+        counts_[i] = counts_[i] > earlier.counts_[i] ?
+            counts_[i] - earlier.counts_[i] : 0;
+        if (counts_[i] > 0) {
+            total_count_ += counts_[i];
+            if (min_ == numeric_limits<uint64_t>::max()) {
+                min_ = i > 0 ? getHighestValue(i - 1) + 1 : 0;
+            }
+            max_ = min(getHighestValue(i), max_whole);
+        }
+    }
+    sum_ = sum_ > earlier.sum_ ? sum_ - earlier.sum_ : 0;
+}
+
+double
+LatencyHistogram::getMean() const {
+    if (total_count_ == 0) {
+        return (0);
+    }
+    return (static_cast<double>(sum_) / total_count_);
+}
+
+uint64_t
+LatencyHistogram::getHighestValue(unsigned int bucket) {
+    if (bucket < SUB_BUCKETS) {
+        return (bucket);
+    }
+    // Reverse of getBucket(): the bucket covers values whose high-order
+    // bits are "sub" followed by "shift" bits of arbitrary value.  For the
+    // very last bucket the shift overflows to 0, resulting in the maximum
+    // of uint64_t, which is what we want.
+    const unsigned int shift = bucket / (SUB_BUCKETS / 2) - 1;
+    const uint64_t sub = bucket - shift * (SUB_BUCKETS / 2);
+    return (((sub + 1) << shift) - 1);
+}
+
+uint64_t
+LatencyHistogram::getPercentile(double percentile) const {
+    if (total_count_ == 0) {
+        return (0);
+    }
+
+    // The number of values that must be equal to or smaller than the
+    // result (at least 1, so 0th percentile means the smallest value).
+    uint64_t target = static_cast<uint64_t>(total_count_ * percentile / 100);
+    if (target < total_count_ * percentile / 100) {
+        ++target;               // round up
+    }
+    if (target == 0) {
+        target = 1;
+    } else if (target > total_count_) {
+        target = total_count_;
+    }
+
+    uint64_t count = 0;
+    for (unsigned int i = 0; i < BUCKETS; ++i) {
+        count += counts_[i];
+        if (count >= target) {
+            const uint64_t value = getHighestValue(i);
+            return (value < max_ ? value : max_);
+        }
+    }
+    return (max_);          // shouldn't happen, but just in case
+}
+
+} // end of QueryPerf
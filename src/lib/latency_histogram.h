@@ -0,0 +1,157 @@
+// Copyright (C) 2012  JINMEI Tatuya
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+// OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#ifndef __QUERYPERF_LATENCY_HISTOGRAM_H
+#define __QUERYPERF_LATENCY_HISTOGRAM_H 1
+
+#include <stdint.h>
+
+namespace Queryperf {
+
+/// \brief A fixed-size histogram of latency values.
+///
+/// This is a simplified version of the "HDR" histogram: values are
+/// recorded in buckets whose width grows with the magnitude of the values,
+/// so that the relative error of each bucket is bounded (less than 1/64,
+/// i.e., about 1.6%) over the entire range of \c uint64_t.  Values smaller
+/// than \c SUB_BUCKETS are recorded exactly.
+///
+/// The histogram itself is unit-agnostic; the dispatcher records
+/// round-trip times in microseconds.
+///
+/// Recording a value only involves a few integer operations and never
+/// allocates memory, so it can be used for every response without
+/// affecting the performance.  Histograms of multiple threads can be
+/// merged into one by \c merge() at the end of the test.
+///
+/// While the test is running, another thread can take a snapshot of a
+/// histogram with \c load(), as long as values are recorded by
+/// \c recordShared().  The difference between two snapshots, i.e., the
+/// values recorded in between, is given by \c subtract().
+class LatencyHistogram {
+public:
+    /// \brief Number of exactly recorded values; must be a power of 2.
+    static const unsigned int SUB_BUCKET_BITS = 7;
+    static const unsigned int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+
+    /// \brief The total number of buckets.
+    static const unsigned int BUCKETS =
+        (64 - SUB_BUCKET_BITS + 2) * (SUB_BUCKETS / 2);
+
+    /// \brief Constructor: the histogram is initially empty.
+    LatencyHistogram() { clear(); }
+
+    /// \brief Make the histogram empty.
+    void clear();
+
+    /// \brief Record a value.
+    void record(uint64_t value) {
+        ++counts_[getBucket(value)];
+        ++total_count_;
+        sum_ += value;
+        if (value < min_) {
+            min_ = value;
+        }
+        if (value > max_) {
+            max_ = value;
+        }
+    }
+
+    /// \brief Record a value so that other threads can \c load() the
+    /// histogram at the same time.
+    ///
+    /// Only a single thread can record values, so the fields are simply
+    /// updated with atomic stores (plain stores on common architectures)
+    /// rather than more expensive read-modify-write operations.
+    void recordShared(uint64_t value) {
+        uint64_t& count = counts_[getBucket(value)];
+        __atomic_store_n(&count, count + 1, __ATOMIC_RELAXED);
+        __atomic_store_n(&total_count_, total_count_ + 1, __ATOMIC_RELAXED);
+        __atomic_store_n(&sum_, sum_ + value, __ATOMIC_RELAXED);
+        if (value < min_) {
+            __atomic_store_n(&min_, value, __ATOMIC_RELAXED);
+        }
+        if (value > max_) {
+            __atomic_store_n(&max_, value, __ATOMIC_RELAXED);
+        }
+    }
+
+    /// \brief Make this histogram a snapshot of another one, which may be
+    /// being updated by \c recordShared() in another thread.
+    ///
+    /// The fields are read one by one, so the snapshot may not be exactly
+    /// consistent: e.g., the total count can be slightly different from
+    /// the sum of the buckets.
+    void load(const LatencyHistogram& source);
+
+    /// \brief Remove the values recorded in an earlier snapshot of the
+    /// same histogram, leaving those recorded after it.
+    ///
+    /// The smallest and largest values are those of the buckets that
+    /// remain non empty, so they are only approximate.
+    void subtract(const LatencyHistogram& earlier);
+
+    /// \brief Add all values recorded in another histogram to this one.
+    void merge(const LatencyHistogram& other);
+
+    /// \brief Return the number of recorded values.
+    uint64_t getCount() const { return (total_count_); }
+
+    /// \brief Return the smallest recorded value (0 if empty).
+    uint64_t getMin() const { return (total_count_ > 0 ? min_ : 0); }
+
+    /// \brief Return the largest recorded value (0 if empty).
+    uint64_t getMax() const { return (max_); }
+
+    /// \brief Return the average of recorded values (0 if empty).
+    double getMean() const;
+
+    /// \brief Return the value at the given percentile.
+    ///
+    /// The returned value is the highest value that belongs to the bucket
+    /// containing the specified percentile (but not larger than
+    /// \c getMax()), so it's larger than the exact value by less than
+    /// the bucket's relative error.
+    ///
+    /// \param percentile A value between 0 and 100 (e.g., 99.9).
+    /// \return The value at the percentile, or 0 if empty.
+    uint64_t getPercentile(double percentile) const;
+
+private:
+    static unsigned int getBucket(uint64_t value) {
+        if (value < SUB_BUCKETS) {
+            return (value);
+        }
+        // Keep the SUB_BUCKET_BITS most significant bits of the value;
+        // "shift" is the number of discarded low-order bits (>= 1).
+        const unsigned int shift =
+            (63 - __builtin_clzll(value)) - SUB_BUCKET_BITS + 1;
+        return (shift * (SUB_BUCKETS / 2) + (value >> shift));
+    }
+    static uint64_t getHighestValue(unsigned int bucket);
+
+    uint64_t counts_[BUCKETS];
+    uint64_t total_count_;
+    uint64_t sum_;
+    uint64_t min_;
+    uint64_t max_;
+};
+
+} // end of QueryPerf
+
+#endif // __QUERYPERF_LATENCY_HISTOGRAM_H
+
+// Local Variables:
+// mode: c++
+// End:
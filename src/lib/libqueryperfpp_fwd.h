@@ -25,6 +25,13 @@ class QueryContext;
 class QueryContextCreator;
 class MessageSocket;
 class MessageManager;
+class LatencyHistogram;
+class StatsCounters;
+struct StatsSnapshot;
+class LoadProfile;
+struct LoadStepResult;
+struct ServerResult;
+struct ResponseStats;
 
 } // end of QueryPerf
 
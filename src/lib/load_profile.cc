@@ -0,0 +1,294 @@
+// Copyright (C) 2012  JINMEI Tatuya
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+// OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#include <load_profile.h>
+
+#include <boost/foreach.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+using namespace std;
+using boost::lexical_cast;
+
+namespace Queryperf {
+
+namespace {
+vector<string>
+split(const string& text, char separator) {
+    vector<string> fields;
+    string::size_type pos = 0;
+    while (true) {
+        const string::size_type end = text.find(separator, pos);
+        fields.push_back(text.substr(pos, end - pos));
+        if (end == string::npos) {
+            break;
+        }
+        pos = end + 1;
+    }
+    return (fields);
+}
+
+// Convert a field of a profile text to an unsigned integer; lexical_cast
+// would accept negative numbers.
+size_t
+parseCount(const string& field, const string& text) {
+    if (field.empty() ||
+        field.find_first_not_of("0123456789") != string::npos) {
+        throw LoadProfileError("invalid load profile: " + text);
+    }
+    try {
+        return (lexical_cast<size_t>(field));
+    } catch (const boost::bad_lexical_cast&) {
+        throw LoadProfileError("invalid load profile: " + text);
+    }
+}
+
+double
+parseNumber(const string& field, const string& text) {
+    try {
+        return (lexical_cast<double>(field));
+    } catch (const boost::bad_lexical_cast&) {
+        throw LoadProfileError("invalid load profile: " + text);
+    }
+}
+
+// Rate at the given time of a ramp from "from" to "to" over "duration".
+size_t
+getRampRate(size_t from, size_t to, size_t duration, size_t t) {
+    return (from + (static_cast<int64_t>(to) - static_cast<int64_t>(from)) *
+            static_cast<int64_t>(t) / static_cast<int64_t>(duration));
+}
+}
+
+uint64_t
+LoadStep::getDueQueries(uint64_t elapsed) const {
+    const uint64_t step_usec = static_cast<uint64_t>(duration) * 1000000;
+    if (elapsed > step_usec) {
+        elapsed = step_usec;
+    }
+    if (start_rate == end_rate) {
+        return (elapsed * start_rate / 1000000);
+    }
+    // Integral of the linearly changing rate.
+    const double t = static_cast<double>(elapsed) / 1000000;
+    const double rate_diff = static_cast<double>(end_rate) -
+        static_cast<double>(start_rate);
+    return (static_cast<uint64_t>(start_rate * t +
+                                  rate_diff * t * t / (2 * duration)));
+}
+
+double
+LoadStepResult::getLossRate() const {
+    const size_t due = queries_sent + queries_skipped;
+    if (due == 0) {
+        return (0);
+    }
+    return (static_cast<double>(due - queries_completed) * 100 / due);
+}
+
+void
+LoadStepResult::merge(const LoadStepResult& other) {
+    step.start_rate += other.step.start_rate;
+    step.end_rate += other.step.end_rate;
+    queries_sent += other.queries_sent;
+    queries_completed += other.queries_completed;
+    queries_skipped += other.queries_skipped;
+    rtt_histogram.merge(other.rtt_histogram);
+}
+
+LoadProfile::LoadProfile() :
+    search_(false), max_loss_(0), max_p99_(0), duration_(0), start_rate_(0),
+    max_rate_(0), resolution_(0), lo_rate_(0), hi_rate_(0), next_step_(0)
+{}
+
+LoadProfile
+LoadProfile::createSteps(const vector<size_t>& rates, size_t duration) {
+    if (rates.empty() || duration == 0) {
+        throw LoadProfileError("load steps need a rate and a duration");
+    }
+    LoadProfile profile;
+    BOOST_FOREACH(size_t rate, rates) {
+        profile.steps_.push_back(LoadStep(rate, rate, duration));
+    }
+    return (profile);
+}
+
+LoadProfile
+LoadProfile::createRamp(size_t from, size_t to, size_t duration,
+                        size_t n_steps)
+{
+    if (n_steps == 0 || duration < n_steps) {
+        throw LoadProfileError("a ramp needs at least one second per step");
+    }
+    LoadProfile profile;
+    for (size_t i = 0; i < n_steps; ++i) {
+        const size_t begin = duration * i / n_steps;
+        const size_t end = duration * (i + 1) / n_steps;
+        profile.steps_.push_back(
+            LoadStep(getRampRate(from, to, duration, begin),
+                     getRampRate(from, to, duration, end), end - begin));
+    }
+    return (profile);
+}
+
+LoadProfile
+LoadProfile::createSearch(double max_loss, uint64_t max_p99, size_t duration,
+                          size_t start_rate, size_t max_rate,
+                          size_t resolution)
+{
+    if (!(max_loss > 0 && max_loss <= 100) || max_p99 == 0 ||
+        duration == 0) {
+        throw LoadProfileError("invalid search criteria");
+    }
+    if (start_rate == 0 || max_rate < start_rate) {
+        throw LoadProfileError("invalid range of search");
+    }
+    LoadProfile profile;
+    profile.search_ = true;
+    profile.max_loss_ = max_loss;
+    profile.max_p99_ = max_p99;
+    profile.duration_ = duration;
+    profile.start_rate_ = start_rate;
+    profile.max_rate_ = max_rate;
+    profile.resolution_ = resolution;
+    return (profile);
+}
+
+LoadProfile
+LoadProfile::parse(const string& text) {
+    const vector<string> fields = split(text, ':');
+    if (fields[0] == "step" && fields.size() == 3) {
+        vector<size_t> rates;
+        BOOST_FOREACH(const string& rate, split(fields[1], ',')) {
+            rates.push_back(parseCount(rate, text));
+        }
+        return (createSteps(rates, parseCount(fields[2], text)));
+    }
+    if (fields[0] == "ramp" && (fields.size() == 3 || fields.size() == 4)) {
+        const vector<string> range = split(fields[1], '-');
+        if (range.size() != 2) {
+            throw LoadProfileError("invalid load profile: " + text);
+        }
+        return (createRamp(parseCount(range[0], text),
+                           parseCount(range[1], text),
+                           parseCount(fields[2], text),
+                           fields.size() == 4 ? parseCount(fields[3], text) :
+                           DEFAULT_RAMP_STEPS));
+    }
+    if (fields[0] == "search" && fields.size() >= 4 && fields.size() <= 7) {
+        const double p99_msec = parseNumber(fields[2], text);
+        return (createSearch(parseNumber(fields[1], text),
+                             static_cast<uint64_t>(p99_msec * 1000),
+                             parseCount(fields[3], text),
+                             fields.size() > 4 ? parseCount(fields[4], text) :
+                             DEFAULT_SEARCH_START,
+                             fields.size() > 5 ? parseCount(fields[5], text) :
+                             DEFAULT_SEARCH_MAX,
+                             fields.size() > 6 ?
+                             parseCount(fields[6], text) : 0));
+    }
+    throw LoadProfileError("invalid load profile: " + text);
+}
+
+LoadProfile
+LoadProfile::getShare(size_t index, size_t count) const {
+    if (search_) {
+        throw LoadProfileError("a search profile cannot be shared");
+    }
+    LoadProfile profile(*this);
+    BOOST_FOREACH(LoadStep& step, profile.steps_) {
+        step.start_rate = step.start_rate / count +
+            (index < step.start_rate % count ? 1 : 0);
+        step.end_rate = step.end_rate / count +
+            (index < step.end_rate % count ? 1 : 0);
+    }
+    return (profile);
+}
+
+string
+LoadProfile::toText() const {
+    if (search_) {
+        return ("search for the highest rate with loss < " +
+                lexical_cast<string>(max_loss_) + "% and p99 latency < " +
+                lexical_cast<string>(max_p99_ / 1000.0) + " ms, " +
+                lexical_cast<string>(duration_) + " seconds per step");
+    }
+    size_t duration = 0;
+    BOOST_FOREACH(const LoadStep& step, steps_) {
+        duration += step.duration;
+    }
+    return (lexical_cast<string>(steps_.size()) + " steps from " +
+            lexical_cast<string>(steps_.front().start_rate) + " to " +
+            lexical_cast<string>(steps_.back().end_rate) + " qps over " +
+            lexical_cast<string>(duration) + " seconds");
+}
+
+LoadStep
+LoadProfile::start() {
+    if (search_) {
+        lo_rate_ = hi_rate_ = 0;
+        return (LoadStep(start_rate_, start_rate_, duration_));
+    }
+    next_step_ = 1;
+    return (steps_.front());
+}
+
+bool
+LoadProfile::next(const LoadStepResult& result, LoadStep& step) {
+    if (!search_) {
+        if (next_step_ == steps_.size()) {
+            return (false);
+        }
+        step = steps_[next_step_++];
+        return (true);
+    }
+
+    const size_t rate = result.step.start_rate;
+    if (isAcceptable(result)) {
+        lo_rate_ = max(lo_rate_, rate);
+    } else if (hi_rate_ == 0 || rate < hi_rate_) {
+        hi_rate_ = rate;
+    }
+    size_t next_rate;
+    if (hi_rate_ == 0) {
+        // No limit found yet.
+        if (lo_rate_ >= max_rate_) {
+            return (false);
+        }
+        next_rate = min(lo_rate_ * 2, max_rate_);
+    } else {
+        const size_t resolution = resolution_ > 0 ? resolution_ :
+            max(lo_rate_ / 100, static_cast<size_t>(1));
+        if (hi_rate_ - lo_rate_ <= resolution) {
+            return (false);
+        }
+        next_rate = lo_rate_ + (hi_rate_ - lo_rate_) / 2;
+    }
+    step = LoadStep(next_rate, next_rate, duration_);
+    return (true);
+}
+
+bool
+LoadProfile::isAcceptable(const LoadStepResult& result) const {
+    if (!search_) {
+        return (true);
+    }
+    return (result.getLossRate() < max_loss_ &&
+            result.rtt_histogram.getPercentile(99) < max_p99_);
+}
+
+} // end of QueryPerf
@@ -0,0 +1,207 @@
+// Copyright (C) 2012  JINMEI Tatuya
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+// OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#ifndef __QUERYPERF_LOAD_PROFILE_H
+#define __QUERYPERF_LOAD_PROFILE_H 1
+
+#include <latency_histogram.h>
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+#include <stdint.h>
+
+namespace Queryperf {
+
+/// \brief Exception class thrown on invalid load profiles.
+class LoadProfileError : public std::runtime_error {
+public:
+    explicit LoadProfileError(const std::string& what_arg) :
+        std::runtime_error(what_arg)
+    {}
+};
+
+/// \brief A period of a load profile with a target query rate.
+///
+/// The rate changes linearly from \c start_rate to \c end_rate over the
+/// period; they are the same for a constant rate.
+struct LoadStep {
+    LoadStep() : start_rate(0), end_rate(0), duration(0) {}
+    LoadStep(size_t start, size_t end, size_t duration_sec) :
+        start_rate(start), end_rate(end), duration(duration_sec)
+    {}
+
+    size_t start_rate;          // queries per second
+    size_t end_rate;            // queries per second
+    size_t duration;            // seconds
+
+    /// \brief Return the number of queries to be sent in the first
+    /// \c elapsed microseconds of the step.
+    uint64_t getDueQueries(uint64_t elapsed) const;
+};
+
+/// \brief Statistics of a single step of a load profile.
+///
+/// Queries are counted for the step in which they are sent, even if the
+/// response arrives in a later step.
+struct LoadStepResult {
+    explicit LoadStepResult(const LoadStep& load_step) :
+        step(load_step), queries_sent(0), queries_completed(0),
+        queries_skipped(0)
+    {}
+
+    LoadStep step;
+    size_t queries_sent;
+    size_t queries_completed;
+    size_t queries_skipped;     // due but not sent as the window was full
+    LatencyHistogram rtt_histogram; // in microseconds
+
+    /// \brief Return the percentage of queries due in the step (sent or
+    /// skipped) that were not completed.
+    double getLossRate() const;
+
+    /// \brief Add the statistics of another thread for the same step.
+    void merge(const LoadStepResult& other);
+};
+
+/// \brief A sequence of target query rates for the open-loop mode.
+///
+/// A profile is either a fixed sequence of steps (constant rates or
+/// linear ramps), or a search for the highest rate at which the server
+/// meets given criteria of loss and latency.  The latter decides each
+/// step from the result of the previous one: it doubles the rate from the
+/// initial one until the criteria aren't met, and then bisects the range
+/// until it's narrow enough.
+///
+/// The user of the profile (i.e., the dispatcher) calls \c start() for the
+/// first step, and then \c next() at the end of each step with its
+/// result.
+class LoadProfile {
+public:
+    /// \brief Default initial rate of a search.
+    static const size_t DEFAULT_SEARCH_START = 1000;
+
+    /// \brief Default upper limit of the rate of a search.
+    static const size_t DEFAULT_SEARCH_MAX = 10000000;
+
+    /// \brief Default number of steps of a ramp.
+    static const size_t DEFAULT_RAMP_STEPS = 10;
+
+    /// \brief Create a profile of constant rates, each for \c duration
+    /// seconds.
+    static LoadProfile createSteps(const std::vector<size_t>& rates,
+                                   size_t duration);
+
+    /// \brief Create a profile that increases (or decreases) the rate
+    /// linearly from \c from to \c to over \c duration seconds.
+    ///
+    /// It's divided into \c n_steps steps of about the same length, which
+    /// are reported separately.
+    static LoadProfile createRamp(size_t from, size_t to, size_t duration,
+                                  size_t n_steps = DEFAULT_RAMP_STEPS);
+
+    /// \brief Create a profile that searches for the highest rate that
+    /// meets the criteria.
+    ///
+    /// A step is acceptable if less than \c max_loss percent of the queries
+    /// are lost and the 99th percentile of the latency is less than
+    /// \c max_p99 microseconds.  Each step lasts \c duration seconds.  The
+    /// search ends when the range of the highest acceptable rate is
+    /// narrower than \c resolution queries per second, or 1% of the rate
+    /// if \c resolution is 0.
+    static LoadProfile createSearch(double max_loss, uint64_t max_p99,
+                                    size_t duration,
+                                    size_t start_rate = DEFAULT_SEARCH_START,
+                                    size_t max_rate = DEFAULT_SEARCH_MAX,
+                                    size_t resolution = 0);
+
+    /// \brief Create a profile from its textual representation.
+    ///
+    /// It's one of the following (rates are in queries per second,
+    /// durations in seconds):
+    /// - step:RATE[,RATE...]:DURATION
+    /// - ramp:FROM-TO:DURATION[:STEPS]
+    /// - search:LOSS%:P99_MSEC:DURATION[:START[:MAX[:RESOLUTION]]]
+    ///
+    /// \throw LoadProfileError The text is invalid.
+    static LoadProfile parse(const std::string& text);
+
+    /// \brief Return whether it's a search profile.
+    bool isSearch() const { return (search_); }
+
+    /// \brief Return the steps of a fixed profile (empty for a search).
+    const std::vector<LoadStep>& getSteps() const { return (steps_); }
+
+    /// \brief Return the profile for one of \c count threads sharing the
+    /// load.
+    ///
+    /// Rates are evenly distributed to the threads.
+    ///
+    /// \throw LoadProfileError It's a search profile, whose steps depend
+    /// on the result of the whole.
+    LoadProfile getShare(size_t index, size_t count) const;
+
+    /// \brief Return a short description of the profile.
+    std::string toText() const;
+
+    /// \brief Start (or restart) the profile and return the first step.
+    LoadStep start();
+
+    /// \brief Decide the next step from the result of the current one.
+    ///
+    /// For a search profile, the result must include all responses to the
+    /// queries sent in the step.
+    ///
+    /// \return true if there's a next step (set in \c step); false if the
+    /// profile has finished.
+    bool next(const LoadStepResult& result, LoadStep& step);
+
+    /// \brief Return whether the result of a step meets the criteria of the
+    /// search.  It's always true for a fixed profile.
+    bool isAcceptable(const LoadStepResult& result) const;
+
+    /// \brief Return the highest acceptable rate found by a search so far
+    /// (0 if none).
+    size_t getFoundRate() const { return (lo_rate_); }
+
+private:
+    LoadProfile();
+
+    std::vector<LoadStep> steps_; // fixed profile
+    bool search_;
+
+    // Search parameters and state.  The highest acceptable rate is in
+    // [lo_rate_, hi_rate_); hi_rate_ of 0 means no unacceptable rate has
+    // been found.
+    double max_loss_;
+    uint64_t max_p99_;
+    size_t duration_;
+    size_t start_rate_;
+    size_t max_rate_;
+    size_t resolution_;
+    size_t lo_rate_;
+    size_t hi_rate_;
+
+    size_t next_step_;          // index of the next step (fixed profile)
+};
+
+} // end of QueryPerf
+
+#endif // __QUERYPERF_LOAD_PROFILE_H
+
+// Local Variables:
+// mode: c++
+// End:
@@ -15,6 +15,8 @@
 #ifndef __QUERYPERF_MESSAGE_MANAGER_H
 #define __QUERYPERF_MESSAGE_MANAGER_H 1
 
+#include <diagnostic_log.h>
+
 #include <boost/noncopyable.hpp>
 #include <boost/function.hpp>
 #include <boost/date_time/posix_time/posix_time_types.hpp>
@@ -26,6 +28,8 @@
 
 namespace Queryperf {
 
+class TLSContext;
+
 /// \brief Exception class thrown on socket related errors.
 class MessageSocketError : public std::runtime_error {
 public:
@@ -60,6 +64,14 @@ public:
     virtual ~MessageSocket() {}
 
     virtual void send(const void* data, size_t datalen) = 0;
+
+    /// \brief Return the CPU that processed the last message received on
+    /// the socket.
+    ///
+    /// It helps check whether the owner thread runs close to the receive
+    /// queue of the NIC (see \c getSocketIncomingCPU()).  It returns -1 if
+    /// it's unknown; the default implementation always returns -1.
+    virtual int getIncomingCPU() const { return (-1); }
 };
 
 /// \brief Timers that work with a \c MessageManager.
@@ -76,6 +88,27 @@ public:
     virtual void cancel() = 0;
 };
 
+/// \brief Parameters of a persistent TCP connection.
+///
+/// See \c MessageManager::createPersistentMessageSocket().
+struct StreamSocketParams {
+    StreamSocketParams() : tls_context(NULL), max_messages(0) {}
+
+    /// \brief If non NULL, messages are exchanged over TLS (DNS over TLS,
+    /// RFC 7858) with this context.  It must be valid while the socket
+    /// exists.
+    TLSContext* tls_context;
+
+    /// \brief If non 0, the connection is closed once this number of
+    /// messages have been sent and responded, and a new connection is
+    /// opened for subsequent messages (which are held until then).  Small
+    /// values make the connection setup (and the TLS handshake) dominant,
+    /// while 0 means a connection is used as long as it works.  Note that
+    /// the connection is kept if the server doesn't respond to some of
+    /// the messages, until it's closed by the server.
+    size_t max_messages;
+};
+
 class MessageManager : private boost::noncopyable {
 protected:
     MessageManager() {}
@@ -95,15 +128,85 @@ public:
         void* recvbuf, size_t recvbuf_len,
         MessageSocket::Callback callback) = 0;
 
+    /// \brief Create a socket for a persistent TCP connection.
+    ///
+    /// Unlike the TCP sockets created by \c createMessageSocket(), which
+    /// open a new connection for every query, the returned socket keeps a
+    /// single connection to the server open and sends any number of
+    /// messages over it.  \c send() doesn't wait for responses to previous
+    /// messages (pipelining, as described in RFC 7766), and the given data
+    /// are copied, so they don't have to be kept valid after the call.
+    /// The connection is established on the first \c send().
+    ///
+    /// The callback is called for each complete DNS message received on
+    /// the connection, in the order of arrival (which may be different
+    /// from the order of the queries).  The data given to the callback is
+    /// stored in an internal buffer of the socket, and is valid only during
+    /// the callback.  If the connection fails or is closed by the server,
+    /// the callback is called with NULL data of length 0; the data queued
+    /// but not yet sent are discarded, and the next \c send() opens a new
+    /// connection.  The socket must not be destroyed within the callback.
+    ///
+    /// The connection can be secured with TLS, and can be reopened after a
+    /// given number of messages, as specified in \c params.  These are
+    /// transparent to the owner, except that a failure of the TLS
+    /// handshake is reported like other failures of the connection.
+    ///
+    /// The default implementation throws \c MessageSocketError.
+    ///
+    /// \param address Textual representation of the destination (IPv6 or
+    ///        IPv4) address.
+    /// \param port The destination TCP port.
+    /// \param params Other parameters of the connection.
+    /// \param callback The callback function or functor that is to be called
+    ///        when a complete message is received or the connection is
+    ///        closed.
+    virtual MessageSocket* createPersistentMessageSocket(
+        const std::string& /*address*/, uint16_t /*port*/,
+        const StreamSocketParams& /*params*/,
+        MessageSocket::Callback /*callback*/)
+    {
+        throw MessageSocketError("persistent TCP connections are not "
+                                 "supported");
+    }
+
     /// \brief Create a timer object.
     virtual MessageTimer* createMessageTimer(
         MessageTimer::Callback callback) = 0;
 
+    /// \brief Create a timer object for coarse-grained timeouts.
+    ///
+    /// The returned timer works the same way as those created by
+    /// \c createMessageTimer(), except that it may expire later than
+    /// specified (by an implementation specific tick interval).  In return,
+    /// starting and canceling it should be cheaper, so it's suitable for a
+    /// large number of timers that are frequently restarted, such as
+    /// per-query timeouts.
+    ///
+    /// The default implementation simply calls \c createMessageTimer().
+    virtual MessageTimer* createCoarseMessageTimer(
+        MessageTimer::Callback callback)
+    {
+        return (createMessageTimer(callback));
+    }
+
     /// \brief Start the main event loop.
     virtual void run() = 0;
 
     /// \brief Stop the event loop.
     virtual void stop() = 0;
+
+    /// \brief Return the log of diagnostic messages on failures of the
+    /// sockets of the manager.
+    ///
+    /// The owner of the manager can use it for its own messages, and
+    /// enable it with \c DiagnosticLog::setRate() (it's disabled by
+    /// default).  Failures are reported to the owner via the socket
+    /// callbacks in any case.
+    DiagnosticLog& getDiagnosticLog() { return (diag_log_); }
+
+private:
+    DiagnosticLog diag_log_;
 };
 
 } // end of QueryPerf
@@ -0,0 +1,41 @@
+// Copyright (C) 2012  JINMEI Tatuya
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+// OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#ifndef __QUERYPERF_MONOTONIC_TIME_H
+#define __QUERYPERF_MONOTONIC_TIME_H 1
+
+#include <stdint.h>
+#include <time.h>
+
+namespace Queryperf {
+
+/// \brief Return the current time of the monotonic clock in microseconds.
+///
+/// This is used for measuring round-trip times and for managing timers
+/// in the message managers that don't rely on ASIO.  Unlike the boost
+/// clocks it's cheap and isn't affected by adjustments of the system time.
+inline uint64_t
+getMonotonicTime() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (static_cast<uint64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000);
+}
+
+} // end of QueryPerf
+
+#endif // __QUERYPERF_MONOTONIC_TIME_H
+
+// Local Variables:
+// mode: c++
+// End:
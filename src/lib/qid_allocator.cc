@@ -0,0 +1,91 @@
+// Copyright (C) 2012  JINMEI Tatuya
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+// OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#include <qid_allocator.h>
+
+#include <cassert>
+
+namespace Queryperf {
+
+const size_t QidAllocator::QID_SPACE;
+const uint32_t QidAllocator::NONE;
+
+QidAllocator::QidAllocator(size_t size) :
+    size_(size), free_(size), free_head_(0), free_count_(size),
+    queued_(size, true), quarantine_head_(NONE), quarantine_tail_(NONE),
+    quarantine_prev_(size, NONE), quarantine_next_(size, NONE),
+    states_(size, FREE), probes_(0)
+{
+    assert(size > 0 && size <= QID_SPACE);
+    for (size_t i = 0; i < size; ++i) {
+        free_[i] = i;
+    }
+}
+
+void
+QidAllocator::release(uint16_t qid) {
+    if (states_[qid] == QUARANTINED) {
+        unlinkQuarantined(qid);
+    }
+    states_[qid] = FREE;
+    if (!queued_[qid]) {
+        free_[(free_head_ + free_count_) % size_] = qid;
+        ++free_count_;
+        queued_[qid] = true;
+    }
+}
+
+void
+QidAllocator::quarantine(uint16_t qid) {
+    if (states_[qid] == QUARANTINED) {
+        unlinkQuarantined(qid);  // it moves to the end
+    }
+    states_[qid] = QUARANTINED;
+    quarantine_prev_[qid] = quarantine_tail_;
+    quarantine_next_[qid] = NONE;
+    if (quarantine_tail_ == NONE) {
+        quarantine_head_ = qid;
+    } else {
+        quarantine_next_[quarantine_tail_] = qid;
+    }
+    quarantine_tail_ = qid;
+}
+
+void
+QidAllocator::unlinkQuarantined(uint16_t qid) {
+    const uint32_t prev = quarantine_prev_[qid];
+    const uint32_t next = quarantine_next_[qid];
+    if (prev == NONE) {
+        quarantine_head_ = next;
+    } else {
+        quarantine_next_[prev] = next;
+    }
+    if (next == NONE) {
+        quarantine_tail_ = prev;
+    } else {
+        quarantine_prev_[next] = prev;
+    }
+}
+
+uint16_t
+QidAllocator::allocateQuarantined() {
+    assert(quarantine_head_ != NONE); // otherwise all QIDs are in use
+    const uint16_t qid = quarantine_head_;
+    ++probes_;
+    unlinkQuarantined(qid);
+    states_[qid] = IN_USE;
+    return (qid);
+}
+
+} // end of QueryPerf
@@ -0,0 +1,139 @@
+// Copyright (C) 2012  JINMEI Tatuya
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+// OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#ifndef __QUERYPERF_QID_ALLOCATOR_H
+#define __QUERYPERF_QID_ALLOCATOR_H 1
+
+#include <cstddef>
+#include <vector>
+
+#include <stdint.h>
+
+namespace Queryperf {
+
+/// \brief The QIDs of a single socket, from which those for new queries
+/// are chosen.
+///
+/// A QID is either in use (by an outstanding query), free, or quarantined:
+/// its query has timed out, so a late response to it may still come and
+/// would be taken for the response to a new query of the same QID.  Free
+/// QIDs are kept in a FIFO list in the order they are released, and
+/// quarantined ones in another FIFO list in the order of the timeouts,
+/// from which a QID is removed as soon as it's released.  Each list has at
+/// most one entry per QID.
+/// \c allocate() takes the least recently released free QID, or, only if
+/// there's none, the QID that has been quarantined for the longest time.
+/// Each operation is O(1) (amortized for \c allocate()), regardless of how
+/// many QIDs are in use or quarantined.
+///
+/// Only the QIDs below a given size are used, so that the memory for a
+/// socket sending a small number of queries at a time can be small.
+/// Initially all of them are free, and they are allocated in ascending
+/// order.
+class QidAllocator {
+public:
+    /// \brief The number of all 16-bit QIDs, the maximum size.
+    static const size_t QID_SPACE = 65536;
+
+    /// \brief Constructor.
+    ///
+    /// \param size The number of QIDs used (1 to \c QID_SPACE).
+    explicit QidAllocator(size_t size = QID_SPACE);
+
+    /// \brief Return the number of QIDs used.
+    size_t getSize() const { return (size_); }
+
+    /// \brief Take a QID that is not in use.
+    ///
+    /// At least one QID must be free or quarantined; otherwise the
+    /// behavior is undefined.
+    uint16_t allocate() {
+        while (free_count_ > 0) {
+            const uint16_t qid = free_[free_head_];
+            free_head_ = (free_head_ + 1) % size_;
+            --free_count_;
+            ++probes_;
+            queued_[qid] = false;
+            // It may have been reserved since it was released.
+            if (states_[qid] == FREE) {
+                states_[qid] = IN_USE;
+                return (qid);
+            }
+        }
+        return (allocateQuarantined());
+    }
+
+    /// \brief Take the given QID if it's free.
+    ///
+    /// \return true if the QID is free and is now in use; false otherwise
+    /// (including the case it's not below the size).
+    bool reserve(uint16_t qid) {
+        if (qid >= size_ || states_[qid] != FREE) {
+            return (false);
+        }
+        states_[qid] = IN_USE;
+        return (true);
+    }
+
+    /// \brief Make the given QID free, i.e., its query has completed (or a
+    /// late response to it has come).
+    ///
+    /// The QID must be below the size.
+    void release(uint16_t qid);
+
+    /// \brief Quarantine the given QID, i.e., its query has timed out.
+    ///
+    /// The QID must be below the size.
+    void quarantine(uint16_t qid);
+
+    /// \brief Return the total number of list entries examined by
+    /// \c allocate() (mainly for tests).
+    uint64_t getProbeCount() const { return (probes_); }
+
+private:
+    enum State { FREE = 0, IN_USE, QUARANTINED };
+
+    // The end of the quarantine list (an invalid QID).
+    static const uint32_t NONE = QID_SPACE;
+
+    uint16_t allocateQuarantined();
+    void unlinkQuarantined(uint16_t qid);
+
+    size_t size_;
+
+    // Free QIDs in a ring buffer.  A QID appears at most once (queued_);
+    // it may have been reserved since then, in which case it's skipped.
+    std::vector<uint16_t> free_;
+    size_t free_head_;
+    size_t free_count_;
+    std::vector<bool> queued_;
+
+    // Quarantined QIDs in a doubly linked list indexed by QID, so that a
+    // released one is removed in constant time.
+    uint32_t quarantine_head_;
+    uint32_t quarantine_tail_;
+    std::vector<uint32_t> quarantine_prev_;
+    std::vector<uint32_t> quarantine_next_;
+
+    std::vector<uint8_t> states_;
+    uint64_t probes_;
+};
+
+} // end of QueryPerf
+
+#endif // __QUERYPERF_QID_ALLOCATOR_H
+
+// Local Variables:
+// mode: c++
+// End:
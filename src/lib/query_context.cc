@@ -18,6 +18,10 @@
 #include <dns/message.h>
 #include <dns/messagerenderer.h>
 
+#include <vector>
+
+#include <stdint.h>
+
 using namespace bundy::dns;
 
 namespace Queryperf {
@@ -30,6 +34,7 @@ struct QueryContext::QueryContextImpl {
     QueryRepository* repository_;
     Message query_msg_;
     MessageRenderer query_renderer_;
+    std::vector<uint8_t> query_data_; // copy of a preloaded query
 };
 
 QueryContext::QueryContext(QueryRepository& repository) :
@@ -43,10 +48,32 @@ QueryContext::~QueryContext() {
 QueryContext::QuerySpec
 QueryContext::start(qid_t qid) {
     int protocol;
+
+    // If queries are preloaded, we only have to copy the pre-rendered data
+    // and patch the QID.
+    size_t len;
+    const uint8_t* data = static_cast<const uint8_t*>(
+        impl_->repository_->getNextQueryData(len, protocol));
+    if (data != NULL) {
+        impl_->query_data_.assign(data, data + len);
+        impl_->query_data_[0] = qid >> 8;
+        impl_->query_data_[1] = qid & 0xff;
+        impl_->repository_->expandQnameTemplates(&impl_->query_data_[0], len);
+        return (QuerySpec(protocol, &impl_->query_data_[0], len));
+    }
+
     impl_->repository_->getNextQuery(impl_->query_msg_, protocol);
     impl_->query_msg_.setQid(qid);
     impl_->query_renderer_.clear();
     impl_->query_msg_.toWire(impl_->query_renderer_);
+    if (impl_->repository_->hasQnameTemplates()) {
+        // The rendered data can't be modified, so it's copied.
+        data = static_cast<const uint8_t*>(impl_->query_renderer_.getData());
+        len = impl_->query_renderer_.getLength();
+        impl_->query_data_.assign(data, data + len);
+        impl_->repository_->expandQnameTemplates(&impl_->query_data_[0], len);
+        return (QuerySpec(protocol, &impl_->query_data_[0], len));
+    }
     return (QuerySpec(protocol, impl_->query_renderer_.getData(),
                       impl_->query_renderer_.getLength()));
 }
@@ -13,10 +13,12 @@
 // PERFORMANCE OF THIS SOFTWARE.
 
 #include <query_repository.h>
+#include <query_sampler.h>
 
 #include <dns/name.h>
 #include <dns/edns.h>
 #include <dns/message.h>
+#include <dns/messagerenderer.h>
 #include <dns/opcode.h>
 #include <dns/rcode.h>
 #include <dns/rdata.h>
@@ -25,27 +27,86 @@
 #include <dns/rrttl.h>
 #include <dns/question.h>
 
+#include <util/buffer.h>
+
+#include <boost/bind.hpp>
 #include <boost/foreach.hpp>
+#include <boost/function.hpp>
 #include <boost/lexical_cast.hpp>
+#include <boost/noncopyable.hpp>
 #include <boost/scoped_ptr.hpp>
+#include <boost/shared_ptr.hpp>
 
+#include <deque>
 #include <istream>
 #include <fstream>
 #include <string>
 #include <map>
 #include <vector>
 
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+
 #include <netinet/in.h>
 
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+
 using namespace std;
 using boost::lexical_cast;
 using boost::scoped_ptr;
 using namespace bundy::dns;
+using Queryperf::QueryRepositoryError;
+using Queryperf::QuerySampler;
+using Queryperf::RandomGenerator;
 
 namespace {
 // an ad hoc threadshold to prevent a busy loop due to an empty input file.
 const size_t MAX_EMPTY_LOOP = 1000;
 
+// Number of queries in a chunk of streamed queries, and number of chunks
+// per repository using the stream.
+const size_t STREAM_CHUNK_QUERIES = 256;
+const size_t STREAM_CHUNKS_PER_CONSUMER = 4;
+
+// Return 64 bits of entropy for this run, from /dev/urandom if possible.
+uint64_t
+getRunEntropy() {
+    uint64_t entropy = 0;
+    const int fd = open("/dev/urandom", O_RDONLY);
+    if (fd != -1) {
+        const ssize_t cc = read(fd, &entropy, sizeof(entropy));
+        close(fd);
+        if (cc == static_cast<ssize_t>(sizeof(entropy))) {
+            return (entropy);
+        }
+    }
+    return ((static_cast<uint64_t>(getpid()) << 32) ^ time(NULL));
+}
+
+// Return the seed of the random numbers of a new repository: the entropy
+// of the run mixed with the number of repositories created before, so
+// that the repositories of different threads (and of different runs)
+// generate different sequences.
+uint64_t
+getRepositorySeed() {
+    static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+    static uint64_t entropy = 0;
+    static uint64_t count = 0;
+    pthread_mutex_lock(&mutex);
+    if (count == 0) {
+        entropy = getRunEntropy();
+    }
+    const uint64_t seed = entropy + count++;
+    pthread_mutex_unlock(&mutex);
+    return (seed);
+}
+
 // Set of parameters of a request (mostly query, but may be of a different
 // opcode)
 struct RequestParam {
@@ -73,24 +134,526 @@ struct RequestParam {
     vector<RRsetPtr> authorities;
     bool use_dnssec;
     bool use_edns;
+    vector<uint8_t> templates;  // encoded qname templates, empty if none
 };
 
+// Build a query message for the request parameters.
+void
+buildQueryMessage(const RequestParam& param, const EDNSPtr& edns,
+                  Message& query_msg)
+{
+    query_msg.clear(Message::RENDER);
+    query_msg.setOpcode(Opcode::QUERY());
+    query_msg.setRcode(Rcode::NOERROR());
+    query_msg.setHeaderFlag(Message::HEADERFLAG_RD);
+    query_msg.addQuestion(param.question);
+    BOOST_FOREACH(const RRsetPtr rrset, param.authorities) {
+        query_msg.addRRset(Message::SECTION_AUTHORITY, rrset);
+    }
+    if (param.use_edns || param.use_dnssec) {
+        query_msg.setEDNS(edns);
+    }
+}
+
 struct QueryOptions {
     QueryOptions() {
         clear();
     }
     void clear() {
         serial = 0;
+        weight = 1;
+        templates.clear();
     }
     uint32_t serial;         // querier's serial, only useful for IXFR
+    double weight;           // only useful for the weighted selection
+    vector<uint8_t> templates; // qname templates (not really an option)
+};
+
+// Preloaded queries are kept in the "compiled" format below, which is also
+// the format of compiled query files, so the latter can simply be mapped
+// into memory.  All integers are in network byte order.
+//
+// Header (HEADER_LEN bytes):
+//   0: magic (COMPILED_MAGIC)
+//   4: format version (uint16, COMPILED_VERSION)
+//   6: flags of the default EDNS policy (uint8, FLAG_xxx)
+//   7: default transport protocol (uint8, IPPROTO_xxx)
+//   8: default query class (uint16)
+//  10: reserved (6 bytes)
+//  16: number of queries (uint64)
+// Index (INDEX_ENTRY_LEN bytes for each query):
+//   offset of the query record from the beginning of the data (uint64)
+// Query records:
+//   transport protocol (uint8), flags of the EDNS policy (uint8),
+//   length of the query (uint16), followed by the query in wire format
+//   (with QID 0), followed by its qname templates if FLAG_TEMPLATE is set
+//   in the flags
+const char COMPILED_MAGIC[] = { 'Q', 'P', 'P', 'B' };
+const uint16_t COMPILED_VERSION = 1;
+const size_t HEADER_LEN = 24;
+const size_t INDEX_ENTRY_LEN = 8;
+const size_t RECORD_HEADER_LEN = 4;
+const uint8_t FLAG_EDNS = 0x01;
+const uint8_t FLAG_DNSSEC = 0x02;
+const uint8_t FLAG_TEMPLATE = 0x04;
+
+// Qname templates are parts of the query name replaced with random
+// characters or a sequence number every time the query is sent, by
+// overwriting placeholders of the same length in the wire data.  They're
+// encoded as the number of templates (uint8), followed by TEMPLATE_LEN
+// bytes for each: offset of the placeholder in the query (uint16), type
+// (uint8, TEMPLATE_xxx) and length (uint8).
+const uint8_t TEMPLATE_RAND = 1;
+const uint8_t TEMPLATE_SEQ = 2;
+const size_t TEMPLATE_LEN = 4;
+const size_t MAX_RAND_LEN = 63;         // the maximum label length
+const size_t DEFAULT_SEQ_LEN = 10;
+const size_t MAX_SEQ_LEN = 19;          // 10^19 fits in uint64_t
+// Characters of random templates; 32 of them so each takes 5 random bits.
+const char RAND_CHARS[] = "0123456789abcdefghijklmnopqrstuv";
+
+void
+writeUint(vector<uint8_t>& buffer, size_t pos, uint64_t value, size_t len) {
+    for (size_t i = len; i > 0; --i) {
+        buffer[pos + i - 1] = value & 0xff;
+        value >>= 8;
+    }
+}
+
+uint64_t
+readUint(const uint8_t* data, size_t len) {
+    uint64_t value = 0;
+    for (size_t i = 0; i < len; ++i) {
+        value = (value << 8) | data[i];
+    }
+    return (value);
+}
+
+// Split a line into tokens separated by white spaces, which is much
+// faster than a stringstream.  The first tokens of the vector are
+// replaced (reusing their memory), and the number of tokens is returned.
+size_t
+tokenize(const string& line, vector<string>& tokens) {
+    const char* const spaces = " \t\n\v\f\r";
+    size_t count = 0;
+    size_t pos = line.find_first_not_of(spaces);
+    while (pos != string::npos) {
+        const size_t end = line.find_first_of(spaces, pos);
+        if (count == tokens.size()) {
+            tokens.push_back(string());
+        }
+        tokens[count++].assign(line, pos,
+                               end == string::npos ? end : end - pos);
+        pos = line.find_first_not_of(spaces, end);
+    }
+    return (count);
+}
+
+uint8_t
+getEDNSFlags(bool use_edns, bool use_dnssec) {
+    return ((use_edns ? FLAG_EDNS : 0) | (use_dnssec ? FLAG_DNSSEC : 0));
+}
+
+// Parse the templates in a textual query name, e.g., "{rand:8}" in
+// "{rand:8}.example.com".  It returns the name with the placeholders in
+// place of the templates, and appends the encoded templates to templates.
+string
+parseQnameTemplates(const string& qname_text, vector<uint8_t>& templates) {
+    if (qname_text.find('\\') != string::npos) {
+        throw QueryRepositoryError("escapes can't be used in a query name "
+                                   "with templates");
+    }
+    string name;
+    size_t count = 0;
+    templates.assign(1, 0);
+    for (size_t pos = 0; pos < qname_text.size(); ++pos) {
+        if (qname_text[pos] != '{') {
+            name.push_back(qname_text[pos]);
+            continue;
+        }
+        const size_t end = qname_text.find('}', pos);
+        if (end == string::npos) {
+            throw QueryRepositoryError("unterminated qname template");
+        }
+        const string spec = qname_text.substr(pos + 1, end - pos - 1);
+        const size_t colon = spec.find(':');
+        const string type = spec.substr(0, colon);
+        size_t len;
+        if (type == "rand" && colon != string::npos) {
+            len = lexical_cast<size_t>(spec.substr(colon + 1));
+            if (len == 0 || len > MAX_RAND_LEN) {
+                throw QueryRepositoryError("invalid qname template: " + spec);
+            }
+        } else if (type == "seq") {
+            len = colon == string::npos ? DEFAULT_SEQ_LEN :
+                lexical_cast<size_t>(spec.substr(colon + 1));
+            if (len == 0 || len > MAX_SEQ_LEN) {
+                throw QueryRepositoryError("invalid qname template: " + spec);
+            }
+        } else {
+            throw QueryRepositoryError("unknown qname template: " + spec);
+        }
+
+        // Without escapes, each character of the text follows the same
+        // number of bytes in the wire format (the label lengths replacing
+        // the dots), plus the first label length and the DNS header.
+        const size_t offset = 12 + 1 + name.size();
+        templates.resize(templates.size() + TEMPLATE_LEN);
+        writeUint(templates, templates.size() - TEMPLATE_LEN, offset, 2);
+        templates[templates.size() - 2] =
+            type == "rand" ? TEMPLATE_RAND : TEMPLATE_SEQ;
+        templates[templates.size() - 1] = len;
+        name.append(len, type == "rand" ? 'a' : '0');
+        ++count;
+        pos = end;
+    }
+    // A name has at most 255 bytes, so the count fits.
+    templates[0] = count;
+    return (name);
+}
+
+// Render the query of the parameters, and append it to the buffer as a
+// query record of the compiled format.
+void
+appendQueryRecord(vector<uint8_t>& buffer, const RequestParam& param,
+                  const EDNSPtr& edns, Message& query_msg,
+                  MessageRenderer& renderer)
+{
+    buildQueryMessage(param, edns, query_msg);
+    query_msg.setQid(0);
+    renderer.clear();
+    query_msg.toWire(renderer);
+
+    const size_t offset = buffer.size();
+    buffer.resize(offset + RECORD_HEADER_LEN);
+    buffer[offset] = param.proto;
+    buffer[offset + 1] = getEDNSFlags(param.use_edns, param.use_dnssec);
+    writeUint(buffer, offset + 2, renderer.getLength(), 2);
+    const uint8_t* data = static_cast<const uint8_t*>(renderer.getData());
+    buffer.insert(buffer.end(), data, data + renderer.getLength());
+    if (!param.templates.empty()) {
+        buffer[offset + 1] |= FLAG_TEMPLATE;
+        buffer.insert(buffer.end(), param.templates.begin(),
+                      param.templates.end());
+    }
+}
+
+// Preloaded queries.  Once loaded they're never modified, so they can be
+// shared by multiple repositories (possibly in different threads).
+class PreloadedQueries : private boost::noncopyable {
+public:
+    // Render the parsed queries into an internal buffer.
+    // params will be swapped with an empty vector.
+    PreloadedQueries(vector<RequestParam>& params, RRClass qclass,
+                     bool use_edns, bool use_dnssec, int proto,
+                     const EDNSPtr& edns);
+
+    // Map a compiled query file (already opened) into memory.
+    PreloadedQueries(const string& file, int fd);
+
+    // Make a private copy of other preloaded queries in memory allocated by
+    // the calling thread.
+    explicit PreloadedQueries(const PreloadedQueries& source) :
+        boost::noncopyable(), params_(source.params_),
+        buffer_(source.data_, source.data_ + source.len_),
+        data_(&buffer_[0]), len_(source.len_), count_(source.count_),
+        mapped_(false)
+    {}
+
+    ~PreloadedQueries() {
+        if (mapped_) {
+            munmap(const_cast<uint8_t*>(data_), len_);
+        }
+    }
+
+    size_t getCount() const { return (count_); }
+    uint8_t getFlags() const { return (data_[6]); }
+    int getProtocol() const { return (data_[7]); }
+    RRClass getQueryClass() const {
+        return (RRClass(static_cast<uint16_t>(readUint(&data_[8], 2))));
+    }
+
+    // Return the wire data of the index-th query with its attributes.
+    const uint8_t* getQuery(size_t index, size_t& len, int& proto,
+                            uint8_t& flags) const
+    {
+        const uint64_t offset =
+            readUint(&data_[HEADER_LEN + index * INDEX_ENTRY_LEN],
+                     INDEX_ENTRY_LEN);
+        if (offset > len_ - RECORD_HEADER_LEN) {
+            throw QueryRepositoryError("broken compiled query data");
+        }
+        const uint8_t* record = &data_[offset];
+        proto = record[0];
+        flags = record[1];
+        len = readUint(&record[2], 2);
+        if (len > len_ - offset - RECORD_HEADER_LEN) {
+            throw QueryRepositoryError("broken compiled query data");
+        }
+        return (record + RECORD_HEADER_LEN);
+    }
+
+    // Return the qname templates of a query returned by getQuery(), or
+    // NULL if it has none.
+    const uint8_t* getTemplates(const uint8_t* query, size_t len,
+                                uint8_t flags) const
+    {
+        if ((flags & FLAG_TEMPLATE) == 0) {
+            return (NULL);
+        }
+        const size_t pos = (query - data_) + len;
+        if (pos >= len_ || len_ - pos - 1 < data_[pos] * TEMPLATE_LEN) {
+            throw QueryRepositoryError("broken compiled query data");
+        }
+        return (&data_[pos]);
+    }
+
+    // Return the parameters of the index-th query.  Only available if the
+    // queries were parsed from text; otherwise NULL is returned.
+    const RequestParam* getParam(size_t index) const {
+        return (params_.empty() ? NULL : &params_[index]);
+    }
+
+    // Return the whole data in the compiled format.
+    const uint8_t* getData(size_t& len) const {
+        len = len_;
+        return (data_);
+    }
+
+private:
+    vector<RequestParam> params_;
+    vector<uint8_t> buffer_;    // holds data_ unless mapped_
+    const uint8_t* data_;
+    size_t len_;
+    uint64_t count_;
+    bool mapped_;
+};
+typedef boost::shared_ptr<const PreloadedQueries> ConstPreloadedQueriesPtr;
+
+PreloadedQueries::PreloadedQueries(vector<RequestParam>& params,
+                                   RRClass qclass, bool use_edns,
+                                   bool use_dnssec, int proto,
+                                   const EDNSPtr& edns) :
+    buffer_(HEADER_LEN + params.size() * INDEX_ENTRY_LEN),
+    count_(params.size()), mapped_(false)
+{
+    params_.swap(params);
+    memcpy(&buffer_[0], COMPILED_MAGIC, sizeof(COMPILED_MAGIC));
+    writeUint(buffer_, 4, COMPILED_VERSION, 2);
+    buffer_[6] = getEDNSFlags(use_edns, use_dnssec);
+    buffer_[7] = proto;
+    writeUint(buffer_, 8, qclass.getCode(), 2);
+    writeUint(buffer_, 16, count_, 8);
+
+    // Render all queries in the buffer, so we don't have to do it for every
+    // query sent.
+    Message query_msg(Message::RENDER);
+    MessageRenderer renderer;
+    for (size_t i = 0; i < params_.size(); ++i) {
+        writeUint(buffer_, HEADER_LEN + i * INDEX_ENTRY_LEN, buffer_.size(),
+                  INDEX_ENTRY_LEN);
+        appendQueryRecord(buffer_, params_[i], edns, query_msg, renderer);
+    }
+
+    data_ = &buffer_[0];
+    len_ = buffer_.size();
+}
+
+PreloadedQueries::PreloadedQueries(const string& file, int fd) :
+    data_(NULL), len_(0), count_(0), mapped_(false)
+{
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        throw QueryRepositoryError("failed to get size of compiled query "
+                                   "file: " + file + ": " + strerror(errno));
+    }
+    len_ = st.st_size;
+    if (len_ < HEADER_LEN) {
+        throw QueryRepositoryError("broken compiled query file: " + file);
+    }
+    void* addr = mmap(NULL, len_, PROT_READ, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+        throw QueryRepositoryError("failed to map compiled query file: " +
+                                   file + ": " + strerror(errno));
+    }
+    data_ = static_cast<const uint8_t*>(addr);
+    mapped_ = true;
+
+    // Only the header and the size of the index are checked here, so the
+    // loading time doesn't depend on the number of queries; query records
+    // are checked when they are used.
+    count_ = readUint(&data_[16], 8);
+    if (memcmp(data_, COMPILED_MAGIC, sizeof(COMPILED_MAGIC)) != 0 ||
+        readUint(&data_[4], 2) != COMPILED_VERSION || count_ == 0 ||
+        count_ > (len_ - HEADER_LEN) / INDEX_ENTRY_LEN) {
+        munmap(addr, len_);
+        throw QueryRepositoryError("broken or unsupported compiled query "
+                                   "file: " + file);
+    }
+}
+
+// Queries parsed ahead by a background thread when they aren't preloaded.
+// The thread renders the queries into chunks in the compiled record format,
+// and the repositories using the stream (possibly in different threads)
+// take ready chunks one by one, so the lock is taken only once per chunk
+// and sending a query never waits for parsing unless the thread falls
+// behind.
+class QueryStream : private boost::noncopyable {
+public:
+    // Parse the next query of the input.
+    typedef boost::function<void(RequestParam&)> Parser;
+
+    struct Chunk {
+        vector<uint8_t> data;   // query records
+    };
+
+    QueryStream(const Parser& parser, const EDNSPtr& edns) :
+        parser_(parser), edns_(edns), running_(false), stopping_(false)
+    {
+        pthread_mutex_init(&mutex_, NULL);
+        pthread_cond_init(&cond_, NULL);
+    }
+
+    ~QueryStream() {
+        stop();
+        pthread_cond_destroy(&cond_);
+        pthread_mutex_destroy(&mutex_);
+    }
+
+    // Start the parser thread.
+    void start() {
+        const int error = pthread_create(&thread_, NULL, run, this);
+        if (error != 0) {
+            throw QueryRepositoryError(string("failed to start query "
+                                              "stream: ") + strerror(error));
+        }
+        running_ = true;
+    }
+
+    // Stop the parser thread; the parser is never called after this.
+    void stop() {
+        if (running_) {
+            pthread_mutex_lock(&mutex_);
+            stopping_ = true;
+            pthread_cond_broadcast(&cond_);
+            pthread_mutex_unlock(&mutex_);
+            pthread_join(thread_, NULL);
+            running_ = false;
+        }
+    }
+
+    // Add chunks for a new repository using the stream.
+    void addConsumer() {
+        pthread_mutex_lock(&mutex_);
+        for (size_t i = 0; i < STREAM_CHUNKS_PER_CONSUMER; ++i) {
+            chunks_.push_back(boost::shared_ptr<Chunk>(new Chunk));
+            free_.push_back(chunks_.back().get());
+        }
+        pthread_cond_broadcast(&cond_);
+        pthread_mutex_unlock(&mutex_);
+    }
+
+    // Return a chunk of ready queries, waiting for one if necessary.  The
+    // chunk used so far, if any, is given back to be filled again.
+    Chunk* getChunk(Chunk* used);
+
+private:
+    static void* run(void* arg);
+
+    const Parser parser_;
+    const EDNSPtr edns_;
+    vector<boost::shared_ptr<Chunk> > chunks_;
+    // Everything below is protected by mutex_ once the thread starts
+    deque<Chunk*> free_;        // chunks to be filled by the thread
+    deque<Chunk*> ready_;       // chunks filled with queries
+    string error_;              // set if the thread failed to read queries
+    pthread_t thread_;
+    bool running_;
+    bool stopping_;
+    pthread_mutex_t mutex_;
+    pthread_cond_t cond_;
 };
+
+void*
+QueryStream::run(void* arg) {
+    QueryStream* stream = static_cast<QueryStream*>(arg);
+    Message query_msg(Message::RENDER);
+    MessageRenderer renderer;
+    RequestParam param;
+
+    pthread_mutex_lock(&stream->mutex_);
+    while (!stream->stopping_ && stream->error_.empty()) {
+        if (stream->free_.empty()) {
+            pthread_cond_wait(&stream->cond_, &stream->mutex_);
+            continue;
+        }
+        Chunk* chunk = stream->free_.front();
+        stream->free_.pop_front();
+        pthread_mutex_unlock(&stream->mutex_);
+
+        // Queries are parsed and rendered without the lock.
+        string error;
+        chunk->data.clear();
+        try {
+            for (size_t i = 0; i < STREAM_CHUNK_QUERIES; ++i) {
+                stream->parser_(param);
+                appendQueryRecord(chunk->data, param, stream->edns_,
+                                  query_msg, renderer);
+            }
+        } catch (const std::exception& ex) {
+            error = ex.what();
+            if (error.empty()) {
+                error = "unknown error";
+            }
+        }
+
+        pthread_mutex_lock(&stream->mutex_);
+        if (!chunk->data.empty()) {
+            stream->ready_.push_back(chunk);
+        } else {
+            stream->free_.push_back(chunk);
+        }
+        stream->error_ = error;
+        pthread_cond_broadcast(&stream->cond_);
+    }
+    pthread_mutex_unlock(&stream->mutex_);
+    return (NULL);
+}
+
+QueryStream::Chunk*
+QueryStream::getChunk(Chunk* used) {
+    pthread_mutex_lock(&mutex_);
+    if (used != NULL) {
+        free_.push_back(used);
+        pthread_cond_broadcast(&cond_);
+    }
+    while (ready_.empty() && error_.empty() && !stopping_) {
+        pthread_cond_wait(&cond_, &mutex_);
+    }
+    if (ready_.empty()) {
+        // Queries parsed before a failure have all been used.
+        const string error = error_.empty() ? "query stream stopped" :
+            "failed to read queries: " + error_;
+        pthread_mutex_unlock(&mutex_);
+        throw QueryRepositoryError(error);
+    }
+    Chunk* chunk = ready_.front();
+    ready_.pop_front();
+    pthread_mutex_unlock(&mutex_);
+    return (chunk);
+}
+typedef boost::shared_ptr<QueryStream> QueryStreamPtr;
 }
 
 namespace Queryperf {
 
 struct QueryRepository::QueryRepositoryImpl {
     QueryRepositoryImpl(istream& input) :
-        qclass_(RRClass::IN()), input_(input)
+        qclass_(RRClass::IN()), input_(input), compiled_(false),
+        selection_(SELECT_SEQUENTIAL), zipf_exponent_(1),
+        rng_(getRepositorySeed()), last_templates_(NULL), seq_(0),
+        seq_step_(1), stream_owner_(false), chunk_(NULL),
+        chunk_pos_(0), parse_msg_(Message::PARSE)
     {
         initialize();
     }
@@ -98,11 +661,39 @@ struct QueryRepository::QueryRepositoryImpl {
     QueryRepositoryImpl(const string& input_file) :
         qclass_(RRClass::IN()),
         input_ifs_(new ifstream(input_file.c_str())),
-        input_(*input_ifs_)
+        input_(*input_ifs_), input_file_(input_file),
+        compiled_(isCompiled(input_)), selection_(SELECT_SEQUENTIAL),
+        zipf_exponent_(1), rng_(getRepositorySeed()), last_templates_(NULL),
+        seq_(0), seq_step_(1), stream_owner_(false), chunk_(NULL), chunk_pos_(0),
+        parse_msg_(Message::PARSE)
     {
         initialize();
     }
 
+    ~QueryRepositoryImpl() {
+        // The parser thread uses this object, so it must stop first
+        // (other repositories sharing the stream can't use it any more).
+        if (stream_owner_) {
+            stream_->stop();
+        }
+    }
+
+    // Check if the input data is in the compiled format.
+    static bool isCompiled(istream& input) {
+        // Input that can't be rewound (e.g., a pipe) isn't examined, so
+        // that nothing is consumed; compiled queries are read from a file.
+        if (!input.good() || input.tellg() == streampos(-1)) {
+            return (false);
+        }
+        char magic[sizeof(COMPILED_MAGIC)];
+        input.read(magic, sizeof(magic));
+        const bool compiled = input.gcount() == sizeof(magic) &&
+            memcmp(magic, COMPILED_MAGIC, sizeof(magic)) == 0;
+        input.clear();
+        input.seekg(0);
+        return (compiled);
+    }
+
     void initialize() {
         use_dnssec_ = true;
         use_edns_ = true;
@@ -128,37 +719,117 @@ struct QueryRepository::QueryRepositoryImpl {
                                 bool rewind);
 
     // Extract optional attributes of the query.  Used by readNextRequest.
-    void parseQueryOptions(stringstream& ss);
+    void parseQueryOptions(size_t token_count);
+
+    // Read the parameters of the next request from the input, rewinding
+    // it at the end.
+    void readNextParam(RequestParam& param);
 
     // Get the parameters of the next request, either from the preloaded
     // vector (if done) or from the input stream.
     const RequestParam& getNextParam();
 
+    // Reconstruct the parameters of a query record.
+    const RequestParam& decodeParam(const uint8_t* data, size_t len,
+                                    int proto, uint8_t flags,
+                                    const uint8_t* templates);
+
+    // Return the next query of the stream with its attributes.
+    const uint8_t* nextStreamed(size_t& len, int& proto, uint8_t& flags) {
+        if (chunk_ == NULL || chunk_pos_ == chunk_->data.size()) {
+            chunk_ = stream_->getChunk(chunk_);
+            chunk_pos_ = 0;
+        }
+        const uint8_t* record = &chunk_->data[chunk_pos_];
+        proto = record[0];
+        flags = record[1];
+        len = readUint(&record[2], 2);
+        chunk_pos_ += RECORD_HEADER_LEN + len;
+        const uint8_t* query = record + RECORD_HEADER_LEN;
+        if ((flags & FLAG_TEMPLATE) != 0) {
+            chunk_pos_ += 1 + query[len] * TEMPLATE_LEN;
+        }
+        return (query);
+    }
+
+    // Whether queries have been preloaded or are being streamed; most
+    // settings can't be changed after that.
+    bool isLoaded() const { return (preloaded_ || stream_); }
+
+    // Map the compiled input file and use the settings stored in it.
+    void loadCompiled();
+
+    // Start using the preloaded queries from the given position.
+    void setPreloaded(ConstPreloadedQueriesPtr preloaded, size_t start);
+
+    // Build the sampler of the selection mode for the given number of
+    // queries; weights are those of the queries, empty if unknown.
+    void buildSampler(size_t count, const vector<double>& weights);
+
+    // Fill in the placeholders of the qname templates in the wire data of
+    // a query.
+    void expandTemplates(const uint8_t* templates, uint8_t* data,
+                         size_t len);
+
+    // Return the position of the next preloaded query and advance it.
+    size_t nextIndex() {
+        if (selection_ != SELECT_SEQUENTIAL) {
+            const uint64_t random = rng_.next();
+            if (sampler_) {
+                return (sampler_->sample(random));
+            }
+            // Uniform: scale the upper 32 bits to the number of queries.
+            return (((random >> 32) * preloaded_->getCount()) >> 32);
+        }
+        const size_t index = next_index_;
+        if (++next_index_ == preloaded_->getCount()) {
+            next_index_ = 0;
+        }
+        return (index);
+    }
+
     RRClass qclass_;            // Query class
     scoped_ptr<ifstream> input_ifs_;
     istream& input_;
+    const string input_file_;       // empty unless created from a file
+    const bool compiled_;           // whether the input file is compiled
     map<string, string> aux_typemap_;
-    vector<RequestParam> params_;   // used in the "preload" mode
+    ConstPreloadedQueriesPtr preloaded_; // used in the "preload" mode
     bool use_edns_;                 // whether to include ENDS by default.
     bool use_dnssec_;               // whether to set EDNS DO bit by default.
                                     // EDNS will be included regardless of
                                     // use_edns_.
     EDNSPtr edns_;                  // template of common EDNS OPT RR
     int proto_;                     // Default transport protocol
-    vector<RequestParam>::const_iterator current_param_;
-    vector<RequestParam>::const_iterator end_param_;
+    size_t next_index_;             // position of the next preloaded query
+    SelectionMode selection_;
+    double zipf_exponent_;
+    // Table for choosing queries at random (unless sequential or uniform),
+    // shared with the repositories sharing preloaded_.
+    boost::shared_ptr<const QuerySampler> sampler_;
+    RandomGenerator rng_;
+    // Qname templates of the query last returned, NULL if none
+    const uint8_t* last_templates_;
+    uint64_t seq_;                  // the next value of sequence templates
+    uint64_t seq_step_;             // increment of seq_ per query
+    QueryStreamPtr stream_;         // used in the "stream" mode
+    bool stream_owner_;             // whether stream_ parses our input
+    QueryStream::Chunk* chunk_;     // chunk of streamed queries being used
+    size_t chunk_pos_;              // position of the next query in chunk_
 
     QueryOptions options_;
+    vector<string> tokens_;         // tokens of the line being parsed
 
 private:
     RequestParam param_placeholder_;
+    Message parse_msg_;             // used to decode compiled queries
 };
 
 void
-QueryRepository::QueryRepositoryImpl::parseQueryOptions(stringstream& ss) {
-    while (!ss.eof()) {
-        string option;
-        ss >> option;
+QueryRepository::QueryRepositoryImpl::parseQueryOptions(size_t token_count) {
+    // The options follow the name and type.
+    for (size_t i = 2; i < token_count; ++i) {
+        const string& option = tokens_[i];
 
         const size_t pos_delim = option.find('=');
         if (pos_delim == string::npos) {
@@ -170,6 +841,11 @@ QueryRepository::QueryRepositoryImpl::parseQueryOptions(stringstream& ss) {
         // Set option: for now just hardcode known options.
         if (optname == "serial") {
             options_.serial = lexical_cast<uint32_t>(optarg);
+        } else if (optname == "weight") {
+            options_.weight = lexical_cast<double>(optarg);
+            if (!(options_.weight >= 0)) {
+                throw QueryRepositoryError("Invalid query weight: " + optarg);
+            }
         }
     }
 }
@@ -197,6 +873,16 @@ QueryRepository::QueryRepositoryImpl::readNextRequest(
                 if (rewind) {
                     input_.clear();
                     input_.seekg(0);
+                    if (input_.fail() || input_.tellg() != streampos(0)) {
+                        // A pipe can't be read again.  The last line is
+                        // still used; it fails at the next read.
+                        input_.clear(ios::eofbit);
+                        if (line.empty()) {
+                            throw QueryRepositoryError(
+                                "input data can't be rewound (not "
+                                "seekable); preload the queries instead");
+                        }
+                    }
                 } else if (line.empty()) {
                     return (QuestionPtr());
                 }
@@ -211,22 +897,32 @@ QueryRepository::QueryRepositoryImpl::readNextRequest(
 
         options_.clear();
         authorities.clear();
-        stringstream ss(line);
-        string qname_text, qtype_text;
-        ss >> qname_text >> qtype_text;
-        if (ss.bad() || ss.fail()) {
+        const size_t token_count = tokenize(line, tokens_);
+        if (token_count < 2) {
             // Ignore the line is organized in an unexpected way.
             continue;
         }
-        if (!ss.eof()) {
+        string& qname_text = tokens_[0];
+        string& qtype_text = tokens_[1];
+        if (token_count > 2) {
             try {
-                parseQueryOptions(ss);
+                parseQueryOptions(token_count);
             } catch (const std::exception& ex) {
                 cerr << "Error parsing query option (" << ex.what() << "): "
                      << line << endl;
                 continue;
             }
         }
+        if (qname_text.find('{') != string::npos) {
+            try {
+                qname_text = parseQnameTemplates(qname_text,
+                                                 options_.templates);
+            } catch (const std::exception& ex) {
+                cerr << "Error parsing qname template (" << ex.what()
+                     << "): " << line << endl;
+                continue;
+            }
+        }
         // Workaround for some RR types that are not recognized by BIND 10
         map<string, string>::const_iterator it =
             aux_typemap_.find(qtype_text);
@@ -262,22 +958,170 @@ QueryRepository::QueryRepositoryImpl::readNextRequest(
 
 const RequestParam&
 QueryRepository::QueryRepositoryImpl::getNextParam() {
-    if (!params_.empty()) {
-        // queries have been preloaded.  get the next one from the vector.
-        const RequestParam& param = *current_param_;
-        if (++current_param_ == end_param_) {
-            current_param_ = params_.begin();
+    if (preloaded_) {
+        // queries have been preloaded.  get the next one from the vector,
+        // or decode it if it's compiled.
+        const size_t index = nextIndex();
+        const RequestParam* param = preloaded_->getParam(index);
+        if (param != NULL) {
+            return (*param);
         }
-        return (param);
+        size_t len;
+        int proto;
+        uint8_t flags;
+        const uint8_t* data = preloaded_->getQuery(index, len, proto, flags);
+        return (decodeParam(data, len, proto, flags,
+                            preloaded_->getTemplates(data, len, flags)));
+    }
+    if (stream_) {
+        size_t len;
+        int proto;
+        uint8_t flags;
+        const uint8_t* data = nextStreamed(len, proto, flags);
+        return (decodeParam(data, len, proto, flags,
+                            (flags & FLAG_TEMPLATE) != 0 ? data + len : NULL));
+    }
+    if (compiled_) {
+        throw QueryRepositoryError("compiled query data must be preloaded");
+    }
+    if (selection_ != SELECT_SEQUENTIAL) {
+        throw QueryRepositoryError("random query selection requires "
+                                   "preloaded queries");
     }
 
-    param_placeholder_.question =
-        readNextRequest(param_placeholder_.authorities, true);
-    param_placeholder_.proto = proto_;
-    param_placeholder_.setEDNSPolicy(use_dnssec_, use_edns_);
+    readNextParam(param_placeholder_);
+    return (param_placeholder_);
+}
+
+void
+QueryRepository::QueryRepositoryImpl::readNextParam(RequestParam& param) {
+    param.question = readNextRequest(param.authorities, true);
+    param.proto = proto_;
+    param.setEDNSPolicy(use_dnssec_, use_edns_);
+    param.templates = options_.templates;
+}
+
+const RequestParam&
+QueryRepository::QueryRepositoryImpl::decodeParam(const uint8_t* data,
+                                                  size_t len, int proto,
+                                                  uint8_t flags,
+                                                  const uint8_t* templates)
+{
+    param_placeholder_.proto = proto;
+    bundy::util::InputBuffer buffer(data, len);
+    parse_msg_.clear(Message::PARSE);
+    parse_msg_.fromWire(buffer);
+
+    param_placeholder_.question = *parse_msg_.beginQuestion();
+    param_placeholder_.authorities.clear();
+    for (RRsetIterator it =
+             parse_msg_.beginSection(Message::SECTION_AUTHORITY);
+         it != parse_msg_.endSection(Message::SECTION_AUTHORITY);
+         ++it) {
+        param_placeholder_.authorities.push_back(*it);
+    }
+    param_placeholder_.use_edns = (flags & FLAG_EDNS) != 0;
+    param_placeholder_.use_dnssec = (flags & FLAG_DNSSEC) != 0;
+    if (templates != NULL) {
+        param_placeholder_.templates.assign(
+            templates, templates + 1 + templates[0] * TEMPLATE_LEN);
+    } else {
+        param_placeholder_.templates.clear();
+    }
     return (param_placeholder_);
 }
 
+void
+QueryRepository::QueryRepositoryImpl::expandTemplates(
+    const uint8_t* templates, uint8_t* data, size_t len)
+{
+    // All sequence templates of a query have the same value, and it's
+    // incremented for each query having them.
+    bool seq_used = false;
+    for (size_t i = 0; i < templates[0]; ++i) {
+        const uint8_t* entry = &templates[1 + i * TEMPLATE_LEN];
+        const size_t offset = readUint(entry, 2);
+        const size_t template_len = entry[3];
+        if (offset > len || template_len > len - offset) {
+            throw QueryRepositoryError("broken qname template");
+        }
+        uint8_t* placeholder = data + offset;
+        if (entry[2] == TEMPLATE_RAND) {
+            uint64_t random = 0;
+            for (size_t j = 0; j < template_len; ++j) {
+                if (j % 12 == 0) { // a random number has 12 5-bit parts
+                    random = rng_.next();
+                }
+                placeholder[j] = RAND_CHARS[random & 0x1f];
+                random >>= 5;
+            }
+        } else {
+            uint64_t value = seq_;
+            for (size_t j = template_len; j > 0; --j) {
+                placeholder[j - 1] = '0' + value % 10;
+                value /= 10;
+            }
+            seq_used = true;
+        }
+    }
+    if (seq_used) {
+        seq_ += seq_step_;
+    }
+}
+
+void
+QueryRepository::QueryRepositoryImpl::loadCompiled() {
+    const int fd = open(input_file_.c_str(), O_RDONLY);
+    if (fd == -1) {
+        throw QueryRepositoryError("failed to open compiled query file: " +
+                                   input_file_ + ": " + strerror(errno));
+    }
+    ConstPreloadedQueriesPtr preloaded;
+    try {
+        preloaded.reset(new PreloadedQueries(input_file_, fd));
+    } catch (...) {
+        close(fd);
+        throw;
+    }
+    close(fd);                  // the mapping remains valid
+    buildSampler(preloaded->getCount(), vector<double>());
+
+    // The queries were compiled with these settings; the ones set for this
+    // repository are ignored.
+    qclass_ = preloaded->getQueryClass();
+    use_edns_ = (preloaded->getFlags() & FLAG_EDNS) != 0;
+    use_dnssec_ = (preloaded->getFlags() & FLAG_DNSSEC) != 0;
+    proto_ = preloaded->getProtocol();
+    edns_->setDNSSECAwareness(use_dnssec_);
+
+    setPreloaded(preloaded, 0);
+}
+
+void
+QueryRepository::QueryRepositoryImpl::setPreloaded(
+    ConstPreloadedQueriesPtr preloaded, size_t start)
+{
+    preloaded_ = preloaded;
+    next_index_ = start % preloaded_->getCount();
+}
+
+void
+QueryRepository::QueryRepositoryImpl::buildSampler(
+    size_t count, const vector<double>& weights)
+{
+    if (selection_ == SELECT_ZIPF) {
+        sampler_.reset(new QuerySampler(
+                           QuerySampler::getZipfWeights(count,
+                                                        zipf_exponent_)));
+    } else if (selection_ == SELECT_WEIGHTED) {
+        if (weights.empty()) {
+            throw QueryRepositoryError("query weights are not available "
+                                       "in compiled query data");
+        }
+        sampler_.reset(new QuerySampler(weights));
+    }
+}
+
 QueryRepository::QueryRepository(istream& input) :
     impl_(new QueryRepositoryImpl(input))
 {
@@ -300,52 +1144,221 @@ QueryRepository::~QueryRepository() {
 void
 QueryRepository::load() {
     // duplicate load check
-    if (!impl_->params_.empty()) {
+    if (impl_->isLoaded()) {
         throw QueryRepositoryError("duplicate preload attempt");
     }
 
+    if (impl_->compiled_) {
+        impl_->loadCompiled();
+        return;
+    }
+
+    vector<RequestParam> params;
+    vector<double> weights;
     QuestionPtr question;
     vector<RRsetPtr> authorities;
     while ((question = impl_->readNextRequest(authorities, false))
            != NULL) {
-        impl_->params_.push_back(RequestParam(question, impl_->proto_));
-        impl_->params_.back().authorities = authorities;
-        impl_->params_.back().setEDNSPolicy(impl_->use_dnssec_,
-                                            impl_->use_edns_);
+        params.push_back(RequestParam(question, impl_->proto_));
+        params.back().authorities = authorities;
+        params.back().setEDNSPolicy(impl_->use_dnssec_, impl_->use_edns_);
+        params.back().templates = impl_->options_.templates;
+        weights.push_back(impl_->options_.weight);
     }
-    if (impl_->params_.empty()) {
+    if (params.empty()) {
         throw QueryRepositoryError("failed to preload queries: empty input");
     }
-    impl_->current_param_ = impl_->params_.begin();
-    impl_->end_param_ = impl_->params_.end();
+    impl_->buildSampler(params.size(), weights);
+
+    impl_->setPreloaded(ConstPreloadedQueriesPtr(
+                            new PreloadedQueries(params, impl_->qclass_,
+                                                 impl_->use_edns_,
+                                                 impl_->use_dnssec_,
+                                                 impl_->proto_,
+                                                 impl_->edns_)),
+                        0);
+}
+
+void
+QueryRepository::load(const QueryRepository& source, size_t start) {
+    if (impl_->isLoaded()) {
+        throw QueryRepositoryError("duplicate preload attempt");
+    }
+    if (!source.impl_->preloaded_) {
+        throw QueryRepositoryError("queries are shared from a repository "
+                                   "that hasn't preloaded them");
+    }
+
+    // Inherit the settings that the preloaded queries were built with.
+    impl_->qclass_ = source.impl_->qclass_;
+    impl_->use_dnssec_ = source.impl_->use_dnssec_;
+    impl_->use_edns_ = source.impl_->use_edns_;
+    impl_->proto_ = source.impl_->proto_;
+    impl_->edns_->setDNSSECAwareness(impl_->use_dnssec_);
+    impl_->selection_ = source.impl_->selection_;
+    impl_->zipf_exponent_ = source.impl_->zipf_exponent_;
+    impl_->sampler_ = source.impl_->sampler_;
+
+    impl_->setPreloaded(source.impl_->preloaded_, start);
+}
+
+void
+QueryRepository::stream() {
+    if (impl_->isLoaded()) {
+        throw QueryRepositoryError("duplicate preload attempt");
+    }
+    if (impl_->compiled_) {
+        throw QueryRepositoryError("compiled query data must be preloaded");
+    }
+    if (impl_->selection_ != SELECT_SEQUENTIAL) {
+        throw QueryRepositoryError("random query selection requires "
+                                   "preloaded queries");
+    }
+
+    QueryStreamPtr stream(new QueryStream(
+                              boost::bind(&QueryRepositoryImpl::readNextParam,
+                                          impl_, _1),
+                              impl_->edns_));
+    stream->addConsumer();
+    stream->start();
+    impl_->stream_ = stream;
+    impl_->stream_owner_ = true;
+}
+
+void
+QueryRepository::stream(const QueryRepository& source) {
+    if (impl_->isLoaded()) {
+        throw QueryRepositoryError("duplicate preload attempt");
+    }
+    if (!source.impl_->stream_) {
+        throw QueryRepositoryError("queries are shared from a repository "
+                                   "that isn't streaming them");
+    }
+
+    // Inherit the settings that the streamed queries are built with.
+    impl_->qclass_ = source.impl_->qclass_;
+    impl_->use_dnssec_ = source.impl_->use_dnssec_;
+    impl_->use_edns_ = source.impl_->use_edns_;
+    impl_->proto_ = source.impl_->proto_;
+    impl_->edns_->setDNSSECAwareness(impl_->use_dnssec_);
+
+    source.impl_->stream_->addConsumer();
+    impl_->stream_ = source.impl_->stream_;
+}
+
+void
+QueryRepository::localize() {
+    if (!impl_->preloaded_) {
+        throw QueryRepositoryError("queries must be preloaded to be "
+                                   "localized");
+    }
+    impl_->preloaded_.reset(new PreloadedQueries(*impl_->preloaded_));
+    impl_->last_templates_ = NULL;
+    if (impl_->sampler_) {
+        impl_->sampler_.reset(new QuerySampler(*impl_->sampler_));
+    }
+}
+
+void
+QueryRepository::setSelection(SelectionMode mode, double zipf_exponent) {
+    if (impl_->isLoaded()) {
+        throw QueryRepositoryError("query selection is being set after "
+                                   "preload");
+    }
+    if (!(zipf_exponent >= 0)) {
+        throw QueryRepositoryError("invalid Zipf exponent: " +
+                                   lexical_cast<string>(zipf_exponent));
+    }
+
+    impl_->selection_ = mode;
+    impl_->zipf_exponent_ = zipf_exponent;
+}
+
+QueryRepository::SelectionMode
+QueryRepository::getSelectionMode() const {
+    return (impl_->selection_);
 }
 
 size_t
 QueryRepository::getQueryCount() const {
-    return (impl_->params_.size());
+    return (impl_->preloaded_ ? impl_->preloaded_->getCount() : 0);
+}
+
+void
+QueryRepository::save(const string& output_file) const {
+    if (!impl_->preloaded_) {
+        throw QueryRepositoryError("queries must be preloaded to be saved");
+    }
+
+    size_t len;
+    const uint8_t* data = impl_->preloaded_->getData(len);
+    ofstream ofs(output_file.c_str(), ios::out | ios::binary | ios::trunc);
+    ofs.write(reinterpret_cast<const char*>(data), len);
+    ofs.close();
+    if (ofs.fail()) {
+        throw QueryRepositoryError("failed to write compiled query file: " +
+                                   output_file);
+    }
+}
+
+bool
+QueryRepository::isCompiledFile(const string& file) {
+    ifstream ifs(file.c_str(), ios::in | ios::binary);
+    return (ifs.good() && QueryRepositoryImpl::isCompiled(ifs));
 }
 
 void
 QueryRepository::getNextQuery(Message& query_msg, int& protocol) {
     const RequestParam& param = impl_->getNextParam();
+    buildQueryMessage(param, impl_->edns_, query_msg);
+    protocol = param.proto;
+    impl_->last_templates_ =
+        param.templates.empty() ? NULL : &param.templates[0];
+}
 
-    query_msg.clear(Message::RENDER);
-    query_msg.setOpcode(Opcode::QUERY());
-    query_msg.setRcode(Rcode::NOERROR());
-    query_msg.setHeaderFlag(Message::HEADERFLAG_RD);
-    query_msg.addQuestion(param.question);
-    BOOST_FOREACH(const RRsetPtr rrset, param.authorities) {
-        query_msg.addRRset(Message::SECTION_AUTHORITY, rrset);
+const void*
+QueryRepository::getNextQueryData(size_t& len, int& protocol) {
+    uint8_t flags;
+    if (!impl_->preloaded_) {
+        if (!impl_->stream_) {
+            return (NULL);
+        }
+        const uint8_t* data = impl_->nextStreamed(len, protocol, flags);
+        impl_->last_templates_ =
+            (flags & FLAG_TEMPLATE) != 0 ? data + len : NULL;
+        return (data);
     }
-    protocol = param.proto;
-    if (param.use_edns || param.use_dnssec) {
-        query_msg.setEDNS(impl_->edns_);
+    const uint8_t* data = impl_->preloaded_->getQuery(impl_->nextIndex(), len,
+                                                      protocol, flags);
+    impl_->last_templates_ = impl_->preloaded_->getTemplates(data, len, flags);
+    return (data);
+}
+
+bool
+QueryRepository::hasQnameTemplates() const {
+    return (impl_->last_templates_ != NULL);
+}
+
+void
+QueryRepository::expandQnameTemplates(void* data, size_t len) {
+    if (impl_->last_templates_ != NULL) {
+        impl_->expandTemplates(impl_->last_templates_,
+                               static_cast<uint8_t*>(data), len);
+    }
+}
+
+void
+QueryRepository::setSequence(uint64_t first, uint64_t step) {
+    if (step == 0) {
+        throw QueryRepositoryError("sequence template step must be positive");
     }
+    impl_->seq_ = first;
+    impl_->seq_step_ = step;
 }
 
 void
 QueryRepository::setQueryClass(RRClass qclass) {
-    if (!impl_->params_.empty()) {
+    if (impl_->isLoaded()) {
         throw QueryRepositoryError("query class is being set after preload");
     }
 
@@ -354,7 +1367,7 @@ QueryRepository::setQueryClass(RRClass qclass) {
 
 void
 QueryRepository::setDNSSEC(bool on) {
-    if (!impl_->params_.empty()) {
+    if (impl_->isLoaded()) {
         throw QueryRepositoryError(
             "DNSSEC DO bit is being changed after preload");
     }
@@ -365,7 +1378,7 @@ QueryRepository::setDNSSEC(bool on) {
 
 void
 QueryRepository::setEDNS(bool on) {
-    if (!impl_->params_.empty()) {
+    if (impl_->isLoaded()) {
         throw QueryRepositoryError("EDNS flag is being changed after preload");
     }
 
@@ -374,7 +1387,7 @@ QueryRepository::setEDNS(bool on) {
 
 void
 QueryRepository::setProtocol(int proto) {
-    if (!impl_->params_.empty()) {
+    if (impl_->isLoaded()) {
         throw QueryRepositoryError("Protocol is being changed after preload");
     }
     if (proto != IPPROTO_UDP && proto != IPPROTO_TCP) {
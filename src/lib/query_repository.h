@@ -24,6 +24,8 @@
 #include <string>
 #include <stdexcept>
 
+#include <stdint.h>
+
 namespace Queryperf {
 
 class QueryRepositoryError : public std::runtime_error {
@@ -35,20 +37,218 @@ public:
 
 class QueryRepository : private boost::noncopyable {
 public:
+    /// \brief How to choose the next query among the preloaded ones.
+    enum SelectionMode {
+        SELECT_SEQUENTIAL,      ///< In the order of the input (default)
+        SELECT_UNIFORM,         ///< Uniformly at random
+        SELECT_ZIPF,            ///< Zipf distribution over the input order
+        SELECT_WEIGHTED         ///< By the "weight" option of each query
+    };
+
     explicit QueryRepository(std::istream& input);
+
+    /// \brief Constructor from an input file.
+    ///
+    /// The file can be either a text file of queries or a compiled query
+    /// file saved by \c save().  The latter must be preloaded by \c load()
+    /// before getting queries.
+    ///
+    /// \throw QueryRepositoryError The file cannot be opened.
     explicit QueryRepository(const std::string& input_file);
     ~QueryRepository();
 
     /// \brief Preload all data and hold it internally.
+    ///
+    /// If the input is a compiled query file, it's mapped into memory
+    /// without parsing the queries, and the query class, DNSSEC, EDNS and
+    /// protocol settings used for compiling it are used (those set for
+    /// this repository are ignored).
+    ///
+    /// \throw QueryRepositoryError Duplicate preload, the input is empty,
+    /// the compiled query file is broken, or the weighted selection mode
+    /// is used for a compiled query file (which doesn't keep the weights).
+    /// \throw QuerySamplerError All weights of the queries are 0.
     void load();
 
+    /// \brief Share the queries preloaded by another repository.
+    ///
+    /// This has the same effect as \c load() (including the query class,
+    /// DNSSEC, EDNS and protocol settings, which are taken from
+    /// \c source), but instead of reading the input data the queries
+    /// preloaded in \c source are used.  The preloaded data are never
+    /// modified, so repositories sharing them can be used in different
+    /// threads; only the position of the next query is maintained in each
+    /// repository.
+    ///
+    /// \throw QueryRepositoryError This repository has already been
+    /// preloaded, or \c source hasn't been preloaded.
+    ///
+    /// \param source The repository that has preloaded queries.
+    /// \param start The position of the first query to be returned by
+    /// \c getNextQuery() (modulo the number of queries), so that threads
+    /// don't send the same sequence of queries.
+    void load(const QueryRepository& source, size_t start);
+
+    /// \brief Read the queries ahead in a background thread instead of
+    /// preloading them.
+    ///
+    /// Without preload every query is parsed from the input data when it's
+    /// sent, which is too slow to keep up with a fast server.  In this
+    /// mode a thread parses and renders queries ahead into chunks of wire
+    /// data, which are then returned by \c getNextQueryData() (and
+    /// \c getNextQuery()) in the order of the input data, wrapping around
+    /// at the end, as if they were preloaded.  Memory use doesn't depend on
+    /// the size of the input.  The input can be a pipe, but it can't wrap
+    /// around: reading beyond its end is an error.
+    ///
+    /// The query class, DNSSEC, EDNS and protocol settings can't be changed
+    /// after this call.  Errors in reading the input data are thrown by
+    /// the methods returning queries, once the queries read before the
+    /// error have been returned.  The thread stops when this repository is
+    /// destroyed.
+    ///
+    /// \throw QueryRepositoryError Duplicate preload or stream, the input
+    /// is a compiled query file (which must be preloaded), a random
+    /// selection mode is set, or failed to start the thread.
+    void stream();
+
+    /// \brief Share the queries streamed by another repository.
+    ///
+    /// This is the \c stream() version of \c load(source, start): the
+    /// settings are taken from \c source, and the chunks of queries read by
+    /// its thread are distributed among the repositories sharing them, so
+    /// each query of the input is returned by only one of them.  This
+    /// repository can be used in a different thread than \c source, but
+    /// \c source must be valid while this one is used.
+    ///
+    /// \throw QueryRepositoryError This repository has already been
+    /// preloaded or streamed, or \c source isn't streaming queries.
+    ///
+    /// \param source The repository that streams queries.
+    void stream(const QueryRepository& source);
+
+    /// \brief Replace the preloaded queries with a private copy.
+    ///
+    /// The copy is allocated and first written by the calling thread, so
+    /// on a NUMA system it's placed on the node the thread runs on (if
+    /// the thread is bound to it), rather than wherever the queries were
+    /// loaded or mapped.  Other repositories sharing the queries are not
+    /// affected, and the position of the next query is kept.
+    ///
+    /// \throw QueryRepositoryError Queries haven't been preloaded.
+    void localize();
+
+    /// \brief Set how to choose the next query.
+    ///
+    /// By default queries are sent in the order of the input data,
+    /// wrapping around at the end.  The other modes choose each query at
+    /// random among the preloaded ones: uniformly, by the Zipf
+    /// distribution in which the first query is the most popular (the
+    /// weight of the i-th query is 1/i^zipf_exponent), or by the weight of
+    /// each query given as the "weight" option in the input data (1 by
+    /// default).  A table for choosing queries in constant time is built
+    /// by \c load(), and a repository sharing the queries by
+    /// \c load(source, start) uses the mode and the table of \c source.
+    /// The random numbers of each repository are seeded differently, from
+    /// the entropy of the run.
+    ///
+    /// This must be called before \c load(), and modes other than
+    /// sequential require queries to be preloaded.
+    ///
+    /// \throw QueryRepositoryError Called after preload, or the exponent
+    /// is negative.
+    ///
+    /// \param mode The selection mode.
+    /// \param zipf_exponent The exponent of the Zipf distribution; ignored
+    /// unless \c mode is \c SELECT_ZIPF.
+    void setSelection(SelectionMode mode, double zipf_exponent = 1.0);
+
+    /// \brief Return the selection mode set by \c setSelection().
+    SelectionMode getSelectionMode() const;
+
     /// \brief Return preloaded query count if preload took place.
     ///
     /// It returns 0 if preload hasn't been initiated.
     size_t getQueryCount() const;
 
+    /// \brief Save the preloaded queries as a compiled query file.
+    ///
+    /// The file contains all queries in wire format with their transport
+    /// protocol and EDNS policy, so that a repository created from the
+    /// file can load it with little overhead.
+    ///
+    /// \throw QueryRepositoryError Queries haven't been preloaded, or
+    /// failed to write the file.
+    ///
+    /// \param output_file The name of the compiled query file.
+    void save(const std::string& output_file) const;
+
+    /// \brief Return whether the given file is a compiled query file.
+    ///
+    /// It returns false if the file cannot be opened.
+    static bool isCompiledFile(const std::string& file);
+
     void getNextQuery(bundy::dns::Message& message, int& protocol);
 
+    /// \brief Return the next preloaded query in wire format.
+    ///
+    /// When queries are preloaded, they are also rendered in wire format
+    /// (with the QID of 0) in a single contiguous buffer.  This method
+    /// returns the data of the next query in that buffer, advancing the
+    /// position of the next query in the same way as \c getNextQuery().
+    /// The returned data is valid as long as the repository (or another
+    /// one sharing the queries) exists, and must not be modified; the
+    /// caller is expected to copy it and set the QID.
+    ///
+    /// \param len Set to the length of the query data.
+    /// \param protocol Set to the transport protocol of the query.
+    /// \return A pointer to the query data, or NULL if queries haven't
+    /// been preloaded (in which case \c getNextQuery() must be used).
+    const void* getNextQueryData(size_t& len, int& protocol);
+
+    /// \brief Return whether the query last returned by \c getNextQuery()
+    /// or \c getNextQueryData() has qname templates.
+    ///
+    /// The query name in the input data can contain templates replaced
+    /// with different values every time the query is sent: \c {rand:N}
+    /// for N random letters and digits (1 <= N <= 63), and \c {seq} or
+    /// \c {seq:N} for a sequence number of the repository in N decimal
+    /// digits (10 by default, 1 <= N <= 19, wrapping around; see
+    /// \c setSequence()).  For example, "{rand:8}.example.com" generates
+    /// names that are hardly ever cached.
+    /// The query returned by the above methods has placeholders of the
+    /// same length instead of the templates, which the caller is expected
+    /// to fill in by \c expandQnameTemplates().
+    bool hasQnameTemplates() const;
+
+    /// \brief Fill in the qname templates of the query last returned by
+    /// \c getNextQuery() or \c getNextQueryData() in a copy of its wire
+    /// data.
+    ///
+    /// The placeholders are simply overwritten in the wire data, without
+    /// constructing the name.  It does nothing if the query has no
+    /// templates.
+    ///
+    /// \throw QueryRepositoryError The templates don't fit in the data
+    /// (i.e., the data or a compiled query file is broken).
+    ///
+    /// \param data The wire data of the query, which is modified.
+    /// \param len The length of the data.
+    void expandQnameTemplates(void* data, size_t len);
+
+    /// \brief Set the values of the sequence templates.
+    ///
+    /// By default the sequence of each repository starts at 0 and is
+    /// incremented by 1 for each query having the templates.  Repositories
+    /// used by different threads can avoid generating the same names by
+    /// starting at the thread index and stepping by the number of threads.
+    ///
+    /// \throw QueryRepositoryError \c step is 0.
+    ///
+    /// \param first The value for the next query having the templates.
+    /// \param step The increment of the value per query.
+    void setSequence(uint64_t first, uint64_t step);
+
     /// \brief Set the default RR class of the queries.
     ///
     /// When preload is used, this must be called before load().
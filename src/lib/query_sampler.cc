@@ -0,0 +1,116 @@
+// Copyright (C) 2012  JINMEI Tatuya
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+// OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#include <query_sampler.h>
+
+#include <cmath>
+#include <limits>
+
+using namespace std;
+
+namespace Queryperf {
+
+namespace {
+const double TWO_TO_32 = 4294967296.0;
+
+// Whether the value is a finite non-negative number (false for NaN, too).
+bool
+isValidWeight(double value) {
+    return (value >= 0 && value <= numeric_limits<double>::max());
+}
+
+// Mix the seed so that similar seeds give unrelated sequences (splitmix64),
+// avoiding the all-zero state that xorshift can't leave.
+uint64_t
+mixSeed(uint64_t seed) {
+    uint64_t z = seed + 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    z ^= z >> 31;
+    return (z != 0 ? z : 0x9E3779B97F4A7C15ULL);
+}
+}
+
+RandomGenerator::RandomGenerator(uint64_t seed) : state_(mixSeed(seed)) {}
+
+QuerySampler::QuerySampler(const vector<double>& weights) :
+    columns_(weights.size())
+{
+    const size_t count = weights.size();
+    if (count == 0) {
+        throw QuerySamplerError("no weights to sample");
+    }
+    if (static_cast<uint64_t>(count) >= (1ULL << 32)) {
+        throw QuerySamplerError("too many weights to sample");
+    }
+    double sum = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (!isValidWeight(weights[i])) {
+            throw QuerySamplerError("invalid weight to sample");
+        }
+        sum += weights[i];
+    }
+    if (!(sum > 0)) {
+        throw QuerySamplerError("all weights to sample are 0");
+    }
+
+    // Vose's version of the alias method: the weights are scaled so that
+    // the average is 1, and each column with a weight smaller than 1 is
+    // filled up with a part of a column larger than 1 (the alias).
+    vector<double> scaled(count);
+    vector<size_t> small, large;
+    for (size_t i = 0; i < count; ++i) {
+        scaled[i] = weights[i] * count / sum;
+        if (scaled[i] < 1) {
+            small.push_back(i);
+        } else {
+            large.push_back(i);
+        }
+    }
+    while (!small.empty() && !large.empty()) {
+        const size_t s = small.back();
+        small.pop_back();
+        const size_t l = large.back();
+        columns_[s].threshold = static_cast<uint64_t>(scaled[s] * TWO_TO_32);
+        columns_[s].alias = l;
+        scaled[l] = (scaled[l] + scaled[s]) - 1;
+        if (scaled[l] < 1) {
+            large.pop_back();
+            small.push_back(l);
+        }
+    }
+    // The rest are (nearly, due to rounding errors) 1.
+    for (size_t i = 0; i < small.size(); ++i) {
+        columns_[small[i]].threshold = 1ULL << 32;
+        columns_[small[i]].alias = small[i];
+    }
+    for (size_t i = 0; i < large.size(); ++i) {
+        columns_[large[i]].threshold = 1ULL << 32;
+        columns_[large[i]].alias = large[i];
+    }
+}
+
+vector<double>
+QuerySampler::getZipfWeights(size_t count, double exponent) {
+    if (!isValidWeight(exponent)) {
+        throw QuerySamplerError("invalid Zipf exponent");
+    }
+    vector<double> weights(count);
+    for (size_t i = 0; i < count; ++i) {
+        weights[i] = pow(static_cast<double>(i + 1), -exponent);
+    }
+    return (weights);
+}
+
+} // end of QueryPerf
@@ -0,0 +1,114 @@
+// Copyright (C) 2012  JINMEI Tatuya
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+// OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#ifndef __QUERYPERF_QUERY_SAMPLER_H
+#define __QUERYPERF_QUERY_SAMPLER_H 1
+
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+namespace Queryperf {
+
+class QuerySamplerError : public std::runtime_error {
+public:
+    QuerySamplerError(const std::string& what_arg) :
+        std::runtime_error(what_arg)
+    {}
+};
+
+/// \brief A small and fast pseudo random number generator (xorshift64*).
+///
+/// It's not suitable for anything but choosing queries, but generating a
+/// number only takes a few integer operations.  Each querying thread is
+/// expected to have its own generator.
+class RandomGenerator {
+public:
+    /// \brief Constructor.
+    ///
+    /// Any seed, including 0, can be used; generators with different seeds
+    /// produce different sequences.
+    explicit RandomGenerator(uint64_t seed);
+
+    /// \brief Return the next 64-bit pseudo random number.
+    uint64_t next() {
+        state_ ^= state_ >> 12;
+        state_ ^= state_ << 25;
+        state_ ^= state_ >> 27;
+        return (state_ * 0x2545F4914F6CDD1DULL);
+    }
+
+private:
+    uint64_t state_;
+};
+
+/// \brief A sampler of indices with given weights (the "alias method").
+///
+/// The sampler is built from the weights of all indices in O(N) time,
+/// after which an index is chosen with the probability proportional to its
+/// weight in O(1) time, using a single random number and a single lookup
+/// of the table, regardless of the distribution.
+///
+/// It's never modified once built, so it can be shared by multiple
+/// threads, each with its own \c RandomGenerator.
+class QuerySampler {
+public:
+    /// \brief Constructor.
+    ///
+    /// \throw QuerySamplerError The weights are empty, too many (2^32 or
+    /// more), contain a negative or non-finite value, or are all 0.
+    ///
+    /// \param weights The weight of each index.
+    explicit QuerySampler(const std::vector<double>& weights);
+
+    /// \brief Return the weights of the Zipf distribution.
+    ///
+    /// The weight of the index i is 1/(i+1)^exponent, i.e., the first
+    /// index is the most popular one.  An exponent of 0 means the uniform
+    /// distribution; the larger the exponent, the more skewed.
+    ///
+    /// \throw QuerySamplerError The exponent is negative or not finite.
+    static std::vector<double> getZipfWeights(size_t count, double exponent);
+
+    /// \brief Return the number of indices.
+    size_t getCount() const { return (columns_.size()); }
+
+    /// \brief Choose an index, given a (uniformly distributed) random number.
+    size_t sample(uint64_t random) const {
+        // The upper 32 bits choose the column, and the lower ones whether
+        // to use the column's own index or its alias.
+        const size_t column = ((random >> 32) * columns_.size()) >> 32;
+        const Column& entry = columns_[column];
+        return ((random & 0xffffffff) < entry.threshold ?
+                column : entry.alias);
+    }
+
+private:
+    struct Column {
+        uint64_t threshold; // probability of the column's own index * 2^32
+        size_t alias;
+    };
+    std::vector<Column> columns_;
+};
+
+} // end of QueryPerf
+
+#endif // __QUERYPERF_QUERY_SAMPLER_H
+
+// Local Variables:
+// mode: c++
+// End:
@@ -0,0 +1,127 @@
+// Copyright (C) 2012  JINMEI Tatuya
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+// OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#include <response_validator.h>
+
+#include <cstring>
+
+using namespace std;
+
+namespace Queryperf {
+
+namespace {
+const char* const RCODE_TEXT[] = {
+    "NOERROR", "FORMERR", "SERVFAIL", "NXDOMAIN", "NOTIMP", "REFUSED",
+    "YXDOMAIN", "YXRRSET", "NXRRSET", "NOTAUTH", "NOTZONE", "RCODE11",
+    "RCODE12", "RCODE13", "RCODE14", "RCODE15"
+};
+
+const char* const FLAG_TEXT[] = { "AA", "TC", "RD", "RA", "AD", "CD" };
+
+inline uint8_t
+toLower(uint8_t c) {
+    return (c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c);
+}
+}
+
+bool
+validateResponse(const MessageHeader& header, const void* response,
+                 size_t response_len, const void* query, size_t query_len)
+{
+    if (!header.hasFlag(MessageHeader::FLAG_QR)) {
+        return (false);
+    }
+    if (header.qdcount == 0) {
+        return (header.getRcode() != 0);
+    }
+
+    // Find the end of the owner name of the query's question.  It's
+    // never compressed, since it's the first name in the message.
+    const uint8_t* const qp = static_cast<const uint8_t*>(query);
+    size_t pos = MessageHeader::LENGTH;
+    while (pos < query_len && qp[pos] != 0) {
+        if (qp[pos] > 63) {
+            return (false);
+        }
+        pos += qp[pos] + 1;
+    }
+    const size_t name_end = pos + 1;
+    const size_t question_end = name_end + 4; // type and class
+    if (question_end > query_len || question_end > response_len) {
+        return (false);
+    }
+
+    // Label lengths can't be letters, so the name can be compared as a
+    // sequence of bytes.
+    const uint8_t* const rp = static_cast<const uint8_t*>(response);
+    for (pos = MessageHeader::LENGTH; pos < name_end; ++pos) {
+        if (toLower(qp[pos]) != toLower(rp[pos])) {
+            return (false);
+        }
+    }
+    return (memcmp(qp + name_end, rp + name_end, 4) == 0);
+}
+
+ResponseStats::ResponseStats() :
+    responses(0), nodata(0), invalid(0), tcp_retries(0), late(0),
+    duplicates(0), unknown(0)
+{
+    memset(rcodes, 0, sizeof(rcodes));
+    memset(flags, 0, sizeof(flags));
+}
+
+void
+ResponseStats::record(const MessageHeader& header) {
+    const unsigned int rcode = header.getRcode();
+    ++responses;
+    ++rcodes[rcode];
+    if (rcode == 0 && header.ancount == 0) {
+        ++nodata;
+    }
+    flags[AA] += header.hasFlag(MessageHeader::FLAG_AA) ? 1 : 0;
+    flags[TC] += header.hasFlag(MessageHeader::FLAG_TC) ? 1 : 0;
+    flags[RD] += header.hasFlag(MessageHeader::FLAG_RD) ? 1 : 0;
+    flags[RA] += header.hasFlag(MessageHeader::FLAG_RA) ? 1 : 0;
+    flags[AD] += header.hasFlag(MessageHeader::FLAG_AD) ? 1 : 0;
+    flags[CD] += header.hasFlag(MessageHeader::FLAG_CD) ? 1 : 0;
+}
+
+void
+ResponseStats::merge(const ResponseStats& other) {
+    responses += other.responses;
+    for (size_t i = 0; i < RCODE_COUNT; ++i) {
+        rcodes[i] += other.rcodes[i];
+    }
+    for (size_t i = 0; i < FLAG_COUNT; ++i) {
+        flags[i] += other.flags[i];
+    }
+    nodata += other.nodata;
+    invalid += other.invalid;
+    tcp_retries += other.tcp_retries;
+    late += other.late;
+    duplicates += other.duplicates;
+    unknown += other.unknown;
+}
+
+const char*
+ResponseStats::getRcodeText(unsigned int rcode) {
+    return (rcode < RCODE_COUNT ? RCODE_TEXT[rcode] : "RCODE?");
+}
+
+const char*
+ResponseStats::getFlagText(Flag flag) {
+    return (FLAG_TEXT[flag]);
+}
+
+} // end of QueryPerf
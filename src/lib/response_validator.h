@@ -0,0 +1,146 @@
+// Copyright (C) 2012  JINMEI Tatuya
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+// OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#ifndef __QUERYPERF_RESPONSE_VALIDATOR_H
+#define __QUERYPERF_RESPONSE_VALIDATOR_H 1
+
+#include <cstddef>
+
+#include <stdint.h>
+
+namespace Queryperf {
+
+/// \brief The header of a DNS message, parsed in place.
+///
+/// Unlike \c bundy::dns::Message::parseHeader(), it doesn't copy anything
+/// but the fields, and doesn't throw, so it's cheap enough for every
+/// response.
+struct MessageHeader {
+    /// \brief The length of the header in wire format.
+    static const size_t LENGTH = 12;
+
+    /// \name Bit masks of the flags.
+    //@{
+    static const uint16_t FLAG_QR = 0x8000;
+    static const uint16_t FLAG_AA = 0x0400;
+    static const uint16_t FLAG_TC = 0x0200;
+    static const uint16_t FLAG_RD = 0x0100;
+    static const uint16_t FLAG_RA = 0x0080;
+    static const uint16_t FLAG_AD = 0x0020;
+    static const uint16_t FLAG_CD = 0x0010;
+    //@}
+
+    /// \brief Parse the header of a message.
+    ///
+    /// \return false if the data is shorter than the header (the fields
+    /// are then undefined).
+    bool parse(const void* data, size_t len) {
+        if (len < LENGTH) {
+            return (false);
+        }
+        const uint8_t* const cp = static_cast<const uint8_t*>(data);
+        qid = (cp[0] << 8) | cp[1];
+        flags = (cp[2] << 8) | cp[3];
+        qdcount = (cp[4] << 8) | cp[5];
+        ancount = (cp[6] << 8) | cp[7];
+        nscount = (cp[8] << 8) | cp[9];
+        arcount = (cp[10] << 8) | cp[11];
+        return (true);
+    }
+
+    bool hasFlag(uint16_t flag) const { return ((flags & flag) != 0); }
+
+    /// \brief Return the RCODE in the header (the extended RCODE in the
+    /// OPT RR is ignored).
+    unsigned int getRcode() const { return (flags & 0x000f); }
+
+    uint16_t qid;
+    uint16_t flags;             // including opcode and RCODE
+    uint16_t qdcount;
+    uint16_t ancount;
+    uint16_t nscount;
+    uint16_t arcount;
+};
+
+/// \brief Check whether a response is valid for a query.
+///
+/// The response must have the QR bit set, and echo the question of the
+/// query (the owner name is compared case-insensitively, as some servers
+/// randomize the case).  A response without a question is accepted only
+/// with an error RCODE, since some servers omit it in error responses.
+/// The QID isn't checked; it's expected to have been used to identify
+/// the query.  Only the header and the question are examined, without
+/// parsing the names.
+///
+/// \param header The header of the response, parsed by the caller.
+/// \param response The response in wire format (including the header).
+/// \param query The query in wire format.
+bool validateResponse(const MessageHeader& header,
+                      const void* response, size_t response_len,
+                      const void* query, size_t query_len);
+
+/// \brief Statistics of responses broken down by RCODE and header flags.
+struct ResponseStats {
+    /// \brief Header flags counted separately.
+    enum Flag {
+        AA = 0,
+        TC,
+        RD,
+        RA,
+        AD,
+        CD,
+        FLAG_COUNT
+    };
+
+    /// \brief The number of possible RCODE values in the header.
+    static const size_t RCODE_COUNT = 16;
+
+    ResponseStats();
+
+    /// \brief Count a response.
+    void record(const MessageHeader& header);
+
+    /// \brief Add the statistics of another dispatcher.
+    void merge(const ResponseStats& other);
+
+    /// \brief Return the textual representation of an RCODE (e.g.,
+    /// "NXDOMAIN"), or "RCODEn" for unassigned ones.
+    static const char* getRcodeText(unsigned int rcode);
+
+    /// \brief Return the name of a flag (e.g., "AA").
+    static const char* getFlagText(Flag flag);
+
+    uint64_t responses;         // responses counted in the following
+    uint64_t rcodes[RCODE_COUNT];
+    uint64_t flags[FLAG_COUNT];
+    uint64_t nodata;            // NOERROR without answers
+    uint64_t invalid;           // ignored by validateResponse() or too short
+    uint64_t tcp_retries;       // truncated and retried over TCP
+
+    /// \name Responses that don't match an outstanding query, and aren't
+    /// counted in the above.
+    //@{
+    uint64_t late;              // the first one after the query timed out
+    uint64_t duplicates;        // another one for a query already answered
+    uint64_t unknown;           // the QID has never been used
+    //@}
+};
+
+} // end of QueryPerf
+
+#endif // __QUERYPERF_RESPONSE_VALIDATOR_H
+
+// Local Variables:
+// mode: c++
+// End:
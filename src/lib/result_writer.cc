@@ -0,0 +1,187 @@
+// Copyright (C) 2012  JINMEI Tatuya
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+// OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#include <result_writer.h>
+
+#include <boost/foreach.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/math/special_functions/fpclassify.hpp>
+
+#include <cstdio>
+#include <iomanip>
+#include <sstream>
+
+using namespace std;
+using boost::lexical_cast;
+
+namespace Queryperf {
+
+namespace {
+string
+quoteJSON(const string& text) {
+    string quoted = "\"";
+    BOOST_FOREACH(char c, text) {
+        switch (c) {
+        case '"':
+            quoted += "\\\"";
+            break;
+        case '\\':
+            quoted += "\\\\";
+            break;
+        case '\n':
+            quoted += "\\n";
+            break;
+        case '\r':
+            quoted += "\\r";
+            break;
+        case '\t':
+            quoted += "\\t";
+            break;
+        default:
+            if (static_cast<unsigned char>(c) < 0x20) {
+                char buf[8];
+                snprintf(buf, sizeof(buf), "\\u%04x", c);
+                quoted += buf;
+            } else {
+                quoted += c;
+            }
+        }
+    }
+    return (quoted + "\"");
+}
+
+// Quote a CSV field if necessary (RFC 4180).
+string
+quoteCSV(const string& text) {
+    if (text.find_first_of(",\"\r\n") == string::npos) {
+        return (text);
+    }
+    string quoted = "\"";
+    BOOST_FOREACH(char c, text) {
+        if (c == '"') {
+            quoted += '"';
+        }
+        quoted += c;
+    }
+    return (quoted + "\"");
+}
+}
+
+void
+ResultRecord::addString(const string& name, const string& value) {
+    fields_.push_back(Field(name, value, true));
+}
+
+void
+ResultRecord::addInteger(const string& name, uint64_t value) {
+    fields_.push_back(Field(name, lexical_cast<string>(value), false));
+}
+
+void
+ResultRecord::addNumber(const string& name, double value) {
+    // nan and inf can't be represented in JSON; they are left empty, which
+    // is written as null (and as an empty value in CSV).
+    if (!boost::math::isfinite(value)) {
+        fields_.push_back(Field(name, "", false));
+        return;
+    }
+    ostringstream oss;
+    oss << fixed << setprecision(6) << value;
+    fields_.push_back(Field(name, oss.str(), false));
+}
+
+void
+ResultRecord::addBoolean(const string& name, bool value) {
+    fields_.push_back(Field(name, value ? "true" : "false", false));
+}
+
+ResultSet::Section&
+ResultSet::getSection(const string& name, bool list) {
+    BOOST_FOREACH(Section& section, sections_) {
+        if (section.name == name) {
+            if (section.list != list) {
+                throw ResultSetError("result section type mismatch: " + name);
+            }
+            return (section);
+        }
+    }
+    sections_.push_back(Section(name, list));
+    return (sections_.back());
+}
+
+ResultRecord&
+ResultSet::getRecord(const string& section_name) {
+    Section& section = getSection(section_name, false);
+    if (section.records.empty()) {
+        section.records.push_back(ResultRecord());
+    }
+    return (section.records.front());
+}
+
+ResultRecord&
+ResultSet::addRecord(const string& section_name) {
+    Section& section = getSection(section_name, true);
+    section.records.push_back(ResultRecord());
+    return (section.records.back());
+}
+
+void
+ResultSet::writeJSON(ostream& os) const {
+    os << "{";
+    for (size_t i = 0; i < sections_.size(); ++i) {
+        const Section& section = sections_[i];
+        os << (i > 0 ? ",\n  " : "\n  ") << quoteJSON(section.name) << ": ";
+        const string indent = section.list ? "      " : "    ";
+        if (section.list) {
+            os << "[";
+        }
+        for (size_t j = 0; j < section.records.size(); ++j) {
+            if (section.list) {
+                os << (j > 0 ? ",\n    " : "\n    ");
+            }
+            const vector<ResultRecord::Field>& fields =
+                section.records[j].fields_;
+            os << "{";
+            for (size_t k = 0; k < fields.size(); ++k) {
+                os << (k > 0 ? ",\n" : "\n") << indent
+                   << quoteJSON(fields[k].name) << ": "
+                   << (fields[k].quoted ? quoteJSON(fields[k].value) :
+                       (fields[k].value.empty() ? "null" : fields[k].value));
+            }
+            os << "\n" << indent.substr(2) << "}";
+        }
+        if (section.list) {
+            os << (section.records.empty() ? "]" : "\n  ]");
+        }
+    }
+    os << "\n}\n";
+}
+
+void
+ResultSet::writeCSV(ostream& os) const {
+    os << "section,index,name,value\n";
+    BOOST_FOREACH(const Section& section, sections_) {
+        for (size_t i = 0; i < section.records.size(); ++i) {
+            BOOST_FOREACH(const ResultRecord::Field& field,
+                          section.records[i].fields_) {
+                os << quoteCSV(section.name) << ","
+                   << (section.list ? lexical_cast<string>(i) : "") << ","
+                   << quoteCSV(field.name) << "," << quoteCSV(field.value)
+                   << "\n";
+            }
+        }
+    }
+}
+
+} // end of QueryPerf
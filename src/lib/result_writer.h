@@ -0,0 +1,127 @@
+// Copyright (C) 2012  JINMEI Tatuya
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+// OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#ifndef __QUERYPERF_RESULT_WRITER_H
+#define __QUERYPERF_RESULT_WRITER_H 1
+
+#include <deque>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+namespace Queryperf {
+
+/// \brief Exception class thrown on misuse of \c ResultSet.
+class ResultSetError : public std::runtime_error {
+public:
+    explicit ResultSetError(const std::string& what_arg) :
+        std::runtime_error(what_arg)
+    {}
+};
+
+/// \brief A set of named values, e.g., the counters of a thread.
+///
+/// Values are kept in the order they are added.
+class ResultRecord {
+public:
+    /// \brief Add a text value.
+    void addString(const std::string& name, const std::string& value);
+
+    /// \brief Add an integer value.
+    void addInteger(const std::string& name, uint64_t value);
+
+    /// \brief Add a real number, which is written with 6 digits after the
+    /// decimal point.  A non-finite value (nan or inf) is written as null
+    /// in JSON and as an empty value in CSV.
+    void addNumber(const std::string& name, double value);
+
+    /// \brief Add a boolean value.
+    void addBoolean(const std::string& name, bool value);
+
+private:
+    friend class ResultSet;
+
+    struct Field {
+        Field(const std::string& field_name, const std::string& field_value,
+              bool is_string) :
+            name(field_name), value(field_value), quoted(is_string)
+        {}
+        std::string name;
+        std::string value;      // textual representation (empty if null)
+        bool quoted;            // whether it's a string in JSON
+    };
+    std::vector<Field> fields_;
+};
+
+/// \brief Results of a test run in a machine-readable form.
+///
+/// The results are organized in named sections, each of which is either
+/// a single record (e.g., the configuration) or a list of records (e.g.,
+/// per-thread counters).  They can be written in JSON or CSV:
+///
+/// - JSON: an object whose members are the sections, in the order they
+///   are created; a single record is an object, and a list is an array of
+///   objects.
+/// - CSV: a header line of "section,index,name,value" followed by a line
+///   for each value.  The index is the position of the record in a list
+///   section (from 0), and empty for a single record.  This "long" form
+///   has a fixed set of columns, so results of different runs can be
+///   concatenated and processed with the same tools.
+class ResultSet {
+public:
+    /// \brief Return the record of a single-record section, creating it
+    /// on the first call.
+    ///
+    /// \throw ResultSetError The section is a list.
+    ResultRecord& getRecord(const std::string& section);
+
+    /// \brief Add a record to a list section (created on the first call)
+    /// and return it.
+    ///
+    /// References to the records already returned remain valid.
+    ///
+    /// \throw ResultSetError The section is a single record.
+    ResultRecord& addRecord(const std::string& section);
+
+    /// \brief Write the results in JSON.
+    void writeJSON(std::ostream& os) const;
+
+    /// \brief Write the results in CSV.
+    void writeCSV(std::ostream& os) const;
+
+private:
+    struct Section {
+        Section(const std::string& section_name, bool is_list) :
+            name(section_name), list(is_list)
+        {}
+        std::string name;
+        bool list;
+        std::deque<ResultRecord> records;
+    };
+
+    Section& getSection(const std::string& name, bool list);
+
+    std::deque<Section> sections_;
+};
+
+} // end of QueryPerf
+
+#endif // __QUERYPERF_RESULT_WRITER_H
+
+// Local Variables:
+// mode: c++
+// End:
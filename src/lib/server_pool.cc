@@ -0,0 +1,141 @@
+// Copyright (C) 2012  JINMEI Tatuya
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+// OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#include <server_pool.h>
+
+#include <boost/lexical_cast.hpp>
+
+#include <string>
+#include <vector>
+
+using namespace std;
+using boost::lexical_cast;
+
+namespace Queryperf {
+
+namespace {
+// Convert a field of a server entry to an unsigned integer between 1 and
+// max; lexical_cast would accept negative numbers.
+unsigned int
+parseField(const string& field, unsigned int max, const string& entry) {
+    if (field.empty() ||
+        field.find_first_not_of("0123456789") != string::npos ||
+        field.size() > 10) {
+        throw ServerPoolError("invalid server: " + entry);
+    }
+    const uint64_t value = lexical_cast<uint64_t>(field);
+    if (value == 0 || value > max) {
+        throw ServerPoolError("invalid server: " + entry);
+    }
+    return (static_cast<unsigned int>(value));
+}
+
+unsigned int
+gcd(unsigned int a, unsigned int b) {
+    while (b != 0) {
+        const unsigned int r = a % b;
+        a = b;
+        b = r;
+    }
+    return (a);
+}
+}
+
+vector<ServerSpec>
+parseServerList(const string& text, uint16_t default_port) {
+    vector<ServerSpec> servers;
+    string::size_type pos = 0;
+    while (true) {
+        const string::size_type end = text.find(',', pos);
+        const string entry = text.substr(pos, end - pos);
+
+        ServerSpec server("", default_port, 1);
+        string::size_type field_end = entry.find_first_of("#/");
+        server.address = entry.substr(0, field_end);
+        if (server.address.empty()) {
+            throw ServerPoolError("invalid server: " + entry);
+        }
+        if (field_end != string::npos && entry[field_end] == '#') {
+            const string::size_type port_pos = field_end + 1;
+            field_end = entry.find('/', port_pos);
+            server.port = parseField(entry.substr(port_pos,
+                                                  field_end - port_pos),
+                                     0xffff, entry);
+        }
+        if (field_end != string::npos) {
+            server.weight = parseField(entry.substr(field_end + 1),
+                                       ServerSpec::MAX_WEIGHT, entry);
+        }
+        servers.push_back(server);
+
+        if (end == string::npos) {
+            break;
+        }
+        pos = end + 1;
+    }
+    return (servers);
+}
+
+double
+ServerResult::getLossRate() const {
+    if (queries_sent == 0) {
+        return (0);
+    }
+    return (static_cast<double>(queries_timedout) * 100 / queries_sent);
+}
+
+void
+ServerResult::merge(const ServerResult& other) {
+    queries_sent += other.queries_sent;
+    queries_completed += other.queries_completed;
+    queries_timedout += other.queries_timedout;
+    rtt_histogram.merge(other.rtt_histogram);
+}
+
+void
+ServerSchedule::reset(const vector<unsigned int>& weights) {
+    if (weights.empty()) {
+        throw ServerPoolError("no server for the schedule");
+    }
+    unsigned int divisor = 0;
+    for (size_t i = 0; i < weights.size(); ++i) {
+        if (weights[i] == 0) {
+            throw ServerPoolError("server weight must be positive");
+        }
+        divisor = gcd(weights[i], divisor);
+    }
+
+    // In each round, every server earns its weight, and the one that has
+    // earned the most is chosen and pays the total.
+    int64_t total = 0;
+    vector<int64_t> earned(weights.size(), 0);
+    for (size_t i = 0; i < weights.size(); ++i) {
+        total += weights[i] / divisor;
+    }
+    sequence_.clear();
+    for (int64_t round = 0; round < total; ++round) {
+        size_t chosen = 0;
+        for (size_t i = 0; i < weights.size(); ++i) {
+            earned[i] += weights[i] / divisor;
+            if (earned[i] > earned[chosen]) {
+                chosen = i;
+            }
+        }
+        earned[chosen] -= total;
+        sequence_.push_back(chosen);
+    }
+    next_ = 0;
+}
+
+} // end of QueryPerf
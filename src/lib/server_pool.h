@@ -0,0 +1,127 @@
+// Copyright (C) 2012  JINMEI Tatuya
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+// OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#ifndef __QUERYPERF_SERVER_POOL_H
+#define __QUERYPERF_SERVER_POOL_H 1
+
+#include <latency_histogram.h>
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+#include <stdint.h>
+
+namespace Queryperf {
+
+/// \brief Exception class thrown on invalid server lists.
+class ServerPoolError : public std::runtime_error {
+public:
+    explicit ServerPoolError(const std::string& what_arg) :
+        std::runtime_error(what_arg)
+    {}
+};
+
+/// \brief A server to be tested, with its share of the queries.
+struct ServerSpec {
+    ServerSpec() : port(0), weight(1) {}
+    ServerSpec(const std::string& server_address, uint16_t server_port,
+               unsigned int server_weight) :
+        address(server_address), port(server_port), weight(server_weight)
+    {}
+
+    /// \brief The maximum weight of a server.
+    static const unsigned int MAX_WEIGHT = 1000;
+
+    std::string address;
+    uint16_t port;
+    unsigned int weight;        // relative to the other servers
+};
+
+/// \brief Parse a comma-separated list of servers.
+///
+/// Each server is given as "address[#port][/weight]"; the port defaults to
+/// \c default_port and the weight to 1 (it must be between 1 and
+/// \c ServerSpec::MAX_WEIGHT).  For example, "192.0.2.1,192.0.2.2#5353/3"
+/// sends three fourths of the queries to port 5353 of the second server.
+/// Addresses are not checked here.
+///
+/// \throw ServerPoolError The list is empty or an entry is invalid.
+std::vector<ServerSpec> parseServerList(const std::string& text,
+                                        uint16_t default_port);
+
+/// \brief Statistics of queries sent to a single server.
+struct ServerResult {
+    explicit ServerResult(const ServerSpec& server_spec) :
+        server(server_spec), queries_sent(0), queries_completed(0),
+        queries_timedout(0)
+    {}
+
+    ServerSpec server;
+    size_t queries_sent;
+    size_t queries_completed;
+    size_t queries_timedout;    // or lost with a TCP connection
+    LatencyHistogram rtt_histogram; // in microseconds
+
+    /// \brief Return the percentage of queries sent that were not
+    /// responded (timed out or lost).
+    double getLossRate() const;
+
+    /// \brief Add the statistics of another thread for the same server.
+    void merge(const ServerResult& other);
+};
+
+/// \brief The order in which queries are distributed to servers.
+///
+/// It's a cycle of server indices in which each server appears as many
+/// times as its weight (divided by the greatest common divisor of the
+/// weights), spread as evenly as possible ("smooth" weighted round-robin):
+/// e.g., weights 5, 1 and 1 result in 0, 0, 1, 0, 2, 0, 0.  The cycle is
+/// built in advance, so choosing the server for a query is just a table
+/// lookup.
+class ServerSchedule {
+public:
+    /// \brief Constructor; the schedule has a single server 0 by default.
+    ServerSchedule() : sequence_(1, 0), next_(0) {}
+
+    /// \brief Build the schedule for servers of the given weights.
+    ///
+    /// \throw ServerPoolError \c weights is empty or has a 0.
+    void reset(const std::vector<unsigned int>& weights);
+
+    /// \brief Return the index of the server for the next query.
+    size_t next() {
+        const size_t index = sequence_[next_];
+        if (++next_ == sequence_.size()) {
+            next_ = 0;
+        }
+        return (index);
+    }
+
+    /// \brief Return the length of the cycle.
+    size_t getLength() const { return (sequence_.size()); }
+
+private:
+    std::vector<size_t> sequence_;
+    size_t next_;
+};
+
+} // end of QueryPerf
+
+#endif // __QUERYPERF_SERVER_POOL_H
+
+// Local Variables:
+// mode: c++
+// End:
@@ -0,0 +1,73 @@
+// Copyright (C) 2012  JINMEI Tatuya
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+// OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#ifndef __QUERYPERF_SOCKADDR_UTIL_H
+#define __QUERYPERF_SOCKADDR_UTIL_H 1
+
+// Socket address helpers shared by the message manager implementations
+// that directly use the socket API.
+
+#include <message_manager.h>
+
+#include <cstring>
+#include <string>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <stdint.h>
+
+namespace Queryperf {
+
+/// \brief Convert textual representation of an IPv6 or IPv4 address and
+/// port to a socket address structure, and return its length.
+///
+/// \throw MessageSocketError The address is invalid.
+inline socklen_t
+convertAddress(const std::string& address, uint16_t port,
+               struct sockaddr_storage& ss)
+{
+    memset(&ss, 0, sizeof(ss));
+    void* p = &ss;
+    struct sockaddr_in6* sin6 = static_cast<struct sockaddr_in6*>(p);
+    if (inet_pton(AF_INET6, address.c_str(), &sin6->sin6_addr) == 1) {
+        sin6->sin6_family = AF_INET6;
+        sin6->sin6_port = htons(port);
+        return (sizeof(*sin6));
+    }
+    struct sockaddr_in* sin4 = static_cast<struct sockaddr_in*>(p);
+    if (inet_pton(AF_INET, address.c_str(), &sin4->sin_addr) == 1) {
+        sin4->sin_family = AF_INET;
+        sin4->sin_port = htons(port);
+        return (sizeof(*sin4));
+    }
+    throw MessageSocketError("Failed to create a socket: invalid address: " +
+                             address);
+}
+
+/// \brief Convert a socket address storage to the generic form.
+inline const struct sockaddr*
+convertSockAddr(const struct sockaddr_storage* ss) {
+    const void* p = ss;
+    return (static_cast<const struct sockaddr*>(p));
+}
+
+} // end of QueryPerf
+
+#endif // __QUERYPERF_SOCKADDR_UTIL_H
+
+// Local Variables:
+// mode: c++
+// End:
@@ -0,0 +1,60 @@
+// Copyright (C) 2012  JINMEI Tatuya
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+// OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#include <stats_counters.h>
+
+namespace Queryperf {
+
+namespace {
+// Subtract an earlier value of a counter; the difference can't be
+// negative, but guard against inconsistent snapshots anyway.
+uint64_t
+getDifference(uint64_t value, uint64_t earlier) {
+    return (value > earlier ? value - earlier : 0);
+}
+}
+
+void
+StatsSnapshot::merge(const StatsSnapshot& other) {
+    queries_sent += other.queries_sent;
+    queries_completed += other.queries_completed;
+    queries_timedout += other.queries_timedout;
+    queries_skipped += other.queries_skipped;
+    rtt_histogram.merge(other.rtt_histogram);
+}
+
+void
+StatsSnapshot::subtract(const StatsSnapshot& earlier) {
+    queries_sent = getDifference(queries_sent, earlier.queries_sent);
+    queries_completed = getDifference(queries_completed,
+                                      earlier.queries_completed);
+    queries_timedout = getDifference(queries_timedout,
+                                     earlier.queries_timedout);
+    queries_skipped = getDifference(queries_skipped, earlier.queries_skipped);
+    rtt_histogram.subtract(earlier.rtt_histogram);
+}
+
+void
+StatsCounters::sample(StatsSnapshot& snapshot) const {
+    snapshot.queries_sent = __atomic_load_n(&queries_sent_, __ATOMIC_RELAXED);
+    snapshot.queries_completed = __atomic_load_n(&queries_completed_,
+                                                 __ATOMIC_RELAXED);
+    snapshot.queries_timedout = __atomic_load_n(&queries_timedout_,
+                                                __ATOMIC_RELAXED);
+    snapshot.queries_skipped = __atomic_load_n(&queries_skipped_,
+                                               __ATOMIC_RELAXED);
+    snapshot.rtt_histogram.load(rtt_histogram_);
+}
+
+} // end of QueryPerf
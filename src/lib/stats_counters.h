@@ -0,0 +1,119 @@
+// Copyright (C) 2012  JINMEI Tatuya
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+// OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#ifndef __QUERYPERF_STATS_COUNTERS_H
+#define __QUERYPERF_STATS_COUNTERS_H 1
+
+#include <latency_histogram.h>
+
+#include <cstddef>
+
+#include <stdint.h>
+
+namespace Queryperf {
+
+/// \brief A copy of \c StatsCounters at some point of time.
+struct StatsSnapshot {
+    StatsSnapshot() :
+        queries_sent(0), queries_completed(0), queries_timedout(0),
+        queries_skipped(0)
+    {}
+
+    uint64_t queries_sent;
+    uint64_t queries_completed;
+    uint64_t queries_timedout;
+    uint64_t queries_skipped;
+    LatencyHistogram rtt_histogram; // in microseconds
+
+    /// \brief Add the statistics of another dispatcher.
+    void merge(const StatsSnapshot& other);
+
+    /// \brief Leave only the difference from an earlier snapshot of the
+    /// same statistics.
+    void subtract(const StatsSnapshot& earlier);
+};
+
+/// \brief Query statistics of a dispatcher, which other threads can take
+/// a snapshot of while the dispatcher is running.
+///
+/// Only the dispatcher's thread updates the counters, so they are
+/// updated with atomic stores rather than read-modify-write operations,
+/// and other threads read them with atomic loads; neither needs a lock
+/// or a memory barrier, so sampling doesn't slow down the dispatcher.
+/// The counters are padded so they don't share a cache line with other
+/// data, which may be those of other threads.
+class StatsCounters {
+public:
+    StatsCounters() :
+        queries_sent_(0), queries_completed_(0), queries_timedout_(0),
+        queries_skipped_(0)
+    {}
+
+    /// \brief Count a query sent.
+    void addSent() { add(queries_sent_, 1); }
+
+    /// \brief Count a query responded, and record its round-trip time in
+    /// microseconds.
+    void addCompleted(uint64_t rtt) {
+        add(queries_completed_, 1);
+        rtt_histogram_.recordShared(rtt);
+    }
+
+    /// \brief Count a query that wasn't responded.
+    void addTimedOut() { add(queries_timedout_, 1); }
+
+    /// \brief Count queries that were due in the open-loop mode but
+    /// couldn't be sent.
+    void addSkipped(uint64_t count) { add(queries_skipped_, count); }
+
+    /// \name Accessors for the dispatcher's thread, or after it finishes.
+    //@{
+    uint64_t getQueriesSent() const { return (queries_sent_); }
+    uint64_t getQueriesCompleted() const { return (queries_completed_); }
+    uint64_t getQueriesTimedOut() const { return (queries_timedout_); }
+    uint64_t getQueriesSkipped() const { return (queries_skipped_); }
+    const LatencyHistogram& getLatencyHistogram() const {
+        return (rtt_histogram_);
+    }
+    //@}
+
+    /// \brief Copy the current values into \c snapshot.
+    ///
+    /// It can be called from any thread.  The counters are read one by
+    /// one, so they may be slightly inconsistent with each other.
+    void sample(StatsSnapshot& snapshot) const;
+
+private:
+    static const size_t CACHE_LINE_SIZE = 64;
+
+    static void add(uint64_t& counter, uint64_t count) {
+        __atomic_store_n(&counter, counter + count, __ATOMIC_RELAXED);
+    }
+
+    char head_padding_[CACHE_LINE_SIZE];
+    uint64_t queries_sent_;
+    uint64_t queries_completed_;
+    uint64_t queries_timedout_;
+    uint64_t queries_skipped_;
+    LatencyHistogram rtt_histogram_;
+    char tail_padding_[CACHE_LINE_SIZE];
+};
+
+} // end of QueryPerf
+
+#endif // __QUERYPERF_STATS_COUNTERS_H
+
+// Local Variables:
+// mode: c++
+// End:
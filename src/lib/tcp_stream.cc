@@ -0,0 +1,185 @@
+// Copyright (C) 2012  JINMEI Tatuya
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+// OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#include <tcp_stream.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+namespace Queryperf {
+
+TCPStream::TCPStream(const StreamSocketParams& params) :
+    n_queued_(0), recvbuf_(RECVBUF_LEN), recv_head_(0), recv_tail_(0),
+    max_messages_(params.max_messages), n_sent_(0), n_received_(0),
+    tls_(params.tls_context != NULL ?
+         new TLSSession(*params.tls_context) : NULL),
+    tls_recvbuf_(params.tls_context != NULL ? TLS_RECVBUF_LEN : 0)
+{}
+
+void
+TCPStream::queueMessage(const void* data, size_t datalen) {
+    assert(datalen <= MAX_MESSAGE_LEN);
+    const uint8_t* const cp = static_cast<const uint8_t*>(data);
+    sendq_.push_back(datalen >> 8);
+    sendq_.push_back(datalen & 0xff);
+    sendq_.insert(sendq_.end(), cp, cp + datalen);
+    ++n_queued_;
+}
+
+void
+TCPStream::startConnection() {
+    closeConnection();
+    if (tls_) {
+        tls_->start();
+    }
+}
+
+size_t
+TCPStream::getSendable(size_t& len) const {
+    len = 0;
+    if (tls_ && !tls_->isEstablished()) {
+        return (0);
+    }
+    size_t n = n_queued_;
+    if (max_messages_ > 0) {
+        n = std::min(n, max_messages_ - n_sent_);
+    }
+    if (n == n_queued_) {
+        len = sendq_.size();
+    } else {
+        for (size_t i = 0; i < n; ++i) {
+            len += sendq_[len] * 256 + sendq_[len + 1] + 2;
+        }
+    }
+    return (n);
+}
+
+bool
+TCPStream::hasQueued() const {
+    size_t len;
+    return ((tls_ && tls_->hasOutput()) || getSendable(len) > 0);
+}
+
+bool
+TCPStream::takeQueued(std::vector<uint8_t>& buf) {
+    buf.clear();
+    size_t len;
+    const size_t n = getSendable(len);
+    if (tls_) {
+        if (n > 0) {
+            if (!tls_->write(&sendq_[0], len)) {
+                error_ = tls_->getError();
+                return (false);
+            }
+            sendq_.erase(sendq_.begin(), sendq_.begin() + len);
+        }
+        tls_->takeOutput(buf);
+    } else if (n == n_queued_) {
+        // Swap rather than copy; the old buffer will be reused for the
+        // queue.
+        buf.swap(sendq_);
+        sendq_.clear();
+    } else {
+        buf.assign(sendq_.begin(), sendq_.begin() + len);
+        sendq_.erase(sendq_.begin(), sendq_.begin() + len);
+    }
+    n_queued_ -= n;
+    n_sent_ += n;
+    return (true);
+}
+
+uint8_t*
+TCPStream::getReceiveSpace(size_t& len) {
+    // Move the remaining (partial) message to the beginning of the buffer
+    // only when the free space may not be large enough for a full message;
+    // usually the buffer is simply reset as all data have been taken.
+    if (recv_head_ == recv_tail_) {
+        recv_head_ = recv_tail_ = 0;
+    } else if (RECVBUF_LEN - recv_tail_ < MAX_MESSAGE_LEN + 2) {
+        memmove(&recvbuf_[0], &recvbuf_[recv_head_], recv_tail_ - recv_head_);
+        recv_tail_ -= recv_head_;
+        recv_head_ = 0;
+    }
+    if (tls_) {
+        len = TLS_RECVBUF_LEN;
+        return (&tls_recvbuf_[0]);
+    }
+    len = RECVBUF_LEN - recv_tail_;
+    return (&recvbuf_[0] + recv_tail_);
+}
+
+bool
+TCPStream::commitReceived(size_t len) {
+    if (!tls_) {
+        assert(recv_tail_ + len <= RECVBUF_LEN);
+        recv_tail_ += len;
+        return (true);
+    }
+
+    assert(len <= TLS_RECVBUF_LEN);
+    if (!tls_->receive(&tls_recvbuf_[0], len)) {
+        error_ = tls_->getError();
+        return (false);
+    }
+    while (recv_tail_ < RECVBUF_LEN) {
+        const ssize_t ret = tls_->read(&recvbuf_[recv_tail_],
+                                       RECVBUF_LEN - recv_tail_);
+        if (ret < 0) {
+            error_ = tls_->getError();
+            return (false);
+        }
+        if (ret == 0) {
+            break;
+        }
+        recv_tail_ += ret;
+    }
+    return (true);
+}
+
+bool
+TCPStream::getNextMessage(const void*& data, size_t& datalen) {
+    const size_t available = recv_tail_ - recv_head_;
+    if (available < 2) {
+        return (false);
+    }
+    const size_t msglen = recvbuf_[recv_head_] * 256 +
+        recvbuf_[recv_head_ + 1];
+    if (available < msglen + 2) {
+        return (false);
+    }
+    data = &recvbuf_[0] + recv_head_ + 2;
+    datalen = msglen;
+    recv_head_ += msglen + 2;
+    ++n_received_;
+    return (true);
+}
+
+void
+TCPStream::closeConnection() {
+    recv_head_ = recv_tail_ = 0;
+    n_sent_ = n_received_ = 0;
+    if (tls_) {
+        tls_->reset();
+    }
+}
+
+void
+TCPStream::clear() {
+    sendq_.clear();
+    n_queued_ = 0;
+    closeConnection();
+}
+
+} // end of QueryPerf
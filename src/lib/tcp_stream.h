@@ -0,0 +1,166 @@
+// Copyright (C) 2012  JINMEI Tatuya
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+// OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#ifndef __QUERYPERF_TCP_STREAM_H
+#define __QUERYPERF_TCP_STREAM_H 1
+
+#include <message_manager.h>
+#include <tls_context.h>
+
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_ptr.hpp>
+
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+#include <stdint.h>
+
+namespace Queryperf {
+
+/// \brief Send and receive buffers of a persistent TCP connection.
+///
+/// DNS messages over TCP are preceded by a two-octet length field
+/// (RFC 1035, Section 4.2.2).  This class handles this framing for the
+/// persistent TCP sockets of the message managers (see
+/// \c MessageManager::createPersistentMessageSocket()), independently from
+/// how they do the actual I/O:
+/// - Messages to be sent are queued by \c queueMessage() with the length
+///   field, and the socket takes all of them at once by \c takeQueued(),
+///   so a single write can carry many pipelined queries.
+/// - The socket reads as much data as available into the space returned by
+///   \c getReceiveSpace(), tells the amount by \c commitReceived(), and
+///   then takes the complete messages by \c getNextMessage().
+///
+/// It also applies the other parameters of the connection
+/// (\c StreamSocketParams): if TLS is used, the data taken by
+/// \c takeQueued() and given to \c commitReceived() are TLS records, and
+/// the queued messages are held until the handshake completes; if the
+/// number of messages per connection is limited, the exceeding messages
+/// are held until the socket reopens the connection as \c isFinished()
+/// tells.
+class TCPStream : private boost::noncopyable {
+public:
+    /// \brief Maximum size of a DNS message over TCP.
+    static const size_t MAX_MESSAGE_LEN = 65535;
+
+    /// \brief Size of the receive buffer.
+    ///
+    /// It can hold a full message (with the length field) in addition to
+    /// the remaining part of the previous one.
+    static const size_t RECVBUF_LEN = (MAX_MESSAGE_LEN + 2) * 2;
+
+    /// \brief Size of the buffer for received TLS records.
+    ///
+    /// Decrypting them (with a possibly incomplete record received before)
+    /// never produces more data than the free space of the receive buffer.
+    static const size_t TLS_RECVBUF_LEN = 32768;
+
+    explicit TCPStream(const StreamSocketParams& params =
+                       StreamSocketParams());
+
+    /// \brief Queue a message to be sent.
+    void queueMessage(const void* data, size_t datalen);
+
+    /// \brief Return whether any queued message hasn't been sent.
+    ///
+    /// If it's true while the connection is closed, the socket should
+    /// open a new one.
+    bool hasPending() const { return (n_queued_ > 0); }
+
+    /// \brief Tell that a new connection has been established.
+    ///
+    /// If TLS is used, it starts the handshake, whose first message is
+    /// available via \c takeQueued().
+    void startConnection();
+
+    /// \brief Return whether there's any data to be sent now.
+    bool hasQueued() const;
+
+    /// \brief Move all data to be sent now to \c buf.
+    ///
+    /// The previous content of \c buf is discarded.  The caller can keep
+    /// sending the data from \c buf while new messages are queued.
+    ///
+    /// \return false on failure of TLS (see \c getError()); true
+    /// otherwise.
+    bool takeQueued(std::vector<uint8_t>& buf);
+
+    /// \brief Return the free space of the receive buffer.
+    ///
+    /// \param len Set to the size of the space; it's never 0.
+    uint8_t* getReceiveSpace(size_t& len);
+
+    /// \brief Tell that \c len bytes of data have been stored in the
+    /// space returned by \c getReceiveSpace().
+    ///
+    /// If TLS is used, it may make more data to be sent (see
+    /// \c hasQueued()).
+    ///
+    /// \return false on failure of TLS (see \c getError()); true
+    /// otherwise.
+    bool commitReceived(size_t len);
+
+    /// \brief Take the next complete message of the received data.
+    ///
+    /// The returned data (without the length field) is valid until the next
+    /// call to \c getReceiveSpace() or \c clear().
+    ///
+    /// \return true if a complete message is available; false otherwise.
+    bool getNextMessage(const void*& data, size_t& datalen);
+
+    /// \brief Return whether the current connection has exchanged the
+    /// maximum number of messages, so it should be closed.
+    bool isFinished() const {
+        return (max_messages_ > 0 && n_received_ >= max_messages_);
+    }
+
+    /// \brief Tell that the current connection has been closed (normally).
+    ///
+    /// Data received or being sent on the connection are discarded, but the
+    /// queued messages are kept for the next connection.
+    void closeConnection();
+
+    /// \brief Discard all queued and received data, e.g., when the
+    /// connection has failed.
+    void clear();
+
+    /// \brief Return the description of the last failure.
+    const std::string& getError() const { return (error_); }
+
+private:
+    // Return the number of messages (and the bytes of them) that can be
+    // sent now.
+    size_t getSendable(size_t& len) const;
+
+    std::vector<uint8_t> sendq_;
+    size_t n_queued_;           // # of messages in sendq_
+    std::vector<uint8_t> recvbuf_;
+    size_t recv_head_;          // beginning of the data not yet taken
+    size_t recv_tail_;          // end of the received data
+    const size_t max_messages_; // per connection; 0 means unlimited
+    size_t n_sent_;             // # of messages sent on the connection
+    size_t n_received_;         // # of messages received on it
+    boost::scoped_ptr<TLSSession> tls_; // NULL unless TLS is used
+    std::vector<uint8_t> tls_recvbuf_;  // received TLS records
+    std::string error_;
+};
+
+} // end of QueryPerf
+
+#endif // __QUERYPERF_TCP_STREAM_H
+
+// Local Variables:
+// mode: c++
+// End:
@@ -28,7 +28,15 @@
 // OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
 // PERFORMANCE OF THIS SOFTWARE.
 
+#include <config.h>
+
 #include <asio_message_manager.h>
+#include <tls_context.h>
+
+#include <socket_test_util.h>
+#ifdef HAVE_OPENSSL
+#include <tls_test_util.h>
+#endif
 
 #include <gtest/gtest.h>
 
@@ -40,6 +48,7 @@
 
 #include <cstring>
 #include <string>
+#include <vector>
 #include <utility>
 
 #include <sys/types.h>
@@ -51,6 +60,7 @@
 
 using namespace std;
 using namespace Queryperf;
+using namespace Queryperf::unittest;
 using boost::scoped_ptr;
 using boost::lexical_cast;
 using namespace boost::posix_time;
@@ -60,118 +70,6 @@ using boost::posix_time::ptime;
 namespace {
 const char TEST_DATA[] = "queryperf test";
 
-// A simple helper structure to automatically close test sockets on return
-// or exception in a RAII manner.  non copyable to prevent duplicate close.
-struct ScopedSocket : boost::noncopyable {
-    ScopedSocket() : fd(-1) {}
-    ScopedSocket(int sock) : fd(sock) {}
-    ~ScopedSocket() {
-        closeSocket();
-    }
-    void reset(int sock) {
-        closeSocket();
-        fd = sock;
-    }
-    int fd;
-private:
-    void closeSocket() {
-        if (fd >= 0) {
-            close(fd);
-        }
-    }
-};
-
-// Lower level C-APIs require conversion between various variants of
-// sockaddr's, which is not friendly with C++.  The following templates
-// are a shortcut of common workaround conversion in such cases.
-
-template <typename SAType>
-const struct sockaddr*
-convertSockAddr(const SAType* sa) {
-    const void* p = sa;
-    return (static_cast<const struct sockaddr*>(p));
-}
-
-template <typename SAType>
-const SAType*
-convertSockAddr(const struct sockaddr* sa) {
-    const void* p = sa;
-    return (static_cast<const SAType*>(p));
-}
-
-template <typename SAType>
-struct sockaddr*
-convertSockAddr(SAType* sa) {
-    void* p = sa;
-    return (static_cast<struct sockaddr*>(p));
-}
-
-template <typename SAType>
-SAType*
-convertSockAddr(struct sockaddr* sa) {
-    void* p = sa;
-    return (static_cast<SAType*>(p));
-}
-
-// A helper to impose some reasonable amount of wait on recv(from)
-// if possible.  It returns an option flag to be set for the system call
-// (when necessary).
-int
-setRecvDelay(int s) {
-    const struct timeval timeo = { 10, 0 };
-    if (setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &timeo, sizeof(timeo)) == -1) {
-        if (errno == ENOPROTOOPT) {
-            // Workaround for Solaris: see recursive_query_unittest
-            return (MSG_DONTWAIT);
-        } else {
-            throw runtime_error(string("set RCVTIMEO failed: ") +
-                                strerror(errno));
-        }
-    }
-    return (0);
-}
-
-// A shortcut type that is convenient to be used for socket related
-// system calls, which generally require this pair
-typedef pair<const struct sockaddr*, socklen_t> SockAddrInfo;
-
-// A helper class to convert textual representation of IP address and port
-// to a pair of sockaddr and its length (in the form of a SockAddrInfo
-// pair).  Its get method uses getaddrinfo(3) for the conversion and stores
-// the result in the addrinfo_list_ vector until the object is destructed.
-// The allocated resources will be automatically freed in an RAII manner.
-class SockAddrCreator {
-public:
-    ~SockAddrCreator() {
-        vector<struct addrinfo*>::const_iterator it;
-        for (it = addrinfo_list_.begin(); it != addrinfo_list_.end(); ++it) {
-            freeaddrinfo(*it);
-        }
-    }
-    SockAddrInfo get(const string& addr_str, const string& port_str) {
-        struct addrinfo hints, *res;
-        memset(&hints, 0, sizeof(hints));
-        hints.ai_flags = AI_NUMERICHOST | AI_NUMERICSERV;
-        hints.ai_family = AF_UNSPEC;
-        hints.ai_socktype = SOCK_DGRAM; // could be either DGRAM or STREAM here
-        const int error = getaddrinfo(addr_str.c_str(), port_str.c_str(),
-                                      &hints, &res);
-        if (error != 0) {
-            throw runtime_error("getaddrinfo failed for " + addr_str + ", " +
-                                port_str + ": " + gai_strerror(error));
-        }
-
-        // Technically, this is not entirely exception safe; if push_back
-        // throws, the resources allocated for 'res' will leak.  We prefer
-        // brevity here and ignore the minor failure mode.
-        addrinfo_list_.push_back(res);
-
-        return (SockAddrInfo(res->ai_addr, res->ai_addrlen));
-    }
-private:
-    vector<struct addrinfo*> addrinfo_list_;
-};
-
 // An empty call back for MessageSocket::send.  Used when we don't have
 // to test the callback behavior.
 void
@@ -188,7 +86,7 @@ public:
     ASIOMessageManagerTest() : sendcallback_called_(0),
                                timercallback_called_(0),
                                helpercallback_called_(0),
-                               send_done_(0)
+                               send_done_(0), closecallback_called_(0)
     {}
 
     // A convenient shortcut for the namespace-scope version of getSockAddr
@@ -214,6 +112,50 @@ public:
         }
     }
 
+    // Callback for a persistent TCP socket.  The manager returns from
+    // run() by itself once the connection is closed, as nothing remains.
+    void persistentCallback(const MessageSocket::Event& ev) {
+        if (ev.data == NULL) {
+            ++closecallback_called_;
+            EXPECT_EQ(0, ev.datalen);
+        } else {
+            ++sendcallback_called_;
+            EXPECT_EQ(sizeof(TEST_DATA), ev.datalen);
+            EXPECT_STREQ(TEST_DATA, static_cast<const char*>(ev.data));
+        }
+    }
+
+    // Emulate a server for pipelined queries on a persistent TCP
+    // connection: accept the connection, check n_queries queries, and
+    // send all responses at once, split in the middle of the first length
+    // field so the client needs to reassemble them.  The connection is then
+    // closed.
+    void persistentServerCallback(int listen_fd, size_t n_queries) {
+        ++timercallback_called_;
+
+        sockaddr_storage ss;
+        socklen_t sa_len = sizeof(ss);
+        ScopedSocket s(accept(listen_fd, convertSockAddr(&ss), &sa_len));
+        ASSERT_NE(-1, s.fd);
+
+        vector<uint8_t> responses;
+        for (size_t i = 0; i < n_queries; ++i) {
+            uint8_t lenbuf[2];
+            char databuf[sizeof(TEST_DATA)];
+            EXPECT_EQ(2, recv(s.fd, lenbuf, 2, MSG_WAITALL));
+            EXPECT_EQ(sizeof(TEST_DATA), lenbuf[0] * 256 + lenbuf[1]);
+            EXPECT_EQ(sizeof(TEST_DATA), recv(s.fd, databuf,
+                                              sizeof(databuf), MSG_WAITALL));
+            EXPECT_STREQ(TEST_DATA, databuf);
+            responses.insert(responses.end(), lenbuf, lenbuf + 2);
+            responses.insert(responses.end(), TEST_DATA,
+                             TEST_DATA + sizeof(TEST_DATA));
+        }
+        EXPECT_EQ(1, send(s.fd, &responses[0], 1, 0));
+        EXPECT_EQ(responses.size() - 1,
+                  send(s.fd, &responses[1], responses.size() - 1, 0));
+    }
+
     void timerCallback() {
         ++timercallback_called_;
     }
@@ -260,7 +202,9 @@ public:
     size_t timercallback_called_;
     size_t helpercallback_called_; // # of times callbackForTCPTest is called
     size_t send_done_;
+    size_t closecallback_called_; // for persistent TCP sockets
     ASIOMessageManager asio_manager_;
+    scoped_ptr<TLSContext> tls_ctx_; // must outlive test_sock_
     scoped_ptr<MessageSocket> test_sock_;
     scoped_ptr<MessageSocket> udp_sock_; // auxiliary socket used in TCP test
     scoped_ptr<MessageTimer> test_timer_;
@@ -626,6 +570,99 @@ TEST_F(ASIOMessageManagerTest, multipleUDPSends) {
     EXPECT_EQ(2, sendcallback_called_);
 }
 
+TEST_F(ASIOMessageManagerTest, persistentTCP) {
+    ScopedSocket listen_s(createSocket(AF_INET6, SOCK_STREAM, IPPROTO_TCP,
+                                       getSockAddr("::1", "5306")));
+    test_sock_.reset(asio_manager_.createPersistentMessageSocket(
+                         "::1", 5306, StreamSocketParams(),
+                         boost::bind(&ASIOMessageManagerTest::persistentCallback,
+                                     this, _1)));
+    // Queries are pipelined: they are sent without waiting for responses.
+    for (size_t i = 0; i < 3; ++i) {
+        test_sock_->send(TEST_DATA, sizeof(TEST_DATA));
+    }
+    test_timer_.reset(asio_manager_.createMessageTimer(
+                          boost::bind(
+                              &ASIOMessageManagerTest::persistentServerCallback,
+                              this, listen_s.fd, 3)));
+    test_timer_->start(milliseconds(10));
+    asio_manager_.run();
+    EXPECT_EQ(1, timercallback_called_);
+    EXPECT_EQ(3, sendcallback_called_);
+    EXPECT_EQ(1, closecallback_called_);
+}
+
+TEST_F(ASIOMessageManagerTest, persistentTCPFail) {
+    // Nobody listens on the port; the callback should be called with NULL
+    // data.
+    test_sock_.reset(asio_manager_.createPersistentMessageSocket(
+                         "127.0.0.1", 5304, StreamSocketParams(),
+                         boost::bind(&ASIOMessageManagerTest::persistentCallback,
+                                     this, _1)));
+    test_sock_->send(TEST_DATA, sizeof(TEST_DATA));
+    asio_manager_.run();
+    EXPECT_EQ(0, sendcallback_called_);
+    EXPECT_EQ(1, closecallback_called_);
+}
+
+#ifdef HAVE_OPENSSL
+TEST_F(ASIOMessageManagerTest, persistentTLS) {
+    ScopedSocket listen_s(createSocket(AF_INET6, SOCK_STREAM, IPPROTO_TCP,
+                                       getSockAddr("::1", "5306")));
+    TLSTestServer server(listen_s.fd, 1, 3);
+    tls_ctx_.reset(new TLSContext);
+    StreamSocketParams params;
+    params.tls_context = tls_ctx_.get();
+    test_sock_.reset(asio_manager_.createPersistentMessageSocket(
+                         "::1", 5306, params,
+                         boost::bind(&ASIOMessageManagerTest::persistentCallback,
+                                     this, _1)));
+    // Queries are pipelined over the TLS session; they are sent once the
+    // handshake completes.  The server closes the connection after
+    // responding to all of them.
+    for (size_t i = 0; i < 3; ++i) {
+        test_sock_->send(TEST_DATA, sizeof(TEST_DATA));
+    }
+    asio_manager_.run();
+    server.wait();
+    EXPECT_EQ(3, sendcallback_called_);
+    EXPECT_EQ(1, closecallback_called_);
+    EXPECT_EQ(3, server.getMessageCount());
+    EXPECT_EQ(1, server.getHandshakeCount());
+    EXPECT_EQ(1, tls_ctx_->getHandshakeCount());
+    EXPECT_EQ(0, tls_ctx_->getResumedCount());
+}
+
+TEST_F(ASIOMessageManagerTest, persistentTLSResumption) {
+    ScopedSocket listen_s(createSocket(AF_INET6, SOCK_STREAM, IPPROTO_TCP,
+                                       getSockAddr("::1", "5306")));
+    TLSTestServer server(listen_s.fd, 3, 1);
+    tls_ctx_.reset(new TLSContext);
+    StreamSocketParams params;
+    params.tls_context = tls_ctx_.get();
+    params.max_messages = 1;
+    test_sock_.reset(asio_manager_.createPersistentMessageSocket(
+                         "::1", 5306, params,
+                         boost::bind(&ASIOMessageManagerTest::persistentCallback,
+                                     this, _1)));
+    // Each query is sent over a new connection, which should resume the
+    // session of the previous one.  The socket is closed quietly after
+    // the last response.
+    for (size_t i = 0; i < 3; ++i) {
+        test_sock_->send(TEST_DATA, sizeof(TEST_DATA));
+    }
+    asio_manager_.run();
+    server.wait();
+    EXPECT_EQ(3, sendcallback_called_);
+    EXPECT_EQ(0, closecallback_called_);
+    EXPECT_EQ(3, server.getMessageCount());
+    EXPECT_EQ(3, server.getHandshakeCount());
+    EXPECT_EQ(2, server.getResumedCount());
+    EXPECT_EQ(3, tls_ctx_->getHandshakeCount());
+    EXPECT_EQ(2, tls_ctx_->getResumedCount());
+}
+#endif
+
 TEST_F(ASIOMessageManagerTest, createMessageTimer) {
     test_timer_.reset(asio_manager_.createMessageTimer(noopTimerCallback));
     EXPECT_TRUE(test_timer_);
@@ -650,6 +687,21 @@ TEST_F(ASIOMessageManagerTest, DISABLED_startMessageTimer) {
     EXPECT_LE(500000, duration);
 }
 
+TEST_F(ASIOMessageManagerTest, coarseMessageTimer) {
+    test_timer_.reset(asio_manager_.createCoarseMessageTimer(
+                          boost::bind(&ASIOMessageManagerTest::timerCallback,
+                                      this)));
+    test_timer_->start(milliseconds(10));
+    asio_manager_.run();        // should return once the timer expires
+    EXPECT_EQ(1, timercallback_called_);
+
+    // A canceled timer doesn't keep the manager running.
+    test_timer_->start(seconds(10));
+    test_timer_->cancel();
+    asio_manager_.run();
+    EXPECT_EQ(1, timercallback_called_);
+}
+
 TEST_F(ASIOMessageManagerTest, cancelMessageTimer) {
     test_timer_.reset(asio_manager_.createMessageTimer(
                           boost::bind(&ASIOMessageManagerTest::timerCallback,
@@ -0,0 +1,81 @@
+// Copyright (C) 2012  JINMEI Tatuya
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+// OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#include <cpu_affinity.h>
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace std;
+using namespace Queryperf;
+
+namespace {
+TEST(CPUAffinityTest, parseCPUList) {
+    vector<unsigned int> cpus = parseCPUList("3");
+    ASSERT_EQ(1, cpus.size());
+    EXPECT_EQ(3, cpus[0]);
+
+    // Ranges are expanded, and the order is kept.
+    cpus = parseCPUList("8,0-2,5-5");
+    ASSERT_EQ(5, cpus.size());
+    EXPECT_EQ(8, cpus[0]);
+    EXPECT_EQ(0, cpus[1]);
+    EXPECT_EQ(1, cpus[2]);
+    EXPECT_EQ(2, cpus[3]);
+    EXPECT_EQ(5, cpus[4]);
+
+    EXPECT_EQ(1023, parseCPUList("1023").at(0));
+}
+
+TEST(CPUAffinityTest, parseBadCPUList) {
+    EXPECT_THROW(parseCPUList(""), CPUAffinityError);
+    EXPECT_THROW(parseCPUList("1,"), CPUAffinityError);
+    EXPECT_THROW(parseCPUList(",1"), CPUAffinityError);
+    EXPECT_THROW(parseCPUList("a"), CPUAffinityError);
+    EXPECT_THROW(parseCPUList("-1"), CPUAffinityError);
+    EXPECT_THROW(parseCPUList("+1"), CPUAffinityError);
+    EXPECT_THROW(parseCPUList("1-"), CPUAffinityError);
+    EXPECT_THROW(parseCPUList("1-2-3"), CPUAffinityError);
+    EXPECT_THROW(parseCPUList("3-1"), CPUAffinityError);
+    EXPECT_THROW(parseCPUList("1024"), CPUAffinityError);
+    EXPECT_THROW(parseCPUList("99999999999"), CPUAffinityError);
+}
+
+TEST(CPUAffinityTest, setThreadAffinity) {
+    // Binding to nothing, or to CPUs that (most likely) don't exist, fails
+    // without changing the affinity.
+    EXPECT_THROW(setThreadAffinity(vector<unsigned int>()), CPUAffinityError);
+    EXPECT_THROW(setThreadAffinity(parseCPUList("1020-1023")),
+                 CPUAffinityError);
+}
+
+TEST(CPUAffinityTest, unknownCPU) {
+    EXPECT_EQ(-1, getCPUNode(1023));
+    // The node of an existing CPU depends on the system; it's unknown if
+    // the system doesn't show it.
+    EXPECT_LE(-1, getCPUNode(0));
+
+    // Nothing has been received on the socket.
+    EXPECT_EQ(-1, getSocketIncomingCPU(-1));
+    const int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    ASSERT_LE(0, fd);
+    EXPECT_EQ(-1, getSocketIncomingCPU(fd));
+    close(fd);
+}
+}
@@ -0,0 +1,66 @@
+// Copyright (C) 2012  JINMEI Tatuya
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+// OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#include <diagnostic_log.h>
+
+#include <gtest/gtest.h>
+
+#include <sstream>
+
+#include <unistd.h>
+
+using namespace std;
+using namespace Queryperf;
+
+namespace {
+TEST(DiagnosticLogTest, disabled) {
+    ostringstream os;
+    DiagnosticLog log(os);
+    EXPECT_EQ(0, log.getRate());
+    for (int i = 0; i < 10; ++i) {
+        EXPECT_FALSE(log.admit());
+    }
+    // Events while disabled aren't counted as suppressed.
+    EXPECT_EQ(0, log.getSuppressedCount());
+}
+
+TEST(DiagnosticLogTest, rateLimit) {
+    ostringstream os;
+    DiagnosticLog log(os);
+    log.setRate(2);
+    EXPECT_EQ(2, log.getRate());
+
+    // Only the first 2 events in a second are admitted.
+    EXPECT_TRUE(log.admit());
+    log.write("first");
+    EXPECT_TRUE(log.admit());
+    log.write("second");
+    for (int i = 0; i < 5; ++i) {
+        EXPECT_FALSE(log.admit());
+    }
+    EXPECT_EQ(5, log.getSuppressedCount());
+    EXPECT_EQ("first\nsecond\n", os.str());
+
+    // In the next second more are admitted, and the first message tells
+    // how many have been suppressed.
+    usleep(1010000);
+    os.str("");
+    EXPECT_TRUE(log.admit());
+    log.write("third");
+    EXPECT_TRUE(log.admit());
+    log.write("fourth");
+    EXPECT_EQ("third (5 messages suppressed)\nfourth\n", os.str());
+    EXPECT_EQ(5, log.getSuppressedCount());
+}
+}
@@ -12,28 +12,43 @@
 // OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
 // PERFORMANCE OF THIS SOFTWARE.
 
+#include <config.h>
+
 #include <test_message_manager.h>
 #include <common_test.h>
 
 #include <query_repository.h>
 #include <query_context.h>
 #include <dispatcher.h>
+#include <latency_histogram.h>
+#include <tls_context.h>
+#include <load_profile.h>
+#include <stats_counters.h>
+#include <cpu_affinity.h>
+#include <response_validator.h>
+#include <server_pool.h>
 #include <common_test.h>
 
 #include <dns/message.h>
 #include <dns/messagerenderer.h>
 #include <dns/name.h>
+#include <dns/rcode.h>
 #include <dns/rrtype.h>
 
 #include <gtest/gtest.h>
 
 #include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
 #include <boost/date_time/posix_time/posix_time.hpp>
 
+#include <cctype>
 #include <sstream>
 #include <vector>
 
 #include <netinet/in.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
 
 using namespace std;
 using namespace bundy::dns;
@@ -252,6 +267,286 @@ TEST_F(DispatcherTest, queryMismatch) {
     // The bad response should be ignored, and the queue size should be the
     // same.
     EXPECT_EQ(20, msg_mgr.socket_->queries_.size());
+
+    // It's counted as a response with an unknown ID.
+    EXPECT_EQ(0, disp.getResponseStats().responses);
+    EXPECT_EQ(1, disp.getResponseStats().unknown);
+    EXPECT_EQ(0, disp.getResponseStats().late);
+    EXPECT_EQ(0, disp.getResponseStats().duplicates);
+}
+
+// Respond to the i-th UDP query with the given RCODE and flags.  If
+// qname_offset is non 0, the byte of the response at that offset (in the
+// question) is converted to upper case, or replaced with 'x' if bogus.
+void
+sendCustomResponse(TestMessageSocket* sock, size_t i, const Rcode& rcode,
+                   Message::HeaderFlag flag, size_t qname_offset = 0,
+                   bool bogus = false)
+{
+    Message& query = *sock->queries_.at(i);
+    query.makeResponse();
+    query.setRcode(rcode);
+    query.setHeaderFlag(flag);
+    MessageRenderer renderer;
+    query.toWire(renderer);
+    vector<uint8_t> data(static_cast<const uint8_t*>(renderer.getData()),
+                         static_cast<const uint8_t*>(renderer.getData()) +
+                         renderer.getLength());
+    if (qname_offset != 0) {
+        data.at(qname_offset) = bogus ? 'x' : toupper(data.at(qname_offset));
+    }
+    sock->callback_(MessageSocket::Event(&data[0], data.size()));
+}
+
+void
+sendResponseVariants(TestMessageManager* mgr) {
+    TestMessageSocket* sock = mgr->socket_;
+    sendCustomResponse(sock, 0, Rcode::NOERROR(), Message::HEADERFLAG_AA);
+    sendCustomResponse(sock, 1, Rcode::NXDOMAIN(), Message::HEADERFLAG_RA);
+    // The case of the owner name doesn't matter.
+    sendCustomResponse(sock, 2, Rcode::NOERROR(), Message::HEADERFLAG_AA, 13);
+    // A different owner name is invalid only if validated.
+    sendCustomResponse(sock, 3, Rcode::NOERROR(), Message::HEADERFLAG_AA, 13,
+                       true);
+    // Too short to be a response.
+    const uint8_t garbage[] = { 0, 4, 0x80 };
+    sock->callback_(MessageSocket::Event(garbage, sizeof(garbage)));
+    mgr->stop();
+}
+
+TEST_F(DispatcherTest, responseStats) {
+    EXPECT_FALSE(disp.getResponseValidation());
+    msg_mgr.setRunHandler(boost::bind(sendResponseVariants, &msg_mgr));
+    disp.run();
+    EXPECT_EQ(4, disp.getQueriesCompleted());
+
+    const ResponseStats& stats = disp.getResponseStats();
+    EXPECT_EQ(4, stats.responses);
+    EXPECT_EQ(3, stats.rcodes[Rcode::NOERROR().getCode()]);
+    EXPECT_EQ(1, stats.rcodes[Rcode::NXDOMAIN().getCode()]);
+    EXPECT_EQ(3, stats.flags[ResponseStats::AA]);
+    EXPECT_EQ(1, stats.flags[ResponseStats::RA]);
+    EXPECT_EQ(3, stats.nodata); // makeResponse() doesn't add answers
+    EXPECT_EQ(1, stats.invalid);
+    EXPECT_EQ(0, stats.tcp_retries);
+}
+
+TEST_F(DispatcherTest, responseValidation) {
+    disp.setResponseValidation(true);
+    EXPECT_TRUE(disp.getResponseValidation());
+    msg_mgr.setRunHandler(boost::bind(sendResponseVariants, &msg_mgr));
+    disp.run();
+
+    // The response with the wrong question is ignored, and the query is
+    // still outstanding.
+    EXPECT_EQ(3, disp.getQueriesCompleted());
+    EXPECT_EQ(23, msg_mgr.socket_->queries_.size());
+    EXPECT_EQ(3, disp.getResponseStats().responses);
+    EXPECT_EQ(2, disp.getResponseStats().invalid);
+
+    EXPECT_THROW(disp.setResponseValidation(false), DispatcherError);
+}
+
+void
+sendTruncatedResponse(TestMessageManager* mgr) {
+    sendCustomResponse(mgr->socket_, 0, Rcode::NOERROR(),
+                       Message::HEADERFLAG_TC);
+
+    // The query is resent over TCP with the same QID, and completed by the
+    // TCP response.
+    EXPECT_EQ(20, mgr->socket_->queries_.size());
+    ASSERT_EQ(1, mgr->tcp_sockets_.size());
+    ASSERT_EQ(1, mgr->tcp_sockets_[0]->queries_.size());
+    queryMessageCheck(*mgr->tcp_sockets_[0]->queries_[0], 0,
+                      Name("example.com"), RRType::SOA());
+    Message& query = *mgr->tcp_sockets_[0]->queries_[0];
+    query.makeResponse();
+    MessageRenderer renderer;
+    query.toWire(renderer);
+    mgr->tcp_sockets_[0]->callback_(MessageSocket::Event(renderer.getData(),
+                                                         renderer.getLength()));
+    EXPECT_EQ(1, mgr->n_deleted_sockets_);
+    EXPECT_EQ(21, mgr->socket_->queries_.size());
+    mgr->stop();
+}
+
+TEST_F(DispatcherTest, tcpRetry) {
+    EXPECT_FALSE(disp.getTCPRetry());
+    disp.setTCPRetry(true);
+    EXPECT_TRUE(disp.getTCPRetry());
+    msg_mgr.setRunHandler(boost::bind(sendTruncatedResponse, &msg_mgr));
+    disp.run();
+    EXPECT_EQ(21, disp.getQueriesSent());
+    EXPECT_EQ(1, disp.getQueriesCompleted());
+    EXPECT_EQ(2, disp.getResponseStats().responses);
+    EXPECT_EQ(1, disp.getResponseStats().flags[ResponseStats::TC]);
+    EXPECT_EQ(1, disp.getResponseStats().tcp_retries);
+
+    EXPECT_THROW(disp.setTCPRetry(false), DispatcherError);
+}
+
+void
+respondToQueriesReversed(TestMessageManager* mgr, size_t window) {
+    // Respond to all initial queries in the reverse order of sending.
+    for (size_t i = window; i > 0; --i) {
+        Message& query = *mgr->socket_->queries_.at(i - 1);
+        query.makeResponse();
+        MessageRenderer renderer;
+        query.toWire(renderer);
+        mgr->socket_->callback_(MessageSocket::Event(renderer.getData(),
+                                                     renderer.getLength()));
+
+        // Each response should immediately trigger a new query, and the
+        // timer of the matching query should have been restarted.
+        EXPECT_EQ(window * 2 - i + 1, mgr->socket_->queries_.size());
+        EXPECT_EQ(2, mgr->timers_.at(i)->n_started_);
+    }
+    mgr->stop();
+}
+
+TEST_F(DispatcherTest, outOfOrderResponses) {
+    const size_t window = 100;
+    disp.setWindow(window);
+    msg_mgr.setRunHandler(boost::bind(respondToQueriesReversed, &msg_mgr,
+                                      window));
+    disp.run();
+    EXPECT_EQ(window * 2, disp.getQueriesSent());
+    EXPECT_EQ(window, disp.getQueriesCompleted());
+
+    // The new queries should have been sent with sequential QIDs.
+    for (size_t i = window; i < window * 2; ++i) {
+        EXPECT_EQ(i, msg_mgr.socket_->queries_[i]->getQid());
+    }
+}
+
+void
+respondToLatestQuery(TestMessageManager* mgr, size_t count) {
+    // Keep responding to the most recently sent query, leaving the first
+    // one outstanding.
+    for (size_t i = 0; i < count; ++i) {
+        Message& query = *mgr->socket_->queries_.back();
+        query.makeResponse();
+        MessageRenderer renderer;
+        query.toWire(renderer);
+        mgr->socket_->callback_(MessageSocket::Event(renderer.getData(),
+                                                     renderer.getLength()));
+    }
+
+    // QIDs should have wrapped around, skipping the one still outstanding.
+    EXPECT_EQ(1, mgr->socket_->queries_.back()->getQid());
+
+    // The first query is still outstanding and can be responded to.
+    Message& query = *mgr->socket_->queries_.at(0);
+    query.makeResponse();
+    MessageRenderer renderer;
+    query.toWire(renderer);
+    mgr->socket_->callback_(MessageSocket::Event(renderer.getData(),
+                                                 renderer.getLength()));
+    mgr->stop();
+}
+
+TEST_F(DispatcherTest, qidWrapAround) {
+    disp.setWindow(2);
+    // Initial queries use QIDs 0 and 1; responding to the latest one 65535
+    // times makes the QID wrap around.
+    msg_mgr.setRunHandler(boost::bind(respondToLatestQuery, &msg_mgr, 65535));
+    disp.run();
+    EXPECT_EQ(65538, disp.getQueriesSent());
+    EXPECT_EQ(65536, disp.getQueriesCompleted());
+    EXPECT_EQ(2, msg_mgr.socket_->queries_.back()->getQid());
+}
+
+void
+respondToQueryAt(TestMessageManager* mgr, size_t index) {
+    Message& query = *mgr->socket_->queries_.at(index);
+    if (!query.getHeaderFlag(Message::HEADERFLAG_QR)) { // not responded yet
+        query.makeResponse();
+    }
+    MessageRenderer renderer;
+    query.toWire(renderer);
+    mgr->socket_->callback_(MessageSocket::Event(renderer.getData(),
+                                                 renderer.getLength()));
+}
+
+void
+lateResponseCallback(TestMessageManager* mgr) {
+    // The first query (QID 0) times out, and a new one is sent with QID 2.
+    mgr->timers_.at(1)->callback_();
+    ASSERT_EQ(3, mgr->socket_->queries_.size());
+    EXPECT_EQ(2, mgr->socket_->queries_.back()->getQid());
+
+    // Keep responding to the latest query until the QID wraps around.  QID
+    // 0 is still reserved for the late response, and 1 is outstanding, so
+    // 2 is reused.
+    for (size_t i = 0; i < 65534; ++i) {
+        respondToQueryAt(mgr, mgr->socket_->queries_.size() - 1);
+    }
+    EXPECT_EQ(2, mgr->socket_->queries_.back()->getQid());
+
+    // The response to the timed out query is late, but only the first.
+    const size_t sent = mgr->socket_->queries_.size();
+    respondToQueryAt(mgr, 0);
+    respondToQueryAt(mgr, 0);
+    // Responding to the outstanding query twice makes a duplicate, too.
+    respondToQueryAt(mgr, 1);
+    respondToQueryAt(mgr, 1);
+    EXPECT_EQ(sent + 1, mgr->socket_->queries_.size());
+    mgr->stop();
+}
+
+TEST_F(DispatcherTest, lateResponses) {
+    disp.setWindow(2);
+    msg_mgr.setRunHandler(boost::bind(lateResponseCallback, &msg_mgr));
+    disp.run();
+    EXPECT_EQ(1, disp.getQueriesTimedOut());
+    EXPECT_EQ(65535, disp.getQueriesCompleted());
+
+    const ResponseStats& stats = disp.getResponseStats();
+    EXPECT_EQ(65535, stats.responses);
+    EXPECT_EQ(1, stats.late);
+    EXPECT_EQ(2, stats.duplicates);
+    EXPECT_EQ(0, stats.unknown);
+    // Late responses are measured separately.
+    EXPECT_EQ(1, disp.getLateLatencyHistogram().getCount());
+    EXPECT_EQ(65535, disp.getLatencyHistogram().getCount());
+}
+
+void
+truncatedResponseWrapAround(TestMessageManager* mgr) {
+    // The query of QID 0 is retried over TCP on the same socket.
+    sendCustomResponse(mgr->socket_, 0, Rcode::NOERROR(),
+                       Message::HEADERFLAG_TC);
+    ASSERT_EQ(1, mgr->tcp_sockets_.size());
+
+    // Keep responding to the latest query until the QID wraps around; QID
+    // 0 is never reused while the retry is outstanding.
+    for (size_t i = 0; i < 65535; ++i) {
+        respondToQueryAt(mgr, mgr->socket_->queries_.size() - 1);
+        ASSERT_NE(0, mgr->socket_->queries_.back()->getQid());
+    }
+    EXPECT_EQ(1, mgr->socket_->queries_.back()->getQid());
+
+    // The retry is still outstanding and can be completed.
+    Message& query = *mgr->tcp_sockets_[0]->queries_.at(0);
+    query.makeResponse();
+    MessageRenderer renderer;
+    query.toWire(renderer);
+    mgr->tcp_sockets_[0]->callback_(MessageSocket::Event(renderer.getData(),
+                                                         renderer.getLength()));
+    mgr->stop();
+}
+
+TEST_F(DispatcherTest, tcpRetryWrapAround) {
+    disp.setWindow(2);
+    disp.setTCPRetry(true);
+    msg_mgr.setRunHandler(boost::bind(truncatedResponseWrapAround,
+                                      &msg_mgr));
+    disp.run();
+    EXPECT_EQ(65538, disp.getQueriesSent());
+    EXPECT_EQ(65536, disp.getQueriesCompleted());
+    EXPECT_EQ(1, disp.getResponseStats().tcp_retries);
+    EXPECT_EQ(0, disp.getResponseStats().duplicates);
+    EXPECT_EQ(0, disp.getResponseStats().unknown);
 }
 
 void
@@ -277,8 +572,32 @@ TEST_F(DispatcherTest, queryTimeout) {
     msg_mgr.setRunHandler(boost::bind(queryTimeoutCallback, &msg_mgr, proto));
     disp.run();
 
-    // No queries should have been considered completed.
+    // No queries should have been considered completed, and no RTT should
+    // have been recorded.
     EXPECT_EQ(0, disp.getQueriesCompleted());
+    EXPECT_EQ(1, disp.getQueriesTimedOut());
+    EXPECT_EQ(0, disp.getLatencyHistogram().getCount());
+
+    // The counters can be sampled, too.
+    StatsSnapshot snapshot;
+    disp.getStatsCounters().sample(snapshot);
+    EXPECT_EQ(disp.getQueriesSent(), snapshot.queries_sent);
+    EXPECT_EQ(1, snapshot.queries_timedout);
+}
+
+TEST_F(DispatcherTest, logRate) {
+    // Diagnostic messages are disabled by default, and the rate is passed
+    // to the message manager's log on run().
+    EXPECT_EQ(0, disp.getLogRate());
+    disp.setLogRate(10);
+    EXPECT_EQ(10, disp.getLogRate());
+    msg_mgr.setRunHandler(boost::bind(queryTimeoutCallback, &msg_mgr,
+                                      static_cast<int>(IPPROTO_UDP)));
+    disp.run();
+    EXPECT_EQ(10, msg_mgr.getDiagnosticLog().getRate());
+    EXPECT_EQ(1, disp.getQueriesTimedOut());
+
+    EXPECT_THROW(disp.setLogRate(0), DispatcherError);
 }
 
 TEST_F(DispatcherTest, queryTimeoutTCP) {
@@ -334,11 +653,186 @@ TEST_F(DispatcherTest, sessionTimer) {
 
     EXPECT_EQ(50, disp.getQueriesSent());
     EXPECT_EQ(50, disp.getQueriesCompleted());
+    // RTT should have been recorded for all completed queries.
+    EXPECT_EQ(50, disp.getLatencyHistogram().getCount());
     EXPECT_FALSE(disp.getStartTime().is_special());
     EXPECT_FALSE(disp.getEndTime().is_special());
     EXPECT_TRUE(disp.getStartTime() < disp.getEndTime());
 }
 
+void
+respondToQuery(TestMessageManager* mgr, size_t index) {
+    Message& query = *mgr->socket_->queries_.at(index);
+    query.makeResponse();
+    MessageRenderer renderer;
+    query.toWire(renderer);
+    mgr->socket_->callback_(MessageSocket::Event(renderer.getData(),
+                                                 renderer.getLength()));
+}
+
+void
+openLoopCheck(TestMessageManager* mgr, Dispatcher* disp) {
+    // In the open-loop mode no query is sent until the pacing timer (which
+    // follows the session timer, preceding the query timers) fires.
+    EXPECT_EQ(0, mgr->socket_->queries_.size());
+    ASSERT_EQ(22, mgr->timers_.size());
+    EXPECT_EQ(1, mgr->timers_[1]->n_started_);
+
+    // The rate is high enough so that more queries than the window have
+    // become due.  Only the window size of queries are sent, and the rest
+    // are skipped.
+    usleep(1000);
+    mgr->timers_[1]->callback_();
+    EXPECT_EQ(20, mgr->socket_->queries_.size());
+    EXPECT_EQ(20, disp->getQueriesSent());
+    EXPECT_LT(0, disp->getQueriesSkipped());
+    EXPECT_EQ(2, mgr->timers_[1]->n_started_);
+
+    // A response doesn't trigger a new query; the next tick does.
+    respondToQuery(mgr, 0);
+    EXPECT_EQ(20, mgr->socket_->queries_.size());
+    usleep(1000);
+    mgr->timers_[1]->callback_();
+    EXPECT_EQ(21, mgr->socket_->queries_.size());
+    EXPECT_EQ(20, mgr->socket_->queries_.back()->getQid());
+
+    // Once the session timer expires, no more queries are sent, and the
+    // manager stops when all outstanding queries complete.
+    mgr->timers_[0]->callback_();
+    mgr->timers_[1]->callback_();
+    EXPECT_EQ(21, mgr->socket_->queries_.size());
+    for (size_t i = 1; i < 21; ++i) {
+        respondToQuery(mgr, i);
+    }
+}
+
+TEST_F(DispatcherTest, openLoop) {
+    disp.setQueryRate(1000000000);
+    msg_mgr.setRunHandler(boost::bind(openLoopCheck, &msg_mgr, &disp));
+    disp.run();
+
+    // openLoopCheck doesn't stop the manager; the dispatcher should have
+    // (otherwise run() wouldn't return).
+    EXPECT_EQ(21, disp.getQueriesSent());
+    EXPECT_EQ(21, disp.getQueriesCompleted());
+}
+
+void
+openLoopSlowRateCheck(TestMessageManager* mgr) {
+    // With a rate of 1 qps, the first query isn't due until 1 second later.
+    mgr->timers_[1]->callback_();
+    EXPECT_EQ(0, mgr->socket_->queries_.size());
+    mgr->stop();
+}
+
+TEST_F(DispatcherTest, openLoopSlowRate) {
+    disp.setQueryRate(1);
+    msg_mgr.setRunHandler(boost::bind(openLoopSlowRateCheck, &msg_mgr));
+    disp.run();
+    EXPECT_EQ(0, disp.getQueriesSent());
+    EXPECT_EQ(0, disp.getQueriesSkipped());
+}
+
+void
+loadStepsCheck(TestMessageManager* mgr, const Dispatcher* disp) {
+    // The session timer expires at the end of the first step.
+    EXPECT_EQ(1, mgr->timers_[0]->n_started_);
+    EXPECT_EQ(1, mgr->timers_[0]->duration_seconds_);
+    ASSERT_EQ(1, disp->getStepResults().size());
+
+    // Only the window size of queries are sent.
+    usleep(1000);
+    mgr->timers_[1]->callback_();
+    EXPECT_EQ(20, mgr->socket_->queries_.size());
+    respondToQuery(mgr, 0);
+
+    // The next step starts immediately, while queries of the first step
+    // are outstanding.
+    mgr->timers_[0]->callback_();
+    EXPECT_EQ(2, mgr->timers_[0]->n_started_);
+    EXPECT_EQ(2, mgr->timers_[0]->duration_seconds_);
+    ASSERT_EQ(2, disp->getStepResults().size());
+    usleep(1000);
+    mgr->timers_[1]->callback_();
+    EXPECT_EQ(21, mgr->socket_->queries_.size());
+    respondToQuery(mgr, 20);
+
+    // After the last step, the manager stops when all outstanding queries
+    // complete.
+    mgr->timers_[0]->callback_();
+    EXPECT_EQ(2, mgr->timers_[0]->n_started_);
+    for (size_t i = 1; i < 20; ++i) {
+        respondToQuery(mgr, i);
+    }
+}
+
+TEST_F(DispatcherTest, loadSteps) {
+    // Two steps of 1 and 2 seconds.
+    LoadProfile profile = LoadProfile::createRamp(1000000000, 1000000000, 3,
+                                                  2);
+    disp.setLoadProfile(profile);
+    msg_mgr.setRunHandler(boost::bind(loadStepsCheck, &msg_mgr, &disp));
+    disp.run();
+
+    // Queries are counted for the step in which they are sent.
+    EXPECT_EQ(21, disp.getQueriesSent());
+    EXPECT_EQ(21, disp.getQueriesCompleted());
+    const std::vector<LoadStepResult>& results = disp.getStepResults();
+    ASSERT_EQ(2, results.size());
+    EXPECT_EQ(20, results[0].queries_sent);
+    EXPECT_EQ(20, results[0].queries_completed);
+    EXPECT_LT(0, results[0].queries_skipped);
+    EXPECT_EQ(20, results[0].rtt_histogram.getCount());
+    EXPECT_EQ(1, results[1].queries_sent);
+    EXPECT_EQ(1, results[1].queries_completed);
+    EXPECT_EQ(disp.getQueriesSkipped(),
+              results[0].queries_skipped + results[1].queries_skipped);
+    EXPECT_EQ(0, disp.getFoundRate());
+
+    // It cannot be reset after run().
+    EXPECT_THROW(disp.setLoadProfile(profile), DispatcherError);
+}
+
+void
+loadSearchCheck(TestMessageManager* mgr, const Dispatcher* disp) {
+    usleep(1000);
+    mgr->timers_[1]->callback_();
+    EXPECT_EQ(20, mgr->socket_->queries_.size());
+
+    // At the end of a search step, it waits for the outstanding queries
+    // without sending new ones.
+    mgr->timers_[0]->callback_();
+    EXPECT_EQ(1, mgr->timers_[0]->n_started_);
+    usleep(1000);
+    mgr->timers_[1]->callback_();
+    EXPECT_EQ(20, mgr->socket_->queries_.size());
+    for (size_t i = 0; i < 20; ++i) {
+        respondToQuery(mgr, i);
+    }
+
+    // Too many queries were skipped, so the rate is halved.
+    EXPECT_EQ(2, mgr->timers_[0]->n_started_);
+    ASSERT_EQ(2, disp->getStepResults().size());
+    EXPECT_EQ(500000000, disp->getStepResults()[1].step.start_rate);
+    mgr->stop();
+}
+
+TEST_F(DispatcherTest, loadSearch) {
+    disp.setLoadProfile(LoadProfile::createSearch(1, 1000000, 1, 1000000000,
+                                                  1000000000));
+    msg_mgr.setRunHandler(boost::bind(loadSearchCheck, &msg_mgr, &disp));
+    disp.run();
+    EXPECT_EQ(20, disp.getStepResults()[0].queries_completed);
+    EXPECT_EQ(0, disp.getFoundRate());
+}
+
+TEST_F(DispatcherTest, loadProfileWithRate) {
+    // A load profile and a fixed query rate are exclusive.
+    disp.setQueryRate(100);
+    disp.setLoadProfile(LoadProfile::parse("step:100:1"));
+    EXPECT_THROW(disp.run(), DispatcherError);
+}
+
 TEST_F(DispatcherTest, builtins) {
     // creating dispatcher with "builtin" support classes.  No disruption
     // should happen.
@@ -351,6 +845,116 @@ TEST_F(DispatcherTest, builtins) {
     EXPECT_THROW(disp.loadQueries(), QueryRepositoryError);
 }
 
+TEST_F(DispatcherTest, sharedPreload) {
+    Dispatcher source_disp("test-input.txt");
+    Dispatcher builtin_disp("test-input.txt");
+    EXPECT_EQ(0, source_disp.getQueryCount());
+
+    // The source must have preloaded queries.
+    EXPECT_THROW(builtin_disp.loadQueries(source_disp, 0),
+                 QueryRepositoryError);
+
+    source_disp.loadQueries();
+    builtin_disp.loadQueries(source_disp, 1);
+    EXPECT_EQ(source_disp.getQueryCount(), builtin_disp.getQueryCount());
+
+    // Duplicate preload should be rejected either way.
+    EXPECT_THROW(builtin_disp.loadQueries(), QueryRepositoryError);
+    EXPECT_THROW(builtin_disp.loadQueries(source_disp, 0),
+                 QueryRepositoryError);
+
+    // Sharing is only possible between the "builtin" repositories.
+    EXPECT_THROW(disp.loadQueries(source_disp, 0), DispatcherError);
+    Dispatcher another_disp("test-input.txt");
+    EXPECT_THROW(another_disp.loadQueries(disp, 0), DispatcherError);
+}
+
+TEST_F(DispatcherTest, streamQueries) {
+    Dispatcher source_disp("test-input.txt");
+    Dispatcher builtin_disp("test-input.txt");
+
+    // The source must be streaming queries.
+    EXPECT_THROW(builtin_disp.streamQueries(source_disp),
+                 QueryRepositoryError);
+
+    source_disp.streamQueries();
+    builtin_disp.streamQueries(source_disp);
+    EXPECT_EQ(0, builtin_disp.getQueryCount());
+
+    // Queries can't be preloaded or streamed again.
+    EXPECT_THROW(builtin_disp.loadQueries(), QueryRepositoryError);
+    EXPECT_THROW(source_disp.streamQueries(), QueryRepositoryError);
+
+    // Streaming is only possible for the "builtin" repositories.
+    EXPECT_THROW(disp.streamQueries(), DispatcherError);
+    EXPECT_THROW(disp.streamQueries(source_disp), DispatcherError);
+}
+
+TEST_F(DispatcherTest, compiledQueries) {
+    const char* const compiled_file = "dispatcher-test.qpb";
+    Dispatcher builtin_disp("test-input.txt");
+    EXPECT_FALSE(Dispatcher::isCompiledQueryFile("test-input.txt"));
+
+    // Queries must be preloaded to be saved, and only for the "builtin"
+    // repository.
+    EXPECT_THROW(builtin_disp.saveQueries(compiled_file),
+                 QueryRepositoryError);
+    EXPECT_THROW(disp.saveQueries(compiled_file), DispatcherError);
+
+    builtin_disp.loadQueries();
+    builtin_disp.saveQueries(compiled_file);
+    EXPECT_TRUE(Dispatcher::isCompiledQueryFile(compiled_file));
+
+    Dispatcher compiled_disp(compiled_file);
+    compiled_disp.loadQueries();
+    EXPECT_EQ(builtin_disp.getQueryCount(), compiled_disp.getQueryCount());
+    unlink(compiled_file);
+}
+
+TEST_F(DispatcherTest, seekableQueryFile) {
+    EXPECT_TRUE(Dispatcher::isSeekableQueryFile("test-input.txt"));
+    // Errors are left to the constructor.
+    EXPECT_TRUE(Dispatcher::isSeekableQueryFile("nosuchfile.txt"));
+
+    // A pipe isn't seekable, but its queries can be preloaded (none of the
+    // input is consumed in checking whether it's compiled).
+    int fds[2];
+    ASSERT_EQ(0, pipe(fds));
+    const char data[] = "example.com. SOA\nwww.example.com. A\n";
+    ASSERT_EQ(sizeof(data) - 1, write(fds[1], data, sizeof(data) - 1));
+    close(fds[1]);
+    ostringstream path;
+    path << "/dev/fd/" << fds[0];
+    EXPECT_FALSE(Dispatcher::isSeekableQueryFile(path.str()));
+    EXPECT_FALSE(Dispatcher::isCompiledQueryFile(path.str()));
+    Dispatcher pipe_disp(path.str());
+    pipe_disp.loadQueries();
+    EXPECT_EQ(2, pipe_disp.getQueryCount());
+    close(fds[0]);
+}
+
+TEST_F(DispatcherTest, messageManagerType) {
+    Dispatcher builtin_disp("test-input.txt");
+    builtin_disp.setMessageManagerType("asio");
+#ifdef HAVE_EPOLL
+    builtin_disp.setMessageManagerType("epoll");
+#else
+    EXPECT_THROW(builtin_disp.setMessageManagerType("epoll"),
+                 DispatcherError);
+#endif
+#ifdef HAVE_IO_URING
+    builtin_disp.setMessageManagerType("uring");
+#else
+    EXPECT_THROW(builtin_disp.setMessageManagerType("uring"),
+                 DispatcherError);
+#endif
+    EXPECT_THROW(builtin_disp.setMessageManagerType("no-such-manager"),
+                 DispatcherError);
+
+    // It can't be changed for an external manager.
+    EXPECT_THROW(disp.setMessageManagerType("asio"), DispatcherError);
+}
+
 TEST_F(DispatcherTest, preloadAfterRun) {
     Dispatcher disp("test-input.txt");
     // There's no server to be tested, so the send attempt should fail
@@ -411,6 +1015,25 @@ TEST_F(DispatcherTest, setEDNSForExternalRepository) {
     EXPECT_THROW(disp.setEDNS(false), DispatcherError);
 }
 
+TEST_F(DispatcherTest, setQuerySelection) {
+    Dispatcher disp("test-input.txt");
+    disp.setQuerySelection("sequential");
+    disp.setQuerySelection("uniform");
+    disp.setQuerySelection("weighted");
+    disp.setQuerySelection("zipf");
+    disp.setQuerySelection("zipf:1.2");
+    EXPECT_THROW(disp.setQuerySelection("zipf:"), DispatcherError);
+    EXPECT_THROW(disp.setQuerySelection("zipf:-1"), DispatcherError);
+    EXPECT_THROW(disp.setQuerySelection("uniform:1"), DispatcherError);
+    EXPECT_THROW(disp.setQuerySelection("random"), DispatcherError);
+    disp.loadQueries();
+    EXPECT_THROW(disp.setQuerySelection("uniform"), QueryRepositoryError);
+}
+
+TEST_F(DispatcherTest, setQuerySelectionForExternalRepository) {
+    EXPECT_THROW(disp.setQuerySelection("uniform"), DispatcherError);
+}
+
 TEST_F(DispatcherTest, setProtocol) {
     Dispatcher disp("test-input.txt");
     disp.setProtocol(IPPROTO_UDP);
@@ -448,6 +1071,398 @@ TEST_F(DispatcherTest, serverPort) {
     EXPECT_THROW(disp.setServerAddress("::1"), DispatcherError);
 }
 
+TEST_F(DispatcherTest, window) {
+    // Default window size
+    EXPECT_EQ(20, disp.getWindow());
+
+    // Reset it.
+    disp.setWindow(1000);
+    EXPECT_EQ(1000, disp.getWindow());
+
+    // Out of range values will be rejected.
+    EXPECT_THROW(disp.setWindow(0), DispatcherError);
+    EXPECT_THROW(disp.setWindow(65537), DispatcherError);
+    disp.setWindow(65536);      // this is okay
+
+    // Once started it cannot be changed.
+    disp.setWindow(20);
+    disp.run();
+    EXPECT_THROW(disp.setWindow(10), DispatcherError);
+}
+
+TEST_F(DispatcherTest, udpSocketCount) {
+    // Default is 1.
+    EXPECT_EQ(1, disp.getUDPSocketCount());
+
+    // Out of range values will be rejected.
+    EXPECT_THROW(disp.setUDPSocketCount(0), DispatcherError);
+    EXPECT_THROW(disp.setUDPSocketCount(Dispatcher::MAX_UDP_SOCKETS + 1),
+                 DispatcherError);
+
+    // More sockets allow a larger window.
+    disp.setUDPSocketCount(2);
+    EXPECT_EQ(2, disp.getUDPSocketCount());
+    EXPECT_THROW(disp.setWindow(65536 * 2 + 1), DispatcherError);
+    disp.setWindow(65536 * 2);
+    // Then the sockets can't be reduced.
+    EXPECT_THROW(disp.setUDPSocketCount(1), DispatcherError);
+
+    // Once started it cannot be changed.
+    disp.setWindow(20);
+    disp.run();
+    EXPECT_THROW(disp.setUDPSocketCount(1), DispatcherError);
+}
+
+TEST_F(DispatcherTest, cpuAffinity) {
+    // Not bound by default.
+    EXPECT_TRUE(disp.getCPUAffinity().empty());
+    EXPECT_THROW(disp.getIncomingCPU(0), DispatcherError);
+
+    // The thread can't be bound to a CPU that (most likely) doesn't exist.
+    vector<unsigned int> cpus(1, MAX_CPUS - 1);
+    disp.setCPUAffinity(cpus);
+    EXPECT_EQ(cpus, disp.getCPUAffinity());
+    EXPECT_THROW(disp.run(), DispatcherError);
+
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+    // Bind it to the current CPU, and restore the original affinity of
+    // the test thread afterward.
+    cpu_set_t saved_cpus;
+    ASSERT_EQ(0, pthread_getaffinity_np(pthread_self(), sizeof(saved_cpus),
+                                        &saved_cpus));
+    cpus[0] = sched_getcpu();
+    disp.setCPUAffinity(cpus);
+    disp.setUDPSocketCount(2);
+    disp.run();
+    EXPECT_EQ(0, pthread_setaffinity_np(pthread_self(), sizeof(saved_cpus),
+                                        &saved_cpus));
+    EXPECT_THROW(disp.setCPUAffinity(cpus), DispatcherError);
+
+    // The incoming CPU of each socket is taken from the socket.
+    msg_mgr.udp_sockets_.at(1)->incoming_cpu_ = 3;
+    EXPECT_EQ(-1, disp.getIncomingCPU(0));
+    EXPECT_EQ(3, disp.getIncomingCPU(1));
+    EXPECT_THROW(disp.getIncomingCPU(2), DispatcherError);
+#endif
+}
+
+// Respond to a query sent on the given socket (by its position), and stop.
+void
+respondOnSocket(TestMessageManager* mgr, size_t socket_index,
+                size_t query_index, qid_t qid)
+{
+    TestMessageSocket* sock = mgr->udp_sockets_.at(socket_index);
+    Message& query = *sock->queries_.at(query_index);
+    query.makeResponse();
+    query.setQid(qid);
+    MessageRenderer renderer;
+    query.toWire(renderer);
+    sock->callback_(MessageSocket::Event(renderer.getData(),
+                                         renderer.getLength()));
+    mgr->stop();
+}
+
+TEST_F(DispatcherTest, maxSockets) {
+    for (size_t i = 0; i < Dispatcher::MAX_SERVERS; ++i) {
+        disp.addServer("192.0.2." + boost::lexical_cast<string>(i + 1), 53);
+    }
+    disp.setUDPSocketCount(Dispatcher::MAX_UDP_SOCKETS);
+    disp.setTCPConnectionCount(Dispatcher::MAX_TCP_CONNECTIONS);
+
+    // The QIDs of each socket are limited so that the tables of the 8192
+    // sockets don't take too much memory; a response with a QID that is
+    // never used doesn't match anything.
+    msg_mgr.setRunHandler(boost::bind(respondOnSocket, &msg_mgr, 0, 0,
+                                      1000));
+    disp.run();
+    EXPECT_EQ(Dispatcher::MAX_SERVERS * Dispatcher::MAX_UDP_SOCKETS,
+              msg_mgr.udp_sockets_.size());
+    EXPECT_EQ(Dispatcher::MAX_SERVERS * Dispatcher::MAX_TCP_CONNECTIONS,
+              msg_mgr.persistent_sockets_.size());
+    EXPECT_EQ(20, disp.getQueriesSent()); // the default window
+    EXPECT_EQ(0, disp.getQueriesCompleted());
+    EXPECT_EQ(1, disp.getResponseStats().unknown);
+}
+
+TEST_F(DispatcherTest, multipleUDPSockets) {
+    disp.setUDPSocketCount(3);
+    disp.setWindow(6);
+
+    // Queries are sent over the sockets in a round-robin manner, each
+    // socket has its own QID space.  Respond to the first query of the
+    // second socket.
+    msg_mgr.setRunHandler(boost::bind(respondOnSocket, &msg_mgr, 1, 0, 0));
+    disp.run();
+    ASSERT_EQ(3, msg_mgr.udp_sockets_.size());
+    EXPECT_EQ(msg_mgr.socket_, msg_mgr.udp_sockets_[0]);
+    EXPECT_EQ(7, disp.getQueriesSent());
+    EXPECT_EQ(1, disp.getQueriesCompleted());
+
+    // The next query is sent on the first socket with the next QID.
+    ASSERT_EQ(3, msg_mgr.udp_sockets_[0]->queries_.size());
+    EXPECT_EQ(2, msg_mgr.udp_sockets_[0]->queries_[2]->getQid());
+    for (size_t i = 1; i < 3; ++i) {
+        ASSERT_EQ(2, msg_mgr.udp_sockets_[i]->queries_.size());
+        EXPECT_EQ(0, msg_mgr.udp_sockets_[i]->queries_[0]->getQid());
+        EXPECT_EQ(1, msg_mgr.udp_sockets_[i]->queries_[1]->getQid());
+    }
+}
+
+TEST_F(DispatcherTest, multipleServers) {
+    EXPECT_EQ(1, disp.getServerCount());
+    EXPECT_THROW(disp.addServer("192.0.2.1", 53, 0), DispatcherError);
+    EXPECT_THROW(disp.addServer("192.0.2.1", 53,
+                                ServerSpec::MAX_WEIGHT + 1),
+                 DispatcherError);
+    disp.addServer("192.0.2.1", 53, 2);
+    disp.addServer("192.0.2.2", 5300);
+    EXPECT_EQ(2, disp.getServerCount());
+    EXPECT_TRUE(disp.getServerResults().empty());
+    disp.setUDPSocketCount(2);
+    disp.setTCPConnectionCount(1);
+    disp.setWindow(6);
+
+    // Each server has its own sockets and connections.  The first server
+    // gets two thirds of the queries (in the order of 0, 1, 0), and each
+    // server distributes them to its sockets.  Respond to the first query
+    // of the second server.
+    msg_mgr.setRunHandler(boost::bind(respondOnSocket, &msg_mgr, 2, 0, 0));
+    disp.run();
+    EXPECT_THROW(disp.addServer("192.0.2.3", 53), DispatcherError);
+    ASSERT_EQ(4, msg_mgr.udp_sockets_.size());
+    ASSERT_EQ(2, msg_mgr.persistent_sockets_.size());
+    for (size_t i = 0; i < 4; ++i) {
+        const TestMessageSocket& sock = *msg_mgr.udp_sockets_[i];
+        EXPECT_EQ(i < 2 ? "192.0.2.1" : "192.0.2.2", sock.address_);
+        EXPECT_EQ(i < 2 ? 53 : 5300, sock.port_);
+        EXPECT_EQ(i == 0 ? 3 : (i == 1 ? 2 : 1), sock.queries_.size());
+    }
+    EXPECT_EQ("192.0.2.1", msg_mgr.persistent_sockets_[0]->address_);
+    EXPECT_EQ("192.0.2.2", msg_mgr.persistent_sockets_[1]->address_);
+
+    EXPECT_EQ(7, disp.getQueriesSent());
+    const vector<ServerResult>& results = disp.getServerResults();
+    ASSERT_EQ(2, results.size());
+    EXPECT_EQ("192.0.2.1", results[0].server.address);
+    EXPECT_EQ(2, results[0].server.weight);
+    EXPECT_EQ(5, results[0].queries_sent);
+    EXPECT_EQ(0, results[0].queries_completed);
+    EXPECT_EQ(2, results[1].queries_sent);
+    EXPECT_EQ(1, results[1].queries_completed);
+    EXPECT_EQ(1, results[1].rtt_histogram.getCount());
+}
+
+TEST_F(DispatcherTest, responseOnWrongSocket) {
+    disp.setUDPSocketCount(2);
+    disp.setWindow(3);
+
+    // The first socket has outstanding queries of QID 0 and 1, and the
+    // second one has QID 0.  A response with QID 1 on the second socket
+    // doesn't match any query.
+    msg_mgr.setRunHandler(boost::bind(respondOnSocket, &msg_mgr, 1, 0, 1));
+    disp.run();
+    EXPECT_EQ(3, disp.getQueriesSent());
+    EXPECT_EQ(0, disp.getQueriesCompleted());
+}
+
+TEST_F(DispatcherTest, tcpConnectionCount) {
+    // Default is 0, i.e., a new connection for each TCP query.
+    EXPECT_EQ(0, disp.getTCPConnectionCount());
+
+    // Out of range values will be rejected.
+    EXPECT_THROW(disp.setTCPConnectionCount(
+                     Dispatcher::MAX_TCP_CONNECTIONS + 1), DispatcherError);
+
+    // The connections must be sufficient for the window, and vice versa.
+    disp.setUDPSocketCount(2);
+    disp.setWindow(65536 * 2);
+    EXPECT_THROW(disp.setTCPConnectionCount(1), DispatcherError);
+    disp.setTCPConnectionCount(2);
+    EXPECT_EQ(2, disp.getTCPConnectionCount());
+    disp.setWindow(20);
+    disp.setTCPConnectionCount(1);
+    EXPECT_THROW(disp.setWindow(65536 + 1), DispatcherError);
+
+    // Per-connection statistics are only available for existing
+    // connections after run().
+    EXPECT_THROW(disp.getConnectionQueriesSent(0), DispatcherError);
+    EXPECT_THROW(disp.getConnectionQueriesCompleted(0), DispatcherError);
+
+    // Once started it cannot be changed.
+    disp.run();
+    EXPECT_THROW(disp.setTCPConnectionCount(2), DispatcherError);
+    EXPECT_EQ(0, disp.getConnectionQueriesSent(0));
+    EXPECT_THROW(disp.getConnectionQueriesSent(1), DispatcherError);
+}
+
+// Respond to a query sent on the given persistent TCP connection (by its
+// position).
+void
+respondOnConnection(TestMessageManager* mgr, size_t connection_index,
+                    size_t query_index)
+{
+    TestMessageSocket* sock = mgr->persistent_sockets_.at(connection_index);
+    Message& query = *sock->queries_.at(query_index);
+    query.makeResponse();
+    MessageRenderer renderer;
+    query.toWire(renderer);
+    sock->callback_(MessageSocket::Event(renderer.getData(),
+                                         renderer.getLength()));
+}
+
+void
+respondOnConnectionReversed(TestMessageManager* mgr) {
+    // Respond to the queries on the second connection in the reverse order
+    // of sending.
+    respondOnConnection(mgr, 1, 1);
+    respondOnConnection(mgr, 1, 0);
+    mgr->stop();
+}
+
+TEST_F(DispatcherTest, persistentTCP) {
+    repo.setProtocol(IPPROTO_TCP);
+    disp.setTCPConnectionCount(2);
+    disp.setWindow(4);
+
+    // Queries are pipelined over the connections in a round-robin manner,
+    // and the responses can be in any order.
+    msg_mgr.setRunHandler(boost::bind(respondOnConnectionReversed,
+                                      &msg_mgr));
+    disp.run();
+    EXPECT_TRUE(msg_mgr.tcp_sockets_.empty()); // no per-query connections
+    EXPECT_EQ(0, msg_mgr.socket_->queries_.size());
+    ASSERT_EQ(2, msg_mgr.persistent_sockets_.size());
+    EXPECT_EQ(6, disp.getQueriesSent());
+    EXPECT_EQ(2, disp.getQueriesCompleted());
+    for (size_t i = 0; i < 2; ++i) {
+        TestMessageSocket* sock = msg_mgr.persistent_sockets_[i];
+        ASSERT_EQ(3, sock->queries_.size());
+        for (size_t j = 0; j < 3; ++j) {
+            EXPECT_EQ(j * 2 + i, sock->queries_[j]->getQid());
+        }
+        EXPECT_EQ(3, disp.getConnectionQueriesSent(i));
+    }
+    EXPECT_EQ(0, disp.getConnectionQueriesCompleted(0));
+    EXPECT_EQ(2, disp.getConnectionQueriesCompleted(1));
+}
+
+TEST_F(DispatcherTest, persistentTCPQid) {
+    repo.setProtocol(IPPROTO_TCP);
+    disp.setUDPSocketCount(2);
+    disp.setTCPConnectionCount(1);
+    disp.setWindow(4);
+
+    // QIDs are first chosen for the UDP sockets, so they collide on the
+    // single connection.  They should be replaced so that each query is
+    // identified by the QID.
+    msg_mgr.setRunHandler(boost::bind(&TestMessageManager::stop, &msg_mgr));
+    disp.run();
+    ASSERT_EQ(1, msg_mgr.persistent_sockets_.size());
+    const TestMessageSocket& sock = *msg_mgr.persistent_sockets_[0];
+    ASSERT_EQ(4, sock.queries_.size());
+    for (size_t i = 0; i < 4; ++i) {
+        EXPECT_EQ(i, sock.queries_[i]->getQid());
+        EXPECT_EQ((i % 2) == 0 ? Name("example.com") : Name("www.example.com"),
+                  (*sock.queries_[i]->beginQuestion())->getName());
+    }
+}
+
+void
+closeConnection(TestMessageManager* mgr) {
+    TestMessageSocket* sock = mgr->persistent_sockets_.at(0);
+    sock->callback_(MessageSocket::Event(NULL, 0));
+    mgr->stop();
+}
+
+TEST_F(DispatcherTest, persistentTCPFailure) {
+    repo.setProtocol(IPPROTO_TCP);
+    disp.setTCPConnectionCount(1);
+    disp.setWindow(3);
+
+    // When the connection is closed all outstanding queries on it fail
+    // immediately, and new queries are sent on the (reopened) connection.
+    msg_mgr.setRunHandler(boost::bind(closeConnection, &msg_mgr));
+    disp.run();
+    EXPECT_EQ(6, disp.getQueriesSent());
+    EXPECT_EQ(0, disp.getQueriesCompleted());
+    EXPECT_EQ(6, disp.getConnectionQueriesSent(0));
+    EXPECT_EQ(0, disp.getConnectionQueriesCompleted(0));
+    EXPECT_EQ(1, disp.getTCPFailureCount());
+    const TestMessageSocket& sock = *msg_mgr.persistent_sockets_[0];
+    ASSERT_EQ(6, sock.queries_.size());
+    for (size_t i = 3; i < 6; ++i) {
+        EXPECT_EQ(i, sock.queries_[i]->getQid());
+    }
+}
+
+TEST_F(DispatcherTest, queriesPerConnection) {
+    // Default is 0, i.e., unlimited.
+    EXPECT_EQ(0, disp.getQueriesPerConnection());
+
+    // It only makes sense with persistent TCP connections.
+    repo.setProtocol(IPPROTO_TCP);
+    disp.setQueriesPerConnection(2);
+    EXPECT_EQ(2, disp.getQueriesPerConnection());
+    EXPECT_THROW(disp.run(), DispatcherError);
+
+    // It's passed to the connections.
+    disp.setTCPConnectionCount(1);
+    msg_mgr.setRunHandler(boost::bind(&TestMessageManager::stop, &msg_mgr));
+    disp.run();
+    EXPECT_EQ(2, msg_mgr.stream_params_.max_messages);
+    EXPECT_TRUE(msg_mgr.stream_params_.tls_context == NULL);
+    EXPECT_EQ(0, disp.getTLSHandshakeCount()); // no TLS
+
+    // Once started it cannot be changed.
+    EXPECT_THROW(disp.setQueriesPerConnection(1), DispatcherError);
+}
+
+TEST_F(DispatcherTest, tls) {
+    // Default is off, with session resumption enabled.
+    EXPECT_FALSE(disp.getTLS());
+    EXPECT_TRUE(disp.getTLSSessionResumption());
+    disp.setTLSSessionResumption(false);
+    EXPECT_FALSE(disp.getTLSSessionResumption());
+
+    // It only makes sense with persistent TCP connections.
+    repo.setProtocol(IPPROTO_TCP);
+    disp.setTLS(true);
+    EXPECT_TRUE(disp.getTLS());
+    EXPECT_THROW(disp.run(), DispatcherError);
+
+    disp.setTCPConnectionCount(1);
+    msg_mgr.setRunHandler(boost::bind(&TestMessageManager::stop, &msg_mgr));
+#ifdef HAVE_OPENSSL
+    // The connections share the TLS context.  As the test manager doesn't
+    // do the handshake, the statistics remain 0.
+    disp.run();
+    ASSERT_TRUE(msg_mgr.stream_params_.tls_context != NULL);
+    EXPECT_FALSE(msg_mgr.stream_params_.tls_context->getSessionResumption());
+    EXPECT_EQ(0, disp.getTLSHandshakeCount());
+    EXPECT_EQ(0, disp.getTLSResumedCount());
+
+    // Once started they cannot be changed.
+    EXPECT_THROW(disp.setTLS(false), DispatcherError);
+    EXPECT_THROW(disp.setTLSSessionResumption(true), DispatcherError);
+#else
+    EXPECT_THROW(disp.run(), DispatcherError);
+#endif
+}
+
+TEST_F(DispatcherTest, queryRate) {
+    // Default is 0, i.e., the closed-loop mode.
+    EXPECT_EQ(0, disp.getQueryRate());
+
+    // Reset it.
+    disp.setQueryRate(10000);
+    EXPECT_EQ(10000, disp.getQueryRate());
+
+    // Once started it cannot be changed.
+    disp.setQueryRate(0);
+    disp.run();
+    EXPECT_THROW(disp.setQueryRate(100), DispatcherError);
+}
+
 TEST_F(DispatcherTest, testDuration) {
     // Default test duration
     EXPECT_EQ(30, disp.getTestDuration());
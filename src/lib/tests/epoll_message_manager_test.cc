@@ -0,0 +1,596 @@
+// Copyright (C) 2012  JINMEI Tatuya
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+// OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#include <config.h>
+
+#include <epoll_message_manager.h>
+#include <tls_context.h>
+
+#include <socket_test_util.h>
+#ifdef HAVE_OPENSSL
+#include <tls_test_util.h>
+#endif
+
+#include <gtest/gtest.h>
+
+#include <boost/bind.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+using namespace std;
+using namespace Queryperf;
+using namespace Queryperf::unittest;
+using boost::scoped_ptr;
+using boost::lexical_cast;
+using namespace boost::posix_time;
+
+namespace {
+const char TEST_DATA[] = "queryperf test";
+
+void
+noopSocketCallback(const MessageSocket::Event&) {
+}
+
+class EpollMessageManagerTest : public ::testing::Test {
+public:
+    EpollMessageManagerTest() : sendcallback_called_(0),
+                                timercallback_called_(0), stop_at_(1),
+                                closecallback_called_(0)
+    {}
+
+    // A convenient shortcut for the namespace-scope version of getSockAddr
+    SockAddrInfo getSockAddr(const string& addr_str, const string& port_str) {
+        return (addr_creator_.get(addr_str, port_str));
+    }
+
+    int createSocket(int family, int type, int protocol,
+                     const SockAddrInfo& sainfo)
+    {
+        const int s = socket(family, type, protocol);
+        if (s < 0) {
+            throw runtime_error(string("socket(2) failed: ") +
+                                strerror(errno));
+        }
+        const int on = 1;
+        if (setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) == -1 ||
+            bind(s, sainfo.first, sainfo.second) < 0) {
+            close(s);
+            throw runtime_error(string("failed to set up socket: ") +
+                                strerror(errno));
+        }
+        if (protocol == IPPROTO_TCP && listen(s, 1) == -1) {
+            close(s);
+            throw runtime_error(string("listen(2) failed: ") +
+                                strerror(errno));
+        }
+        return (s);
+    }
+
+    // Common callback for the message socket.  It stops the manager once
+    // it's called stop_at_ times.
+    void sendCallback(const MessageSocket::Event& ev) {
+        ++sendcallback_called_;
+        EXPECT_EQ(sizeof(TEST_DATA), ev.datalen);
+        EXPECT_STREQ(TEST_DATA, static_cast<const char*>(ev.data));
+        if (sendcallback_called_ == stop_at_) {
+            manager_.stop();
+        }
+    }
+
+    // Callback for a TCP socket that is expected to fail.
+    void failedTCPCallback(const MessageSocket::Event& ev) {
+        ++sendcallback_called_;
+        EXPECT_EQ(0, ev.datalen);
+    }
+
+    // Emulate a server for a TCP query: accept the connection, check the
+    // query, and send responses (the first one is TEST_DATA).
+    void tcpServerCallback(int listen_fd, size_t n_responses) {
+        ++timercallback_called_;
+
+        sockaddr_storage ss;
+        socklen_t sa_len = sizeof(ss);
+        ScopedSocket s(accept(listen_fd, convertSockAddr(&ss), &sa_len));
+        ASSERT_NE(-1, s.fd);
+
+        uint8_t lenbuf[2];
+        char databuf[sizeof(TEST_DATA)];
+        EXPECT_EQ(2, recv(s.fd, lenbuf, 2, MSG_WAITALL));
+        EXPECT_EQ(sizeof(TEST_DATA), lenbuf[0] * 256 + lenbuf[1]);
+        EXPECT_EQ(sizeof(TEST_DATA), recv(s.fd, databuf, sizeof(databuf),
+                                          MSG_WAITALL));
+        EXPECT_STREQ(TEST_DATA, databuf);
+        // The client should have shut down the sending side.
+        EXPECT_EQ(0, recv(s.fd, lenbuf, 1, setRecvDelay(s.fd)));
+
+        const char DUMMY_DATA[] = "dummy data";
+        for (size_t i = 0; i < n_responses; ++i) {
+            const size_t len = (i == 0) ? sizeof(TEST_DATA) :
+                sizeof(DUMMY_DATA);
+            lenbuf[0] = 0;
+            lenbuf[1] = len;
+            EXPECT_EQ(sizeof(lenbuf), send(s.fd, lenbuf, sizeof(lenbuf), 0));
+            EXPECT_EQ(len, send(s.fd, i == 0 ? TEST_DATA : DUMMY_DATA, len,
+                                0));
+        }
+        // The connection will be closed on return, completing the query.
+    }
+
+    // Callback for a persistent TCP socket.  It stops the manager when
+    // the connection is closed.
+    void persistentCallback(const MessageSocket::Event& ev) {
+        if (ev.data == NULL) {
+            ++closecallback_called_;
+            EXPECT_EQ(0, ev.datalen);
+            manager_.stop();
+        } else {
+            ++sendcallback_called_;
+            EXPECT_EQ(sizeof(TEST_DATA), ev.datalen);
+            EXPECT_STREQ(TEST_DATA, static_cast<const char*>(ev.data));
+        }
+    }
+
+    // Emulate a server for pipelined queries on a persistent TCP
+    // connection: accept the connection, check n_queries queries, and
+    // send all responses at once, split in the middle of the first length
+    // field so the client needs to reassemble them.  The connection is then
+    // closed.
+    void persistentServerCallback(int listen_fd, size_t n_queries) {
+        ++timercallback_called_;
+
+        sockaddr_storage ss;
+        socklen_t sa_len = sizeof(ss);
+        ScopedSocket s(accept(listen_fd, convertSockAddr(&ss), &sa_len));
+        ASSERT_NE(-1, s.fd);
+
+        vector<uint8_t> responses;
+        for (size_t i = 0; i < n_queries; ++i) {
+            uint8_t lenbuf[2];
+            char databuf[sizeof(TEST_DATA)];
+            EXPECT_EQ(2, recv(s.fd, lenbuf, 2, MSG_WAITALL));
+            EXPECT_EQ(sizeof(TEST_DATA), lenbuf[0] * 256 + lenbuf[1]);
+            EXPECT_EQ(sizeof(TEST_DATA), recv(s.fd, databuf,
+                                              sizeof(databuf), MSG_WAITALL));
+            EXPECT_STREQ(TEST_DATA, databuf);
+            responses.insert(responses.end(), lenbuf, lenbuf + 2);
+            responses.insert(responses.end(), TEST_DATA,
+                             TEST_DATA + sizeof(TEST_DATA));
+        }
+        EXPECT_EQ(1, send(s.fd, &responses[0], 1, 0));
+        EXPECT_EQ(responses.size() - 1,
+                  send(s.fd, &responses[1], responses.size() - 1, 0));
+    }
+
+    void timerCallback() {
+        ++timercallback_called_;
+    }
+
+    void tcpCheck(int family, const string& addr, const string& port,
+                  size_t n_responses);
+
+    size_t sendcallback_called_;
+    size_t timercallback_called_;
+    size_t stop_at_;
+    size_t closecallback_called_; // for persistent TCP sockets
+    EpollMessageManager manager_;
+    scoped_ptr<TLSContext> tls_ctx_; // must outlive test_sock_
+    scoped_ptr<MessageSocket> test_sock_;
+    scoped_ptr<MessageTimer> test_timer_;
+    scoped_ptr<MessageTimer> test_timer2_;
+    uint8_t recvbuf_[65535];
+
+private:
+    SockAddrCreator addr_creator_;
+};
+
+TEST_F(EpollMessageManagerTest, createMessageSocketIPv6) {
+    scoped_ptr<EpollMessageSocket> sock(
+        dynamic_cast<EpollMessageSocket*>(
+            manager_.createMessageSocket(
+                IPPROTO_UDP, "::1", 5300, recvbuf_, sizeof(recvbuf_),
+                noopSocketCallback)));
+    ASSERT_TRUE(sock);
+    const int s = sock->native();
+    EXPECT_NE(-1, s);
+
+    // The socket should be already bound (and connected)
+    struct sockaddr_in6 sin6;
+    memset(&sin6, 0, sizeof(sin6));
+    socklen_t salen = sizeof(sin6);
+    EXPECT_NE(-1, getsockname(s, convertSockAddr(&sin6), &salen));
+    EXPECT_NE(0, sin6.sin6_port);
+}
+
+TEST_F(EpollMessageManagerTest, createMessageSocketIPv4) {
+    scoped_ptr<EpollMessageSocket> sock(
+        dynamic_cast<EpollMessageSocket*>(
+            manager_.createMessageSocket(
+                IPPROTO_UDP, "127.0.0.1", 5304, recvbuf_, sizeof(recvbuf_),
+                noopSocketCallback)));
+    ASSERT_TRUE(sock);
+    const int s = sock->native();
+    EXPECT_NE(-1, s);
+
+    // Receive buffer size should be at least 32KB.
+    int bufsize;
+    socklen_t optlen = sizeof(bufsize);
+    EXPECT_EQ(0, getsockopt(s, SOL_SOCKET, SO_RCVBUF, &bufsize, &optlen));
+    EXPECT_LE(32768, bufsize);
+
+    struct sockaddr_in sin4;
+    memset(&sin4, 0, sizeof(sin4));
+    socklen_t salen = sizeof(sin4);
+    EXPECT_NE(-1, getsockname(s, convertSockAddr(&sin4), &salen));
+    EXPECT_NE(0, sin4.sin_port);
+}
+
+TEST_F(EpollMessageManagerTest, createMessageSocketTCP) {
+    scoped_ptr<EpollMessageSocket> sock(
+        dynamic_cast<EpollMessageSocket*>(
+            manager_.createMessageSocket(
+                IPPROTO_TCP, "::1", 5300, recvbuf_, sizeof(recvbuf_),
+                noopSocketCallback)));
+    ASSERT_TRUE(sock);
+    // In the case of TCP, the underlying socket is not open until send()
+    EXPECT_EQ(-1, sock->native());
+}
+
+TEST_F(EpollMessageManagerTest, createMessageSocketBadParam) {
+    // Unspecified protocol (assuming it's neither UDP or TCP)
+    EXPECT_THROW(manager_.createMessageSocket(
+                     0, "::1", 5300, recvbuf_, sizeof(recvbuf_),
+                     noopSocketCallback),
+                 MessageSocketError);
+
+    // Bad address
+    EXPECT_THROW(manager_.createMessageSocket(
+                     IPPROTO_UDP, "127.0.0..1", 5300, recvbuf_,
+                     sizeof(recvbuf_), noopSocketCallback),
+                 MessageSocketError);
+    EXPECT_THROW(manager_.createMessageSocket(
+                     IPPROTO_TCP, "127.0.0..1", 5300, recvbuf_,
+                     sizeof(recvbuf_), noopSocketCallback),
+                 MessageSocketError);
+
+    // Null callback
+    EXPECT_THROW(manager_.createMessageSocket(IPPROTO_UDP, "127.0.0.1",
+                                              5300, recvbuf_,
+                                              sizeof(recvbuf_), NULL),
+                 MessageSocketError);
+
+    // Too small buffer for TCP
+    EXPECT_THROW(manager_.createMessageSocket(IPPROTO_TCP, "127.0.0.1",
+                                              5300, recvbuf_, 512,
+                                              noopSocketCallback),
+                 MessageSocketError);
+}
+
+TEST_F(EpollMessageManagerTest, sendUDP) {
+    ScopedSocket recv_s(createSocket(AF_INET6, SOCK_DGRAM, IPPROTO_UDP,
+                                     getSockAddr("::1", "5306")));
+    test_sock_.reset(manager_.createMessageSocket(
+                         IPPROTO_UDP, "::1", 5306, recvbuf_, sizeof(recvbuf_),
+                         boost::bind(&EpollMessageManagerTest::sendCallback,
+                                     this, _1)));
+
+    // The data is queued until the manager runs; nothing should be
+    // received yet.
+    test_sock_->send(TEST_DATA, sizeof(TEST_DATA));
+    char recvbuf[sizeof(TEST_DATA)];
+    EXPECT_EQ(-1, recv(recv_s.fd, recvbuf, sizeof(recvbuf), MSG_DONTWAIT));
+
+    // Let the manager send it, using a timer to get the control back.
+    test_timer_.reset(manager_.createMessageTimer(
+                          boost::bind(&EpollMessageManager::stop,
+                                      &manager_)));
+    test_timer_->start(milliseconds(10));
+    manager_.run();
+
+    sockaddr_storage ss;
+    socklen_t sa_len = sizeof(ss);
+    EXPECT_EQ(sizeof(TEST_DATA), recvfrom(recv_s.fd, recvbuf, sizeof(recvbuf),
+                                          setRecvDelay(recv_s.fd),
+                                          convertSockAddr(&ss), &sa_len));
+    EXPECT_STREQ(TEST_DATA, recvbuf);
+
+    // Echo back the data; the callback will be called and stop the manager.
+    EXPECT_EQ(sizeof(TEST_DATA), sendto(recv_s.fd, recvbuf, sizeof(recvbuf),
+                                        0, convertSockAddr(&ss), sa_len));
+    EXPECT_EQ(0, sendcallback_called_);
+    manager_.run();
+    EXPECT_EQ(1, sendcallback_called_);
+}
+
+TEST_F(EpollMessageManagerTest, batchedUDP) {
+    // Send more messages than the batch size, which will require multiple
+    // sendmmsg calls.
+    const size_t n_messages = EpollMessageManager::BATCH_SIZE * 2 + 1;
+    ScopedSocket recv_s(createSocket(AF_INET, SOCK_DGRAM, IPPROTO_UDP,
+                                     getSockAddr("127.0.0.1", "5304")));
+    test_sock_.reset(manager_.createMessageSocket(
+                         IPPROTO_UDP, "127.0.0.1", 5304, recvbuf_,
+                         sizeof(recvbuf_),
+                         boost::bind(&EpollMessageManagerTest::sendCallback,
+                                     this, _1)));
+    for (size_t i = 0; i < n_messages; ++i) {
+        test_sock_->send(TEST_DATA, sizeof(TEST_DATA));
+    }
+    test_timer_.reset(manager_.createMessageTimer(
+                          boost::bind(&EpollMessageManager::stop,
+                                      &manager_)));
+    test_timer_->start(milliseconds(0));
+    manager_.run();
+
+    // All of them should have been sent; echo them back.  We do it
+    // in small chunks so they won't be dropped due to the (intentionally
+    // small) receive buffer; multiple responses can still be received at
+    // once.
+    const size_t chunk_size = 16;
+    for (size_t i = 0; i < n_messages; ++i) {
+        char recvbuf[sizeof(TEST_DATA)];
+        sockaddr_storage ss;
+        socklen_t sa_len = sizeof(ss);
+        ASSERT_EQ(sizeof(TEST_DATA),
+                  recvfrom(recv_s.fd, recvbuf, sizeof(recvbuf),
+                           setRecvDelay(recv_s.fd), convertSockAddr(&ss),
+                           &sa_len));
+        EXPECT_EQ(sizeof(TEST_DATA), sendto(recv_s.fd, recvbuf,
+                                            sizeof(recvbuf), 0,
+                                            convertSockAddr(&ss), sa_len));
+        if ((i + 1) % chunk_size == 0 || i + 1 == n_messages) {
+            stop_at_ = i + 1;
+            manager_.run();
+            EXPECT_EQ(i + 1, sendcallback_called_);
+        }
+    }
+}
+
+void
+EpollMessageManagerTest::tcpCheck(int family, const string& addr,
+                                  const string& port, size_t n_responses)
+{
+    ScopedSocket listen_s(createSocket(family, SOCK_STREAM, IPPROTO_TCP,
+                                       getSockAddr(addr, port)));
+    test_sock_.reset(manager_.createMessageSocket(
+                         IPPROTO_TCP, addr, lexical_cast<uint16_t>(port),
+                         recvbuf_, sizeof(recvbuf_),
+                         boost::bind(&EpollMessageManagerTest::sendCallback,
+                                     this, _1)));
+    test_sock_->send(TEST_DATA, sizeof(TEST_DATA));
+
+    // The server side is handled in a timer callback, so the manager can
+    // send the query in the meantime.
+    test_timer_.reset(manager_.createMessageTimer(
+                          boost::bind(
+                              &EpollMessageManagerTest::tcpServerCallback,
+                              this, listen_s.fd, n_responses)));
+    test_timer_->start(milliseconds(10));
+    manager_.run();
+    EXPECT_EQ(1, timercallback_called_);
+    EXPECT_EQ(1, sendcallback_called_);
+}
+
+TEST_F(EpollMessageManagerTest, sendTCPIPv6) {
+    tcpCheck(AF_INET6, "::1", "5306", 1);
+}
+
+TEST_F(EpollMessageManagerTest, sendTCPIPv4) {
+    tcpCheck(AF_INET, "127.0.0.1", "5304", 1);
+}
+
+TEST_F(EpollMessageManagerTest, sendTCPMulti) {
+    // Subsequent responses are ignored; the callback gets the first one.
+    tcpCheck(AF_INET6, "::1", "5306", 3);
+}
+
+TEST_F(EpollMessageManagerTest, sendTCPFail) {
+    // Nobody listens on the port; the callback should be called with empty
+    // data.
+    test_sock_.reset(manager_.createMessageSocket(
+                         IPPROTO_TCP, "127.0.0.1", 5304, recvbuf_,
+                         sizeof(recvbuf_),
+                         boost::bind(
+                             &EpollMessageManagerTest::failedTCPCallback,
+                             this, _1)));
+    test_sock_->send(TEST_DATA, sizeof(TEST_DATA));
+    manager_.run();
+    EXPECT_EQ(1, sendcallback_called_);
+
+    // It can be used only once.
+    EXPECT_THROW(test_sock_->send(TEST_DATA, sizeof(TEST_DATA)),
+                 MessageSocketError);
+}
+
+TEST_F(EpollMessageManagerTest, persistentTCP) {
+    ScopedSocket listen_s(createSocket(AF_INET6, SOCK_STREAM, IPPROTO_TCP,
+                                       getSockAddr("::1", "5306")));
+    test_sock_.reset(manager_.createPersistentMessageSocket(
+                         "::1", 5306, StreamSocketParams(),
+                         boost::bind(&EpollMessageManagerTest::persistentCallback,
+                                     this, _1)));
+    // Queries are pipelined: they are sent without waiting for responses.
+    for (size_t i = 0; i < 3; ++i) {
+        test_sock_->send(TEST_DATA, sizeof(TEST_DATA));
+    }
+    test_timer_.reset(manager_.createMessageTimer(
+                          boost::bind(
+                              &EpollMessageManagerTest::persistentServerCallback,
+                              this, listen_s.fd, 3)));
+    test_timer_->start(milliseconds(10));
+    manager_.run();
+    EXPECT_EQ(1, timercallback_called_);
+    EXPECT_EQ(3, sendcallback_called_);
+    EXPECT_EQ(1, closecallback_called_);
+
+    // The connection is reopened on the next send.
+    test_sock_->send(TEST_DATA, sizeof(TEST_DATA));
+    test_timer_.reset(manager_.createMessageTimer(
+                          boost::bind(
+                              &EpollMessageManagerTest::persistentServerCallback,
+                              this, listen_s.fd, 1)));
+    test_timer_->start(milliseconds(10));
+    manager_.run();
+    EXPECT_EQ(2, timercallback_called_);
+    EXPECT_EQ(4, sendcallback_called_);
+    EXPECT_EQ(2, closecallback_called_);
+}
+
+TEST_F(EpollMessageManagerTest, persistentTCPFail) {
+    // Nobody listens on the port; the callback should be called with NULL
+    // data.
+    test_sock_.reset(manager_.createPersistentMessageSocket(
+                         "127.0.0.1", 5304, StreamSocketParams(),
+                         boost::bind(&EpollMessageManagerTest::persistentCallback,
+                                     this, _1)));
+    test_sock_->send(TEST_DATA, sizeof(TEST_DATA));
+    manager_.run();
+    EXPECT_EQ(0, sendcallback_called_);
+    EXPECT_EQ(1, closecallback_called_);
+}
+
+#ifdef HAVE_OPENSSL
+TEST_F(EpollMessageManagerTest, persistentTLS) {
+    ScopedSocket listen_s(createSocket(AF_INET6, SOCK_STREAM, IPPROTO_TCP,
+                                       getSockAddr("::1", "5306")));
+    TLSTestServer server(listen_s.fd, 1, 3);
+    tls_ctx_.reset(new TLSContext);
+    StreamSocketParams params;
+    params.tls_context = tls_ctx_.get();
+    test_sock_.reset(manager_.createPersistentMessageSocket(
+                         "::1", 5306, params,
+                         boost::bind(&EpollMessageManagerTest::persistentCallback,
+                                     this, _1)));
+    // Queries are pipelined over the TLS session; they are sent once the
+    // handshake completes.  The server closes the connection after
+    // responding to all of them.
+    for (size_t i = 0; i < 3; ++i) {
+        test_sock_->send(TEST_DATA, sizeof(TEST_DATA));
+    }
+    manager_.run();
+    server.wait();
+    EXPECT_EQ(3, sendcallback_called_);
+    EXPECT_EQ(1, closecallback_called_);
+    EXPECT_EQ(3, server.getMessageCount());
+    EXPECT_EQ(1, server.getHandshakeCount());
+    EXPECT_EQ(1, tls_ctx_->getHandshakeCount());
+    EXPECT_EQ(0, tls_ctx_->getResumedCount());
+}
+
+TEST_F(EpollMessageManagerTest, persistentTLSResumption) {
+    ScopedSocket listen_s(createSocket(AF_INET6, SOCK_STREAM, IPPROTO_TCP,
+                                       getSockAddr("::1", "5306")));
+    TLSTestServer server(listen_s.fd, 3, 1);
+    tls_ctx_.reset(new TLSContext);
+    StreamSocketParams params;
+    params.tls_context = tls_ctx_.get();
+    params.max_messages = 1;
+    test_sock_.reset(manager_.createPersistentMessageSocket(
+                         "::1", 5306, params,
+                         boost::bind(&EpollMessageManagerTest::persistentCallback,
+                                     this, _1)));
+    // Each query is sent over a new connection, which should resume the
+    // session of the previous one.  The socket is closed quietly after
+    // the last response.
+    for (size_t i = 0; i < 3; ++i) {
+        test_sock_->send(TEST_DATA, sizeof(TEST_DATA));
+    }
+    manager_.run();
+    server.wait();
+    EXPECT_EQ(3, sendcallback_called_);
+    EXPECT_EQ(0, closecallback_called_);
+    EXPECT_EQ(3, server.getMessageCount());
+    EXPECT_EQ(3, server.getHandshakeCount());
+    EXPECT_EQ(2, server.getResumedCount());
+    EXPECT_EQ(3, tls_ctx_->getHandshakeCount());
+    EXPECT_EQ(2, tls_ctx_->getResumedCount());
+}
+#endif
+
+TEST_F(EpollMessageManagerTest, startMessageTimer) {
+    test_timer_.reset(manager_.createMessageTimer(
+                          boost::bind(&EpollMessageManagerTest::timerCallback,
+                                      this)));
+    const ptime start_tm = microsec_clock::local_time();
+    test_timer_->start(milliseconds(50));
+    EXPECT_EQ(0, timercallback_called_);
+    manager_.run();         // should return once the timer expires
+    const ptime end_tm = microsec_clock::local_time();
+    EXPECT_EQ(1, timercallback_called_);
+    EXPECT_LE(50000, (end_tm - start_tm).total_microseconds());
+
+    // Restarting a running timer resets the expiration time.
+    test_timer_->start(seconds(10));
+    test_timer_->start(milliseconds(10));
+    manager_.run();
+    EXPECT_EQ(2, timercallback_called_);
+}
+
+TEST_F(EpollMessageManagerTest, coarseMessageTimer) {
+    test_timer_.reset(manager_.createCoarseMessageTimer(
+                          boost::bind(&EpollMessageManagerTest::timerCallback,
+                                      this)));
+    const ptime start_tm = microsec_clock::local_time();
+    test_timer_->start(milliseconds(50));
+    manager_.run();         // should return once the timer expires
+    const ptime end_tm = microsec_clock::local_time();
+    EXPECT_EQ(1, timercallback_called_);
+    EXPECT_LE(50000, (end_tm - start_tm).total_microseconds());
+
+    // A canceled timer doesn't keep the manager running.
+    test_timer_->start(seconds(10));
+    test_timer_->cancel();
+    manager_.run();
+    EXPECT_EQ(1, timercallback_called_);
+}
+
+TEST_F(EpollMessageManagerTest, cancelMessageTimer) {
+    test_timer_.reset(manager_.createMessageTimer(
+                          boost::bind(&EpollMessageManagerTest::timerCallback,
+                                      this)));
+    test_timer_->start(seconds(1));
+    test_timer_->cancel();
+    manager_.run();             // nothing to wait for; return immediately
+    EXPECT_EQ(0, timercallback_called_);
+
+    // Deleting a running timer effectively cancels it.
+    test_timer_->start(seconds(1));
+    test_timer_.reset();
+    manager_.run();
+}
+
+TEST_F(EpollMessageManagerTest, timerOrder) {
+    test_timer_.reset(manager_.createMessageTimer(
+                          boost::bind(&EpollMessageManagerTest::timerCallback,
+                                      this)));
+    test_timer2_.reset(manager_.createMessageTimer(
+                           boost::bind(&EpollMessageManager::stop,
+                                       &manager_)));
+    // The second timer expires sooner and stops the manager.
+    test_timer_->start(milliseconds(100));
+    test_timer2_->start(milliseconds(10));
+    manager_.run();
+    EXPECT_EQ(0, timercallback_called_);
+    manager_.run();
+    EXPECT_EQ(1, timercallback_called_);
+}
+} // unnamed namespace
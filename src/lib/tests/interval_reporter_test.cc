@@ -0,0 +1,173 @@
+// Copyright (C) 2012  JINMEI Tatuya
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+// OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#include <interval_reporter.h>
+#include <stats_counters.h>
+
+#include <gtest/gtest.h>
+
+#include <boost/bind.hpp>
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+#include <unistd.h>
+
+using namespace std;
+using namespace Queryperf;
+
+namespace {
+uint64_t
+getFakeTime(const uint64_t* now) {
+    return (*now);
+}
+
+class IntervalReporterTest : public ::testing::Test {
+protected:
+    IntervalReporterTest() :
+        now_(1000000),
+        reporter_(oss_, 1000, boost::bind(getFakeTime, &now_))
+    {
+        reporter_.addCounters(counters1_);
+        reporter_.addCounters(counters2_);
+    }
+
+    // Return the report lines written so far, and clear them.
+    string getReport() {
+        const string report = oss_.str();
+        oss_.str("");
+        return (report);
+    }
+
+    uint64_t now_;
+    ostringstream oss_;
+    StatsCounters counters1_;
+    StatsCounters counters2_;
+    IntervalReporter reporter_;
+};
+
+TEST(StatsCountersTest, sample) {
+    StatsCounters counters;
+    counters.addSent();
+    counters.addSent();
+    counters.addCompleted(100);
+    counters.addTimedOut();
+    counters.addSkipped(3);
+    EXPECT_EQ(2, counters.getQueriesSent());
+    EXPECT_EQ(1, counters.getQueriesCompleted());
+    EXPECT_EQ(1, counters.getQueriesTimedOut());
+    EXPECT_EQ(3, counters.getQueriesSkipped());
+    EXPECT_EQ(1, counters.getLatencyHistogram().getCount());
+
+    StatsSnapshot earlier;
+    counters.sample(earlier);
+    EXPECT_EQ(2, earlier.queries_sent);
+    EXPECT_EQ(1, earlier.queries_completed);
+    EXPECT_EQ(1, earlier.queries_timedout);
+    EXPECT_EQ(3, earlier.queries_skipped);
+    EXPECT_EQ(100, earlier.rtt_histogram.getMax());
+
+    counters.addSent();
+    counters.addCompleted(50);
+    StatsSnapshot later;
+    counters.sample(later);
+    later.subtract(earlier);
+    EXPECT_EQ(1, later.queries_sent);
+    EXPECT_EQ(1, later.queries_completed);
+    EXPECT_EQ(0, later.queries_timedout);
+    EXPECT_EQ(0, later.queries_skipped);
+    EXPECT_EQ(1, later.rtt_histogram.getCount());
+    EXPECT_EQ(50, later.rtt_histogram.getPercentile(50));
+}
+
+TEST_F(IntervalReporterTest, report) {
+    for (int i = 0; i < 4; ++i) {
+        counters1_.addSent();
+        counters2_.addSent();
+    }
+    counters1_.addCompleted(100);
+    counters1_.addCompleted(100);
+    counters2_.addCompleted(200);
+    counters2_.addTimedOut();
+
+    // Both counters are summed up.
+    now_ += 500000;
+    reporter_.report();
+    EXPECT_EQ("[Interval] 0.000-0.500 s: 8 sent, 3 completed (37.50%), "
+              "1 timed out, 0 skipped, 6.00 qps, latency 50th 0.000100 s, "
+              "90th 0.000200 s, 99th 0.000200 s\n", getReport());
+
+    // Only the difference from the previous report is shown.
+    counters2_.addSent();
+    counters2_.addCompleted(300);
+    counters1_.addSkipped(2);
+    now_ += 1000000;
+    reporter_.report();
+    EXPECT_EQ("[Interval] 0.500-1.500 s: 1 sent, 1 completed (100.00%), "
+              "0 timed out, 2 skipped, 1.00 qps, latency 50th 0.000300 s, "
+              "90th 0.000300 s, 99th 0.000300 s\n", getReport());
+
+    // Nothing happened.
+    now_ += 1000000;
+    reporter_.report();
+    EXPECT_EQ("[Interval] 1.500-2.500 s: 0 sent, 0 completed (N/A), "
+              "0 timed out, 0 skipped, 0.00 qps\n", getReport());
+
+    // The results are kept for later use.
+    const vector<IntervalResult>& results = reporter_.getResults();
+    ASSERT_EQ(3, results.size());
+    EXPECT_EQ(0, results[0].start);
+    EXPECT_EQ(500000, results[0].end);
+    EXPECT_EQ(8, results[0].queries_sent);
+    EXPECT_EQ(3, results[0].queries_completed);
+    EXPECT_EQ(1, results[0].queries_timedout);
+    EXPECT_EQ(100, results[0].rtt_p50);
+    EXPECT_EQ(200, results[0].rtt_p99);
+    EXPECT_EQ(500000, results[1].start);
+    EXPECT_EQ(2, results[1].queries_skipped);
+    EXPECT_EQ(0, results[2].queries_completed);
+    EXPECT_EQ(0, results[2].rtt_p90);
+}
+
+TEST_F(IntervalReporterTest, badInterval) {
+    EXPECT_THROW(IntervalReporter(oss_, 0), IntervalReporterError);
+}
+
+TEST(IntervalReporterThreadTest, run) {
+    // With the real clock and thread, reports are made periodically, and
+    // the last one on stop().
+    ostringstream oss;
+    StatsCounters counters;
+    IntervalReporter reporter(oss, 10);
+    reporter.addCounters(counters);
+    reporter.start();
+    EXPECT_THROW(reporter.start(), IntervalReporterError);
+    counters.addSent();
+    usleep(35000);
+    reporter.stop();
+    reporter.stop();            // no-op
+
+    const string report = oss.str();
+    size_t n_lines = 0;
+    for (size_t pos = report.find('\n'); pos != string::npos;
+         pos = report.find('\n', pos + 1)) {
+        ++n_lines;
+    }
+    EXPECT_LE(3, n_lines);
+    EXPECT_EQ(0, report.find("[Interval] 0.0"));
+    EXPECT_NE(string::npos, report.find(" 1 sent"));
+}
+}
@@ -0,0 +1,133 @@
+// Copyright (C) 2012  JINMEI Tatuya
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+// OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#include <latency_histogram.h>
+
+#include <gtest/gtest.h>
+
+#include <stdint.h>
+
+using namespace std;
+using namespace Queryperf;
+
+namespace {
+class LatencyHistogramTest : public ::testing::Test {
+protected:
+    LatencyHistogram histogram;
+};
+
+TEST_F(LatencyHistogramTest, empty) {
+    EXPECT_EQ(0, histogram.getCount());
+    EXPECT_EQ(0, histogram.getMin());
+    EXPECT_EQ(0, histogram.getMax());
+    EXPECT_EQ(0, histogram.getMean());
+    EXPECT_EQ(0, histogram.getPercentile(50));
+}
+
+TEST_F(LatencyHistogramTest, exactValues) {
+    // Small values are recorded exactly.
+    for (uint64_t i = 1; i <= 100; ++i) {
+        histogram.record(i);
+    }
+    EXPECT_EQ(100, histogram.getCount());
+    EXPECT_EQ(1, histogram.getMin());
+    EXPECT_EQ(100, histogram.getMax());
+    EXPECT_DOUBLE_EQ(50.5, histogram.getMean());
+
+    EXPECT_EQ(1, histogram.getPercentile(0));
+    EXPECT_EQ(1, histogram.getPercentile(1));
+    EXPECT_EQ(50, histogram.getPercentile(50));
+    EXPECT_EQ(90, histogram.getPercentile(90));
+    EXPECT_EQ(99, histogram.getPercentile(99));
+    EXPECT_EQ(100, histogram.getPercentile(99.9));
+    EXPECT_EQ(100, histogram.getPercentile(100));
+}
+
+TEST_F(LatencyHistogramTest, relativeError) {
+    // Larger values are approximated, but the error should be bounded and
+    // the approximated value shouldn't be smaller than the actual one.
+    const uint64_t values[] = { 128, 129, 255, 256, 1000, 12345, 999999,
+                                1ULL << 40, (1ULL << 40) + 12345,
+                                0xffffffffffffffffULL };
+    for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); ++i) {
+        histogram.clear();
+        histogram.record(values[i]);
+        histogram.record(values[i] / 2); // make sure p100 isn't clamped
+        const uint64_t value = values[i] / 2;
+        const uint64_t result = histogram.getPercentile(50);
+        EXPECT_LE(value, result);
+        EXPECT_GE(value / 64, result - value);
+        EXPECT_EQ(values[i], histogram.getPercentile(100));
+    }
+}
+
+TEST_F(LatencyHistogramTest, clamp) {
+    // The result never exceeds the maximum recorded value.
+    histogram.record(1000);
+    EXPECT_EQ(1000, histogram.getPercentile(50));
+    EXPECT_EQ(1000, histogram.getMin());
+}
+
+TEST_F(LatencyHistogramTest, merge) {
+    LatencyHistogram other;
+    for (uint64_t i = 1; i <= 50; ++i) {
+        histogram.record(i);
+        other.record(i + 50);
+    }
+    histogram.merge(other);
+    EXPECT_EQ(100, histogram.getCount());
+    EXPECT_EQ(1, histogram.getMin());
+    EXPECT_EQ(100, histogram.getMax());
+    EXPECT_EQ(50, histogram.getPercentile(50));
+    EXPECT_EQ(99, histogram.getPercentile(99));
+
+    // Merging an empty histogram doesn't change anything.
+    histogram.merge(LatencyHistogram());
+    EXPECT_EQ(100, histogram.getCount());
+    EXPECT_EQ(1, histogram.getMin());
+}
+
+TEST_F(LatencyHistogramTest, snapshot) {
+    for (uint64_t i = 1; i <= 50; ++i) {
+        histogram.recordShared(i);
+    }
+    LatencyHistogram earlier;
+    earlier.load(histogram);
+    EXPECT_EQ(50, earlier.getCount());
+    EXPECT_EQ(1, earlier.getMin());
+    EXPECT_EQ(50, earlier.getMax());
+
+    // The difference from the earlier snapshot is what's recorded since
+    // then.
+    for (uint64_t i = 51; i <= 100; ++i) {
+        histogram.recordShared(i);
+    }
+    LatencyHistogram later;
+    later.load(histogram);
+    later.subtract(earlier);
+    EXPECT_EQ(50, later.getCount());
+    EXPECT_EQ(51, later.getMin());
+    EXPECT_EQ(100, later.getMax());
+    EXPECT_DOUBLE_EQ(75.5, later.getMean());
+    EXPECT_EQ(75, later.getPercentile(50));
+
+    // Nothing is recorded in between.
+    later.load(histogram);
+    earlier.load(histogram);
+    later.subtract(earlier);
+    EXPECT_EQ(0, later.getCount());
+    EXPECT_EQ(0, later.getPercentile(99));
+}
+
+} // unnamed namespace
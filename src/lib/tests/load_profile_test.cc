@@ -0,0 +1,175 @@
+// Copyright (C) 2012  JINMEI Tatuya
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+// OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#include <load_profile.h>
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace Queryperf;
+
+namespace {
+// Make the result of a step with the given number of lost queries and
+// latency (in microseconds) of the completed ones.
+LoadStepResult
+makeResult(const LoadStep& step, size_t n_sent, size_t n_lost,
+           uint64_t latency)
+{
+    LoadStepResult result(step);
+    result.queries_sent = n_sent;
+    result.queries_completed = n_sent - n_lost;
+    for (size_t i = 0; i < result.queries_completed; ++i) {
+        result.rtt_histogram.record(latency);
+    }
+    return (result);
+}
+
+TEST(LoadProfileTest, steps) {
+    LoadProfile profile = LoadProfile::parse("step:100,200,400:10");
+    EXPECT_FALSE(profile.isSearch());
+    ASSERT_EQ(3, profile.getSteps().size());
+    EXPECT_EQ("3 steps from 100 to 400 qps over 30 seconds",
+              profile.toText());
+
+    // The steps are taken in order regardless of the results.
+    LoadStep step = profile.start();
+    EXPECT_EQ(100, step.start_rate);
+    EXPECT_EQ(100, step.end_rate);
+    EXPECT_EQ(10, step.duration);
+    const LoadStepResult bad_result = makeResult(step, 10, 10, 0);
+    EXPECT_TRUE(profile.isAcceptable(bad_result));
+    EXPECT_TRUE(profile.next(bad_result, step));
+    EXPECT_EQ(200, step.start_rate);
+    EXPECT_TRUE(profile.next(bad_result, step));
+    EXPECT_EQ(400, step.start_rate);
+    EXPECT_FALSE(profile.next(bad_result, step));
+    EXPECT_EQ(0, profile.getFoundRate());
+}
+
+TEST(LoadProfileTest, ramp) {
+    // 0 to 1000 qps over 10 seconds, in 4 steps of 2 or 3 seconds.
+    const LoadProfile profile = LoadProfile::parse("ramp:0-1000:10:4");
+    const vector<LoadStep>& steps = profile.getSteps();
+    ASSERT_EQ(4, steps.size());
+    const size_t expected[][3] = {
+        { 0, 200, 2 }, { 200, 500, 3 }, { 500, 700, 2 }, { 700, 1000, 3 }
+    };
+    for (size_t i = 0; i < 4; ++i) {
+        EXPECT_EQ(expected[i][0], steps[i].start_rate);
+        EXPECT_EQ(expected[i][1], steps[i].end_rate);
+        EXPECT_EQ(expected[i][2], steps[i].duration);
+    }
+
+    // Decreasing rates and the default number of steps.
+    const LoadProfile down = LoadProfile::parse("ramp:1000-0:20");
+    ASSERT_EQ(10, down.getSteps().size()); // DEFAULT_RAMP_STEPS
+    EXPECT_EQ(1000, down.getSteps().front().start_rate);
+    EXPECT_EQ(0, down.getSteps().back().end_rate);
+}
+
+TEST(LoadProfileTest, dueQueries) {
+    // Constant rate.
+    const LoadStep step(1000, 1000, 2);
+    EXPECT_EQ(0, step.getDueQueries(0));
+    EXPECT_EQ(500, step.getDueQueries(500000));
+    EXPECT_EQ(2000, step.getDueQueries(2000000));
+    EXPECT_EQ(2000, step.getDueQueries(3000000)); // the step has ended
+
+    // Linear ramp: the integral of the rate.
+    const LoadStep ramp(0, 1000, 2);
+    EXPECT_EQ(250, ramp.getDueQueries(1000000));
+    EXPECT_EQ(1000, ramp.getDueQueries(2000000));
+}
+
+TEST(LoadProfileTest, search) {
+    // The highest acceptable rate is between 2500 and 3000 qps: the
+    // search doubles the rate, then bisects the range down to 100 qps.
+    LoadProfile profile = LoadProfile::parse("search:1:10:5:1000:100000:100");
+    EXPECT_TRUE(profile.isSearch());
+    EXPECT_TRUE(profile.getSteps().empty());
+    EXPECT_EQ("search for the highest rate with loss < 1% and p99 latency "
+              "< 10 ms, 5 seconds per step", profile.toText());
+
+    const size_t expected_rates[] = { 1000, 2000, 4000, 3000, 2500, 2750,
+                                      2625, 2562 };
+    LoadStep step = profile.start();
+    for (size_t i = 0;
+         i < sizeof(expected_rates) / sizeof(expected_rates[0]); ++i) {
+        EXPECT_EQ(expected_rates[i], step.start_rate);
+        EXPECT_EQ(5, step.duration);
+        // Rates up to 2500 are acceptable; higher ones lose too many
+        // queries or respond too slowly.
+        const LoadStepResult result =
+            step.start_rate <= 2500 ? makeResult(step, 1000, 9, 9000) :
+            (i % 2 == 0 ? makeResult(step, 1000, 10, 1000) :
+             makeResult(step, 1000, 0, 10000));
+        EXPECT_EQ(step.start_rate <= 2500, profile.isAcceptable(result));
+        const bool has_next = profile.next(result, step);
+        EXPECT_EQ(i < 7, has_next);
+    }
+    EXPECT_EQ(2500, profile.getFoundRate());
+
+    // Restart the search.  If the maximum rate is acceptable, it stops
+    // there.
+    profile = LoadProfile::parse("search:1:10:5:1000:1500");
+    step = profile.start();
+    EXPECT_EQ(0, profile.getFoundRate());
+    EXPECT_TRUE(profile.next(makeResult(step, 100, 0, 0), step));
+    EXPECT_EQ(1500, step.start_rate);
+    EXPECT_FALSE(profile.next(makeResult(step, 100, 0, 0), step));
+    EXPECT_EQ(1500, profile.getFoundRate());
+
+    // Skipped queries are lost, too.
+    LoadStepResult result = makeResult(step, 98, 0, 0);
+    result.queries_skipped = 2;
+    EXPECT_DOUBLE_EQ(2, result.getLossRate());
+    EXPECT_FALSE(profile.isAcceptable(result));
+}
+
+TEST(LoadProfileTest, share) {
+    const LoadProfile profile = LoadProfile::parse("ramp:10-21:2:1");
+    const LoadProfile share0 = profile.getShare(0, 3);
+    const LoadProfile share2 = profile.getShare(2, 3);
+    EXPECT_EQ(4, share0.getSteps()[0].start_rate);
+    EXPECT_EQ(7, share0.getSteps()[0].end_rate);
+    EXPECT_EQ(3, share2.getSteps()[0].start_rate);
+    EXPECT_EQ(7, share2.getSteps()[0].end_rate);
+
+    // Results of the threads are merged.
+    LoadStepResult result(share0.getSteps()[0]);
+    result.merge(LoadStepResult(share2.getSteps()[0]));
+    EXPECT_EQ(7, result.step.start_rate);
+    EXPECT_EQ(14, result.step.end_rate);
+
+    EXPECT_THROW(LoadProfile::parse("search:1:10:5").getShare(0, 2),
+                 LoadProfileError);
+}
+
+TEST(LoadProfileTest, badProfiles) {
+    const char* const bad_texts[] = {
+        "", "step", "step:100", "step:100:0", "step:100,:10", "step:-1:10",
+        "step:100:10:1", "ramp:100:10", "ramp:100-:10", "ramp:0-100:3:4",
+        "ramp:0-100:10:0", "search:1:10", "search:0:10:5", "search:1:0:5",
+        "search:x:10:5", "search:1:10:5:0", "search:1:10:5:1000:999",
+        "search:1:10:5:1:2:3:4", "flat:100:10"
+    };
+    for (size_t i = 0; i < sizeof(bad_texts) / sizeof(bad_texts[0]); ++i) {
+        EXPECT_THROW(LoadProfile::parse(bad_texts[i]), LoadProfileError)
+            << bad_texts[i];
+    }
+}
+}
@@ -0,0 +1,139 @@
+// Copyright (C) 2012  JINMEI Tatuya
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+// OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#include <qid_allocator.h>
+
+#include <gtest/gtest.h>
+
+#include <stdint.h>
+
+using namespace Queryperf;
+
+namespace {
+class QidAllocatorTest : public ::testing::Test {
+protected:
+    QidAllocator qids_;
+};
+
+TEST_F(QidAllocatorTest, ascending) {
+    for (size_t i = 0; i < 10; ++i) {
+        EXPECT_EQ(i, qids_.allocate());
+    }
+}
+
+TEST_F(QidAllocatorTest, release) {
+    // A released QID is used again after all the others.
+    EXPECT_EQ(0, qids_.allocate());
+    qids_.release(0);
+    for (size_t i = 1; i < QidAllocator::QID_SPACE; ++i) {
+        EXPECT_EQ(i, qids_.allocate());
+    }
+    EXPECT_EQ(0, qids_.allocate());
+}
+
+TEST_F(QidAllocatorTest, quarantine) {
+    // Quarantined QIDs are used only if there's no free one, and the one
+    // quarantined first is used first.
+    for (size_t i = 0; i < QidAllocator::QID_SPACE; ++i) {
+        EXPECT_EQ(i, qids_.allocate());
+    }
+    qids_.quarantine(10);
+    qids_.quarantine(5);
+    qids_.release(20);
+    EXPECT_EQ(20, qids_.allocate());
+    EXPECT_EQ(10, qids_.allocate());
+    EXPECT_EQ(5, qids_.allocate());
+
+    // A QID released while quarantined (e.g., on a late response) is free.
+    qids_.quarantine(5);
+    qids_.quarantine(10);
+    qids_.release(10);
+    EXPECT_EQ(10, qids_.allocate());
+    EXPECT_EQ(5, qids_.allocate());
+
+    // Only the latest quarantine counts.
+    qids_.quarantine(10);
+    qids_.quarantine(5);
+    qids_.release(10);
+    qids_.quarantine(10);
+    EXPECT_EQ(5, qids_.allocate());
+    EXPECT_EQ(10, qids_.allocate());
+}
+
+TEST_F(QidAllocatorTest, repeatedQuarantine) {
+    for (size_t i = 0; i < QidAllocator::QID_SPACE; ++i) {
+        qids_.allocate();
+    }
+    // A QID that times out and then gets a late response over and over
+    // leaves nothing behind in the quarantine list.
+    for (size_t i = 0; i < 100000; ++i) {
+        qids_.quarantine(5);
+        qids_.release(5);
+        ASSERT_EQ(5, qids_.allocate());
+    }
+    // Quarantining a QID again moves it to the end.
+    qids_.quarantine(7);
+    qids_.quarantine(5);
+    qids_.quarantine(7);
+    const uint64_t probes = qids_.getProbeCount();
+    EXPECT_EQ(5, qids_.allocate());
+    EXPECT_EQ(7, qids_.allocate());
+    EXPECT_EQ(probes + 2, qids_.getProbeCount());
+}
+
+TEST_F(QidAllocatorTest, size) {
+    // Only the QIDs below the size are used.
+    QidAllocator qids(3);
+    EXPECT_EQ(3, qids.getSize());
+    EXPECT_EQ(0, qids.allocate());
+    EXPECT_EQ(1, qids.allocate());
+    qids.release(0);
+    EXPECT_EQ(2, qids.allocate());
+    EXPECT_EQ(0, qids.allocate());
+    EXPECT_FALSE(qids.reserve(3));
+    qids.quarantine(1);
+    EXPECT_EQ(1, qids.allocate());
+}
+
+TEST_F(QidAllocatorTest, reserve) {
+    EXPECT_EQ(0, qids_.allocate());
+    EXPECT_FALSE(qids_.reserve(0));
+    EXPECT_TRUE(qids_.reserve(1));
+    EXPECT_FALSE(qids_.reserve(1));
+    qids_.quarantine(1);
+    EXPECT_FALSE(qids_.reserve(1));
+    qids_.release(1);
+    EXPECT_TRUE(qids_.reserve(1));
+
+    // A reserved QID isn't allocated.
+    EXPECT_EQ(2, qids_.allocate());
+}
+
+TEST_F(QidAllocatorTest, allQuarantined) {
+    // With the whole QID space timed out, a QID is chosen without
+    // examining all of them.
+    for (size_t i = 0; i < QidAllocator::QID_SPACE; ++i) {
+        qids_.allocate();
+    }
+    for (size_t i = 0; i < QidAllocator::QID_SPACE; ++i) {
+        qids_.quarantine(i);
+    }
+    for (size_t i = 0; i < QidAllocator::QID_SPACE; ++i) {
+        const uint64_t probes = qids_.getProbeCount();
+        EXPECT_EQ(i, qids_.allocate());
+        EXPECT_EQ(probes + 1, qids_.getProbeCount());
+        qids_.quarantine(i);
+    }
+}
+}
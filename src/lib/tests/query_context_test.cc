@@ -30,6 +30,8 @@
 
 #include <sstream>
 
+#include <cstring>
+
 #include <netinet/in.h>
 
 using namespace std;
@@ -84,4 +86,76 @@ TEST_F(QueryContextTest, setProtocol) {
                  RRType::SOA(), IPPROTO_TCP);
 }
 
+TEST_F(QueryContextTest, preload) {
+    // Queries built from preloaded data should be identical to those
+    // rendered for each query.
+    const char* const input = "example.com. SOA\n"
+        "www.example.com. A\n"
+        "example.com. IXFR serial=42\n"
+        "example.org. AXFR";
+    stringstream ss(input);
+    QueryRepository repo(ss);
+    stringstream preload_ss(input);
+    QueryRepository preload_repo(preload_ss);
+    repo.setDNSSEC(false);
+    preload_repo.setDNSSEC(false);
+    preload_repo.load();
+
+    QueryContext ctx(repo);
+    QueryContext preload_ctx(preload_repo);
+    const qid_t qids[] = { 0, 1, 0x1234, 0xffff, 42 };
+    for (size_t i = 0; i < sizeof(qids) / sizeof(qids[0]); ++i) {
+        const QueryContext::QuerySpec spec = ctx.start(qids[i]);
+        const QueryContext::QuerySpec preload_spec =
+            preload_ctx.start(qids[i]);
+        EXPECT_EQ(spec.proto, preload_spec.proto);
+        ASSERT_EQ(spec.len, preload_spec.len);
+        EXPECT_EQ(0, memcmp(spec.data, preload_spec.data, spec.len));
+    }
+}
+
+// Return the query name of the query data.
+string
+getQname(const QueryContext::QuerySpec& spec) {
+    InputBuffer buffer(spec.data, spec.len);
+    Message msg(Message::PARSE);
+    msg.fromWire(buffer);
+    return ((*msg.beginQuestion())->getName().toText());
+}
+
+// Check the query names generated from templates.
+void
+checkTemplates(QueryContext& ctx) {
+    const string rand_chars = "0123456789abcdefghijklmnopqrstuv";
+    const string name1 = getQname(ctx.start(1));
+    ASSERT_EQ(21, name1.size());
+    EXPECT_EQ(string::npos, name1.substr(0, 8).find_first_not_of(rand_chars));
+    EXPECT_EQ(".example.com.", name1.substr(8));
+    const string name2 = getQname(ctx.start(2));
+    ASSERT_EQ(27, name2.size());
+    EXPECT_EQ("q0000.", name2.substr(0, 6));
+    EXPECT_EQ(string::npos, name2.substr(6, 3).find_first_not_of(rand_chars));
+    EXPECT_EQ(".0000.example.org.", name2.substr(9));
+
+    // Random parts are different each time (with a negligible chance of
+    // false failure), and the sequence is incremented.
+    EXPECT_NE(name1, getQname(ctx.start(3)));
+    EXPECT_EQ("q0001.", getQname(ctx.start(4)).substr(0, 6));
+}
+
+TEST_F(QueryContextTest, qnameTemplates) {
+    const char* const input = "{rand:8}.example.com. A\n"
+        "q{seq:4}.{rand:3}.{seq:4}.example.org. AAAA";
+    stringstream ss(input);
+    QueryRepository repo(ss);
+    QueryContext ctx(repo);
+    checkTemplates(ctx);
+
+    stringstream preload_ss(input);
+    QueryRepository preload_repo(preload_ss);
+    preload_repo.load();
+    QueryContext preload_ctx(preload_repo);
+    checkTemplates(preload_ctx);
+}
+
 }
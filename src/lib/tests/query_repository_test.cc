@@ -13,6 +13,7 @@
 // PERFORMANCE OF THIS SOFTWARE.
 
 #include <query_repository.h>
+#include <query_sampler.h>
 #include <common_test.h>
 
 #include <dns/name.h>
@@ -25,12 +26,17 @@
 
 #include <gtest/gtest.h>
 
+#include <cstring>
+#include <fstream>
 #include <sstream>
 #include <string>
 #include <iostream>
+#include <vector>
 
 #include <netinet/in.h>
 
+#include <unistd.h>
+
 using namespace std;
 using namespace bundy::dns;
 using namespace Queryperf;
@@ -101,6 +107,211 @@ TEST_F(QueryRepositoryTest, duplicatePreload) {
     EXPECT_THROW(repo.load(), QueryRepositoryError);
 }
 
+TEST_F(QueryRepositoryTest, sharedPreload) {
+    stringstream ss("example.com. SOA\nwww.example.com. A");
+    QueryRepository repo(ss);
+    stringstream ss2;           // unused, but necessary for the constructor
+    QueryRepository repo2(ss2);
+
+    // The source repository hasn't been preloaded yet.
+    EXPECT_THROW(repo2.load(repo, 0), QueryRepositoryError);
+
+    repo.setProtocol(IPPROTO_TCP);
+    repo.setDNSSEC(false);
+    repo.load();
+    repo2.load(repo, 0);
+    EXPECT_EQ(2, repo2.getQueryCount());
+    EXPECT_THROW(repo2.load(repo, 0), QueryRepositoryError);
+    EXPECT_THROW(repo2.load(), QueryRepositoryError);
+
+    // Settings are inherited from the source repository.
+    EXPECT_THROW(repo2.setProtocol(IPPROTO_UDP), QueryRepositoryError);
+    initialCheck(repo2, msg, IPPROTO_TCP, true, false);
+
+    // Each repository has its own position; the start position can be
+    // larger than the number of queries.
+    stringstream ss3;
+    QueryRepository repo3(ss3);
+    repo3.load(repo, 3);
+    int protocol;
+    repo3.getNextQuery(msg, protocol);
+    queryMessageCheck(msg, 0, Name("www.example.com"), RRType::A(),
+                      default_expected_rr_counts, true, false);
+    initialCheck(repo, msg, IPPROTO_TCP, true, false);
+}
+
+TEST_F(QueryRepositoryTest, localize) {
+    stringstream ss("example.com. SOA\nwww.example.com. A");
+    QueryRepository repo(ss);
+    stringstream ss2;
+    QueryRepository repo2(ss2);
+
+    // Queries must be preloaded to be copied.
+    EXPECT_THROW(repo.localize(), QueryRepositoryError);
+
+    repo.load();
+    repo2.load(repo, 1);
+    size_t len, len2;
+    int protocol2;
+    const void* data = repo.getNextQueryData(len, protocol);
+    repo2.localize();
+    const void* data2 = repo2.getNextQueryData(len2, protocol2);
+
+    // The copy has the same queries in a different place, and the position
+    // of the next query is kept.  The original is still available.
+    EXPECT_NE(data, data2);
+    queryMessageCheck(data2, len2, 0, Name("www.example.com"), RRType::A());
+    data2 = repo2.getNextQueryData(len2, protocol2);
+    ASSERT_EQ(len, len2);
+    EXPECT_EQ(protocol, protocol2);
+    EXPECT_EQ(0, memcmp(data, data2, len));
+    EXPECT_EQ(2, repo2.getQueryCount());
+    repo2.getNextQuery(msg, protocol);
+    queryMessageCheck(msg, 0, Name("www.example.com"), RRType::A(),
+                      default_expected_rr_counts);
+    data = repo.getNextQueryData(len, protocol);
+    queryMessageCheck(data, len, 0, Name("www.example.com"), RRType::A());
+}
+
+TEST_F(QueryRepositoryTest, getNextQueryData) {
+    stringstream ss("example.com. SOA\nwww.example.com. A");
+    QueryRepository repo(ss);
+    size_t len;
+
+    // Wire format data is only available for preloaded queries.
+    EXPECT_EQ(static_cast<const void*>(NULL),
+              repo.getNextQueryData(len, protocol));
+
+    repo.setProtocol(IPPROTO_TCP);
+    repo.load();
+    const void* data = repo.getNextQueryData(len, protocol);
+    ASSERT_NE(static_cast<const void*>(NULL), data);
+    EXPECT_EQ(IPPROTO_TCP, protocol);
+    queryMessageCheck(data, len, 0, Name("example.com"), RRType::SOA());
+
+    // It shares the position with getNextQuery().
+    repo.getNextQuery(msg, protocol);
+    queryMessageCheck(msg, 0, Name("www.example.com"), RRType::A(),
+                      default_expected_rr_counts);
+    data = repo.getNextQueryData(len, protocol);
+    queryMessageCheck(data, len, 0, Name("example.com"), RRType::SOA());
+}
+
+TEST_F(QueryRepositoryTest, stream) {
+    stringstream ss("example.com. SOA\nwww.example.com. A");
+    QueryRepository repo(ss);
+    repo.setProtocol(IPPROTO_TCP);
+    repo.setDNSSEC(false);
+    repo.stream();
+    EXPECT_EQ(0, repo.getQueryCount());
+    EXPECT_THROW(repo.stream(), QueryRepositoryError);
+    EXPECT_THROW(repo.load(), QueryRepositoryError);
+    EXPECT_THROW(repo.setProtocol(IPPROTO_UDP), QueryRepositoryError);
+
+    // Queries are returned in order, wrapping around, both as wire data
+    // and as messages.
+    initialCheck(repo, msg, IPPROTO_TCP, true, false);
+    size_t len;
+    const void* data = repo.getNextQueryData(len, protocol);
+    ASSERT_NE(static_cast<const void*>(NULL), data);
+    EXPECT_EQ(IPPROTO_TCP, protocol);
+    queryMessageCheck(data, len, 0, Name("www.example.com"), RRType::A(),
+                      true, false);
+    EXPECT_FALSE(repo.hasQnameTemplates());
+    for (size_t i = 0; i < 1000; ++i) { // beyond the first chunks
+        data = repo.getNextQueryData(len, protocol);
+    }
+    queryMessageCheck(data, len, 0, Name("www.example.com"), RRType::A(),
+                      true, false);
+}
+
+TEST_F(QueryRepositoryTest, sharedStream) {
+    stringstream ss("example.com. SOA\nwww.example.com. A");
+    QueryRepository repo(ss);
+    stringstream ss2;
+    QueryRepository repo2(ss2);
+
+    // The source must be streaming queries.
+    EXPECT_THROW(repo2.stream(repo), QueryRepositoryError);
+    repo.load();
+    EXPECT_THROW(repo2.stream(repo), QueryRepositoryError);
+
+    stringstream ss3("example.com. SOA\nwww.example.com. A");
+    QueryRepository repo3(ss3);
+    repo3.setProtocol(IPPROTO_TCP);
+    repo3.stream();
+    repo2.stream(repo3);
+    EXPECT_THROW(repo2.stream(repo3), QueryRepositoryError);
+
+    // Settings are inherited from the source repository, and each one gets
+    // its own chunks of queries (starting at the beginning of the input
+    // here).
+    EXPECT_THROW(repo2.setProtocol(IPPROTO_UDP), QueryRepositoryError);
+    initialCheck(repo2, msg, IPPROTO_TCP);
+    initialCheck(repo3, msg, IPPROTO_TCP);
+}
+
+TEST_F(QueryRepositoryTest, streamErrors) {
+    // Random selection needs preloaded queries.
+    stringstream ss("www.example.com. A");
+    QueryRepository repo(ss);
+    repo.setSelection(QueryRepository::SELECT_UNIFORM);
+    EXPECT_THROW(repo.stream(), QueryRepositoryError);
+
+    // Failure of reading the input is reported to the user of the queries.
+    stringstream empty_stream;
+    QueryRepository repo2(empty_stream);
+    repo2.stream();
+    size_t len;
+    EXPECT_THROW(repo2.getNextQueryData(len, protocol), QueryRepositoryError);
+    EXPECT_THROW(repo2.getNextQuery(msg, protocol), QueryRepositoryError);
+}
+
+// A stream buffer that can't seek, like that of a pipe.
+class UnseekableStringBuf : public stringbuf {
+public:
+    UnseekableStringBuf(const string& data) : stringbuf(data, ios::in) {}
+
+protected:
+    virtual pos_type seekoff(off_type, ios::seekdir, ios::openmode) {
+        return (pos_type(off_type(-1)));
+    }
+    virtual pos_type seekpos(pos_type, ios::openmode) {
+        return (pos_type(off_type(-1)));
+    }
+};
+
+TEST_F(QueryRepositoryTest, unseekableInput) {
+    // Queries can be read once, but they can't wrap around.
+    UnseekableStringBuf buf("example.com. SOA\nwww.example.com. A");
+    istream input(&buf);
+    QueryRepository repo(input);
+    repo.getNextQuery(msg, protocol);
+    EXPECT_EQ(Name("example.com"), (*msg.beginQuestion())->getName());
+    repo.getNextQuery(msg, protocol);
+    EXPECT_EQ(Name("www.example.com"), (*msg.beginQuestion())->getName());
+    EXPECT_THROW(repo.getNextQuery(msg, protocol), QueryRepositoryError);
+
+    // Same for streamed queries, once the queries read have been returned.
+    UnseekableStringBuf buf2("example.com. SOA\nwww.example.com. A\n");
+    istream input2(&buf2);
+    QueryRepository repo2(input2);
+    repo2.stream();
+    size_t len;
+    const void* data = repo2.getNextQueryData(len, protocol);
+    queryMessageCheck(data, len, 0, Name("example.com"), RRType::SOA());
+    data = repo2.getNextQueryData(len, protocol);
+    queryMessageCheck(data, len, 0, Name("www.example.com"), RRType::A());
+    EXPECT_THROW(repo2.getNextQueryData(len, protocol), QueryRepositoryError);
+
+    // Preloading reads the input only once.
+    UnseekableStringBuf buf3("example.com. SOA\nwww.example.com. A\n");
+    istream input3(&buf3);
+    QueryRepository repo3(input3);
+    repo3.load();
+    EXPECT_EQ(2, repo3.getQueryCount());
+}
+
 TEST_F(QueryRepositoryTest, createFromFile) {
     QueryRepository repo("test-input.txt");
     initialCheck(repo, msg);
@@ -265,4 +476,302 @@ TEST_F(QueryRepositoryTest, IXFRPreload) {
     repo.load();
     checkIXFR(repo, msg);
 }
+
+// Name of a compiled query file created in tests
+const char* const COMPILED_FILE = "compiled-test.qpb";
+
+// Count how many times "example.com" is chosen in n queries.
+size_t
+countFirstQuery(QueryRepository& repo, Message& msg, size_t n) {
+    size_t count = 0;
+    int protocol;
+    for (size_t i = 0; i < n; ++i) {
+        repo.getNextQuery(msg, protocol);
+        if ((*msg.beginQuestion())->getName() == Name("example.com")) {
+            ++count;
+        }
+    }
+    return (count);
+}
+
+TEST_F(QueryRepositoryTest, selection) {
+    stringstream ss("example.com. SOA\nwww.example.com. A");
+    QueryRepository repo(ss);
+    EXPECT_EQ(QueryRepository::SELECT_SEQUENTIAL, repo.getSelectionMode());
+    EXPECT_THROW(repo.setSelection(QueryRepository::SELECT_ZIPF, -1),
+                 QueryRepositoryError);
+
+    // Random selection requires preload.
+    repo.setSelection(QueryRepository::SELECT_UNIFORM);
+    EXPECT_EQ(QueryRepository::SELECT_UNIFORM, repo.getSelectionMode());
+    EXPECT_THROW(repo.getNextQuery(msg, protocol), QueryRepositoryError);
+
+    repo.load();
+    EXPECT_THROW(repo.setSelection(QueryRepository::SELECT_SEQUENTIAL),
+                 QueryRepositoryError);
+    EXPECT_NEAR(2000, countFirstQuery(repo, msg, 4000), 200);
+
+    // The wire data are chosen the same way.
+    size_t count = 0;
+    for (size_t i = 0; i < 4000; ++i) {
+        size_t len;
+        const uint8_t* data = static_cast<const uint8_t*>(
+            repo.getNextQueryData(len, protocol));
+        count += (data[12] == 7) ? 1 : 0; // the first label is "example"
+    }
+    EXPECT_NEAR(2000, count, 200);
+}
+
+TEST_F(QueryRepositoryTest, zipfSelection) {
+    stringstream ss("example.com. SOA\nwww.example.com. A");
+    QueryRepository repo(ss);
+    repo.setSelection(QueryRepository::SELECT_ZIPF, 1);
+    repo.load();
+    // Weights are 1 and 1/2.
+    EXPECT_NEAR(4000, countFirstQuery(repo, msg, 6000), 200);
+
+    // A repository sharing the queries uses the same distribution.
+    stringstream ss2;
+    QueryRepository repo2(ss2);
+    repo2.load(repo, 1);
+    EXPECT_EQ(QueryRepository::SELECT_ZIPF, repo2.getSelectionMode());
+    EXPECT_NEAR(4000, countFirstQuery(repo2, msg, 6000), 200);
+    repo2.localize();
+    EXPECT_NEAR(4000, countFirstQuery(repo2, msg, 6000), 200);
+}
+
+TEST_F(QueryRepositoryTest, weightedSelection) {
+    stringstream ss("example.com. SOA weight=3\n"
+                    "www.example.com. A\n" // default weight is 1
+                    "bad.example.com. A weight=-1\n" // ignored
+                    "never.example.com. A weight=0\n");
+    QueryRepository repo(ss);
+    repo.setSelection(QueryRepository::SELECT_WEIGHTED);
+    repo.load();
+    EXPECT_EQ(3, repo.getQueryCount());
+
+    int protocol;
+    size_t count = 0;
+    for (size_t i = 0; i < 4000; ++i) {
+        repo.getNextQuery(msg, protocol);
+        const Name& qname = (*msg.beginQuestion())->getName();
+        EXPECT_NE(Name("never.example.com"), qname);
+        count += (qname == Name("example.com")) ? 1 : 0;
+    }
+    EXPECT_NEAR(3000, count, 200);
+
+    // All weights are 0.
+    stringstream ss2("example.com. SOA weight=0\n");
+    QueryRepository repo2(ss2);
+    repo2.setSelection(QueryRepository::SELECT_WEIGHTED);
+    EXPECT_THROW(repo2.load(), QuerySamplerError);
+}
+
+TEST_F(QueryRepositoryTest, qnameTemplates) {
+    stringstream ss("{rand:0}.example.com. A\n"
+                    "{rand:64}.example.com. A\n"
+                    "{seq:20}.example.com. A\n"
+                    "{unknown}.example.com. A\n"
+                    "{rand:3.example.com. A\n"
+                    "www\\.{seq}.example.com. A\n"
+                    "{rand:63}{rand:1}.example.com. A\n" // too long label
+                    "x{seq:2}y.example.com. A\n");
+    QueryRepository repo(ss);
+    repo.load();
+    EXPECT_EQ(1, repo.getQueryCount());
+
+    // The query has placeholders, and they're overwritten in the copy.
+    size_t len;
+    const uint8_t* data = static_cast<const uint8_t*>(
+        repo.getNextQueryData(len, protocol));
+    EXPECT_TRUE(repo.hasQnameTemplates());
+    EXPECT_EQ(0, memcmp("\x04" "x00y\x07" "example", &data[12], 13));
+    vector<uint8_t> copy(data, data + len);
+    repo.expandQnameTemplates(&copy[0], len);
+    EXPECT_EQ(0, memcmp("\x04" "x00y\x07" "example", &copy[12], 13));
+    repo.getNextQueryData(len, protocol);
+    repo.expandQnameTemplates(&copy[0], len);
+    EXPECT_EQ(0, memcmp("\x04" "x01y\x07" "example", &copy[12], 13));
+    // It wraps around.
+    for (size_t i = 0; i < 98; ++i) {
+        repo.expandQnameTemplates(&copy[0], len);
+    }
+    EXPECT_EQ(0, memcmp("\x04" "x99y", &copy[12], 5));
+    repo.expandQnameTemplates(&copy[0], len);
+    EXPECT_EQ(0, memcmp("\x04" "x00y", &copy[12], 5));
+
+    // The data must be large enough.
+    EXPECT_THROW(repo.expandQnameTemplates(&copy[0], 15),
+                 QueryRepositoryError);
+
+    stringstream ss2("www.example.com. A");
+    QueryRepository repo2(ss2);
+    repo2.getNextQuery(msg, protocol);
+    EXPECT_FALSE(repo2.hasQnameTemplates());
+
+    // Streamed queries have the templates, too.
+    stringstream ss3("x{seq:2}y.example.com. A\n");
+    QueryRepository repo3(ss3);
+    repo3.stream();
+    data = static_cast<const uint8_t*>(repo3.getNextQueryData(len, protocol));
+    EXPECT_TRUE(repo3.hasQnameTemplates());
+    copy.assign(data, data + len);
+    repo3.expandQnameTemplates(&copy[0], len);
+    repo3.expandQnameTemplates(&copy[0], len);
+    EXPECT_EQ(0, memcmp("\x04" "x01y\x07" "example", &copy[12], 13));
+}
+
+TEST_F(QueryRepositoryTest, qnameTemplatesPerRepository) {
+    // Repositories sharing the queries (e.g., in different threads) don't
+    // generate the same names.
+    stringstream ss("{rand:12}.example.com. A\n");
+    QueryRepository repo(ss);
+    repo.load();
+    stringstream ss2;
+    QueryRepository repo2(ss2);
+    repo2.load(repo, 0);
+
+    size_t len, len2;
+    const uint8_t* data = static_cast<const uint8_t*>(
+        repo.getNextQueryData(len, protocol));
+    const uint8_t* data2 = static_cast<const uint8_t*>(
+        repo2.getNextQueryData(len2, protocol));
+    ASSERT_EQ(len, len2);
+    vector<uint8_t> copy(data, data + len);
+    vector<uint8_t> copy2(data2, data2 + len2);
+    repo.expandQnameTemplates(&copy[0], len);
+    repo2.expandQnameTemplates(&copy2[0], len2);
+    EXPECT_NE(0, memcmp(&copy[12], &copy2[12], 13));
+
+    // Sequence numbers can be interleaved.
+    stringstream ss3("x{seq:2}y.example.com. A\n");
+    QueryRepository repo3(ss3);
+    repo3.load();
+    EXPECT_THROW(repo3.setSequence(0, 0), QueryRepositoryError);
+    repo3.setSequence(1, 3);
+    data = static_cast<const uint8_t*>(repo3.getNextQueryData(len, protocol));
+    copy.assign(data, data + len);
+    repo3.expandQnameTemplates(&copy[0], len);
+    EXPECT_EQ(0, memcmp("\x04" "x01y", &copy[12], 5));
+    repo3.expandQnameTemplates(&copy[0], len);
+    EXPECT_EQ(0, memcmp("\x04" "x04y", &copy[12], 5));
+}
+
+class CompiledQueryRepositoryTest : public QueryRepositoryTest {
+protected:
+    ~CompiledQueryRepositoryTest() {
+        unlink(COMPILED_FILE);
+    }
+};
+
+TEST_F(CompiledQueryRepositoryTest, saveAndLoad) {
+    stringstream ss("example.com. SOA\nwww.example.com. A");
+    QueryRepository repo(ss);
+
+    // Queries must be preloaded to be saved.
+    EXPECT_THROW(repo.save(COMPILED_FILE), QueryRepositoryError);
+
+    repo.setProtocol(IPPROTO_TCP);
+    repo.setDNSSEC(false);
+    repo.load();
+    repo.save(COMPILED_FILE);
+    EXPECT_TRUE(QueryRepository::isCompiledFile(COMPILED_FILE));
+    EXPECT_FALSE(QueryRepository::isCompiledFile("test-input.txt"));
+    EXPECT_FALSE(QueryRepository::isCompiledFile("nosuchfile.txt"));
+
+    QueryRepository compiled(COMPILED_FILE);
+    // Compiled queries must be preloaded.
+    EXPECT_THROW(compiled.getNextQuery(msg, protocol), QueryRepositoryError);
+    EXPECT_THROW(compiled.stream(), QueryRepositoryError);
+    // Settings are fixed at the time of compilation.
+    compiled.setProtocol(IPPROTO_UDP);
+    compiled.setDNSSEC(true);
+    compiled.load();
+    EXPECT_EQ(2, compiled.getQueryCount());
+    EXPECT_THROW(compiled.setProtocol(IPPROTO_UDP), QueryRepositoryError);
+
+    // The wire data should be identical to the original.
+    for (size_t i = 0; i < compiled.getQueryCount(); ++i) {
+        size_t len, compiled_len;
+        int compiled_protocol;
+        const void* data = repo.getNextQueryData(len, protocol);
+        const void* compiled_data =
+            compiled.getNextQueryData(compiled_len, compiled_protocol);
+        EXPECT_EQ(protocol, compiled_protocol);
+        ASSERT_EQ(len, compiled_len);
+        EXPECT_EQ(0, memcmp(data, compiled_data, len));
+    }
+
+    // Messages are reconstructed from the compiled data, and can be shared.
+    stringstream ss2;
+    QueryRepository repo2(ss2);
+    repo2.load(compiled, 0);
+    initialCheck(repo2, msg, IPPROTO_TCP, true, false);
+    initialCheck(compiled, msg, IPPROTO_TCP, true, false);
+}
+
+TEST_F(CompiledQueryRepositoryTest, IXFR) {
+    stringstream ss("example.com. IXFR serial=42\n");
+    QueryRepository repo(ss);
+    repo.load();
+    repo.save(COMPILED_FILE);
+
+    QueryRepository compiled(COMPILED_FILE);
+    compiled.load();
+    checkIXFR(compiled, msg);
+}
+
+TEST_F(CompiledQueryRepositoryTest, selection) {
+    stringstream ss("example.com. SOA weight=2\nwww.example.com. A");
+    QueryRepository repo(ss);
+    repo.load();
+    repo.save(COMPILED_FILE);
+
+    // Weights aren't saved, but the other modes can be used.
+    QueryRepository compiled(COMPILED_FILE);
+    compiled.setSelection(QueryRepository::SELECT_WEIGHTED);
+    EXPECT_THROW(compiled.load(), QueryRepositoryError);
+
+    QueryRepository compiled2(COMPILED_FILE);
+    compiled2.setSelection(QueryRepository::SELECT_ZIPF, 0);
+    compiled2.load();
+    EXPECT_NEAR(2000, countFirstQuery(compiled2, msg, 4000), 200);
+}
+
+TEST_F(CompiledQueryRepositoryTest, qnameTemplates) {
+    stringstream ss("{seq:3}.example.com. A\nwww.example.com. A");
+    QueryRepository repo(ss);
+    repo.load();
+    repo.save(COMPILED_FILE);
+
+    // The templates are kept in the compiled file.
+    QueryRepository compiled(COMPILED_FILE);
+    compiled.load();
+    size_t len;
+    const uint8_t* data = static_cast<const uint8_t*>(
+        compiled.getNextQueryData(len, protocol));
+    ASSERT_TRUE(compiled.hasQnameTemplates());
+    vector<uint8_t> copy(data, data + len);
+    compiled.expandQnameTemplates(&copy[0], len);
+    compiled.expandQnameTemplates(&copy[0], len);
+    EXPECT_EQ(0, memcmp("\x03" "001\x07" "example", &copy[12], 12));
+    compiled.getNextQueryData(len, protocol);
+    EXPECT_FALSE(compiled.hasQnameTemplates());
+
+    // And decoded queries have them too.
+    compiled.getNextQuery(msg, protocol);
+    EXPECT_TRUE(compiled.hasQnameTemplates());
+}
+
+TEST_F(CompiledQueryRepositoryTest, brokenFile) {
+    stringstream ss("example.com. SOA\nwww.example.com. A");
+    QueryRepository repo(ss);
+    repo.load();
+    repo.save(COMPILED_FILE);
+
+    // Truncate the index.
+    ASSERT_EQ(0, truncate(COMPILED_FILE, 30));
+    QueryRepository compiled(COMPILED_FILE);
+    EXPECT_THROW(compiled.load(), QueryRepositoryError);
+}
 }
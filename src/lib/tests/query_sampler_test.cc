@@ -0,0 +1,97 @@
+// Copyright (C) 2012  JINMEI Tatuya
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+// OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#include <query_sampler.h>
+
+#include <gtest/gtest.h>
+
+#include <limits>
+#include <vector>
+
+using namespace std;
+using namespace Queryperf;
+
+namespace {
+// Count the indices chosen by a sampler for the given number of times.
+vector<size_t>
+countSamples(const QuerySampler& sampler, size_t n) {
+    RandomGenerator rng(1);
+    vector<size_t> counts(sampler.getCount());
+    for (size_t i = 0; i < n; ++i) {
+        ++counts.at(sampler.sample(rng.next()));
+    }
+    return (counts);
+}
+
+TEST(RandomGeneratorTest, seed) {
+    RandomGenerator rng1(0), rng2(0), rng3(1);
+    const uint64_t value = rng1.next();
+    EXPECT_NE(0, value);
+    EXPECT_EQ(value, rng2.next());
+    EXPECT_NE(value, rng3.next());
+}
+
+TEST(QuerySamplerTest, sample) {
+    vector<double> weights;
+    weights.push_back(1);
+    weights.push_back(0);
+    weights.push_back(3);
+    const QuerySampler sampler(weights);
+    EXPECT_EQ(3, sampler.getCount());
+
+    const vector<size_t> counts = countSamples(sampler, 40000);
+    EXPECT_EQ(0, counts[1]);
+    EXPECT_NEAR(10000, counts[0], 500);
+    EXPECT_NEAR(30000, counts[2], 500);
+}
+
+TEST(QuerySamplerTest, uniform) {
+    // With equal weights each index is chosen by its range of the upper
+    // 32 bits.
+    const QuerySampler sampler(vector<double>(2, 5));
+    EXPECT_EQ(0, sampler.sample(0));
+    EXPECT_EQ(0, sampler.sample(0x7fffffffffffffffULL));
+    EXPECT_EQ(1, sampler.sample(0x8000000000000000ULL));
+    EXPECT_EQ(1, sampler.sample(0xffffffffffffffffULL));
+}
+
+TEST(QuerySamplerTest, zipf) {
+    const vector<double> weights = QuerySampler::getZipfWeights(3, 1);
+    ASSERT_EQ(3, weights.size());
+    EXPECT_DOUBLE_EQ(1, weights[0]);
+    EXPECT_DOUBLE_EQ(0.5, weights[1]);
+    EXPECT_DOUBLE_EQ(1.0 / 3, weights[2]);
+    EXPECT_EQ(vector<double>(4, 1), QuerySampler::getZipfWeights(4, 0));
+
+    // Weights 6:3:2
+    const vector<size_t> counts = countSamples(QuerySampler(weights), 44000);
+    EXPECT_NEAR(24000, counts[0], 800);
+    EXPECT_NEAR(12000, counts[1], 800);
+    EXPECT_NEAR(8000, counts[2], 800);
+
+    EXPECT_THROW(QuerySampler::getZipfWeights(3, -1), QuerySamplerError);
+}
+
+TEST(QuerySamplerTest, badWeights) {
+    EXPECT_THROW(QuerySampler(vector<double>()), QuerySamplerError);
+    EXPECT_THROW(QuerySampler(vector<double>(3, 0)), QuerySamplerError);
+    EXPECT_THROW(QuerySampler(vector<double>(1, -1)), QuerySamplerError);
+    EXPECT_THROW(QuerySampler(vector<double>(
+                                  1, numeric_limits<double>::infinity())),
+                 QuerySamplerError);
+    EXPECT_THROW(QuerySampler(vector<double>(
+                                  1, numeric_limits<double>::quiet_NaN())),
+                 QuerySamplerError);
+}
+}
@@ -0,0 +1,169 @@
+// Copyright (C) 2012  JINMEI Tatuya
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+// OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#include <response_validator.h>
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace Queryperf;
+
+namespace {
+// A query for "www.example.com/A/IN" with QID 0x1234 and RD.
+const uint8_t QUERY[] = {
+    0x12, 0x34, 0x01, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x03, 'w', 'w', 'w', 0x07, 'e', 'x', 'a', 'm', 'p', 'l', 'e',
+    0x03, 'c', 'o', 'm', 0x00, 0x00, 0x01, 0x00, 0x01
+};
+
+class ResponseValidatorTest : public ::testing::Test {
+protected:
+    ResponseValidatorTest() :
+        response(QUERY, QUERY + sizeof(QUERY))
+    {
+        response[2] |= 0x80;    // QR
+    }
+
+    bool validate() {
+        MessageHeader header;
+        EXPECT_TRUE(header.parse(&response[0], response.size()));
+        return (validateResponse(header, &response[0], response.size(),
+                                 QUERY, sizeof(QUERY)));
+    }
+
+    vector<uint8_t> response;
+};
+
+TEST_F(ResponseValidatorTest, parseHeader) {
+    MessageHeader header;
+    EXPECT_FALSE(header.parse(QUERY, MessageHeader::LENGTH - 1));
+    ASSERT_TRUE(header.parse(QUERY, MessageHeader::LENGTH));
+    EXPECT_EQ(0x1234, header.qid);
+    EXPECT_EQ(0x0100, header.flags);
+    EXPECT_EQ(1, header.qdcount);
+    EXPECT_EQ(0, header.ancount);
+    EXPECT_EQ(0, header.nscount);
+    EXPECT_EQ(0, header.arcount);
+    EXPECT_TRUE(header.hasFlag(MessageHeader::FLAG_RD));
+    EXPECT_FALSE(header.hasFlag(MessageHeader::FLAG_QR));
+
+    // RCODE is the lowest 4 bits, AA/TC are in the first byte.
+    response[2] |= 0x06;
+    response[3] |= 0x05;
+    ASSERT_TRUE(header.parse(&response[0], response.size()));
+    EXPECT_EQ(5, header.getRcode());
+    EXPECT_TRUE(header.hasFlag(MessageHeader::FLAG_QR));
+    EXPECT_TRUE(header.hasFlag(MessageHeader::FLAG_AA));
+    EXPECT_TRUE(header.hasFlag(MessageHeader::FLAG_TC));
+    EXPECT_FALSE(header.hasFlag(MessageHeader::FLAG_RA));
+}
+
+TEST_F(ResponseValidatorTest, validate) {
+    EXPECT_TRUE(validate());
+
+    // Answers following the question don't matter.
+    response[7] = 1;
+    response.insert(response.end(), 16, 0);
+    EXPECT_TRUE(validate());
+
+    // The owner name is compared case-insensitively.
+    response[17] = 'E';
+    response[26] = 'O';
+    EXPECT_TRUE(validate());
+}
+
+TEST_F(ResponseValidatorTest, invalid) {
+    // Not a response.
+    response[2] &= ~0x80;
+    EXPECT_FALSE(validate());
+    response[2] |= 0x80;
+
+    // Different name, type, or class.
+    response[13] = 'x';
+    EXPECT_FALSE(validate());
+    response[13] = 'w';
+    response[30] = 28;
+    EXPECT_FALSE(validate());
+    response[30] = 1;
+    response[32] = 3;
+    EXPECT_FALSE(validate());
+    response[32] = 1;
+    EXPECT_TRUE(validate());
+
+    // Truncated question.
+    response.pop_back();
+    EXPECT_FALSE(validate());
+}
+
+TEST_F(ResponseValidatorTest, noQuestion) {
+    response.resize(MessageHeader::LENGTH);
+    response[5] = 0;
+    EXPECT_FALSE(validate());   // NOERROR
+
+    response[3] |= 0x02;        // SERVFAIL
+    EXPECT_TRUE(validate());
+}
+
+TEST(ResponseStatsTest, record) {
+    ResponseStats stats;
+    EXPECT_EQ(0, stats.responses);
+    EXPECT_EQ(0, stats.rcodes[0]);
+
+    MessageHeader header;
+    header.parse(QUERY, sizeof(QUERY));
+    header.flags |= MessageHeader::FLAG_QR | MessageHeader::FLAG_AA;
+    stats.record(header);       // NOERROR without answers
+    header.ancount = 1;
+    stats.record(header);
+    header.flags |= 3;          // NXDOMAIN
+    stats.record(header);
+
+    EXPECT_EQ(3, stats.responses);
+    EXPECT_EQ(2, stats.rcodes[0]);
+    EXPECT_EQ(1, stats.rcodes[3]);
+    EXPECT_EQ(3, stats.flags[ResponseStats::AA]);
+    EXPECT_EQ(3, stats.flags[ResponseStats::RD]);
+    EXPECT_EQ(0, stats.flags[ResponseStats::TC]);
+    EXPECT_EQ(1, stats.nodata);
+
+    ResponseStats total;
+    total.invalid = 2;
+    stats.late = 1;
+    stats.duplicates = 2;
+    stats.unknown = 3;
+    total.merge(stats);
+    total.merge(stats);
+    EXPECT_EQ(6, total.responses);
+    EXPECT_EQ(2, total.rcodes[3]);
+    EXPECT_EQ(6, total.flags[ResponseStats::AA]);
+    EXPECT_EQ(2, total.nodata);
+    EXPECT_EQ(2, total.invalid);
+    EXPECT_EQ(2, total.late);
+    EXPECT_EQ(4, total.duplicates);
+    EXPECT_EQ(6, total.unknown);
+}
+
+TEST(ResponseStatsTest, text) {
+    EXPECT_EQ(string("NOERROR"), ResponseStats::getRcodeText(0));
+    EXPECT_EQ(string("NXDOMAIN"), ResponseStats::getRcodeText(3));
+    EXPECT_EQ(string("REFUSED"), ResponseStats::getRcodeText(5));
+    EXPECT_EQ(string("RCODE15"), ResponseStats::getRcodeText(15));
+    EXPECT_EQ(string("RCODE?"), ResponseStats::getRcodeText(16));
+    EXPECT_EQ(string("AA"), ResponseStats::getFlagText(ResponseStats::AA));
+    EXPECT_EQ(string("CD"), ResponseStats::getFlagText(ResponseStats::CD));
+}
+}
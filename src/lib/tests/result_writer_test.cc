@@ -0,0 +1,130 @@
+// Copyright (C) 2012  JINMEI Tatuya
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+// OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#include <result_writer.h>
+
+#include <gtest/gtest.h>
+
+#include <limits>
+#include <sstream>
+#include <string>
+
+using namespace std;
+using namespace Queryperf;
+
+namespace {
+class ResultSetTest : public ::testing::Test {
+protected:
+    ResultSetTest() {
+        ResultRecord& config = results_.getRecord("config");
+        config.addString("server", "::1");
+        config.addInteger("port", 53);
+        ResultRecord& thread0 = results_.addRecord("threads");
+        ResultRecord& thread1 = results_.addRecord("threads");
+        // The first record is still valid after adding another one.
+        thread0.addInteger("queries_sent", 10);
+        thread0.addNumber("qps", 1.5);
+        thread1.addInteger("queries_sent", 20);
+        thread1.addNumber("qps", 2);
+        // The same single record is returned.
+        results_.getRecord("config").addBoolean("edns", true);
+    }
+
+    ResultSet results_;
+};
+
+TEST_F(ResultSetTest, json) {
+    ostringstream oss;
+    results_.writeJSON(oss);
+    EXPECT_EQ("{\n"
+              "  \"config\": {\n"
+              "    \"server\": \"::1\",\n"
+              "    \"port\": 53,\n"
+              "    \"edns\": true\n"
+              "  },\n"
+              "  \"threads\": [\n"
+              "    {\n"
+              "      \"queries_sent\": 10,\n"
+              "      \"qps\": 1.500000\n"
+              "    },\n"
+              "    {\n"
+              "      \"queries_sent\": 20,\n"
+              "      \"qps\": 2.000000\n"
+              "    }\n"
+              "  ]\n"
+              "}\n", oss.str());
+}
+
+TEST_F(ResultSetTest, csv) {
+    ostringstream oss;
+    results_.writeCSV(oss);
+    EXPECT_EQ("section,index,name,value\n"
+              "config,,server,::1\n"
+              "config,,port,53\n"
+              "config,,edns,true\n"
+              "threads,0,queries_sent,10\n"
+              "threads,0,qps,1.500000\n"
+              "threads,1,queries_sent,20\n"
+              "threads,1,qps,2.000000\n", oss.str());
+}
+
+TEST(ResultSetQuoteTest, quote) {
+    ResultSet results;
+    results.getRecord("config").addString("queries", "a \"A\",\n\\b\x01");
+    ostringstream json;
+    results.writeJSON(json);
+    EXPECT_NE(string::npos,
+              json.str().find("\"queries\": \"a \\\"A\\\",\\n\\\\b\\u0001\""));
+    ostringstream csv;
+    results.writeCSV(csv);
+    EXPECT_EQ("section,index,name,value\n"
+              "config,,queries,\"a \"\"A\"\",\n\\b\x01\"\n", csv.str());
+}
+
+TEST(ResultSetNumberTest, nonFinite) {
+    // nan and inf are not valid in JSON; they are written as null.
+    ResultSet results;
+    ResultRecord& record = results.getRecord("total");
+    record.addNumber("nan", std::numeric_limits<double>::quiet_NaN());
+    record.addNumber("inf", std::numeric_limits<double>::infinity());
+    record.addNumber("qps", 0);
+    ostringstream json;
+    results.writeJSON(json);
+    EXPECT_EQ("{\n"
+              "  \"total\": {\n"
+              "    \"nan\": null,\n"
+              "    \"inf\": null,\n"
+              "    \"qps\": 0.000000\n"
+              "  }\n"
+              "}\n", json.str());
+    ostringstream csv;
+    results.writeCSV(csv);
+    EXPECT_EQ("section,index,name,value\n"
+              "total,,nan,\n"
+              "total,,inf,\n"
+              "total,,qps,0.000000\n", csv.str());
+}
+
+TEST_F(ResultSetTest, sectionMismatch) {
+    EXPECT_THROW(results_.addRecord("config"), ResultSetError);
+    EXPECT_THROW(results_.getRecord("threads"), ResultSetError);
+
+    // A record without values.
+    ResultSet results;
+    results.addRecord("steps");
+    ostringstream oss;
+    results.writeJSON(oss);
+    EXPECT_EQ("{\n  \"steps\": [\n    {\n    }\n  ]\n}\n", oss.str());
+}
+}
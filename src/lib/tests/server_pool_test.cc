@@ -0,0 +1,117 @@
+// Copyright (C) 2012  JINMEI Tatuya
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+// OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#include <server_pool.h>
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace Queryperf;
+
+namespace {
+TEST(ServerPoolTest, parseServerList) {
+    vector<ServerSpec> servers = parseServerList("192.0.2.1", 53);
+    ASSERT_EQ(1, servers.size());
+    EXPECT_EQ("192.0.2.1", servers[0].address);
+    EXPECT_EQ(53, servers[0].port);
+    EXPECT_EQ(1, servers[0].weight);
+
+    servers = parseServerList("::1#5300,192.0.2.2/3,192.0.2.3#853/1000",
+                              53);
+    ASSERT_EQ(3, servers.size());
+    EXPECT_EQ("::1", servers[0].address);
+    EXPECT_EQ(5300, servers[0].port);
+    EXPECT_EQ(1, servers[0].weight);
+    EXPECT_EQ("192.0.2.2", servers[1].address);
+    EXPECT_EQ(53, servers[1].port);
+    EXPECT_EQ(3, servers[1].weight);
+    EXPECT_EQ(853, servers[2].port);
+    EXPECT_EQ(1000, servers[2].weight);
+}
+
+TEST(ServerPoolTest, parseBadServerList) {
+    EXPECT_THROW(parseServerList("", 53), ServerPoolError);
+    EXPECT_THROW(parseServerList("192.0.2.1,", 53), ServerPoolError);
+    EXPECT_THROW(parseServerList("#53", 53), ServerPoolError);
+    EXPECT_THROW(parseServerList("192.0.2.1#", 53), ServerPoolError);
+    EXPECT_THROW(parseServerList("192.0.2.1#0", 53), ServerPoolError);
+    EXPECT_THROW(parseServerList("192.0.2.1#65536", 53), ServerPoolError);
+    EXPECT_THROW(parseServerList("192.0.2.1#-1", 53), ServerPoolError);
+    EXPECT_THROW(parseServerList("192.0.2.1/0", 53), ServerPoolError);
+    EXPECT_THROW(parseServerList("192.0.2.1/1001", 53), ServerPoolError);
+    EXPECT_THROW(parseServerList("192.0.2.1/1/2", 53), ServerPoolError);
+    EXPECT_THROW(parseServerList("192.0.2.1/99999999999", 53),
+                 ServerPoolError);
+}
+
+TEST(ServerPoolTest, schedule) {
+    // A single server by default.
+    ServerSchedule schedule;
+    EXPECT_EQ(1, schedule.getLength());
+    EXPECT_EQ(0, schedule.next());
+    EXPECT_EQ(0, schedule.next());
+
+    // The cycle is spread evenly, and repeated.
+    vector<unsigned int> weights;
+    weights.push_back(5);
+    weights.push_back(1);
+    weights.push_back(1);
+    schedule.reset(weights);
+    ASSERT_EQ(7, schedule.getLength());
+    const size_t expected[] = { 0, 0, 1, 0, 2, 0, 0 };
+    for (size_t i = 0; i < 14; ++i) {
+        EXPECT_EQ(expected[i % 7], schedule.next());
+    }
+
+    // Weights are reduced by their greatest common divisor.
+    weights.clear();
+    weights.push_back(200);
+    weights.push_back(300);
+    schedule.reset(weights);
+    ASSERT_EQ(5, schedule.getLength());
+    vector<size_t> counts(2, 0);
+    for (size_t i = 0; i < 5; ++i) {
+        ++counts[schedule.next()];
+    }
+    EXPECT_EQ(2, counts[0]);
+    EXPECT_EQ(3, counts[1]);
+
+    weights.push_back(0);
+    EXPECT_THROW(schedule.reset(weights), ServerPoolError);
+    EXPECT_THROW(schedule.reset(vector<unsigned int>()), ServerPoolError);
+}
+
+TEST(ServerPoolTest, result) {
+    ServerResult result(ServerSpec("192.0.2.1", 53, 2));
+    EXPECT_EQ(0, result.getLossRate());
+    result.queries_sent = 10;
+    result.queries_completed = 7;
+    result.queries_timedout = 3;
+    result.rtt_histogram.record(100);
+    EXPECT_DOUBLE_EQ(30, result.getLossRate());
+
+    ServerResult total(result.server);
+    total.merge(result);
+    total.merge(result);
+    EXPECT_EQ("192.0.2.1", total.server.address);
+    EXPECT_EQ(2, total.server.weight);
+    EXPECT_EQ(20, total.queries_sent);
+    EXPECT_EQ(14, total.queries_completed);
+    EXPECT_EQ(6, total.queries_timedout);
+    EXPECT_EQ(2, total.rtt_histogram.getCount());
+}
+}
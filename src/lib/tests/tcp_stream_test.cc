@@ -0,0 +1,121 @@
+// Copyright (C) 2012  JINMEI Tatuya
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+// OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#include <tcp_stream.h>
+
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+using namespace std;
+using namespace Queryperf;
+
+namespace {
+const char TEST_DATA[] = "queryperf test";
+
+// Feed data to the stream as if they were received, in pieces of the
+// given size.
+void
+receive(TCPStream& stream, const vector<uint8_t>& data, size_t piece_len) {
+    for (size_t i = 0; i < data.size(); i += piece_len) {
+        size_t len;
+        uint8_t* space = stream.getReceiveSpace(len);
+        const size_t n = min(piece_len, data.size() - i);
+        ASSERT_LE(n, len);
+        memcpy(space, &data[i], n);
+        EXPECT_TRUE(stream.commitReceived(n));
+    }
+}
+
+TEST(TCPStreamTest, framing) {
+    TCPStream stream;
+    EXPECT_FALSE(stream.hasPending());
+    EXPECT_FALSE(stream.hasQueued());
+
+    stream.queueMessage(TEST_DATA, sizeof(TEST_DATA));
+    stream.queueMessage(TEST_DATA, sizeof(TEST_DATA));
+    EXPECT_TRUE(stream.hasPending());
+    EXPECT_TRUE(stream.hasQueued());
+
+    // Both messages are taken at once, each with the length field.
+    vector<uint8_t> buf;
+    EXPECT_TRUE(stream.takeQueued(buf));
+    EXPECT_EQ((sizeof(TEST_DATA) + 2) * 2, buf.size());
+    EXPECT_EQ(0, buf[0]);
+    EXPECT_EQ(sizeof(TEST_DATA), buf[1]);
+    EXPECT_FALSE(stream.hasPending());
+    EXPECT_FALSE(stream.hasQueued());
+
+    // Echo them back, byte by byte: messages are available only once
+    // they are complete.
+    const void* data;
+    size_t datalen;
+    receive(stream, vector<uint8_t>(buf.begin(),
+                                    buf.begin() + sizeof(TEST_DATA) + 1), 1);
+    EXPECT_FALSE(stream.getNextMessage(data, datalen));
+    receive(stream, vector<uint8_t>(buf.begin() + sizeof(TEST_DATA) + 1,
+                                    buf.end()), 1);
+    for (size_t i = 0; i < 2; ++i) {
+        ASSERT_TRUE(stream.getNextMessage(data, datalen));
+        EXPECT_EQ(sizeof(TEST_DATA), datalen);
+        EXPECT_STREQ(TEST_DATA, static_cast<const char*>(data));
+    }
+    EXPECT_FALSE(stream.getNextMessage(data, datalen));
+    EXPECT_FALSE(stream.isFinished()); // never without the limit
+}
+
+TEST(TCPStreamTest, maxMessages) {
+    StreamSocketParams params;
+    params.max_messages = 2;
+    TCPStream stream(params);
+    for (size_t i = 0; i < 3; ++i) {
+        stream.queueMessage(TEST_DATA, sizeof(TEST_DATA));
+    }
+
+    // Only two of them can be sent on the first connection.
+    vector<uint8_t> buf;
+    EXPECT_TRUE(stream.takeQueued(buf));
+    EXPECT_EQ((sizeof(TEST_DATA) + 2) * 2, buf.size());
+    EXPECT_TRUE(stream.hasPending());
+    EXPECT_FALSE(stream.hasQueued());
+
+    // The connection is finished once both responses are received.
+    const void* data;
+    size_t datalen;
+    receive(stream, buf, buf.size());
+    EXPECT_TRUE(stream.getNextMessage(data, datalen));
+    EXPECT_FALSE(stream.isFinished());
+    EXPECT_TRUE(stream.getNextMessage(data, datalen));
+    EXPECT_TRUE(stream.isFinished());
+
+    // The remaining one is sent on the next connection.
+    stream.closeConnection();
+    EXPECT_FALSE(stream.isFinished());
+    stream.startConnection();
+    EXPECT_TRUE(stream.hasQueued());
+    EXPECT_TRUE(stream.takeQueued(buf));
+    EXPECT_EQ(sizeof(TEST_DATA) + 2, buf.size());
+    EXPECT_FALSE(stream.hasPending());
+
+    // clear() discards everything.
+    stream.queueMessage(TEST_DATA, sizeof(TEST_DATA));
+    stream.clear();
+    EXPECT_FALSE(stream.hasPending());
+    EXPECT_FALSE(stream.hasQueued());
+}
+}
@@ -66,17 +66,17 @@ TestMessageTimer::cancel() {
 
 MessageSocket*
 TestMessageManager::createMessageSocket(int proto,
-                                        const std::string&, uint16_t,
-                                        void*, size_t,
+                                        const std::string& address,
+                                        uint16_t port, void*, size_t,
                                         MessageSocket::Callback callback)
 {
     TestMessageSocket* ret;
     if (proto == IPPROTO_UDP) {
-        if (socket_ != NULL) {
-            throw std::runtime_error("duplicate socket creation");
+        ret = new TestMessageSocket(callback);
+        if (socket_ == NULL) {
+            socket_ = ret;
         }
-        socket_ = new TestMessageSocket(callback);
-        ret = socket_;
+        udp_sockets_.push_back(ret);
     } else {
         assert(proto == IPPROTO_TCP);
         std::auto_ptr<TestMessageSocket> p(new TestMessageSocket(callback));
@@ -84,10 +84,26 @@ TestMessageManager::createMessageSocket(int proto,
         ret = p.release();   // give the ownership
     }
 
+    ret->address_ = address;
+    ret->port_ = port;
     ret->manager_ = this;
     return (ret);
 }
 
+MessageSocket*
+TestMessageManager::createPersistentMessageSocket(
+    const std::string& address, uint16_t port,
+    const StreamSocketParams& params, MessageSocket::Callback callback)
+{
+    stream_params_ = params;
+    std::auto_ptr<TestMessageSocket> p(new TestMessageSocket(callback));
+    p->address_ = address;
+    p->port_ = port;
+    p->manager_ = this;
+    persistent_sockets_.push_back(p.get());
+    return (p.release());   // give the ownership
+}
+
 MessageTimer*
 TestMessageManager::createMessageTimer(MessageTimer::Callback callback) {
     std::auto_ptr<TestMessageTimer> p(new TestMessageTimer(callback));
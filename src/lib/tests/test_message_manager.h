@@ -41,13 +41,18 @@ class TestMessageSocket : public MessageSocket {
 public:
     friend class TestMessageManager;
     TestMessageSocket(Callback callback) : callback_(callback),
+                                           incoming_cpu_(-1), port_(0),
                                            manager_(NULL)
     {}
     ~TestMessageSocket();
     virtual void send(const void* data, size_t datalen);
+    virtual int getIncomingCPU() const { return (incoming_cpu_); }
 
     std::vector<boost::shared_ptr<bundy::dns::Message> > queries_;
     Callback callback_;
+    int incoming_cpu_;
+    std::string address_;       // of the server
+    uint16_t port_;
 
 private:
     TestMessageManager* manager_;
@@ -79,6 +84,11 @@ public:
         void* recvbuf, size_t recvbuf_len,
         MessageSocket::Callback callback);
 
+    virtual MessageSocket* createPersistentMessageSocket(
+        const std::string& address, uint16_t port,
+        const StreamSocketParams& params,
+        MessageSocket::Callback callback);
+
     virtual MessageTimer* createMessageTimer(MessageTimer::Callback callback);
 
     virtual void run();
@@ -87,13 +97,20 @@ public:
 
     void setRunHandler(Handler handler) { run_handler_ = handler; }
 
-    // Use a fixed internal UDP socket object.
+    // Use a fixed internal UDP socket object.  If multiple UDP sockets are
+    // created, this is the first one, and all of them are stored in
+    // udp_sockets_.
     TestMessageSocket* socket_;
+    std::vector<TestMessageSocket*> udp_sockets_;
 
     // TCP sockets
     std::vector<TestMessageSocket*> tcp_sockets_;
     size_t n_deleted_sockets_;
 
+    // Persistent TCP sockets, in the order of creation.
+    std::vector<TestMessageSocket*> persistent_sockets_;
+    StreamSocketParams stream_params_; // given on the last creation
+
     // Timers created in this manager.
     std::vector<TestMessageTimer*> timers_;
 
@@ -0,0 +1,186 @@
+// Copyright (C) 2012  JINMEI Tatuya
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+// OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#include <timer_wheel.h>
+#include <test_message_manager.h>
+
+#include <gtest/gtest.h>
+
+#include <boost/bind.hpp>
+#include <boost/scoped_ptr.hpp>
+
+#include <stdint.h>
+
+using namespace std;
+using namespace Queryperf;
+using namespace Queryperf::unittest;
+using boost::scoped_ptr;
+using boost::posix_time::milliseconds;
+
+namespace {
+const unsigned int TEST_TICK = 10000; // 10ms
+const size_t TEST_SLOTS = 8;
+
+class TimerWheelTest : public ::testing::Test {
+protected:
+    TimerWheelTest() :
+        now_(0),
+        wheel_(msg_mgr_, TEST_TICK, TEST_SLOTS,
+               boost::bind(&TimerWheelTest::getNow, this)),
+        tick_timer_(*msg_mgr_.timers_.at(0)),
+        called1_(0), called2_(0),
+        timer1_(wheel_.createTimer(boost::bind(&TimerWheelTest::callback,
+                                               this, &called1_))),
+        timer2_(wheel_.createTimer(boost::bind(&TimerWheelTest::callback,
+                                               this, &called2_)))
+    {}
+
+    uint64_t getNow() const { return (now_); }
+
+    // Advance the clock and call the callback of the underlying timer.
+    void tick(uint64_t now) {
+        now_ = now;
+        tick_timer_.callback_();
+    }
+
+    void callback(int* counter) {
+        ++*counter;
+    }
+
+    uint64_t now_;
+    TestMessageManager msg_mgr_;
+    TimerWheel wheel_;
+    TestMessageTimer& tick_timer_;
+    int called1_, called2_;
+    scoped_ptr<MessageTimer> timer1_, timer2_;
+};
+
+TEST_F(TimerWheelTest, badParams) {
+    EXPECT_THROW(TimerWheel(msg_mgr_, 0), MessageTimerError);
+    EXPECT_THROW(TimerWheel(msg_mgr_, TEST_TICK, 0), MessageTimerError);
+    EXPECT_THROW(TimerWheel(msg_mgr_, TEST_TICK, 6), MessageTimerError);
+}
+
+TEST_F(TimerWheelTest, expire) {
+    // The underlying timer starts only when a timer of the wheel starts.
+    EXPECT_EQ(1, msg_mgr_.timers_.size());
+    EXPECT_EQ(0, tick_timer_.n_started_);
+    timer1_->start(milliseconds(25));
+    EXPECT_EQ(1, tick_timer_.n_started_);
+    EXPECT_EQ(1, wheel_.getTimerCount());
+
+    // It doesn't expire early.
+    tick(10000);
+    tick(20000);
+    EXPECT_EQ(0, called1_);
+    EXPECT_EQ(3, tick_timer_.n_started_);
+
+    // Once the timer expires, the underlying timer stops.
+    tick(30000);
+    EXPECT_EQ(1, called1_);
+    EXPECT_EQ(0, wheel_.getTimerCount());
+    EXPECT_EQ(3, tick_timer_.n_started_);
+
+    // A zero duration expires at the next tick.
+    timer1_->start(milliseconds(0));
+    tick(40000);
+    EXPECT_EQ(2, called1_);
+}
+
+TEST_F(TimerWheelTest, cancel) {
+    timer1_->start(milliseconds(15));
+    timer2_->start(milliseconds(15));
+    timer1_->cancel();
+    timer1_->cancel();          // no-op
+    EXPECT_EQ(1, wheel_.getTimerCount());
+    tick(20000);
+    EXPECT_EQ(0, called1_);
+    EXPECT_EQ(1, called2_);
+
+    // Restarting a running timer resets the expiration time.
+    timer1_->start(milliseconds(10));
+    timer1_->start(milliseconds(30));
+    EXPECT_EQ(1, wheel_.getTimerCount());
+    tick(30000);
+    tick(40000);
+    EXPECT_EQ(0, called1_);
+    tick(50000);
+    EXPECT_EQ(1, called1_);
+
+    // Deleting a running timer effectively cancels it.
+    timer1_->start(milliseconds(10));
+    timer1_.reset();
+    EXPECT_EQ(0, wheel_.getTimerCount());
+}
+
+TEST_F(TimerWheelTest, rounds) {
+    // A timer longer than one round of the wheel (80ms) expires in a later
+    // round.
+    timer1_->start(milliseconds(200));
+    timer2_->start(milliseconds(40));
+    for (uint64_t now = 10000; now < 200000; now += 10000) {
+        tick(now);
+        EXPECT_EQ(now >= 40000 ? 1 : 0, called2_);
+    }
+    EXPECT_EQ(0, called1_);
+    tick(200000);
+    EXPECT_EQ(1, called1_);
+}
+
+TEST_F(TimerWheelTest, lateTick) {
+    // If the underlying timer is late, all passed ticks are handled.
+    timer1_->start(milliseconds(10));
+    timer2_->start(milliseconds(50));
+    tick(65000);
+    EXPECT_EQ(1, called1_);
+    EXPECT_EQ(1, called2_);
+}
+
+// Restart a timer from its own callback.
+void
+restartCallback(int* counter, scoped_ptr<MessageTimer>* timer) {
+    ++*counter;
+    (*timer)->start(milliseconds(0));
+}
+
+// Delete another timer from the callback.
+void
+deleteCallback(int* counter, scoped_ptr<MessageTimer>* timer) {
+    ++*counter;
+    timer->reset();
+}
+
+TEST_F(TimerWheelTest, updateInCallback) {
+    // A timer restarted from the callback won't expire in the same tick.
+    timer1_.reset(wheel_.createTimer(boost::bind(restartCallback, &called1_,
+                                                 &timer1_)));
+    timer1_->start(milliseconds(10));
+    tick(10000);
+    EXPECT_EQ(1, called1_);
+    EXPECT_EQ(1, wheel_.getTimerCount());
+    tick(20000);
+    EXPECT_EQ(2, called1_);
+
+    // A timer can delete another one expiring at the same tick.
+    timer1_.reset(wheel_.createTimer(boost::bind(deleteCallback, &called1_,
+                                                 &timer2_)));
+    timer1_->start(milliseconds(10));
+    timer2_->start(milliseconds(10));
+    tick(40000);
+    EXPECT_EQ(3, called1_);
+    EXPECT_EQ(0, called2_);
+    EXPECT_FALSE(timer2_);
+    EXPECT_EQ(0, wheel_.getTimerCount());
+}
+}
@@ -0,0 +1,156 @@
+// Copyright (C) 2012  JINMEI Tatuya
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+// OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#include <tls_test_util.h>
+#include <socket_test_util.h>
+
+#include <openssl/evp.h>
+#include <openssl/x509.h>
+
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+namespace Queryperf {
+namespace unittest {
+
+namespace {
+// Create a server context with a self-signed certificate of a newly
+// generated key; the client doesn't verify it anyway.
+SSL_CTX*
+createServerContext() {
+    SSL_CTX* ctx = SSL_CTX_new(TLS_server_method());
+    EVP_PKEY_CTX* pctx = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, NULL);
+    EVP_PKEY* pkey = NULL;
+    X509* cert = X509_new();
+    if (ctx == NULL || pctx == NULL || cert == NULL ||
+        EVP_PKEY_keygen_init(pctx) <= 0 ||
+        EVP_PKEY_CTX_set_ec_paramgen_curve_nid(pctx,
+                                               NID_X9_62_prime256v1) <= 0 ||
+        EVP_PKEY_keygen(pctx, &pkey) <= 0) {
+        throw std::runtime_error("failed to create a test TLS key");
+    }
+    EVP_PKEY_CTX_free(pctx);
+
+    ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+    X509_gmtime_adj(X509_getm_notBefore(cert), 0);
+    X509_gmtime_adj(X509_getm_notAfter(cert), 3600);
+    X509_set_pubkey(cert, pkey);
+    X509_NAME* name = X509_get_subject_name(cert);
+    X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC,
+                               reinterpret_cast<const unsigned char*>(
+                                   "localhost"), -1, -1, 0);
+    X509_set_issuer_name(cert, name);
+    if (X509_sign(cert, pkey, EVP_sha256()) == 0 ||
+        SSL_CTX_use_certificate(ctx, cert) != 1 ||
+        SSL_CTX_use_PrivateKey(ctx, pkey) != 1) {
+        throw std::runtime_error("failed to create a test TLS certificate");
+    }
+    X509_free(cert);
+    EVP_PKEY_free(pkey);
+    return (ctx);
+}
+
+// Read exactly len bytes.  Return false on failure or end of stream.
+bool
+readFull(SSL* ssl, uint8_t* buf, size_t len) {
+    while (len > 0) {
+        const int ret = SSL_read(ssl, buf, len);
+        if (ret <= 0) {
+            return (false);
+        }
+        buf += ret;
+        len -= ret;
+    }
+    return (true);
+}
+}
+
+TLSTestServer::TLSTestServer(int listen_fd, size_t n_connections,
+                             size_t n_messages) :
+    ctx_(createServerContext()), listen_fd_(listen_fd),
+    n_connections_(n_connections), n_messages_per_connection_(n_messages),
+    n_handshakes_(0), n_resumed_(0),
+    n_messages_(0), running_(false)
+{
+    // Don't wait forever for a connection if the client is broken.
+    setRecvDelay(listen_fd_);
+    const int error = pthread_create(&thread_, NULL, run, this);
+    if (error != 0) {
+        SSL_CTX_free(ctx_);
+        throw std::runtime_error(std::string("pthread_create failed: ") +
+                                 strerror(error));
+    }
+    running_ = true;
+}
+
+TLSTestServer::~TLSTestServer() {
+    wait();
+    SSL_CTX_free(ctx_);
+}
+
+void
+TLSTestServer::wait() {
+    if (running_) {
+        pthread_join(thread_, NULL);
+        running_ = false;
+    }
+}
+
+void*
+TLSTestServer::run(void* arg) {
+    static_cast<TLSTestServer*>(arg)->serve();
+    return (NULL);
+}
+
+void
+TLSTestServer::serve() {
+    for (size_t i = 0; i < n_connections_; ++i) {
+        ScopedSocket s(accept(listen_fd_, NULL, NULL));
+        if (s.fd < 0) {
+            return;
+        }
+        setRecvDelay(s.fd);
+        SSL* ssl = SSL_new(ctx_);
+        SSL_set_fd(ssl, s.fd);
+        if (SSL_accept(ssl) == 1) {
+            ++n_handshakes_;
+            if (SSL_session_reused(ssl)) {
+                ++n_resumed_;
+            }
+            std::vector<uint8_t> buf;
+            for (size_t j = 0; j < n_messages_per_connection_; ++j) {
+                uint8_t lenbuf[2];
+                if (!readFull(ssl, lenbuf, sizeof(lenbuf))) {
+                    break;
+                }
+                buf.assign(lenbuf, lenbuf + sizeof(lenbuf));
+                buf.resize(sizeof(lenbuf) + lenbuf[0] * 256 + lenbuf[1]);
+                if (!readFull(ssl, &buf[sizeof(lenbuf)],
+                              buf.size() - sizeof(lenbuf)) ||
+                    SSL_write(ssl, &buf[0], buf.size()) <= 0) {
+                    break;
+                }
+                ++n_messages_;
+            }
+        }
+        SSL_free(ssl);
+    }
+}
+
+} // end of unittest
+} // end of QueryPerf
@@ -0,0 +1,70 @@
+// Copyright (C) 2012  JINMEI Tatuya
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+// OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#ifndef __QUERYPERF_TLS_TEST_UTIL_H
+#define __QUERYPERF_TLS_TEST_UTIL_H 1
+
+// A stub DNS over TLS server for the tests of the message managers.  It's
+// available only when OpenSSL is.
+
+#include <boost/noncopyable.hpp>
+
+#include <sys/types.h>
+#include <pthread.h>
+
+#include <openssl/ssl.h>
+
+namespace Queryperf {
+namespace unittest {
+
+// The server runs in a separate thread, since the handshake needs the
+// event loop of the client to run in the meantime.  It accepts the given
+// number of connections on the listening socket one by one, and on each
+// connection it echoes back the given number of messages and closes it.
+// The statistics can be examined once wait() returns.
+class TLSTestServer : boost::noncopyable {
+public:
+    TLSTestServer(int listen_fd, size_t n_connections, size_t n_messages);
+    ~TLSTestServer();
+
+    // Wait for the server to handle all connections.
+    void wait();
+
+    size_t getHandshakeCount() const { return (n_handshakes_); }
+    size_t getResumedCount() const { return (n_resumed_); }
+    size_t getMessageCount() const { return (n_messages_); }
+
+private:
+    static void* run(void* arg);
+    void serve();
+
+    SSL_CTX* ctx_;
+    const int listen_fd_;
+    const size_t n_connections_;
+    const size_t n_messages_per_connection_;
+    size_t n_handshakes_;
+    size_t n_resumed_;
+    size_t n_messages_;
+    pthread_t thread_;
+    bool running_;
+};
+
+} // end of unittest
+} // end of QueryPerf
+
+#endif // __QUERYPERF_TLS_TEST_UTIL_H
+
+// Local Variables:
+// mode: c++
+// End:
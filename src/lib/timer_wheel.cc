@@ -0,0 +1,216 @@
+// Copyright (C) 2012  JINMEI Tatuya
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+// OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#include <timer_wheel.h>
+#include <monotonic_time.h>
+
+#include <boost/bind.hpp>
+#include <boost/scoped_array.hpp>
+#include <boost/scoped_ptr.hpp>
+
+using namespace boost::posix_time;
+using boost::scoped_array;
+using boost::scoped_ptr;
+
+namespace Queryperf {
+
+namespace {
+// A node of the circular, doubly-linked lists of timers.  The head of each
+// list is a node itself, so nodes can be removed without knowing the list.
+struct TimerNode : private boost::noncopyable {
+    TimerNode() : prev(this), next(this) {}
+
+    bool isLinked() const { return (next != this); }
+
+    void insertBefore(TimerNode& pos) {
+        prev = pos.prev;
+        next = &pos;
+        pos.prev->next = this;
+        pos.prev = this;
+    }
+
+    void unlink() {
+        prev->next = next;
+        next->prev = prev;
+        prev = next = this;
+    }
+
+    TimerNode* prev;
+    TimerNode* next;
+};
+
+class WheelTimer;
+}
+
+struct TimerWheel::TimerWheelImpl {
+    TimerWheelImpl(MessageManager& manager, unsigned int tick_usec,
+                   size_t n_slots, Clock clock);
+
+    void add(WheelTimer& timer, uint64_t duration_usec);
+    void remove(WheelTimer& timer);
+
+    // Callback for the underlying timer; expire the timers of all ticks
+    // that have passed.
+    void tickCallback();
+
+    // Expire timers of the given slot whose rounds have been consumed.
+    void expireSlot(TimerNode& slot);
+
+    const uint64_t tick_usec_;
+    const size_t n_slots_;
+    const Clock clock_;
+    scoped_array<TimerNode> slots_;
+    size_t current_slot_;       // slot of the last processed tick
+    uint64_t current_time_;     // time of the last processed tick
+    size_t n_timers_;           // number of running timers
+    bool ticking_;              // whether the underlying timer is running
+    scoped_ptr<MessageTimer> tick_timer_;
+};
+
+namespace {
+class WheelTimer : public MessageTimer, public TimerNode {
+public:
+    WheelTimer(TimerWheel::TimerWheelImpl& wheel, Callback callback) :
+        rounds_(0), wheel_(wheel), callback_(callback)
+    {}
+    virtual ~WheelTimer() { cancel(); }
+
+    virtual void start(const time_duration& duration) {
+        wheel_.remove(*this);
+        const long usec = duration.total_microseconds();
+        wheel_.add(*this, usec > 0 ? usec : 0);
+    }
+
+    virtual void cancel() { wheel_.remove(*this); }
+
+    void expire() { callback_(); }
+
+    size_t rounds_;             // remaining rounds of the wheel
+
+private:
+    TimerWheel::TimerWheelImpl& wheel_;
+    const Callback callback_;
+};
+}
+
+TimerWheel::TimerWheelImpl::TimerWheelImpl(MessageManager& manager,
+                                           unsigned int tick_usec,
+                                           size_t n_slots, Clock clock) :
+    tick_usec_(tick_usec), n_slots_(n_slots),
+    clock_(clock ? clock : Clock(getMonotonicTime)),
+    slots_(new TimerNode[n_slots]), current_slot_(0), current_time_(0),
+    n_timers_(0), ticking_(false),
+    tick_timer_(manager.createMessageTimer(
+                    boost::bind(&TimerWheelImpl::tickCallback, this)))
+{}
+
+void
+TimerWheel::TimerWheelImpl::add(WheelTimer& timer, uint64_t duration_usec) {
+    const uint64_t now = clock_();
+    if (!ticking_) {
+        // The wheel has been idle; restart it from now.
+        current_time_ = now;
+        tick_timer_->start(microseconds(tick_usec_));
+        ticking_ = true;
+    }
+
+    // The number of ticks from the last processed one until the expiration
+    // (rounded up so the timer never expires too early).
+    uint64_t ticks = (now + duration_usec - current_time_ + tick_usec_ - 1) /
+        tick_usec_;
+    if (ticks == 0) {
+        ticks = 1;
+    }
+    timer.rounds_ = (ticks - 1) / n_slots_;
+    timer.insertBefore(slots_[(current_slot_ + ticks) & (n_slots_ - 1)]);
+    ++n_timers_;
+}
+
+void
+TimerWheel::TimerWheelImpl::remove(WheelTimer& timer) {
+    if (timer.isLinked()) {
+        timer.unlink();
+        --n_timers_;
+    }
+}
+
+void
+TimerWheel::TimerWheelImpl::expireSlot(TimerNode& slot) {
+    // Move the expiring timers to a separate list first, so that timers
+    // restarted from the callbacks won't be expired in this tick.  The
+    // callbacks can also cancel or delete other timers in the list.
+    TimerNode expired;
+    TimerNode* node = slot.next;
+    while (node != &slot) {
+        WheelTimer* timer = static_cast<WheelTimer*>(node);
+        node = node->next;
+        if (timer->rounds_ > 0) {
+            --timer->rounds_;
+        } else {
+            timer->unlink();
+            timer->insertBefore(expired);
+        }
+    }
+    while (expired.isLinked()) {
+        WheelTimer* timer = static_cast<WheelTimer*>(expired.next);
+        timer->unlink();
+        --n_timers_;
+        timer->expire();
+    }
+}
+
+void
+TimerWheel::TimerWheelImpl::tickCallback() {
+    const uint64_t now = clock_();
+    // The underlying timer may be late; catch up with all passed ticks.
+    while (n_timers_ > 0 && current_time_ + tick_usec_ <= now) {
+        current_time_ += tick_usec_;
+        current_slot_ = (current_slot_ + 1) & (n_slots_ - 1);
+        expireSlot(slots_[current_slot_]);
+    }
+    if (n_timers_ > 0) {
+        tick_timer_->start(microseconds(current_time_ + tick_usec_ - now));
+    } else {
+        ticking_ = false;
+    }
+}
+
+TimerWheel::TimerWheel(MessageManager& manager, unsigned int tick_usec,
+                       size_t n_slots, Clock clock)
+{
+    if (tick_usec == 0) {
+        throw MessageTimerError("timer wheel tick must be positive");
+    }
+    if (n_slots == 0 || (n_slots & (n_slots - 1)) != 0) {
+        throw MessageTimerError("number of timer wheel slots must be "
+                                "a power of 2");
+    }
+    impl_ = new TimerWheelImpl(manager, tick_usec, n_slots, clock);
+}
+
+TimerWheel::~TimerWheel() {
+    delete impl_;
+}
+
+MessageTimer*
+TimerWheel::createTimer(MessageTimer::Callback callback) {
+    return (new WheelTimer(*impl_, callback));
+}
+
+size_t
+TimerWheel::getTimerCount() const {
+    return (impl_->n_timers_);
+}
+
+} // end of QueryPerf
@@ -0,0 +1,99 @@
+// Copyright (C) 2012  JINMEI Tatuya
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+// OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#ifndef __QUERYPERF_TIMER_WHEEL_H
+#define __QUERYPERF_TIMER_WHEEL_H 1
+
+#include <message_manager.h>
+
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+
+#include <cstddef>
+
+#include <stdint.h>
+
+namespace Queryperf {
+
+/// \brief A hashed timing wheel of coarse-grained timers.
+///
+/// This class manages a large number of \c MessageTimer objects that are
+/// frequently restarted or canceled, such as per-query timeouts, with
+/// a single underlying timer of a \c MessageManager.  Starting or
+/// canceling a timer is an O(1) list operation (with no memory
+/// allocation or system call), and on each tick of the underlying timer
+/// only the timers in the slot for that tick are checked.  In return the
+/// resolution of the timers is the tick interval: a timer expires no
+/// earlier than specified, but may expire later by up to one tick (plus
+/// the delay of the underlying timer).
+///
+/// The underlying timer runs only while at least one timer of the wheel
+/// is running, so it doesn't prevent \c MessageManager::run() from
+/// returning.
+///
+/// Timers created by \c createTimer() refer to the wheel, and must be
+/// destroyed before the wheel.  Likewise, the wheel must be destroyed
+/// before the manager.
+class TimerWheel : private boost::noncopyable {
+public:
+    /// \brief Default interval of the ticks in microseconds.
+    static const unsigned int DEFAULT_TICK_USEC = 10000;
+
+    /// \brief Default number of the slots; one round of the wheel is
+    /// about 10 seconds with the default tick, covering the default
+    /// query timeout.
+    static const size_t DEFAULT_SLOTS = 1024;
+
+    /// \brief Functor type to get the current time in microseconds.
+    typedef boost::function<uint64_t()> Clock;
+
+    /// \brief Constructor.
+    ///
+    /// \throw MessageTimerError Invalid parameter.
+    ///
+    /// \param manager The message manager that provides the underlying
+    /// timer.
+    /// \param tick_usec The tick interval in microseconds; must be positive.
+    /// \param n_slots The number of slots; must be a power of 2.  Timers
+    /// that expire after more ticks than this are kept for multiple rounds
+    /// of the wheel, so it only affects the efficiency.
+    /// \param clock Used to get the current time (mainly for tests).  If
+    /// empty, the monotonic clock is used.
+    TimerWheel(MessageManager& manager,
+               unsigned int tick_usec = DEFAULT_TICK_USEC,
+               size_t n_slots = DEFAULT_SLOTS, Clock clock = Clock());
+
+    ~TimerWheel();
+
+    /// \brief Create a timer managed in the wheel.
+    ///
+    /// The caller is responsible for deleting the returned object.
+    MessageTimer* createTimer(MessageTimer::Callback callback);
+
+    /// \brief Return the number of running timers.
+    size_t getTimerCount() const;
+
+    struct TimerWheelImpl;
+
+private:
+    TimerWheelImpl* impl_;
+};
+
+} // end of QueryPerf
+
+#endif // __QUERYPERF_TIMER_WHEEL_H
+
+// Local Variables:
+// mode: c++
+// End:
@@ -0,0 +1,311 @@
+// Copyright (C) 2012  JINMEI Tatuya
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+// OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#include <config.h>
+
+#include <tls_context.h>
+
+#ifdef HAVE_OPENSSL
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#endif
+
+namespace Queryperf {
+
+#ifdef HAVE_OPENSSL
+
+namespace {
+// Return the given text followed by the description of the pending OpenSSL
+// errors (which are cleared).
+std::string
+getSSLErrorText(const std::string& what) {
+    std::string text = what;
+    unsigned long code;
+    while ((code = ERR_get_error()) != 0) {
+        char buf[256];
+        ERR_error_string_n(code, buf, sizeof(buf));
+        text += std::string(": ") + buf;
+    }
+    return (text);
+}
+
+int newSessionCallback(SSL* ssl, SSL_SESSION* session);
+}
+
+struct TLSContext::TLSContextImpl {
+    TLSContextImpl(bool resume_sessions) :
+        ctx_(NULL), resume_sessions_(resume_sessions), handshakes_(0),
+        resumed_(0)
+    {}
+
+    SSL_CTX* ctx_;
+    const bool resume_sessions_;
+    size_t handshakes_;
+    size_t resumed_;
+};
+
+TLSContext::TLSContext(bool resume_sessions) :
+    impl_(new TLSContextImpl(resume_sessions))
+{
+    SSL_CTX* ctx = SSL_CTX_new(TLS_client_method());
+    if (ctx == NULL) {
+        delete impl_;
+        throw TLSError(getSSLErrorText("failed to create TLS context"));
+    }
+    SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+    SSL_CTX_set_verify(ctx, SSL_VERIFY_NONE, NULL);
+    if (resume_sessions) {
+        // Each TLSSession keeps its own session (see newSessionCallback()),
+        // so the internal cache isn't used.  With TLS 1.3 tickets are sent
+        // after the handshake, which the callback handles, too.
+        SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT |
+                                       SSL_SESS_CACHE_NO_INTERNAL_STORE);
+        SSL_CTX_sess_set_new_cb(ctx, newSessionCallback);
+    }
+    impl_->ctx_ = ctx;
+}
+
+TLSContext::~TLSContext() {
+    SSL_CTX_free(impl_->ctx_);
+    delete impl_;
+}
+
+bool
+TLSContext::getSessionResumption() const {
+    return (impl_->resume_sessions_);
+}
+
+size_t
+TLSContext::getHandshakeCount() const {
+    return (impl_->handshakes_);
+}
+
+size_t
+TLSContext::getResumedCount() const {
+    return (impl_->resumed_);
+}
+
+struct TLSSession::TLSSessionImpl {
+    TLSSessionImpl(TLSContext::TLSContextImpl& ctx) :
+        ctx_(ctx), ssl_(NULL), wbio_(NULL), session_(NULL),
+        established_(false)
+    {}
+
+    // Advance the handshake.  It returns false on failure.
+    bool handshake();
+
+    void setError(const std::string& what) {
+        error_ = getSSLErrorText(what);
+    }
+
+    TLSContext::TLSContextImpl& ctx_;
+    SSL* ssl_;                  // for the current connection, if any
+    BIO* wbio_;                 // records to be sent (owned by ssl_)
+    SSL_SESSION* session_;      // to be resumed on the next connection
+    bool established_;
+    std::string error_;
+};
+
+namespace {
+int
+newSessionCallback(SSL* ssl, SSL_SESSION* session) {
+    TLSSession::TLSSessionImpl* impl =
+        static_cast<TLSSession::TLSSessionImpl*>(SSL_get_app_data(ssl));
+    if (impl->session_ != NULL) {
+        SSL_SESSION_free(impl->session_);
+    }
+    impl->session_ = session;
+    return (1);                 // we've taken the ownership
+}
+}
+
+bool
+TLSSession::TLSSessionImpl::handshake() {
+    const int ret = SSL_do_handshake(ssl_);
+    if (ret == 1) {
+        established_ = true;
+        ++ctx_.handshakes_;
+        if (SSL_session_reused(ssl_)) {
+            ++ctx_.resumed_;
+        }
+        return (true);
+    }
+    const int error = SSL_get_error(ssl_, ret);
+    if (error == SSL_ERROR_WANT_READ || error == SSL_ERROR_WANT_WRITE) {
+        return (true);
+    }
+    setError("TLS handshake failed");
+    return (false);
+}
+
+TLSSession::TLSSession(TLSContext& ctx) :
+    impl_(new TLSSessionImpl(*ctx.impl_))
+{}
+
+TLSSession::~TLSSession() {
+    reset();
+    if (impl_->session_ != NULL) {
+        SSL_SESSION_free(impl_->session_);
+    }
+    delete impl_;
+}
+
+void
+TLSSession::start() {
+    reset();
+    SSL* ssl = SSL_new(impl_->ctx_.ctx_);
+    if (ssl == NULL) {
+        throw TLSError(getSSLErrorText("failed to create TLS session"));
+    }
+    // Memory BIOs; reading from the empty one should mean "retry later",
+    // rather than the end of stream.
+    BIO* rbio = BIO_new(BIO_s_mem());
+    BIO* wbio = BIO_new(BIO_s_mem());
+    if (rbio == NULL || wbio == NULL) {
+        BIO_free(rbio);
+        BIO_free(wbio);
+        SSL_free(ssl);
+        throw TLSError(getSSLErrorText("failed to create TLS session"));
+    }
+    BIO_set_mem_eof_return(rbio, -1);
+    SSL_set_bio(ssl, rbio, wbio);
+    SSL_set_connect_state(ssl);
+    SSL_set_app_data(ssl, impl_);
+    if (impl_->ctx_.resume_sessions_ && impl_->session_ != NULL) {
+        SSL_set_session(ssl, impl_->session_);
+    }
+    impl_->ssl_ = ssl;
+    impl_->wbio_ = wbio;
+    if (!impl_->handshake()) {
+        throw TLSError(impl_->error_);
+    }
+}
+
+void
+TLSSession::reset() {
+    if (impl_->ssl_ != NULL) {
+        // Pretend the session was shut down cleanly; otherwise OpenSSL
+        // marks it non resumable.  The connection is going away anyway.
+        SSL_set_shutdown(impl_->ssl_,
+                         SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN);
+        SSL_free(impl_->ssl_);
+        impl_->ssl_ = NULL;
+        impl_->wbio_ = NULL;
+    }
+    impl_->established_ = false;
+}
+
+bool
+TLSSession::isEstablished() const {
+    return (impl_->established_);
+}
+
+bool
+TLSSession::hasOutput() const {
+    return (impl_->wbio_ != NULL && BIO_ctrl_pending(impl_->wbio_) > 0);
+}
+
+void
+TLSSession::takeOutput(std::vector<uint8_t>& buf) {
+    if (!hasOutput()) {
+        return;
+    }
+    const size_t offset = buf.size();
+    const size_t len = BIO_ctrl_pending(impl_->wbio_);
+    buf.resize(offset + len);
+    BIO_read(impl_->wbio_, &buf[offset], len);
+}
+
+bool
+TLSSession::write(const void* data, size_t datalen) {
+    if (datalen == 0) {
+        return (true);
+    }
+    // Memory BIOs never block, so everything is written at once.
+    if (SSL_write(impl_->ssl_, data, datalen) <= 0) {
+        impl_->setError("TLS write failed");
+        return (false);
+    }
+    return (true);
+}
+
+bool
+TLSSession::receive(const void* data, size_t datalen) {
+    BIO_write(SSL_get_rbio(impl_->ssl_), data, datalen);
+    if (!impl_->established_) {
+        return (impl_->handshake());
+    }
+    return (true);
+}
+
+ssize_t
+TLSSession::read(void* buf, size_t buflen) {
+    if (!impl_->established_) {
+        return (0);
+    }
+    const int ret = SSL_read(impl_->ssl_, buf, buflen);
+    if (ret > 0) {
+        return (ret);
+    }
+    const int error = SSL_get_error(impl_->ssl_, ret);
+    if (error == SSL_ERROR_WANT_READ || error == SSL_ERROR_ZERO_RETURN) {
+        // No more data for now, or the server has closed the session, in
+        // which case it will close the connection, too.
+        return (0);
+    }
+    impl_->setError("TLS read failed");
+    return (-1);
+}
+
+const std::string&
+TLSSession::getError() const {
+    return (impl_->error_);
+}
+
+#else  // !HAVE_OPENSSL
+
+// Without OpenSSL no context can be created, so the others are never used.
+
+struct TLSContext::TLSContextImpl {};
+struct TLSSession::TLSSessionImpl {};
+
+TLSContext::TLSContext(bool) : impl_(NULL) {
+    throw TLSError("TLS is not supported (built without OpenSSL)");
+}
+
+TLSContext::~TLSContext() {}
+bool TLSContext::getSessionResumption() const { return (false); }
+size_t TLSContext::getHandshakeCount() const { return (0); }
+size_t TLSContext::getResumedCount() const { return (0); }
+
+TLSSession::TLSSession(TLSContext&) : impl_(NULL) {}
+TLSSession::~TLSSession() {}
+void TLSSession::start() {}
+void TLSSession::reset() {}
+bool TLSSession::isEstablished() const { return (false); }
+bool TLSSession::hasOutput() const { return (false); }
+void TLSSession::takeOutput(std::vector<uint8_t>&) {}
+bool TLSSession::write(const void*, size_t) { return (false); }
+bool TLSSession::receive(const void*, size_t) { return (false); }
+ssize_t TLSSession::read(void*, size_t) { return (-1); }
+
+const std::string&
+TLSSession::getError() const {
+    static const std::string error("TLS is not supported");
+    return (error);
+}
+
+#endif  // HAVE_OPENSSL
+
+} // end of QueryPerf
@@ -0,0 +1,148 @@
+// Copyright (C) 2012  JINMEI Tatuya
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+// OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#ifndef __QUERYPERF_TLS_CONTEXT_H
+#define __QUERYPERF_TLS_CONTEXT_H 1
+
+#include <boost/noncopyable.hpp>
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+#include <stdint.h>
+
+namespace Queryperf {
+
+/// \brief Exception class thrown on TLS related errors.
+class TLSError : public std::runtime_error {
+public:
+    explicit TLSError(const std::string& what_arg) :
+        std::runtime_error(what_arg)
+    {}
+};
+
+/// \brief Client side TLS configuration, shared by TLS connections.
+///
+/// This is a thin wrapper of the OpenSSL context.  As a benchmarking tool
+/// we don't authenticate the server, i.e., its certificate is not
+/// verified.  It also keeps the statistics of handshakes done by the
+/// sessions of this context.
+///
+/// The context and its sessions are expected to be used in a single
+/// thread.
+class TLSContext : private boost::noncopyable {
+public:
+    /// \brief Constructor.
+    ///
+    /// \throw TLSError TLS is not supported (without OpenSSL) or the
+    /// OpenSSL context cannot be created.
+    ///
+    /// \param resume_sessions Whether to resume the previous session
+    /// (using a session ticket or ID given by the server) when a session
+    /// reconnects to the server.
+    explicit TLSContext(bool resume_sessions = true);
+    ~TLSContext();
+
+    /// \brief Return whether session resumption is enabled.
+    bool getSessionResumption() const;
+
+    /// \brief Return the number of completed handshakes.
+    size_t getHandshakeCount() const;
+
+    /// \brief Return the number of completed handshakes that resumed a
+    /// previous session (counted in \c getHandshakeCount(), too).
+    size_t getResumedCount() const;
+
+    struct TLSContextImpl;
+
+private:
+    friend class TLSSession;
+    TLSContextImpl* impl_;
+};
+
+/// \brief A TLS client over one connection at a time.
+///
+/// This class doesn't do any I/O by itself: TLS records to be sent are
+/// stored in an internal buffer, taken by \c takeOutput(), and records
+/// received from the server are given by \c receive().  So it can be used
+/// with any I/O model of the message managers.
+///
+/// The same session object can be used for subsequent connections to the
+/// same server (see \c start()), in which case it can resume the previous
+/// session if the context enables it.
+class TLSSession : private boost::noncopyable {
+public:
+    explicit TLSSession(TLSContext& ctx);
+    ~TLSSession();
+
+    /// \brief Start the handshake on a new connection.
+    ///
+    /// The first handshake message will be available from
+    /// \c takeOutput().
+    void start();
+
+    /// \brief Forget the current connection, if any.
+    ///
+    /// Any buffered data are discarded, but the session (if any) is kept
+    /// for resumption.
+    void reset();
+
+    /// \brief Return whether the handshake has completed.
+    bool isEstablished() const;
+
+    /// \brief Return whether there are TLS records to be sent.
+    bool hasOutput() const;
+
+    /// \brief Append all TLS records to be sent to \c buf.
+    void takeOutput(std::vector<uint8_t>& buf);
+
+    /// \brief Encrypt application data.
+    ///
+    /// It must be called after the handshake completes.
+    ///
+    /// \return false on failure (see \c getError()); true otherwise.
+    bool write(const void* data, size_t datalen);
+
+    /// \brief Process data received from the server.
+    ///
+    /// It advances the handshake if it's not completed, possibly making
+    /// more records to be sent.
+    ///
+    /// \return false on failure (see \c getError()); true otherwise.
+    bool receive(const void* data, size_t datalen);
+
+    /// \brief Read decrypted application data.
+    ///
+    /// \return The number of bytes stored in \c buf (0 if no data are
+    /// available), or -1 on failure (see \c getError()).
+    ssize_t read(void* buf, size_t buflen);
+
+    /// \brief Return the description of the last failure.
+    const std::string& getError() const;
+
+    struct TLSSessionImpl;
+
+private:
+    TLSSessionImpl* impl_;
+};
+
+} // end of QueryPerf
+
+#endif // __QUERYPERF_TLS_CONTEXT_H
+
+// Local Variables:
+// mode: c++
+// End:
@@ -0,0 +1,1407 @@
+// Copyright (C) 2012  JINMEI Tatuya
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+// OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#include <config.h>
+
+#include <message_manager.h>
+#include <uring_message_manager.h>
+#include <timer_wheel.h>
+#include <monotonic_time.h>
+#include <sockaddr_util.h>
+#include <tcp_stream.h>
+#include <cpu_affinity.h>
+
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/scoped_ptr.hpp>
+
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <linux/io_uring.h>
+#include <unistd.h>
+#include <stdint.h>
+
+using boost::lexical_cast;
+
+namespace Queryperf {
+
+namespace {
+class UringMessageTimer;
+
+// Size of the completion ring.  A multishot receive can generate many
+// completions for a single submission, so we make it much larger than the
+// submission ring.
+const unsigned int CQ_ENTRIES = 4096;
+
+// Operation codes of the submitted operations.  They are encoded in the
+// lowest bits of the user data of each submission, together with the
+// address of the socket that submitted it (which is sufficiently aligned).
+enum Operation {
+    OP_SEND = 1,
+    OP_RECEIVE,
+    OP_CONNECT,
+    OP_CANCEL
+};
+const uint64_t OP_MASK = 7;
+
+std::string
+getErrorText(const std::string& prefix, int error = errno) {
+    return (prefix + strerror(error));
+}
+
+// Thin wrappers for the io_uring system calls, for which the standard
+// library doesn't provide an interface.
+int
+ioUringSetup(unsigned int entries, struct io_uring_params* params) {
+    return (syscall(__NR_io_uring_setup, entries, params));
+}
+
+int
+ioUringEnter(int fd, unsigned int to_submit, unsigned int min_complete,
+             unsigned int flags, const void* arg, size_t argsz)
+{
+    return (syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+                    arg, argsz));
+}
+
+int
+ioUringRegister(int fd, unsigned int opcode, const void* arg,
+                unsigned int nr_args)
+{
+    return (syscall(__NR_io_uring_register, fd, opcode, arg, nr_args));
+}
+
+// Return a pointer to a field of the mapped ring at the given offset.
+template <typename T>
+T*
+getRingField(void* ring, uint32_t offset) {
+    return (reinterpret_cast<T*>(static_cast<uint8_t*>(ring) + offset));
+}
+} // end of unnamed namespace
+
+struct UringMessageManager::UringMessageManagerImpl {
+    // Timers are kept sorted by the expiration time (in the monotonic time
+    // in microseconds).
+    typedef std::multimap<uint64_t, UringMessageTimer*> TimerMap;
+    typedef UringMessageSocket::UringMessageSocketImpl SocketImpl;
+
+    explicit UringMessageManagerImpl(DiagnosticLog& log);
+    ~UringMessageManagerImpl();
+
+    // Return a cleared submission queue entry for a new operation.  If the
+    // submission ring is full, queued entries are submitted first.
+    struct io_uring_sqe* getSqe();
+
+    // Submit all queued operations, and wait for at least min_complete
+    // completions up to timeout_usec microseconds (no limit if negative).
+    void enter(unsigned int min_complete, int64_t timeout_usec);
+
+    bool hasCompletions() const {
+        return (*cq_head_ != __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE));
+    }
+    void handleCompletions();
+
+    void registerRing(unsigned int opcode, const void* arg);
+    uint16_t allocateBufferGroup();
+    void releaseBufferGroup(uint16_t bgid) { free_bgids_.push_back(bgid); }
+
+    // Return the timeout for the wait based on the next timer, in
+    // microseconds.
+    int64_t getTimeout() const;
+    void fireTimers();
+
+    void run();
+
+    void cleanup();
+
+    DiagnosticLog& log_;        // the log of the manager
+    int ring_fd_;
+    void* sq_ring_;
+    size_t sq_ring_size_;
+    void* cq_ring_;
+    size_t cq_ring_size_;
+    struct io_uring_sqe* sqes_;
+    size_t sqes_size_;
+
+    // Pointers to the shared ring fields.  The local sq_tail_ is published
+    // to the kernel on submission.
+    unsigned int* sq_head_;
+    unsigned int* sq_ktail_;
+    unsigned int sq_mask_;
+    unsigned int sq_entries_;
+    unsigned int sq_tail_;
+    unsigned int* cq_head_;
+    unsigned int* cq_tail_;
+    unsigned int cq_mask_;
+    struct io_uring_cqe* cqes_;
+
+    bool stopped_;
+    size_t n_waiting_;   // # of sockets waiting for responses
+    TimerMap timers_;
+
+    // Sockets released by the owner while having operations in flight.
+    // They are destroyed once all the operations complete.
+    std::set<SocketImpl*> zombies_;
+
+    uint16_t next_bgid_;
+    std::vector<uint16_t> free_bgids_;
+    boost::scoped_ptr<TimerWheel> timer_wheel_; // for coarse timers
+};
+
+typedef UringMessageManager::UringMessageManagerImpl ManagerImpl;
+
+// The real implementation of the sockets.  Since the kernel may keep
+// referring to the socket's data until the submitted operations complete,
+// the implementation object can outlive the UringMessageSocket; when it's
+// released by the owner (via cancel()), outstanding operations are
+// cancelled, and the object destructs itself on the last completion.
+class UringMessageSocket::UringMessageSocketImpl {
+protected:
+    UringMessageSocketImpl(ManagerImpl& mgr) :
+        mgr_(mgr), pending_(0), cancelled_(false), in_handler_(false)
+    {}
+public:
+    virtual ~UringMessageSocketImpl() {}
+    virtual void send(const void* data, size_t datalen) = 0;
+    virtual int native() const = 0;
+
+    // Called when the owner releases the socket.
+    void cancel();
+
+    // Called from the manager for each completion of operations submitted
+    // by this socket.
+    void handleCompletion(Operation op, int res, uint32_t flags);
+
+protected:
+    // Handle the completion of a submitted operation (other than
+    // cancellation) while the socket is still owned.
+    virtual void handleOperation(Operation op, int res, uint32_t flags) = 0;
+
+    // Stop waiting for responses and cancel outstanding operations.
+    virtual void cancelOperations() = 0;
+
+    // Get a submission queue entry for a new operation of the socket.
+    struct io_uring_sqe* prepareOperation(Operation op, uint8_t opcode,
+                                          int fd);
+
+    // Submit cancellation of a previously submitted operation.
+    void cancelOperation(Operation op);
+
+    ManagerImpl& mgr_;
+    size_t pending_;            // # of outstanding operations
+    bool cancelled_;
+
+private:
+    bool in_handler_;
+};
+
+void
+UringMessageSocket::UringMessageSocketImpl::cancel() {
+    cancelled_ = true;
+    cancelOperations();
+    if (pending_ == 0 && !in_handler_) {
+        delete this;
+    } else {
+        // If we are in the handler, it will delete us once it's done.
+        mgr_.zombies_.insert(this);
+    }
+}
+
+void
+UringMessageSocket::UringMessageSocketImpl::handleCompletion(
+    Operation op, int res, uint32_t flags)
+{
+    // A multishot operation continues unless the completion says otherwise.
+    if ((flags & IORING_CQE_F_MORE) == 0) {
+        --pending_;
+    }
+    if (op != OP_CANCEL && !cancelled_) {
+        in_handler_ = true;
+        handleOperation(op, res, flags);
+        in_handler_ = false;
+    }
+    if (cancelled_ && pending_ == 0) {
+        mgr_.zombies_.erase(this);
+        delete this;
+    }
+}
+
+struct io_uring_sqe*
+UringMessageSocket::UringMessageSocketImpl::prepareOperation(Operation op,
+                                                             uint8_t opcode,
+                                                             int fd)
+{
+    struct io_uring_sqe* sqe = mgr_.getSqe();
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->user_data = reinterpret_cast<uintptr_t>(this) | op;
+    ++pending_;
+    return (sqe);
+}
+
+void
+UringMessageSocket::UringMessageSocketImpl::cancelOperation(Operation op) {
+    struct io_uring_sqe* sqe = prepareOperation(OP_CANCEL,
+                                                IORING_OP_ASYNC_CANCEL, -1);
+    sqe->addr = reinterpret_cast<uintptr_t>(this) | op;
+}
+
+namespace {
+class UDPMessageSocket : public UringMessageSocket::UringMessageSocketImpl {
+public:
+    UDPMessageSocket(ManagerImpl& mgr, const std::string& address,
+                     uint16_t port, size_t recvbuf_len,
+                     MessageSocket::Callback callback);
+    virtual ~UDPMessageSocket();
+    virtual void send(const void* data, size_t datalen);
+    virtual int native() const { return (fd_); }
+
+protected:
+    virtual void handleOperation(Operation op, int res, uint32_t flags);
+    virtual void cancelOperations();
+
+private:
+    void startReceive();
+
+    // Give a receive buffer (back) to the kernel.  Note that we don't use
+    // buf_ring_->bufs: it's not at the beginning of the ring in C++ (where
+    // an empty struct has a non-zero size).  The ring is simply an array
+    // of io_uring_buf whose first entry overlaps the tail.
+    void provideBuffer(uint16_t bid) {
+        struct io_uring_buf* buf =
+            reinterpret_cast<struct io_uring_buf*>(buf_ring_) +
+            (buf_tail_ & (UringMessageManager::RECV_BUFFERS - 1));
+        buf->addr = reinterpret_cast<uintptr_t>(&recv_arena_[bid *
+                                                             recvbuf_len_]);
+        buf->len = recvbuf_len_;
+        buf->bid = bid;
+        __atomic_store_n(&buf_ring_->tail, ++buf_tail_, __ATOMIC_RELEASE);
+    }
+
+    int fd_;
+    MessageSocket::Callback callback_;
+    bool receiving_;            // whether we've sent anything
+    bool receive_armed_;        // whether the receive operation is running
+    uint16_t bgid_;
+    struct io_uring_buf_ring* buf_ring_;
+    uint16_t buf_tail_;
+    const size_t recvbuf_len_;
+    std::vector<uint8_t> recv_arena_;
+};
+
+// The buffer ring must be page aligned, so we allocate it by mmap.
+const size_t BUF_RING_SIZE =
+    UringMessageManager::RECV_BUFFERS * sizeof(struct io_uring_buf);
+
+UDPMessageSocket::UDPMessageSocket(ManagerImpl& mgr,
+                                   const std::string& address, uint16_t port,
+                                   size_t recvbuf_len,
+                                   MessageSocket::Callback callback) :
+    UringMessageSocketImpl(mgr), fd_(-1), callback_(callback),
+    receiving_(false), receive_armed_(false), bgid_(0), buf_ring_(NULL),
+    buf_tail_(0), recvbuf_len_(recvbuf_len)
+{
+    if (recvbuf_len == 0) {
+        throw MessageSocketError("Insufficient UDP receive buffer");
+    }
+
+    struct sockaddr_storage ss;
+    const socklen_t salen = convertAddress(address, port, ss);
+    // Note that the socket is blocking; the kernel takes care of waiting
+    // for the readiness of the socket for the submitted operations.
+    fd_ = socket(ss.ss_family, SOCK_DGRAM | SOCK_CLOEXEC, IPPROTO_UDP);
+    if (fd_ < 0) {
+        throw MessageSocketError(getErrorText("Failed to create a socket: "));
+    }
+    void* ring = MAP_FAILED;
+    try {
+        // make sure the receive buffer is large enough (32KB, derived from
+        // the original queryperf)
+        const int bufsize = 32768;
+        if (connect(fd_, convertSockAddr(&ss), salen) < 0 ||
+            setsockopt(fd_, SOL_SOCKET, SO_RCVBUF, &bufsize,
+                       sizeof(bufsize)) < 0) {
+            throw MessageSocketError(
+                getErrorText("Failed to create a socket: "));
+        }
+
+        ring = mmap(NULL, BUF_RING_SIZE, PROT_READ | PROT_WRITE,
+                    MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+        if (ring == MAP_FAILED) {
+            throw MessageSocketError(
+                getErrorText("Failed to allocate buffer ring: "));
+        }
+        bgid_ = mgr_.allocateBufferGroup();
+        struct io_uring_buf_reg reg;
+        memset(&reg, 0, sizeof(reg));
+        reg.ring_addr = reinterpret_cast<uintptr_t>(ring);
+        reg.ring_entries = UringMessageManager::RECV_BUFFERS;
+        reg.bgid = bgid_;
+        try {
+            mgr_.registerRing(IORING_REGISTER_PBUF_RING, &reg);
+        } catch (...) {
+            mgr_.releaseBufferGroup(bgid_);
+            throw;
+        }
+    } catch (...) {
+        if (ring != MAP_FAILED) {
+            munmap(ring, BUF_RING_SIZE);
+        }
+        close(fd_);
+        throw;
+    }
+    buf_ring_ = static_cast<struct io_uring_buf_ring*>(ring);
+
+    // Each message can be as large as the buffer the caller gave us.
+    recv_arena_.resize(recvbuf_len * UringMessageManager::RECV_BUFFERS);
+    for (size_t i = 0; i < UringMessageManager::RECV_BUFFERS; ++i) {
+        provideBuffer(i);
+    }
+}
+
+UDPMessageSocket::~UDPMessageSocket() {
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.bgid = bgid_;
+    // This shouldn't fail, and we can't do anything about it anyway.
+    try {
+        mgr_.registerRing(IORING_UNREGISTER_PBUF_RING, &reg);
+    } catch (const MessageSocketError&) {}
+    mgr_.releaseBufferGroup(bgid_);
+    munmap(buf_ring_, BUF_RING_SIZE);
+    close(fd_);
+}
+
+void
+UDPMessageSocket::send(const void* data, size_t datalen) {
+    if (!receiving_) {
+        ++mgr_.n_waiting_;
+        receiving_ = true;
+        startReceive();
+    }
+    struct io_uring_sqe* sqe = prepareOperation(OP_SEND, IORING_OP_SEND,
+                                                fd_);
+    sqe->addr = reinterpret_cast<uintptr_t>(data);
+    sqe->len = datalen;
+}
+
+void
+UDPMessageSocket::startReceive() {
+    // The kernel picks up a buffer from our buffer group for each message,
+    // and the operation keeps running for subsequent messages.
+    struct io_uring_sqe* sqe = prepareOperation(OP_RECEIVE, IORING_OP_RECV,
+                                                fd_);
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = bgid_;
+    receive_armed_ = true;
+}
+
+void
+UDPMessageSocket::handleOperation(Operation op, int res, uint32_t flags) {
+    if (op == OP_SEND) {
+        if (res < 0) {
+            throw MessageSocketError(
+                getErrorText("Unexpected failure on socket send: ", -res));
+        }
+        return;
+    }
+
+    assert(op == OP_RECEIVE);
+    const bool more = (flags & IORING_CQE_F_MORE) != 0;
+    if (!more) {
+        receive_armed_ = false;
+    }
+    if (res >= 0 && (flags & IORING_CQE_F_BUFFER) != 0) {
+        const uint16_t bid = flags >> IORING_CQE_BUFFER_SHIFT;
+        callback_(MessageSocket::Event(&recv_arena_[bid * recvbuf_len_],
+                                       res));
+        if (cancelled_) {
+            return;             // released in the callback
+        }
+        provideBuffer(bid);
+    } else if (res < 0 && res != -ENOBUFS) {
+        // ENOBUFS means we've run out of the buffers; the remaining
+        // messages are kept in the socket until we restart the operation.
+        throw MessageSocketError(
+            getErrorText("unexpected failure on socket read: ", -res));
+    }
+    if (!more) {
+        startReceive();
+    }
+}
+
+void
+UDPMessageSocket::cancelOperations() {
+    if (receiving_) {
+        --mgr_.n_waiting_;
+        receiving_ = false;
+    }
+    if (receive_armed_) {
+        cancelOperation(OP_RECEIVE);
+        receive_armed_ = false;
+    }
+}
+
+class TCPMessageSocket : public UringMessageSocket::UringMessageSocketImpl {
+public:
+    TCPMessageSocket(ManagerImpl& mgr, const std::string& address,
+                     uint16_t port, void* recvbuf,
+                     MessageSocket::Callback callback);
+    virtual ~TCPMessageSocket();
+    virtual void send(const void* data, size_t datalen);
+    virtual int native() const { return (fd_); }
+
+protected:
+    virtual void handleOperation(Operation op, int res, uint32_t flags);
+    virtual void cancelOperations();
+
+private:
+    enum State {
+        INIT,                   // not sent yet
+        CONNECTING,
+        WRITING,
+        READING_LENGTH,
+        READING_DATA,
+        DONE                    // callback has been called
+    };
+
+    void handleWrite(int res);
+    void handleRead(int res);
+    void startWrite();
+    void startRead();
+
+    // Do callback.  The caller must not touch this object after that, since
+    // the callback may release it.
+    void complete(const void* data, size_t datalen);
+
+    int fd_;
+    struct sockaddr_storage dest_;
+    socklen_t dest_len_;
+    MessageSocket::Callback callback_;
+    State state_;
+    Operation current_op_; // valid while an operation is outstanding
+    uint8_t* recvbuf_;    // for the first message (must be of > 64KB)
+    size_t recvdata_len_; // actual message length of the first message
+    bool first_received_;
+    uint8_t* aux_recvbuf_; // placeholder for subsequent messages
+    uint8_t msglen_placeholder_[2];
+    size_t msglen_;        // length of the message being read
+    size_t read_len_;      // length of data read for the current item
+    struct iovec sendbufs_[2];
+    struct msghdr sendmsg_;
+};
+
+TCPMessageSocket::TCPMessageSocket(ManagerImpl& mgr,
+                                   const std::string& address, uint16_t port,
+                                   void* recvbuf,
+                                   MessageSocket::Callback callback) :
+    UringMessageSocketImpl(mgr), fd_(-1),
+    dest_len_(convertAddress(address, port, dest_)), callback_(callback),
+    state_(INIT), current_op_(OP_CONNECT),
+    recvbuf_(static_cast<uint8_t*>(recvbuf)), recvdata_len_(0),
+    first_received_(false), aux_recvbuf_(NULL), msglen_(0), read_len_(0)
+{
+    // Note: we don't even open the socket yet.
+}
+
+TCPMessageSocket::~TCPMessageSocket() {
+    if (fd_ >= 0) {
+        close(fd_);
+    }
+    delete[] aux_recvbuf_;
+}
+
+void
+TCPMessageSocket::send(const void* data, size_t datalen) {
+    if (state_ != INIT) {
+        throw MessageSocketError("TCP message socket can be used only once");
+    }
+    msglen_placeholder_[0] = datalen >> 8;
+    msglen_placeholder_[1] = (datalen & 0x00ff);
+    sendbufs_[0].iov_base = msglen_placeholder_;
+    sendbufs_[0].iov_len = sizeof(msglen_placeholder_);
+    sendbufs_[1].iov_base = const_cast<void*>(data);
+    sendbufs_[1].iov_len = datalen;
+
+    fd_ = socket(dest_.ss_family, SOCK_STREAM | SOCK_CLOEXEC, IPPROTO_TCP);
+    if (fd_ < 0) {
+        throw MessageSocketError(getErrorText("Failed to create a socket: "));
+    }
+    // Errors, including immediate ones, are reported via the callback.
+    struct io_uring_sqe* sqe = prepareOperation(OP_CONNECT,
+                                                IORING_OP_CONNECT, fd_);
+    sqe->addr = reinterpret_cast<uintptr_t>(&dest_);
+    sqe->off = dest_len_;
+    current_op_ = OP_CONNECT;
+    ++mgr_.n_waiting_;
+    state_ = CONNECTING;
+}
+
+void
+TCPMessageSocket::handleOperation(Operation, int res, uint32_t) {
+    switch (state_) {
+    case CONNECTING:
+        if (res < 0) {
+            if (mgr_.log_.admit()) {
+                mgr_.log_.write(getErrorText("[Warn] TCP connect failed: ",
+                                             -res));
+            }
+            complete(NULL, 0);
+            return;
+        }
+        state_ = WRITING;
+        startWrite();
+        break;
+    case WRITING:
+        handleWrite(res);
+        break;
+    case READING_LENGTH:
+    case READING_DATA:
+        handleRead(res);
+        break;
+    default:
+        assert(false);          // we shouldn't have any operation otherwise
+    }
+}
+
+void
+TCPMessageSocket::startWrite() {
+    memset(&sendmsg_, 0, sizeof(sendmsg_));
+    sendmsg_.msg_iov = sendbufs_[0].iov_len > 0 ? &sendbufs_[0] :
+        &sendbufs_[1];
+    sendmsg_.msg_iovlen = (sendmsg_.msg_iov == &sendbufs_[0]) ? 2 : 1;
+    struct io_uring_sqe* sqe = prepareOperation(OP_SEND, IORING_OP_SENDMSG,
+                                                fd_);
+    sqe->addr = reinterpret_cast<uintptr_t>(&sendmsg_);
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    current_op_ = OP_SEND;
+}
+
+void
+TCPMessageSocket::handleWrite(int res) {
+    if (res < 0) {
+        if (mgr_.log_.admit()) {
+            mgr_.log_.write(getErrorText("[Warn] TCP send failed: ", -res));
+        }
+        complete(NULL, 0);
+        return;
+    }
+
+    // Skip the data that have been sent, and send the rest if any.
+    size_t sent = res;
+    struct iovec* iov = sendmsg_.msg_iov;
+    while (sent > 0) {
+        const size_t n = sent < iov->iov_len ? sent : iov->iov_len;
+        iov->iov_base = static_cast<uint8_t*>(iov->iov_base) + n;
+        iov->iov_len -= n;
+        sent -= n;
+        if (iov->iov_len == 0 && iov == &sendbufs_[0]) {
+            ++iov;
+        }
+    }
+    if (sendbufs_[1].iov_len > 0) {
+        startWrite();
+        return;
+    }
+
+    // Immediately after sending the query, shutdown the outbound direction
+    // of the socket, so the server won't wait for subsequent queries.
+    if (shutdown(fd_, SHUT_WR) < 0) {
+        if (mgr_.log_.admit()) {
+            mgr_.log_.write(getErrorText(
+                                "[Warn] failed to shut down TCP socket: ",
+                                errno));
+        }
+        complete(NULL, 0);
+        return;
+    }
+
+    // Then wait for the response.
+    state_ = READING_LENGTH;
+    startRead();
+}
+
+void
+TCPMessageSocket::startRead() {
+    while (true) {
+        uint8_t* buf;
+        size_t len;
+        if (state_ == READING_LENGTH) {
+            buf = msglen_placeholder_;
+            len = sizeof(msglen_placeholder_);
+        } else {
+            // We keep the first message in recvbuf_ for callback, and
+            // hold others in the aux buffer only temporarily.
+            buf = first_received_ ? aux_recvbuf_ : recvbuf_;
+            len = msglen_;
+        }
+
+        if (read_len_ < len) {
+            struct io_uring_sqe* sqe = prepareOperation(OP_RECEIVE,
+                                                        IORING_OP_RECV, fd_);
+            sqe->addr = reinterpret_cast<uintptr_t>(buf + read_len_);
+            sqe->len = len - read_len_;
+            current_op_ = OP_RECEIVE;
+            return;
+        }
+
+        read_len_ = 0;
+        if (state_ == READING_LENGTH) {
+            msglen_ = msglen_placeholder_[0] * 256 + msglen_placeholder_[1];
+            if (first_received_ && aux_recvbuf_ == NULL) {
+                aux_recvbuf_ = new uint8_t[65535];
+            }
+            state_ = READING_DATA;
+        } else {
+            // There may be more messages, like in the case for AXFR.  For
+            // now, we'll simply read and discard any subsequent message
+            // until the server closes the connection.
+            if (!first_received_) {
+                recvdata_len_ = msglen_;
+                first_received_ = true;
+            }
+            state_ = READING_LENGTH;
+        }
+    }
+}
+
+void
+TCPMessageSocket::handleRead(int res) {
+    if (res < 0) {
+        if (mgr_.log_.admit()) {
+            mgr_.log_.write(getErrorText("[Warn] failed to read TCP message: ",
+                                         -res));
+        }
+        complete(NULL, 0);
+        return;
+    }
+    if (res == 0) {
+        // The server has closed the connection.  Normally we've received
+        // all messages by now; otherwise it's an unexpected termination,
+        // but do the callback with what we've had so far anyway.
+        complete(recvbuf_, recvdata_len_);
+        return;
+    }
+    read_len_ += res;
+    startRead();
+}
+
+void
+TCPMessageSocket::cancelOperations() {
+    if (state_ != INIT && state_ != DONE) {
+        --mgr_.n_waiting_;
+        if (pending_ > 0) {
+            cancelOperation(current_op_);
+        }
+    }
+}
+
+void
+TCPMessageSocket::complete(const void* data, size_t datalen) {
+    --mgr_.n_waiting_;
+    state_ = DONE;
+    callback_(MessageSocket::Event(data, datalen));
+}
+
+// A persistent TCP connection with pipelined messages.  At most one send
+// and one receive operation are outstanding at a time; messages sent while
+// the send operation is running are queued and sent together in the next
+// one.  When the connection fails, a new connection won't be opened until
+// all operations for the old one complete.
+class PersistentTCPMessageSocket :
+        public UringMessageSocket::UringMessageSocketImpl
+{
+public:
+    PersistentTCPMessageSocket(ManagerImpl& mgr, const std::string& address,
+                               uint16_t port,
+                               const StreamSocketParams& params,
+                               MessageSocket::Callback callback);
+    virtual ~PersistentTCPMessageSocket();
+    virtual void send(const void* data, size_t datalen);
+    virtual int native() const { return (fd_); }
+
+protected:
+    virtual void handleOperation(Operation op, int res, uint32_t flags);
+    virtual void cancelOperations();
+
+private:
+    enum State {
+        CLOSED,
+        CONNECTING,
+        CONNECTED,
+        CLOSING                 // failed; waiting for operations to complete
+    };
+
+    void startConnect();
+    void startWrite();
+    void startRead();
+    void handleRead(int res);
+
+    // Stop using the connection and tell the owner.  error is the errno
+    // value of the failure, or 0 if the server has closed the connection.
+    void fail(const char* what, int error);
+
+    // Stop using the connection that has exchanged all messages allowed.
+    // A new one will be opened if more messages are queued.
+    void reconnect();
+
+    // Cancel the operations for the connection, and close it once all of
+    // them complete.
+    void startClose();
+
+    // Close the connection on completion of all its operations.
+    void finishClose();
+
+    int fd_;
+    struct sockaddr_storage dest_;
+    socklen_t dest_len_;
+    MessageSocket::Callback callback_;
+    State state_;
+    size_t n_ops_;              // # of outstanding operations (but cancel)
+    bool writing_;
+    bool reading_;
+    TCPStream stream_;
+    std::vector<uint8_t> writebuf_; // data being written
+    size_t write_head_;             // data before this have been written
+};
+
+PersistentTCPMessageSocket::PersistentTCPMessageSocket(
+    ManagerImpl& mgr, const std::string& address, uint16_t port,
+    const StreamSocketParams& params, MessageSocket::Callback callback) :
+    UringMessageSocketImpl(mgr), fd_(-1),
+    dest_len_(convertAddress(address, port, dest_)), callback_(callback),
+    state_(CLOSED), n_ops_(0), writing_(false), reading_(false),
+    stream_(params), write_head_(0)
+{}
+
+PersistentTCPMessageSocket::~PersistentTCPMessageSocket() {
+    if (fd_ >= 0) {
+        close(fd_);
+    }
+}
+
+void
+PersistentTCPMessageSocket::send(const void* data, size_t datalen) {
+    stream_.queueMessage(data, datalen);
+    if (state_ == CLOSED) {
+        startConnect();
+    } else if (state_ == CONNECTED && !writing_ && stream_.hasQueued()) {
+        startWrite();
+    }
+}
+
+void
+PersistentTCPMessageSocket::startConnect() {
+    fd_ = socket(dest_.ss_family, SOCK_STREAM | SOCK_CLOEXEC, IPPROTO_TCP);
+    if (fd_ < 0) {
+        throw MessageSocketError(getErrorText("Failed to create a socket: "));
+    }
+    // Errors, including immediate ones, are reported via the callback.
+    struct io_uring_sqe* sqe = prepareOperation(OP_CONNECT,
+                                                IORING_OP_CONNECT, fd_);
+    sqe->addr = reinterpret_cast<uintptr_t>(&dest_);
+    sqe->off = dest_len_;
+    ++n_ops_;
+    ++mgr_.n_waiting_;
+    state_ = CONNECTING;
+}
+
+void
+PersistentTCPMessageSocket::startWrite() {
+    if (write_head_ == writebuf_.size()) {
+        if (!stream_.takeQueued(writebuf_)) {
+            fail(stream_.getError().c_str(), EPROTO);
+            return;
+        }
+        write_head_ = 0;
+    }
+    struct io_uring_sqe* sqe = prepareOperation(OP_SEND, IORING_OP_SEND, fd_);
+    sqe->addr = reinterpret_cast<uintptr_t>(&writebuf_[write_head_]);
+    sqe->len = writebuf_.size() - write_head_;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    ++n_ops_;
+    writing_ = true;
+}
+
+void
+PersistentTCPMessageSocket::startRead() {
+    size_t len;
+    uint8_t* space = stream_.getReceiveSpace(len);
+    struct io_uring_sqe* sqe = prepareOperation(OP_RECEIVE, IORING_OP_RECV,
+                                                fd_);
+    sqe->addr = reinterpret_cast<uintptr_t>(space);
+    sqe->len = len;
+    ++n_ops_;
+    reading_ = true;
+}
+
+void
+PersistentTCPMessageSocket::handleOperation(Operation op, int res, uint32_t) {
+    --n_ops_;
+    if (op == OP_SEND) {
+        writing_ = false;
+    } else if (op == OP_RECEIVE) {
+        reading_ = false;
+    }
+    if (state_ == CLOSING) {
+        if (n_ops_ == 0) {
+            finishClose();
+        }
+        return;
+    }
+
+    switch (op) {
+    case OP_CONNECT:
+        if (res < 0) {
+            fail("TCP connect failed", -res);
+            return;
+        }
+        {
+            // Queries are often smaller than a segment; don't let them wait
+            // for acknowledgment of the previous ones.
+            const int on = 1;
+            setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        }
+        state_ = CONNECTED;
+        stream_.startConnection();
+        startRead();
+        if (stream_.hasQueued()) {
+            startWrite();
+        }
+        break;
+    case OP_SEND:
+        if (res < 0) {
+            fail("TCP send failed", -res);
+            return;
+        }
+        write_head_ += res;
+        if (write_head_ < writebuf_.size() || stream_.hasQueued()) {
+            startWrite();
+        }
+        break;
+    case OP_RECEIVE:
+        handleRead(res);
+        break;
+    default:
+        assert(false);          // we shouldn't have any other operation
+    }
+}
+
+void
+PersistentTCPMessageSocket::handleRead(int res) {
+    if (res < 0) {
+        fail("failed to read TCP message", -res);
+        return;
+    }
+    if (res == 0) {
+        fail(NULL, 0);
+        return;
+    }
+    if (!stream_.commitReceived(res)) {
+        fail(stream_.getError().c_str(), EPROTO);
+        return;
+    }
+    const void* data;
+    size_t datalen;
+    while (stream_.getNextMessage(data, datalen)) {
+        callback_(MessageSocket::Event(data, datalen));
+    }
+    if (state_ != CONNECTED) {
+        return;                 // failed in the callback
+    }
+    if (stream_.isFinished()) {
+        reconnect();
+        return;
+    }
+    startRead();
+    // The TLS handshake may need to send more data.
+    if (!writing_ && stream_.hasQueued()) {
+        startWrite();
+    }
+}
+
+void
+PersistentTCPMessageSocket::fail(const char* what, int error) {
+    // Closing the connection by the server isn't an error by itself; the
+    // owner will know if it has affected any query.
+    if (error != 0) {
+        if (mgr_.log_.admit()) {
+            mgr_.log_.write(std::string("[Warn] ") + what + ": " +
+                            strerror(error));
+        }
+    }
+    stream_.clear();
+    startClose();
+    callback_(MessageSocket::Event(NULL, 0));
+}
+
+void
+PersistentTCPMessageSocket::reconnect() {
+    stream_.closeConnection();
+    startClose();
+}
+
+void
+PersistentTCPMessageSocket::startClose() {
+    state_ = CLOSING;
+    if (writing_) {
+        cancelOperation(OP_SEND);
+    }
+    if (reading_) {
+        cancelOperation(OP_RECEIVE);
+    }
+    if (n_ops_ == 0) {
+        finishClose();
+    }
+}
+
+void
+PersistentTCPMessageSocket::finishClose() {
+    close(fd_);
+    fd_ = -1;
+    --mgr_.n_waiting_;
+    state_ = CLOSED;
+    writebuf_.clear();
+    write_head_ = 0;
+    // If the owner has sent messages in the meantime, or some messages
+    // are held for the next connection, reconnect.
+    if (stream_.hasPending()) {
+        startConnect();
+    }
+}
+
+void
+PersistentTCPMessageSocket::cancelOperations() {
+    if (state_ == CLOSED) {
+        return;
+    }
+    --mgr_.n_waiting_;
+    if (state_ == CONNECTING) {
+        cancelOperation(OP_CONNECT);
+    }
+    if (writing_) {
+        cancelOperation(OP_SEND);
+    }
+    if (reading_) {
+        cancelOperation(OP_RECEIVE);
+    }
+}
+
+class UringMessageTimer : public MessageTimer {
+public:
+    UringMessageTimer(ManagerImpl& mgr, Callback callback) :
+        mgr_(mgr), callback_(callback), running_(false)
+    {}
+    virtual ~UringMessageTimer() { cancel(); }
+
+    virtual void start(const boost::posix_time::time_duration& duration);
+
+    virtual void cancel() {
+        if (running_) {
+            mgr_.timers_.erase(it_);
+            running_ = false;
+        }
+    }
+
+    // Called from the manager on expiration, after removing the timer.
+    void expire() {
+        running_ = false;
+        callback_();
+    }
+
+private:
+    ManagerImpl& mgr_;
+    Callback callback_;
+    bool running_;
+    ManagerImpl::TimerMap::iterator it_; // valid only when running
+};
+
+void
+UringMessageTimer::start(const boost::posix_time::time_duration& duration) {
+    cancel();
+    const int64_t usec = duration.total_microseconds();
+    it_ = mgr_.timers_.insert(
+        ManagerImpl::TimerMap::value_type(getMonotonicTime() +
+                                          (usec > 0 ? usec : 0), this));
+    running_ = true;
+}
+} // end of unnamed namespace
+
+UringMessageManager::UringMessageManagerImpl::UringMessageManagerImpl(
+    DiagnosticLog& log) :
+    log_(log), ring_fd_(-1), sq_ring_(MAP_FAILED), sq_ring_size_(0),
+    cq_ring_(MAP_FAILED), cq_ring_size_(0), sqes_(NULL), sqes_size_(0),
+    sq_tail_(0), stopped_(false), n_waiting_(0), next_bgid_(0)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_COOP_TASKRUN;
+    params.cq_entries = CQ_ENTRIES;
+    ring_fd_ = ioUringSetup(RING_ENTRIES, &params);
+    if (ring_fd_ < 0 && errno == EINVAL) {
+        // COOP_TASKRUN is only an optimization; retry without it.
+        memset(&params, 0, sizeof(params));
+        params.flags = IORING_SETUP_CQSIZE;
+        params.cq_entries = CQ_ENTRIES;
+        ring_fd_ = ioUringSetup(RING_ENTRIES, &params);
+    }
+    if (ring_fd_ < 0) {
+        throw MessageSocketError(getErrorText("io_uring_setup failed: "));
+    }
+    if ((params.features & IORING_FEAT_EXT_ARG) == 0) {
+        close(ring_fd_);
+        throw MessageSocketError("io_uring is not fully supported by the "
+                                 "kernel");
+    }
+
+    try {
+        sq_ring_size_ = params.sq_off.array +
+            params.sq_entries * sizeof(unsigned int);
+        cq_ring_size_ = params.cq_off.cqes +
+            params.cq_entries * sizeof(struct io_uring_cqe);
+        if ((params.features & IORING_FEAT_SINGLE_MMAP) != 0) {
+            if (cq_ring_size_ > sq_ring_size_) {
+                sq_ring_size_ = cq_ring_size_;
+            }
+            cq_ring_size_ = 0;  // shares the SQ mapping
+        }
+        sq_ring_ = mmap(NULL, sq_ring_size_, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring_fd_,
+                        IORING_OFF_SQ_RING);
+        if (sq_ring_ == MAP_FAILED) {
+            throw MessageSocketError(getErrorText("io_uring mmap failed: "));
+        }
+        if (cq_ring_size_ > 0) {
+            cq_ring_ = mmap(NULL, cq_ring_size_, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, ring_fd_,
+                            IORING_OFF_CQ_RING);
+            if (cq_ring_ == MAP_FAILED) {
+                throw MessageSocketError(
+                    getErrorText("io_uring mmap failed: "));
+            }
+        }
+        sqes_size_ = params.sq_entries * sizeof(struct io_uring_sqe);
+        void* sqes = mmap(NULL, sqes_size_, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, ring_fd_,
+                          IORING_OFF_SQES);
+        if (sqes == MAP_FAILED) {
+            throw MessageSocketError(getErrorText("io_uring mmap failed: "));
+        }
+        sqes_ = static_cast<struct io_uring_sqe*>(sqes);
+    } catch (...) {
+        cleanup();
+        throw;
+    }
+
+    sq_head_ = getRingField<unsigned int>(sq_ring_, params.sq_off.head);
+    sq_ktail_ = getRingField<unsigned int>(sq_ring_, params.sq_off.tail);
+    sq_mask_ = *getRingField<unsigned int>(sq_ring_, params.sq_off.ring_mask);
+    sq_entries_ = params.sq_entries;
+    sq_tail_ = *sq_ktail_;
+    void* cq_ring = cq_ring_size_ > 0 ? cq_ring_ : sq_ring_;
+    cq_head_ = getRingField<unsigned int>(cq_ring, params.cq_off.head);
+    cq_tail_ = getRingField<unsigned int>(cq_ring, params.cq_off.tail);
+    cq_mask_ = *getRingField<unsigned int>(cq_ring, params.cq_off.ring_mask);
+    cqes_ = getRingField<struct io_uring_cqe>(cq_ring, params.cq_off.cqes);
+
+    // We always use the submission queue entries in the ring order, so
+    // the index array is an identity mapping.
+    unsigned int* sq_array = getRingField<unsigned int>(sq_ring_,
+                                                        params.sq_off.array);
+    for (unsigned int i = 0; i < sq_entries_; ++i) {
+        sq_array[i] = i;
+    }
+}
+
+UringMessageManager::UringMessageManagerImpl::~UringMessageManagerImpl() {
+    // Wait (for a reasonably short period) until the operations of released
+    // sockets complete, so the kernel won't refer to their buffers.  If
+    // some don't complete, we give up and destroy the sockets anyway.
+    stopped_ = false;
+    try {
+        for (int i = 0; i < 100 && !zombies_.empty(); ++i) {
+            enter(1, 10000);
+            handleCompletions();
+        }
+    } catch (...) {}
+    while (!zombies_.empty()) {
+        SocketImpl* zombie = *zombies_.begin();
+        zombies_.erase(zombies_.begin());
+        delete zombie;
+    }
+    cleanup();
+}
+
+void
+UringMessageManager::UringMessageManagerImpl::cleanup() {
+    if (sqes_ != NULL) {
+        munmap(sqes_, sqes_size_);
+    }
+    if (cq_ring_ != MAP_FAILED) {
+        munmap(cq_ring_, cq_ring_size_);
+    }
+    if (sq_ring_ != MAP_FAILED) {
+        munmap(sq_ring_, sq_ring_size_);
+    }
+    close(ring_fd_);
+}
+
+struct io_uring_sqe*
+UringMessageManager::UringMessageManagerImpl::getSqe() {
+    if (sq_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) >=
+        sq_entries_) {
+        enter(0, -1);
+        if (sq_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) >=
+            sq_entries_) {
+            throw MessageSocketError("io_uring submission queue overflow");
+        }
+    }
+    struct io_uring_sqe* sqe = &sqes_[sq_tail_ & sq_mask_];
+    memset(sqe, 0, sizeof(*sqe));
+    ++sq_tail_;
+    return (sqe);
+}
+
+void
+UringMessageManager::UringMessageManagerImpl::enter(unsigned int min_complete,
+                                                    int64_t timeout_usec)
+{
+    // Make the queued entries visible to the kernel.
+    __atomic_store_n(sq_ktail_, sq_tail_, __ATOMIC_RELEASE);
+    const unsigned int to_submit =
+        sq_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+    if (to_submit == 0 && min_complete == 0) {
+        return;
+    }
+
+    unsigned int flags = 0;
+    struct io_uring_getevents_arg arg;
+    struct __kernel_timespec ts;
+    const void* argp = NULL;
+    size_t argsz = 0;
+    if (min_complete > 0) {
+        flags |= IORING_ENTER_GETEVENTS;
+        if (timeout_usec >= 0) {
+            ts.tv_sec = timeout_usec / 1000000;
+            ts.tv_nsec = (timeout_usec % 1000000) * 1000;
+            memset(&arg, 0, sizeof(arg));
+            arg.ts = reinterpret_cast<uintptr_t>(&ts);
+            flags |= IORING_ENTER_EXT_ARG;
+            argp = &arg;
+            argsz = sizeof(arg);
+        }
+    }
+    if (ioUringEnter(ring_fd_, to_submit, min_complete, flags, argp,
+                     argsz) < 0) {
+        // ETIME means the timeout, and EBUSY means completions are
+        // overflowing (they'll be delivered once we consume the ring).
+        if (errno != EINTR && errno != ETIME && errno != EBUSY) {
+            throw MessageSocketError(getErrorText("io_uring_enter failed: "));
+        }
+    }
+}
+
+void
+UringMessageManager::UringMessageManagerImpl::handleCompletions() {
+    unsigned int head = *cq_head_;
+    while (!stopped_ && head != __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) {
+        const struct io_uring_cqe* cqe = &cqes_[head & cq_mask_];
+        const uint64_t user_data = cqe->user_data;
+        const int res = cqe->res;
+        const uint32_t flags = cqe->flags;
+
+        // Release the entry before the callback, so it won't be handled
+        // again even if the callback throws.
+        __atomic_store_n(cq_head_, ++head, __ATOMIC_RELEASE);
+
+        SocketImpl* sock = reinterpret_cast<SocketImpl*>(
+            static_cast<uintptr_t>(user_data & ~OP_MASK));
+        sock->handleCompletion(static_cast<Operation>(user_data & OP_MASK),
+                               res, flags);
+    }
+}
+
+void
+UringMessageManager::UringMessageManagerImpl::registerRing(
+    unsigned int opcode, const void* arg)
+{
+    if (ioUringRegister(ring_fd_, opcode, arg, 1) < 0) {
+        throw MessageSocketError(getErrorText("io_uring_register failed: "));
+    }
+}
+
+uint16_t
+UringMessageManager::UringMessageManagerImpl::allocateBufferGroup() {
+    if (!free_bgids_.empty()) {
+        const uint16_t bgid = free_bgids_.back();
+        free_bgids_.pop_back();
+        return (bgid);
+    }
+    if (next_bgid_ == 0xffff) {
+        throw MessageSocketError("too many UDP sockets for io_uring");
+    }
+    return (next_bgid_++);
+}
+
+int64_t
+UringMessageManager::UringMessageManagerImpl::getTimeout() const {
+    if (timers_.empty()) {
+        return (-1);
+    }
+    const uint64_t now = getMonotonicTime();
+    const uint64_t expire = timers_.begin()->first;
+    return (expire <= now ? 0 : expire - now);
+}
+
+void
+UringMessageManager::UringMessageManagerImpl::fireTimers() {
+    const uint64_t now = getMonotonicTime();
+    while (!stopped_ && !timers_.empty() && timers_.begin()->first <= now) {
+        UringMessageTimer* timer = timers_.begin()->second;
+        timers_.erase(timers_.begin());
+        timer->expire();
+    }
+}
+
+void
+UringMessageManager::UringMessageManagerImpl::run() {
+    while (!stopped_) {
+        if (n_waiting_ == 0 && timers_.empty()) {
+            enter(0, -1);       // just submit any queued operations
+            break;              // nothing to wait for
+        }
+
+        // Submit the operations queued by the callbacks in the previous
+        // iteration (or before run()), and wait for completions in a
+        // single system call, unless there's something to do right now.
+        const int64_t timeout = getTimeout();
+        enter((timeout == 0 || hasCompletions()) ? 0 : 1, timeout);
+
+        handleCompletions();
+        fireTimers();
+    }
+    stopped_ = false;
+}
+
+UringMessageSocket::~UringMessageSocket() {
+    // The ownership is being released from the caller.  The underlying
+    // impl object will be responsible for destructing itself.
+    impl_->cancel();
+    impl_ = NULL;               // not necessary, but just in case
+}
+
+void
+UringMessageSocket::send(const void* data, size_t datalen) {
+    impl_->send(data, datalen);
+}
+
+int
+UringMessageSocket::getIncomingCPU() const {
+    return (getSocketIncomingCPU(impl_->native()));
+}
+
+int
+UringMessageSocket::native() const {
+    return (impl_->native());
+}
+
+UringMessageManager::UringMessageManager() :
+    impl_(new UringMessageManagerImpl(getDiagnosticLog()))
+{}
+
+UringMessageManager::~UringMessageManager() {
+    // Timers of the wheel depend on the manager.
+    impl_->timer_wheel_.reset();
+    delete impl_;
+}
+
+MessageSocket*
+UringMessageManager::createMessageSocket(int proto, const std::string& address,
+                                         uint16_t port,
+                                         void* recvbuf, size_t recvbuf_len,
+                                         MessageSocket::Callback callback)
+{
+    if (!callback) {
+        throw MessageSocketError("null socket callback specified");
+    }
+    if (proto == IPPROTO_UDP) {
+        // Received data are stored in the socket's own buffers, so recvbuf
+        // isn't used.
+        return (new UringMessageSocket(
+                    new UDPMessageSocket(*impl_, address, port, recvbuf_len,
+                                         callback)));
+    } else if (proto == IPPROTO_TCP) {
+        if (recvbuf_len < 65535) { // must be able to hold a full TCP msg
+            throw MessageSocketError("Insufficient TCP receive buffer");
+        }
+        return (new UringMessageSocket(
+                    new TCPMessageSocket(*impl_, address, port, recvbuf,
+                                         callback)));
+    }
+    throw MessageSocketError("unsupported or invalid protocol: " +
+                             lexical_cast<std::string>(proto));
+}
+
+MessageSocket*
+UringMessageManager::createPersistentMessageSocket(
+    const std::string& address, uint16_t port,
+    const StreamSocketParams& params, MessageSocket::Callback callback)
+{
+    if (!callback) {
+        throw MessageSocketError("null socket callback specified");
+    }
+    return (new UringMessageSocket(
+                new PersistentTCPMessageSocket(*impl_, address, port, params,
+                                               callback)));
+}
+
+MessageTimer*
+UringMessageManager::createMessageTimer(MessageTimer::Callback callback) {
+    return (new UringMessageTimer(*impl_, callback));
+}
+
+MessageTimer*
+UringMessageManager::createCoarseMessageTimer(MessageTimer::Callback callback) {
+    if (!impl_->timer_wheel_) {
+        impl_->timer_wheel_.reset(new TimerWheel(*this));
+    }
+    return (impl_->timer_wheel_->createTimer(callback));
+}
+
+void
+UringMessageManager::run() {
+    impl_->run();
+}
+
+void
+UringMessageManager::stop() {
+    impl_->stopped_ = true;
+}
+
+} // end of QueryPerf
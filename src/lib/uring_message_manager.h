@@ -0,0 +1,130 @@
+// Copyright (C) 2012  JINMEI Tatuya
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+// OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#ifndef __QUERYPERF_URING_MESSAGE_MANAGER_H
+#define __QUERYPERF_URING_MESSAGE_MANAGER_H 1
+
+#include <message_manager.h>
+
+#include <string>
+
+#include <stdint.h>
+
+namespace Queryperf {
+
+/// \brief Message sockets created by \c UringMessageManager.
+class UringMessageSocket : public MessageSocket {
+public:
+    // The existence of this class needs to be public for the convenience of
+    // the implementation.
+    class UringMessageSocketImpl;
+private:
+    UringMessageSocketImpl* impl_;
+public:
+    UringMessageSocket(UringMessageSocketImpl* impl) : impl_(impl) {}
+    virtual ~UringMessageSocket();
+    virtual void send(const void* data, size_t datalen);
+    virtual int getIncomingCPU() const;
+
+    /// \brief Return the native socket descriptor.
+    ///
+    /// Provided for debugging purposes only.  For TCP it's -1 until
+    /// the first send().
+    int native() const;
+};
+
+/// \brief A message manager built on Linux io_uring.
+///
+/// This is another alternative to \c ASIOMessageManager (in addition to
+/// \c EpollMessageManager) for a higher query rate per thread.  All socket
+/// operations are submitted to and completed through an io_uring instance
+/// of the manager, which is directly accessed via the kernel interface:
+/// - Data sent over UDP sockets are queued in the submission ring as send
+///   operations, which are handed to the kernel with the wait for the next
+///   completions in a single system call per iteration of the event loop
+///   (or when the ring gets full).  Like \c EpollMessageManager, the data
+///   passed to \c MessageSocket::send() must be kept valid until the
+///   callback for the response is called.
+/// - Each UDP socket has a single multishot receive operation, which
+///   stores received messages in buffers that the socket provides to the
+///   kernel via a buffer ring (\c RECV_BUFFERS buffers of the size given
+///   on creation).  The data given to the socket callback is stored in
+///   such a buffer, rather than the buffer passed on creation; it's valid
+///   only during the callback.
+/// - Timers are maintained within the manager; the next expiration time is
+///   used as the timeout of the wait for completions (in microseconds).
+///
+/// So, under load, the kernel is entered once per iteration of the loop
+/// regardless of the number of queries sent or responses received in it.
+///
+/// It requires Linux 6.0 or later (for multishot receive).  If the kernel
+/// doesn't support io_uring or the necessary features, the constructor
+/// throws \c MessageSocketError.
+///
+/// The other behavior is the same as \c EpollMessageManager, including the
+/// TCP sockets, which open a new connection on send(), send the single
+/// query, and wait for responses until the server closes the connection.
+/// A persistent TCP socket has at most one send operation running; data
+/// sent while it's running are sent together in the next one.
+class UringMessageManager : public MessageManager {
+public:
+    /// \brief Number of entries of the submission ring.
+    static const unsigned int RING_ENTRIES = 256;
+
+    /// \brief Number of receive buffers provided per UDP socket.
+    static const unsigned int RECV_BUFFERS = 256;
+
+    /// \brief Constructor.
+    ///
+    /// \throw MessageSocketError io_uring is not available.
+    UringMessageManager();
+
+    virtual ~UringMessageManager();
+
+    virtual MessageSocket* createMessageSocket(
+        int proto, const std::string& address, uint16_t port,
+        void* recvbuf, size_t recvbuf_len,
+        MessageSocket::Callback callback);
+
+    virtual MessageSocket* createPersistentMessageSocket(
+        const std::string& address, uint16_t port,
+        const StreamSocketParams& params,
+        MessageSocket::Callback callback);
+
+    virtual MessageTimer* createMessageTimer(MessageTimer::Callback callback);
+
+    /// \brief Create a timer managed in a \c TimerWheel of the manager
+    /// (with the default tick interval).
+    virtual MessageTimer* createCoarseMessageTimer(
+        MessageTimer::Callback callback);
+
+    virtual void run();
+
+    virtual void stop();
+
+    // The existence of this structure needs to be public for the convenience
+    // of the implementation.
+    struct UringMessageManagerImpl;
+
+private:
+    UringMessageManagerImpl* impl_;
+};
+
+} // end of QueryPerf
+
+#endif // __QUERYPERF_URING_MESSAGE_MANAGER_H
+
+// Local Variables:
+// mode: c++
+// End: